@@ -0,0 +1,95 @@
+/* clock_gettime is POSIX, not ANSI C */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench.h"
+
+double bench_now(void) {
+    /* current time */
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* orders doubles ascending for qsort */
+static int compare_doubles(const void *a, const void *b) {
+    /* cast a and b to double pointers */
+    double first = *(const double *)a, second = *(const double *)b;
+    return first < second ? -1 : first > second;
+}
+
+double bench_median(double *values, int count) {
+    qsort(values, count, sizeof(double), compare_doubles);
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+double bench_spread(double *values, int count) {
+    /* median of values */
+    double median = bench_median(values, count);
+    /* distances from the median */
+    double *deviations;
+    /* median of the distances */
+    double spread;
+    /* index tracker */
+    int i;
+
+    if (count < 2 || median <= 0)
+        return 0;
+    deviations = malloc(count * sizeof(double));
+    if (!deviations)
+        return 0;
+    for (i = 0; i < count; i++)
+        deviations[i] = values[i] > median ? values[i] - median : median - values[i];
+    /* 1.4826 scales the median absolute deviation to a standard deviation for normally distributed values */
+    spread = 1.4826 * bench_median(deviations, count) / median;
+    free(deviations);
+    return spread;
+}
+
+double bench_cycles(void) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    /* low and high halves of the counter */
+    unsigned int low, high;
+
+    __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+    return high * 4294967296.0 + low;
+#else
+    return 0;
+#endif
+}
+
+long bench_file_size(const char *path) {
+    /* file to measure */
+    FILE *file = fopen(path, "rb");
+    /* size of file */
+    long size;
+
+    if (!file)
+        return -1;
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+long bench_count_lines(const char *path) {
+    /* file to count */
+    FILE *file = fopen(path, "rb");
+    /* current character */
+    int c;
+    /* count of newlines */
+    long lines = 0;
+
+    if (!file)
+        return -1;
+    while ((c = getc(file)) != EOF) {
+        if (c == '\n')
+            lines++;
+    }
+    fclose(file);
+    return lines;
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+/* include guard to define only once */
+#ifndef BENCH_H
+#define BENCH_H
+
+/* seconds since an arbitrary point, from a monotonic clock */
+double bench_now(void);
+/* sorts values in place, returns their median */
+double bench_median(double *values, int count);
+/* sorts values in place, returns their spread relative to their median (the median absolute deviation scaled to a
+ * standard deviation), a robust noise estimate that a few disturbed runs don't inflate */
+double bench_spread(double *values, int count);
+/* CPU timestamp counter (reference cycles, not core cycles under frequency scaling), 0 where it isn't available */
+double bench_cycles(void);
+/* returns the size of the file at path in bytes, -1 if it can't be opened */
+long bench_file_size(const char *path);
+/* returns the count of lines in the file at path, -1 if it can't be opened */
+long bench_count_lines(const char *path);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,377 @@
+/* per-file fixed overhead on a corpus of many small generated files
+ *
+ * build: gcc -O2 -ansi -pedantic -Iinclude -Ibench bench/bench_files.c bench/bench.c bench/workload.c
+ *        src/[!m]*.c -pthread -o bench_files
+ * usage: bench_files [--files N] [--min-lines N] [--max-lines N] [--dir DIR] [--regenerate]
+ *
+ * Every mode runs with a warm page cache (the corpus was just read) and a cold one (the corpus pages are evicted
+ * with posix_fadvise first, no root needed). In-process modes time each step of every file:
+ *   open     - opening and closing the .as file (a probe of the open cost alone)
+ *   alloc    - getting an assembler state and a diagnostics collector
+ *   parse    - pre_assemble, first_pass and second_pass
+ *   write    - write_output_files
+ *   teardown - releasing the state and removing the outputs (so the corpus can be reused)
+ * The process mode starts this program again for every file (fork and exec), which only has a total. */
+
+/* fork, exec, waitpid and posix_fadvise are POSIX, not ANSI C */
+#define _POSIX_C_SOURCE 200112L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "assembler.h"
+#include "bench.h"
+#include "bool.h"
+#include "diagnostics.h"
+#include "first_pass.h"
+#include "output.h"
+#include "pre_assembler.h"
+#include "second_pass.h"
+#include "workload.h"
+
+/* default corpus */
+#define DEFAULT_FILES 10000
+#define DEFAULT_MIN_LINES 50
+#define DEFAULT_MAX_LINES 500
+#define DEFAULT_DIR "bench_corpus"
+
+/* steps of an in-process run */
+enum { STEP_OPEN, STEP_ALLOC, STEP_PARSE, STEP_WRITE, STEP_TEARDOWN, STEP_COUNT };
+
+/* how files are assembled */
+typedef enum { MODE_FRESH, MODE_POOLED, MODE_PROCESS } RunMode;
+
+/* names of steps and modes for the report */
+static const char *MODE_NAMES[] = {"in-process, new state", "in-process, pooled state", "process per file"};
+
+/* corpus parameters */
+typedef struct {
+    const char *dir;
+    int files;
+    int min_lines;
+    int max_lines;
+} Corpus;
+
+/* writes the path of file index with extension (empty for the base name the passes take) to path */
+static void corpus_path(Corpus *corpus, int index, const char *extension, char *path) {
+    sprintf(path, "%.40s/f%06d%s", corpus->dir, index, extension);
+}
+
+/* generates corpus files that don't exist yet (all of them if regenerate), returns false on error */
+static Bool generate_corpus(Corpus *corpus, Bool regenerate) {
+    /* generated program parameters */
+    WorkloadConfig config;
+    /* what was generated */
+    WorkloadSummary summary;
+    /* file path */
+    char path[MAX_LINE];
+    /* existing file */
+    FILE *existing;
+    /* index tracker */
+    int i;
+
+    mkdir(corpus->dir, 0755);
+    for (i = 0; i < corpus->files; i++) {
+        corpus_path(corpus, i, ".as", path);
+        if (!regenerate && (existing = fopen(path, "r"))) {
+            fclose(existing);
+            continue;
+        }
+        /* small programs, sizes spread between min_lines and max_lines */
+        workload_default_config(&config);
+        config.lines = corpus->min_lines + (long)i * 7919 % (corpus->max_lines - corpus->min_lines + 1);
+        config.extern_count = 3;
+        config.entry_count = 2;
+        config.macro_count = 2;
+        config.seed = i + 1;
+        if (!generate_workload_file(path, &config, &summary)) {
+            fprintf(stderr, "cannot write %s\n", path);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* reads every corpus file once, so the page cache is warm */
+static void warm_corpus(Corpus *corpus) {
+    /* file path */
+    char path[MAX_LINE];
+    /* read chunk */
+    char chunk[4096];
+    /* file being read */
+    FILE *file;
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < corpus->files; i++) {
+        corpus_path(corpus, i, ".as", path);
+        if ((file = fopen(path, "r"))) {
+            while (fread(chunk, 1, sizeof(chunk), file) > 0)
+                ;
+            fclose(file);
+        }
+    }
+}
+
+/* asks the kernel to drop the corpus pages (clean pages are evicted), returns false if it isn't supported */
+static Bool evict_corpus(Corpus *corpus) {
+    /* file path */
+    char path[MAX_LINE];
+    /* file descriptor */
+    int fd;
+    /* whether every file was evicted */
+    Bool success = true;
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < corpus->files; i++) {
+        corpus_path(corpus, i, ".as", path);
+        fd = open(path, O_RDONLY);
+        if (fd < 0)
+            continue;
+        if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) != 0)
+            success = false;
+        close(fd);
+    }
+    return success;
+}
+
+/* removes the outputs of name */
+static void remove_outputs(const char *name) {
+    /* output path */
+    char path[MAX_LINE];
+    sprintf(path, "%s.am", name);
+    remove(path);
+    sprintf(path, "%s.ob", name);
+    remove(path);
+    sprintf(path, "%s.ent", name);
+    remove(path);
+    sprintf(path, "%s.ext", name);
+    remove(path);
+}
+
+/* assembles name in a fresh state, the whole job of a process in process mode, returns true on success */
+static Bool assemble_one(char *name) {
+    /* state of the only file */
+    AssemblerState *state = create_assembler_state();
+    /* used to tell the caller whether the file assembled or not */
+    Bool success = false;
+
+    if (state) {
+        success = assemble_file(name, state);
+        free_assembler_state(state);
+    }
+    return success;
+}
+
+/* runs corpus in mode, adding each step's seconds to steps, returns count of failed files */
+static int run_in_process(Corpus *corpus, RunMode mode, double *steps) {
+    /* states reused between files in pooled mode */
+    StatePool pool;
+    /* current state */
+    AssemblerState *state;
+    /* file base name and path */
+    char name[MAX_LINE], path[MAX_LINE];
+    /* time before current step */
+    double start;
+    /* probe of the open cost */
+    FILE *probe;
+    /* whether current file assembled */
+    Bool success;
+    /* count of failed files */
+    int failed = 0;
+    /* index tracker */
+    int i;
+
+    state_pool_init(&pool);
+    for (i = 0; i < corpus->files; i++) {
+        corpus_path(corpus, i, "", name);
+        corpus_path(corpus, i, ".as", path);
+
+        start = bench_now();
+        probe = fopen(path, "r");
+        if (probe)
+            fclose(probe);
+        steps[STEP_OPEN] += bench_now() - start;
+
+        start = bench_now();
+        state = mode == MODE_POOLED ? state_pool_acquire(&pool) : create_assembler_state();
+        if (state && !state->diagnostics)
+            state->diagnostics = diagnostics_create(0);
+        steps[STEP_ALLOC] += bench_now() - start;
+        if (!state || !state->diagnostics) {
+            fprintf(stderr, "out of memory\n");
+            failed = corpus->files - i;
+            break;
+        }
+
+        start = bench_now();
+        success = pre_assemble(name, state->diagnostics, NULL, NULL, NULL, state->pre_assembler) &&
+                  first_pass(name, state) && second_pass(name, state);
+        steps[STEP_PARSE] += bench_now() - start;
+
+        start = bench_now();
+        if (success)
+            success = write_output_files(name, state);
+        steps[STEP_WRITE] += bench_now() - start;
+
+        /* a generated file must assemble, show why the first failure didn't */
+        if (!success && failed++ == 0)
+            diagnostics_flush(state->diagnostics, stderr, DIAGNOSTICS_TEXT);
+
+        start = bench_now();
+        diagnostics_clear(state->diagnostics);
+        if (mode == MODE_POOLED) {
+            state_pool_release(&pool, state);
+        } else {
+            diagnostics_free(state->diagnostics);
+            free_assembler_state(state);
+        }
+        remove_outputs(name);
+        steps[STEP_TEARDOWN] += bench_now() - start;
+    }
+
+    /* pooled states keep their collectors */
+    for (i = 0; i < pool.count; i++)
+        diagnostics_free(pool.states[i]->diagnostics);
+    state_pool_free(&pool);
+    return failed;
+}
+
+/* runs corpus with a process per file, returns count of failed files */
+static int run_processes(Corpus *corpus, char *program) {
+    /* file base name */
+    char name[MAX_LINE];
+    /* child process */
+    pid_t child;
+    /* child exit status */
+    int status;
+    /* arguments of the child */
+    char *child_argv[4];
+    /* count of failed files */
+    int failed = 0;
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < corpus->files; i++) {
+        corpus_path(corpus, i, "", name);
+        child_argv[0] = program;
+        child_argv[1] = "--one";
+        child_argv[2] = name;
+        child_argv[3] = NULL;
+
+        child = fork();
+        if (child == 0) {
+            execv(program, child_argv);
+            _exit(127);
+        }
+        if (child < 0 || waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed++;
+        remove_outputs(name);
+    }
+    return failed;
+}
+
+/* runs corpus in mode with a warm or cold cache and prints its line, returns false if any file failed */
+static Bool run_mode(Corpus *corpus, RunMode mode, Bool cold, char *program) {
+    /* seconds of each step */
+    double steps[STEP_COUNT];
+    /* time before the run */
+    double start;
+    /* whole run */
+    double total;
+    /* count of failed files */
+    int failed;
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < STEP_COUNT; i++)
+        steps[i] = 0;
+    if (cold) {
+        if (!evict_corpus(corpus)) {
+            printf("%-26s %-5s (page cache eviction not supported)\n", MODE_NAMES[mode], "cold");
+            return true;
+        }
+    } else {
+        warm_corpus(corpus);
+    }
+
+    start = bench_now();
+    failed = mode == MODE_PROCESS ? run_processes(corpus, program) : run_in_process(corpus, mode, steps);
+    total = bench_now() - start;
+
+    printf("%-26s %-5s %7d %9.3f %9.1f", MODE_NAMES[mode], cold ? "cold" : "warm", corpus->files, total,
+           total * 1e6 / corpus->files);
+    for (i = 0; i < STEP_COUNT; i++) {
+        if (mode == MODE_PROCESS)
+            printf(" %8s", "-");
+        else
+            printf(" %8.1f", steps[i] * 1e6 / corpus->files);
+    }
+    printf("\n");
+    fflush(stdout);
+
+    if (failed > 0)
+        fprintf(stderr, "%d files failed to assemble\n", failed);
+    return failed == 0;
+}
+
+int main(int argc, char *argv[]) {
+    /* corpus parameters */
+    Corpus corpus;
+    /* whether to rewrite existing corpus files */
+    Bool regenerate = false;
+    /* whether every file assembled */
+    Bool success = true;
+    /* current mode */
+    int mode;
+    /* index tracker */
+    int i;
+
+    /* child of process mode */
+    if (argc == 3 && strcmp(argv[1], "--one") == 0)
+        return assemble_one(argv[2]) ? 0 : 1;
+
+    corpus.dir = DEFAULT_DIR;
+    corpus.files = DEFAULT_FILES;
+    corpus.min_lines = DEFAULT_MIN_LINES;
+    corpus.max_lines = DEFAULT_MAX_LINES;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--files") == 0 && i + 1 < argc) {
+            corpus.files = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--min-lines") == 0 && i + 1 < argc) {
+            corpus.min_lines = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-lines") == 0 && i + 1 < argc) {
+            corpus.max_lines = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            corpus.dir = argv[++i];
+        } else if (strcmp(argv[i], "--regenerate") == 0) {
+            regenerate = true;
+        } else {
+            fprintf(stderr, "usage: %s [--files N] [--min-lines N] [--max-lines N] [--dir DIR] [--regenerate]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    if (corpus.files < 1 || corpus.min_lines < 1 || corpus.max_lines < corpus.min_lines) {
+        fprintf(stderr, "invalid corpus parameters\n");
+        return 2;
+    }
+
+    if (!generate_corpus(&corpus, regenerate))
+        return 1;
+
+    printf("%-26s %-5s %7s %9s %9s %8s %8s %8s %8s %8s\n", "mode", "cache", "files", "total s", "us/file", "open",
+           "alloc", "parse", "write", "teardown");
+    for (mode = MODE_FRESH; mode <= MODE_PROCESS; mode++) {
+        success = run_mode(&corpus, (RunMode)mode, false, argv[0]) && success;
+        success = run_mode(&corpus, (RunMode)mode, true, argv[0]) && success;
+    }
+    return success ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,507 @@
+/* microbenchmarks of the hash table, parser and disassembler primitives the passes and tools spend their time in
+ *
+ * build: gcc -O2 -ansi -pedantic -Iinclude -Ibench bench/bench_micro.c bench/bench.c src/[!m]*.c -pthread
+ *        -o bench_micro
+ * usage: bench_micro [--rounds N] [--filter TEXT]
+ *
+ * Each benchmark is calibrated until a round takes MIN_ROUND_SECONDS, warmed up for WARMUP_ROUNDS rounds, then
+ * timed for the given rounds. The median, fastest and slowest round are reported per operation. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assembler.h"
+#include "bench.h"
+#include "bool.h"
+#include "disassembler.h"
+#include "first_pass.h"
+#include "hash_table.h"
+#include "instructions.h"
+#include "parser.h"
+
+/* labels in the tables, about the size of a large hand written program */
+#define LABEL_COUNT 1024
+/* untimed rounds before measuring */
+#define WARMUP_ROUNDS 3
+/* default timed rounds */
+#define DEFAULT_ROUNDS 15
+/* a round runs at least this long, so timer resolution doesn't matter */
+#define MIN_ROUND_SECONDS 0.01
+/* most rounds that can be asked for */
+#define MAX_ROUNDS 1000
+
+/* runs iterations of a benchmark, returns a checksum so the work can't be optimized away */
+typedef long (*BenchFunction)(long iterations);
+
+/* a benchmark and the operations each of its iterations does */
+typedef struct {
+    const char *name;
+    long *ops; /* operations per iteration, set once the inputs are built */
+    BenchFunction run;
+} MicroBench;
+
+/* results are summed here, so the compiler must keep every call */
+static volatile long sink;
+
+/* defined labels, and labels of the same shape that are never defined (undefined symbols) */
+static char labels[LABEL_COUNT][MAX_LABEL];
+static char missing[LABEL_COUNT][MAX_LABEL];
+/* table holding all labels, for lookups */
+static HashTable *table;
+/* table reused by the insert benchmark, it keeps its buckets and nodes between iterations */
+static HashTable *reused_table;
+
+/* typical source lines (after comment removal) */
+static char *lines[] = {"MAIN:   add r3, LIST",   "        jsr fn1",         "LOOP:   prn #48",
+                        "        lea STR, r6",    "        inc r6",          "        mov r6,L3",
+                        "        sub r1, r4",     "        cmp r3, #-6",     "        bne %END",
+                        "        add r7, r6",     "        clr K",           "        sub L3, L3",
+                        ".entry MAIN",            "        jmp %LOOP",       "END:    stop",
+                        "STR:    .string \"abcd\"", "LIST:   .data 6, -9",     "        .data -100",
+                        "K:      .data 31",       ".extern L3",             "\t\tmov #-1, counterValue",
+                        "printResult: red r2",    "  rts",                  "x1: not bufferIndex"};
+/* words the reserved word checks see: mnemonics, registers, directives and labels */
+static char *words[] = {"mov",   "MAIN",    "r3",   "LIST",   ".data", "jsr",    "fn1",    "LOOP",
+                        "prn",   "lea",     "STR",  "r6",     "inc",   "stop",   "END",    ".entry",
+                        "cmp",   "bne",     "K",    "L3",     "mcro",  "r7",     "rts",    "counterValue",
+                        "clr",   ".string", "sub",  "printResult", "red", "x1",  ".extern", "bufferIndex"};
+/* operands with their addressing mode */
+static char *operands[] = {"r3", "LIST", "#48", "STR", "r6", "L3", "r1", "#-6", "%END", "r7", "K",
+                           "%LOOP", "#-1", "counterValue", "r2", "bufferIndex", "#+100", "r0", "%printResult",
+                           "x1"};
+static int operand_modes[sizeof(operands) / sizeof(operands[0])];
+
+/* one of every instruction, encoded with the first mode each operand allows (register, then immediate, then direct) */
+static Word code[3 * (sizeof(INSTRUCTION_TABLE) / sizeof(INSTRUCTION_TABLE[0]))];
+static int code_length;
+/* decode table of the disassembler */
+static DecodeTable decode_table;
+
+/* operations per iteration of each benchmark */
+static long label_ops = LABEL_COUNT;
+static long token_ops;
+static long line_ops = sizeof(lines) / sizeof(lines[0]);
+static long word_ops = sizeof(words) / sizeof(words[0]);
+static long operand_ops = sizeof(operands) / sizeof(operands[0]);
+static long instruction_ops;
+
+/* builds LABEL_COUNT unique labels shaped like real ones: common words with a number, short L-numbered labels and
+ * longer camel case names (and the same shapes with other numbers for missing labels) */
+static void build_labels(void) {
+    /* common label words */
+    static const char *common[] = {"LOOP", "END", "MAIN", "STR", "LIST", "NEXT", "DONE", "COUNT", "K", "X"};
+    /* parts of longer names */
+    static const char *parts[] = {"counter", "Value", "buffer", "Index", "print", "Result", "temp", "Sum"};
+    /* current label length */
+    int length;
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < LABEL_COUNT; i++) {
+        switch (i % 3) {
+            case 0:
+                sprintf(labels[i], "%s%d", common[i % 10], i);
+                sprintf(missing[i], "%s%d", common[i % 10], i + LABEL_COUNT);
+                break;
+            case 1:
+                sprintf(labels[i], "L%d", i);
+                sprintf(missing[i], "L%d", i + LABEL_COUNT);
+                break;
+            default:
+                sprintf(labels[i], "%s%s%d", parts[i % 8], parts[(i / 8) % 8], i);
+                sprintf(missing[i], "%s%s%d", parts[i % 8], parts[(i / 8) % 8], i + LABEL_COUNT);
+                break;
+        }
+        /* keep labels valid (31 chars at most) */
+        length = strlen(labels[i]);
+        if (length >= MAX_LABEL)
+            labels[i][MAX_LABEL - 1] = '\0';
+    }
+}
+
+static long run_insert_grow(long iterations) {
+    /* checksum */
+    long sum = 0;
+    /* table built from scratch, so it resizes on the way */
+    HashTable *grown;
+    /* index trackers */
+    long n;
+    int i;
+
+    for (n = 0; n < iterations; n++) {
+        grown = hash_table_create();
+        for (i = 0; i < LABEL_COUNT; i++)
+            sum += hash_table_insert(grown, labels[i], labels[i]);
+        hash_table_free(grown, NULL);
+    }
+    return sum;
+}
+
+static long run_insert_reuse(long iterations) {
+    /* checksum */
+    long sum = 0;
+    /* index trackers */
+    long n;
+    int i;
+
+    for (n = 0; n < iterations; n++) {
+        /* cleared table keeps its buckets, so this never resizes */
+        hash_table_clear(reused_table, NULL);
+        for (i = 0; i < LABEL_COUNT; i++)
+            sum += hash_table_insert(reused_table, labels[i], labels[i]);
+    }
+    return sum;
+}
+
+static long run_lookup_hit(long iterations) {
+    /* checksum */
+    long sum = 0;
+    /* index trackers */
+    long n;
+    int i;
+
+    for (n = 0; n < iterations; n++) {
+        for (i = 0; i < LABEL_COUNT; i++)
+            sum += hash_table_lookup(table, labels[i]) != NULL;
+    }
+    return sum;
+}
+
+static long run_lookup_miss(long iterations) {
+    /* checksum */
+    long sum = 0;
+    /* index trackers */
+    long n;
+    int i;
+
+    for (n = 0; n < iterations; n++) {
+        for (i = 0; i < LABEL_COUNT; i++)
+            sum += hash_table_lookup(table, missing[i]) != NULL;
+    }
+    return sum;
+}
+
+static long run_contains_hit(long iterations) {
+    /* checksum */
+    long sum = 0;
+    /* index trackers */
+    long n;
+    int i;
+
+    for (n = 0; n < iterations; n++) {
+        for (i = 0; i < LABEL_COUNT; i++)
+            sum += hash_table_contains_key(table, labels[i]);
+    }
+    return sum;
+}
+
+static long run_contains_miss(long iterations) {
+    /* checksum */
+    long sum = 0;
+    /* index trackers */
+    long n;
+    int i;
+
+    for (n = 0; n < iterations; n++) {
+        for (i = 0; i < LABEL_COUNT; i++)
+            sum += hash_table_contains_key(table, missing[i]);
+    }
+    return sum;
+}
+
+/* returns count of get_token calls that tokenize all lines */
+static long tokenize_lines(void) {
+    /* count of calls */
+    long calls = 0;
+    /* a word from line */
+    char token[MAX_LINE];
+    /* rest of line */
+    char *rest;
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < line_ops; i++) {
+        rest = lines[i];
+        do {
+            rest = get_token(rest, token);
+            calls++;
+        } while (token[0] != '\0');
+    }
+    return calls;
+}
+
+static long run_get_token(long iterations) {
+    /* checksum */
+    long sum = 0;
+    /* index tracker */
+    long n;
+
+    for (n = 0; n < iterations; n++)
+        sum += tokenize_lines();
+    return sum;
+}
+
+static long run_skip_whitespace(long iterations) {
+    /* checksum */
+    long sum = 0;
+    /* index trackers */
+    long n;
+    int i;
+
+    for (n = 0; n < iterations; n++) {
+        for (i = 0; i < line_ops; i++)
+            sum += skip_whitespace(lines[i]) - lines[i];
+    }
+    return sum;
+}
+
+static long run_is_reserved_word(long iterations) {
+    /* checksum */
+    long sum = 0;
+    /* index trackers */
+    long n;
+    int i;
+
+    for (n = 0; n < iterations; n++) {
+        for (i = 0; i < word_ops; i++)
+            sum += is_reserved_word(words[i]);
+    }
+    return sum;
+}
+
+static long run_get_instruction_info(long iterations) {
+    /* checksum */
+    long sum = 0;
+    /* index trackers */
+    long n;
+    int i;
+
+    for (n = 0; n < iterations; n++) {
+        for (i = 0; i < word_ops; i++)
+            sum += get_instruction_info(words[i]) != NULL;
+    }
+    return sum;
+}
+
+static long run_get_addressing_mode(long iterations) {
+    /* checksum */
+    long sum = 0;
+    /* index trackers */
+    long n;
+    int i;
+
+    for (n = 0; n < iterations; n++) {
+        for (i = 0; i < operand_ops; i++)
+            sum += get_addressing_mode(operands[i]);
+    }
+    return sum;
+}
+
+static long run_is_valid_addressing_mode(long iterations) {
+    /* checksum */
+    long sum = 0;
+    /* index trackers */
+    long n;
+    int i;
+
+    for (n = 0; n < iterations; n++) {
+        for (i = 0; i < operand_ops; i++)
+            sum += is_valid_addressing_mode(operands[i], operand_modes[i]);
+    }
+    return sum;
+}
+
+/* returns the first mode of modes (a bitmask) in the order register, immediate, direct */
+static int first_mode(int modes) {
+    if (modes & (1 << ADDR_REGISTER))
+        return ADDR_REGISTER;
+    return modes & (1 << ADDR_IMMEDIATE) ? ADDR_IMMEDIATE : ADDR_DIRECT;
+}
+
+/* encodes an operand word of mode */
+static Word operand_word(int mode, int n) {
+    if (mode == ADDR_REGISTER)
+        return MAKE_WORD(1 << (n % 8), ARE_A);
+    return mode == ADDR_IMMEDIATE ? MAKE_WORD(n - 50, ARE_A) : MAKE_WORD(IC_START + n, ARE_R);
+}
+
+/* fills code with every instruction the way first_pass encodes it */
+static void build_code(void) {
+    /* current instruction */
+    const InstructionInfo *info;
+    /* modes of the current instruction */
+    int src_mode, dest_mode;
+    /* index tracker */
+    int i;
+
+    code_length = 0;
+    for (i = 0; INSTRUCTION_TABLE[i].name != NULL; i++) {
+        info = &INSTRUCTION_TABLE[i];
+        src_mode = info->num_operands == 2 ? first_mode(info->src_modes) : 0;
+        dest_mode = info->num_operands >= 1 ? first_mode(info->dest_modes) : 0;
+        code[code_length++] = MAKE_WORD((info->opcode << 8) | (info->funct << 4) | (src_mode << 2) | dest_mode, ARE_A);
+        if (info->num_operands == 2)
+            code[code_length++] = operand_word(src_mode, i);
+        if (info->num_operands >= 1)
+            code[code_length++] = operand_word(dest_mode, i + 1);
+        instruction_ops++;
+    }
+}
+
+static long run_decode_instruction(long iterations) {
+    /* checksum */
+    long sum = 0;
+    /* the decoded instruction */
+    DecodedInstruction instruction;
+    /* index trackers */
+    long n;
+    int i;
+
+    for (n = 0; n < iterations; n++) {
+        for (i = 0; i < code_length; i += instruction.length)
+            sum += decode_instruction(&decode_table, code + i, code_length - i, IC_START + i, MAX_MEMORY, NULL,
+                                      NULL, &instruction);
+    }
+    return sum;
+}
+
+static long run_format_instruction(long iterations) {
+    /* checksum */
+    long sum = 0;
+    /* the decoded instruction */
+    DecodedInstruction instruction;
+    /* its text */
+    char text[MAX_DISASSEMBLY];
+    /* index trackers */
+    long n;
+    int i;
+
+    for (n = 0; n < iterations; n++) {
+        for (i = 0; i < code_length; i += instruction.length) {
+            decode_instruction(&decode_table, code + i, code_length - i, IC_START + i, MAX_MEMORY, NULL, NULL,
+                               &instruction);
+            sum += format_instruction(&instruction, text) - text;
+        }
+    }
+    return sum;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    /* cast a and b to double pointers */
+    double first = *(const double *)a, second = *(const double *)b;
+    return first < second ? -1 : first > second;
+}
+
+/* calibrates, warms up and times bench, then prints its line */
+static void run_bench(MicroBench *bench, int rounds) {
+    /* iterations per round */
+    long iterations = 1;
+    /* time and cycles before the current round */
+    double start, start_cycles;
+    /* per operation nanoseconds and cycles of each round */
+    double ns[MAX_ROUNDS], cycles[MAX_ROUNDS];
+    /* operations per round */
+    double ops;
+    /* index tracker */
+    int i;
+
+    /* double iterations until a round is long enough to time */
+    for (;;) {
+        start = bench_now();
+        sink += bench->run(iterations);
+        if (bench_now() - start >= MIN_ROUND_SECONDS)
+            break;
+        iterations *= 2;
+    }
+
+    /* warm caches and branch predictors */
+    for (i = 0; i < WARMUP_ROUNDS; i++)
+        sink += bench->run(iterations);
+
+    ops = (double)iterations * *bench->ops;
+    for (i = 0; i < rounds; i++) {
+        start = bench_now();
+        start_cycles = bench_cycles();
+        sink += bench->run(iterations);
+        cycles[i] = (bench_cycles() - start_cycles) / ops;
+        ns[i] = (bench_now() - start) * 1e9 / ops;
+    }
+
+    /* median is stable against a few disturbed rounds, min and max show the spread */
+    qsort(ns, rounds, sizeof(double), compare_doubles);
+    qsort(cycles, rounds, sizeof(double), compare_doubles);
+    printf("%-36s %10.2f %10.2f %10.2f %12.2f\n", bench->name, ns[rounds / 2], ns[0], ns[rounds - 1],
+           cycles[rounds / 2]);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    /* all benchmarks, the resize cost is the difference of the two insert ones */
+    MicroBench benches[] = {{"hash_table_insert (grow, resizes)", &label_ops, run_insert_grow},
+                            {"hash_table_insert (reuse, no resize)", &label_ops, run_insert_reuse},
+                            {"hash_table_lookup (hit)", &label_ops, run_lookup_hit},
+                            {"hash_table_lookup (miss)", &label_ops, run_lookup_miss},
+                            {"hash_table_contains_key (hit)", &label_ops, run_contains_hit},
+                            {"hash_table_contains_key (miss)", &label_ops, run_contains_miss},
+                            {"get_token", &token_ops, run_get_token},
+                            {"skip_whitespace", &line_ops, run_skip_whitespace},
+                            {"is_reserved_word", &word_ops, run_is_reserved_word},
+                            {"get_instruction_info", &word_ops, run_get_instruction_info},
+                            {"get_addressing_mode", &operand_ops, run_get_addressing_mode},
+                            {"is_valid_addressing_mode", &operand_ops, run_is_valid_addressing_mode},
+                            {"decode_instruction", &instruction_ops, run_decode_instruction},
+                            {"decode + format_instruction", &instruction_ops, run_format_instruction}};
+    /* count of benchmarks */
+    int bench_count = sizeof(benches) / sizeof(benches[0]);
+    /* timed rounds */
+    int rounds = DEFAULT_ROUNDS;
+    /* only run benchmarks whose name contains this, NULL for all */
+    const char *filter = NULL;
+    /* index tracker */
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--rounds N] [--filter TEXT]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (rounds < 1 || rounds > MAX_ROUNDS) {
+        fprintf(stderr, "rounds must be between 1 and %d\n", MAX_ROUNDS);
+        return 2;
+    }
+
+    /* build inputs */
+    build_labels();
+    table = hash_table_create();
+    reused_table = hash_table_create();
+    if (!table || !reused_table) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < LABEL_COUNT; i++) {
+        if (!hash_table_insert(table, labels[i], labels[i]) || !hash_table_insert(reused_table, labels[i], NULL)) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+    }
+    token_ops = tokenize_lines();
+    for (i = 0; i < operand_ops; i++)
+        operand_modes[i] = get_addressing_mode(operands[i]);
+    build_decode_table(&decode_table);
+    build_code();
+
+    printf("%-36s %10s %10s %10s %12s\n", "benchmark", "ns/op", "min", "max", "cycles/op");
+    for (i = 0; i < bench_count; i++) {
+        if (!filter || strstr(benches[i].name, filter))
+            run_bench(&benches[i], rounds);
+    }
+
+    hash_table_free(table, NULL);
+    hash_table_free(reused_table, NULL);
+    return 0;
+}
\ No newline at end of file
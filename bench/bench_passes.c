@@ -0,0 +1,476 @@
+/* end-to-end throughput of each assembler phase on generated programs of growing size
+ *
+ * build: gcc -O2 -ansi -pedantic -Iinclude -Ibench bench/bench_passes.c bench/bench.c bench/workload.c src/[!m]*.c
+ *        -pthread -o bench_passes
+ * usage: bench_passes [--min-size SIZE] [--max-size SIZE] [--reps N] [--keep] [--check] [--save FILE]
+ *                     [--compare FILE] [--threshold PERCENT]
+ *        sizes take a K, M or G suffix, the defaults are 1K to 64M (use --max-size 1G for the largest images)
+ *
+ * Every size's program must assemble without errors or warnings, otherwise its timings mean nothing. --check only
+ * assembles each size once to make sure of that, without timing it.
+ *
+ * --save writes the results (lines/s of each phase and size, allocations per run when built with
+ * -DTRACK_ALLOCATIONS, and the peak resident set) to a json baseline. --compare reads a baseline written by --save
+ * and compares every phase and size both runs have. A phase regressed if its median lines/s dropped by more than the
+ * threshold (5% by default) and by more than NOISE_FACTOR times the spreads of the two runs added, so a noisy
+ * machine doesn't fail the comparison.
+ *
+ * The exit status is 1 if any phase regressed, 2 for a usage error or if generating, allocating or a baseline file
+ * failed, and 3 if a generated program didn't assemble cleanly (nothing is compared then). */
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "assembler.h"
+#include "bench.h"
+#include "bool.h"
+#include "diagnostics.h"
+#include "first_pass.h"
+#include "pre_assembler.h"
+#include "second_pass.h"
+#include "stats.h"
+#include "workload.h"
+
+/* base name of the generated program (written to the current directory) */
+#define WORKLOAD_NAME "bench_workload"
+/* each size is this many times the previous one */
+#define SIZE_STEP 16
+/* phases timed, pre_assemble through second_pass (the output isn't written) */
+#define BENCH_PHASES 3
+/* most repetitions that can be asked for */
+#define MAX_REPS 1000
+/* a slowdown must exceed the spreads of both runs added, times this */
+#define NOISE_FACTOR 2.0
+/* default slowdown that counts as a regression, in percent */
+#define DEFAULT_THRESHOLD 5.0
+/* longest line of a baseline file worth reading */
+#define MAX_BASELINE_LINE 512
+/* capacity the results array starts with */
+#define INITIAL_RESULTS_SIZE 16
+/* exit statuses, see the top of the file */
+#define STATUS_REGRESSED 1
+#define STATUS_FAILED 2
+#define STATUS_INVALID_WORKLOAD 3
+
+/* timings of a phase on a program of a single size */
+typedef struct {
+    long size;
+    Phase phase;
+    long lines;         /* lines the phase reads */
+    long bytes;         /* bytes the phase reads */
+    double best;        /* fastest of all repetitions, in seconds */
+    double median;      /* median of all repetitions, in seconds */
+    double spread;      /* noise of the repetitions, relative to median (see bench_spread) */
+    double allocations; /* allocation calls per run, 0 unless built with -DTRACK_ALLOCATIONS */
+    double alloc_bytes; /* bytes requested per run, 0 unless built with -DTRACK_ALLOCATIONS */
+} PhaseResult;
+
+/* all results of a run (or of a baseline) */
+typedef struct {
+    PhaseResult *results;
+    int count;
+    int capacity;
+    long peak_rss_kb; /* -1 if unknown */
+} BenchRun;
+
+/* parses a size like 64K, 4M or 1G, returns -1 if invalid */
+static long parse_size(const char *text) {
+    /* text after the number */
+    char *suffix;
+    /* parsed number */
+    long size = strtol(text, &suffix, 10);
+
+    if (size <= 0)
+        return -1;
+    if (*suffix == 'K' || *suffix == 'k')
+        size *= 1024L;
+    else if (*suffix == 'M' || *suffix == 'm')
+        size *= 1024L * 1024L;
+    else if (*suffix == 'G' || *suffix == 'g')
+        size *= 1024L * 1024L * 1024L;
+    else if (*suffix != '\0')
+        return -1;
+    return size;
+}
+
+/* appends result to run, returns false if allocation failed */
+static Bool add_result(BenchRun *run, PhaseResult *result) {
+    /* new capacity if results array needs to grow */
+    int new_capacity;
+    /* grown results array */
+    PhaseResult *new_results;
+
+    if (run->count == run->capacity) {
+        new_capacity = run->capacity ? run->capacity * 2 : INITIAL_RESULTS_SIZE;
+        new_results = realloc(run->results, new_capacity * sizeof(PhaseResult));
+        if (!new_results)
+            return false;
+        run->results = new_results;
+        run->capacity = new_capacity;
+    }
+    run->results[run->count++] = *result;
+    return true;
+}
+
+/* returns the result of phase on size in run, NULL if run has none */
+static PhaseResult *find_result(BenchRun *run, long size, Phase phase) {
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < run->count; i++) {
+        if (run->results[i].size == size && run->results[i].phase == phase)
+            return &run->results[i];
+    }
+    return NULL;
+}
+
+static void print_result(PhaseResult *result) {
+    printf("%10ld  %-12s %10ld %10.2f %10.4f %14.0f %10.2f %7.1f%%\n", result->size, PHASE_NAMES[result->phase],
+           result->lines, result->bytes / (1024.0 * 1024.0), result->best, result->lines / result->median,
+           result->bytes / (1024.0 * 1024.0) / result->median, result->spread * 100);
+}
+
+/* runs all phases reps times on a program of size bytes and adds the results to run (only once, without timing it,
+ * if check), returns 0 on success, STATUS_INVALID_WORKLOAD if the program didn't assemble without errors or warnings,
+ * and STATUS_FAILED if generating it or allocating failed */
+static int bench_size(long size, int reps, Bool keep, Bool check, BenchRun *run) {
+    /* exit status of the benchmark */
+    int status = STATUS_FAILED;
+    /* whether the current phase succeeded or not */
+    Bool success;
+    /* generated program parameters */
+    WorkloadConfig config;
+    /* generated program */
+    WorkloadSummary summary;
+    /* state reused by all repetitions */
+    AssemblerState *state = NULL;
+    /* one collector for all repetitions (they are expected to have no errors) */
+    Diagnostics *diagnostics = NULL;
+    /* results of pre_assemble, first_pass and second_pass */
+    PhaseResult results[BENCH_PHASES];
+    /* duration of each repetition of each phase */
+    double times[BENCH_PHASES][MAX_REPS];
+    /* allocation counters before and after all repetitions */
+    AllocStats allocs_before, allocs_after;
+    /* time before the current phase */
+    double start;
+    /* index trackers */
+    int rep, i;
+
+    workload_default_config(&config);
+    config.lines = 0;
+    config.bytes = size;
+    if (!generate_workload_file(WORKLOAD_NAME ".as", &config, &summary)) {
+        fprintf(stderr, "cannot generate " WORKLOAD_NAME ".as\n");
+        return STATUS_FAILED;
+    }
+
+    state = create_assembler_state();
+    diagnostics = diagnostics_create(0);
+    if (!state || !diagnostics) {
+        fprintf(stderr, "out of memory\n");
+        goto cleanup;
+    }
+    /* generated programs aren't limited by the target memory */
+    state->memory_size = INT_MAX;
+    state->diagnostics = diagnostics;
+
+    alloc_get_stats(&allocs_before);
+    for (rep = 0; rep < reps; rep++) {
+        reset_assembler_state(state);
+        for (i = 0; i < BENCH_PHASES; i++) {
+            ALLOC_PHASE(i);
+            start = bench_now();
+            if (i == PHASE_PRE_ASSEMBLE)
+                success = pre_assemble(WORKLOAD_NAME, diagnostics, NULL, NULL, NULL, state->pre_assembler);
+            else if (i == PHASE_FIRST_PASS)
+                success = first_pass(WORKLOAD_NAME, state);
+            else
+                success = second_pass(WORKLOAD_NAME, state);
+            times[i][rep] = bench_now() - start;
+            ALLOC_PHASE(ALLOC_OUTSIDE_PHASE);
+            /* a generated program must assemble cleanly, otherwise the numbers mean nothing */
+            if (!success || diagnostics->count > 0) {
+                fprintf(stderr, "invalid workload: %s %s on the %ld byte program:\n", PHASE_NAMES[i],
+                        success ? "warned" : "failed", size);
+                diagnostics_flush(diagnostics, stderr, DIAGNOSTICS_TEXT);
+                status = STATUS_INVALID_WORKLOAD;
+                goto cleanup;
+            }
+        }
+    }
+    alloc_get_stats(&allocs_after);
+
+    if (check) {
+        printf("%10ld  assembles cleanly (%ld lines)\n", size, summary.lines);
+        status = 0;
+        goto cleanup;
+    }
+
+    for (i = 0; i < BENCH_PHASES; i++) {
+        results[i].size = size;
+        results[i].phase = i;
+        results[i].median = bench_median(times[i], reps);
+        /* sorted by bench_median */
+        results[i].best = times[i][0];
+        results[i].spread = bench_spread(times[i], reps);
+        results[i].allocations = (double)(allocs_after.phases[i].allocations + allocs_after.phases[i].reallocs -
+                                          allocs_before.phases[i].allocations - allocs_before.phases[i].reallocs) /
+                                 reps;
+        results[i].alloc_bytes = (double)(allocs_after.phases[i].bytes - allocs_before.phases[i].bytes) / reps;
+    }
+    /* pre_assemble reads the .as file, the passes work on the expanded lines */
+    results[0].lines = summary.lines;
+    results[0].bytes = summary.bytes;
+    results[1].lines = results[2].lines = bench_count_lines(WORKLOAD_NAME ".am");
+    results[1].bytes = results[2].bytes = bench_file_size(WORKLOAD_NAME ".am");
+    status = 0;
+    for (i = 0; i < BENCH_PHASES; i++) {
+        print_result(&results[i]);
+        if (!add_result(run, &results[i])) {
+            fprintf(stderr, "out of memory\n");
+            status = STATUS_FAILED;
+        }
+    }
+
+cleanup:
+    fflush(stdout);
+    free_assembler_state(state);
+    diagnostics_free(diagnostics);
+    if (!keep) {
+        remove(WORKLOAD_NAME ".as");
+        remove(WORKLOAD_NAME ".am");
+    }
+    return status;
+}
+
+/* writes run to path as a json baseline, returns false if it couldn't be written */
+static Bool save_baseline(const char *path, BenchRun *run, int reps) {
+    /* baseline file */
+    FILE *file = fopen(path, "w");
+    /* whether a write failed or not */
+    Bool failed;
+    /* current result */
+    PhaseResult *result;
+    /* index tracker */
+    int i;
+
+    if (!file)
+        return false;
+    /* one result per line, so load_baseline can read it back line by line */
+    fprintf(file, "{\"benchmark\":\"bench_passes\",\"reps\":%d,\"peak_rss_kb\":%ld,\"results\":[\n", reps,
+            run->peak_rss_kb);
+    for (i = 0; i < run->count; i++) {
+        result = &run->results[i];
+        fprintf(file,
+                "{\"size\":%ld,\"phase\":\"%s\",\"lines\":%ld,\"bytes\":%ld,\"best_seconds\":%.9f,"
+                "\"median_seconds\":%.9f,\"spread\":%.6f,\"lines_per_second\":%.1f,\"allocations\":%.1f,"
+                "\"alloc_bytes\":%.1f}%s\n",
+                result->size, PHASE_NAMES[result->phase], result->lines, result->bytes, result->best, result->median,
+                result->spread, result->lines / result->median, result->allocations, result->alloc_bytes,
+                i + 1 < run->count ? "," : "");
+    }
+    fprintf(file, "]}\n");
+    failed = ferror(file) != 0;
+    /* closing flushes the buffer, which can fail too */
+    if (fclose(file) != 0)
+        failed = true;
+    return !failed;
+}
+
+/* reads a baseline written by save_baseline into run, returns false if it couldn't be read */
+static Bool load_baseline(const char *path, BenchRun *run) {
+    /* baseline file */
+    FILE *file = fopen(path, "r");
+    /* current line */
+    char line[MAX_BASELINE_LINE];
+    /* phase name of the current result */
+    char phase_name[MAX_BASELINE_LINE];
+    /* the result read from the current line */
+    PhaseResult result;
+    /* where the peak resident set is in the header line */
+    char *peak;
+    /* used to tell the caller whether the baseline was read or not */
+    Bool success = true;
+    /* index tracker */
+    int i;
+
+    if (!file)
+        return false;
+    run->peak_rss_kb = -1;
+    while (success && fgets(line, sizeof(line), file)) {
+        /* the header holds the peak resident set */
+        if ((peak = strstr(line, "\"peak_rss_kb\":")))
+            run->peak_rss_kb = atol(peak + strlen("\"peak_rss_kb\":"));
+        if (strncmp(line, "{\"size\":", 8) != 0)
+            continue;
+        if (sscanf(line,
+                   "{\"size\":%ld,\"phase\":\"%[^\"]\",\"lines\":%ld,\"bytes\":%ld,\"best_seconds\":%lf,"
+                   "\"median_seconds\":%lf,\"spread\":%lf,\"lines_per_second\":%*f,\"allocations\":%lf,"
+                   "\"alloc_bytes\":%lf",
+                   &result.size, phase_name, &result.lines, &result.bytes, &result.best, &result.median,
+                   &result.spread, &result.allocations, &result.alloc_bytes) != 9 ||
+            result.median <= 0) {
+            success = false;
+            break;
+        }
+        /* phases are stored by name, so a baseline survives reordering them */
+        for (i = 0; i < PHASE_COUNT && strcmp(PHASE_NAMES[i], phase_name) != 0; i++)
+            ;
+        result.phase = i;
+        success = i < PHASE_COUNT && add_result(run, &result);
+    }
+    fclose(file);
+    return success;
+}
+
+/* prints how each result of current compares to the same phase and size in baseline, returns the count of phases
+ * that got significantly slower */
+static int compare_runs(BenchRun *baseline, BenchRun *current, double threshold) {
+    /* count of regressions */
+    int regressions = 0;
+    /* current result and its baseline */
+    PhaseResult *result, *base;
+    /* lines/s of both */
+    double base_speed, speed;
+    /* relative change of lines/s, and how much of it is noise */
+    double change, noise;
+    /* what the change means */
+    const char *verdict;
+    /* index tracker */
+    int i;
+
+    printf("\n%10s  %-12s %14s %14s %9s %9s  %s\n", "size", "phase", "base lines/s", "lines/s", "change", "noise",
+           "verdict");
+    for (i = 0; i < current->count; i++) {
+        result = &current->results[i];
+        base = find_result(baseline, result->size, result->phase);
+        if (!base) {
+            printf("%10ld  %-12s %14s\n", result->size, PHASE_NAMES[result->phase], "not in baseline");
+            continue;
+        }
+        base_speed = base->lines / base->median;
+        speed = result->lines / result->median;
+        change = speed / base_speed - 1;
+        /* a change is only significant if it is bigger than the threshold and than both runs' noise */
+        noise = NOISE_FACTOR * (base->spread + result->spread);
+        if (noise < threshold)
+            noise = threshold;
+        if (change < -noise) {
+            verdict = "REGRESSION";
+            regressions++;
+        } else if (change > noise) {
+            verdict = "faster";
+        } else {
+            verdict = "same";
+        }
+        printf("%10ld  %-12s %14.0f %14.0f %+8.1f%% %8.1f%%  %s", result->size, PHASE_NAMES[result->phase],
+               base_speed, speed, change * 100, noise * 100, verdict);
+        /* allocations don't depend on the machine, so any growth is worth a note */
+        if (base->allocations > 0 && result->allocations > base->allocations * (1 + threshold))
+            printf(" (allocations %.0f -> %.0f)", base->allocations, result->allocations);
+        printf("\n");
+    }
+    if (baseline->peak_rss_kb > 0 && current->peak_rss_kb > 0)
+        printf("peak resident set: %ld kB -> %ld kB (%+.1f%%)\n", baseline->peak_rss_kb, current->peak_rss_kb,
+               (double)current->peak_rss_kb / baseline->peak_rss_kb * 100 - 100);
+    printf("%d regression%s\n", regressions, regressions == 1 ? "" : "s");
+    return regressions;
+}
+
+int main(int argc, char *argv[]) {
+    /* smallest and largest program sizes */
+    long min_size = 1024L, max_size = 64L * 1024L * 1024L;
+    /* current program size */
+    long size;
+    /* repetitions of each size (the median is compared, the fastest is reported too) */
+    int reps = 3;
+    /* whether to keep the generated files, and whether to only check that they assemble */
+    Bool keep = false, check = false;
+    /* baseline to write and baseline to compare with, NULL if none */
+    char *save_path = NULL, *compare_path = NULL;
+    /* slowdown that counts as a regression, as a fraction */
+    double threshold = DEFAULT_THRESHOLD / 100;
+    /* results of this run and of the baseline */
+    BenchRun run = {NULL, 0, 0, -1}, baseline = {NULL, 0, 0, -1};
+    /* exit status, and the count of regressed phases */
+    int status = 0, regressions;
+    /* index tracker */
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--min-size") == 0 && i + 1 < argc) {
+            min_size = parse_size(argv[++i]);
+        } else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) {
+            max_size = parse_size(argv[++i]);
+        } else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--keep") == 0) {
+            keep = true;
+        } else if (strcmp(argv[i], "--check") == 0) {
+            check = true;
+        } else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+            save_path = argv[++i];
+        } else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+            compare_path = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = atof(argv[++i]) / 100;
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--min-size SIZE] [--max-size SIZE] [--reps N] [--keep] [--check] [--save FILE] "
+                    "[--compare FILE] [--threshold PERCENT]\n",
+                    argv[0]);
+            return STATUS_FAILED;
+        }
+    }
+    if (min_size <= 0 || max_size < min_size || reps < 1 || reps > MAX_REPS || threshold < 0) {
+        fprintf(stderr, "invalid size range, repetitions or threshold\n");
+        return STATUS_FAILED;
+    }
+    /* a check times nothing, so it has nothing to save or compare */
+    if (check && (save_path || compare_path)) {
+        fprintf(stderr, "--check can't be combined with --save or --compare\n");
+        return STATUS_FAILED;
+    }
+    /* read the baseline first, so a bad path doesn't waste a whole run */
+    if (compare_path && !load_baseline(compare_path, &baseline)) {
+        fprintf(stderr, "cannot read baseline %s\n", compare_path);
+        return STATUS_FAILED;
+    }
+
+    if (!check)
+        printf("%10s  %-12s %10s %10s %10s %14s %10s %8s\n", "size", "phase", "lines", "MB", "seconds", "lines/s",
+               "MB/s", "spread");
+    for (size = min_size; size <= max_size; size *= SIZE_STEP) {
+        status = bench_size(size, check ? 1 : reps, keep, check, &run);
+        if (status == STATUS_INVALID_WORKLOAD) {
+            fprintf(stderr,
+                    "the %ld byte program doesn't assemble cleanly, the workload generator no longer matches the "
+                    "assembler%s\n",
+                    size, compare_path ? " (nothing was compared)" : "");
+            goto cleanup;
+        }
+        if (status != 0)
+            goto cleanup;
+        /* don't overflow past the largest size */
+        if (size > LONG_MAX / SIZE_STEP)
+            break;
+    }
+    run.peak_rss_kb = peak_rss_kb();
+
+    if (save_path && !save_baseline(save_path, &run, reps)) {
+        fprintf(stderr, "cannot write baseline %s\n", save_path);
+        status = STATUS_FAILED;
+    }
+    if (compare_path && (regressions = compare_runs(&baseline, &run, threshold)) > 0) {
+        fprintf(stderr, "%d phase%s regressed against %s\n", regressions, regressions == 1 ? "" : "s", compare_path);
+        status = STATUS_REGRESSED;
+    }
+
+cleanup:
+    free(run.results);
+    free(baseline.results);
+    return status;
+}
\ No newline at end of file
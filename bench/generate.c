@@ -0,0 +1,92 @@
+/* writes a generated .as program
+ *
+ * build: gcc -O2 -ansi -pedantic -Iinclude -Ibench bench/generate.c bench/workload.c src/instructions.c -o generate
+ * usage: generate [options] output.as
+ *        --lines N        stop after N lines (default 1000)
+ *        --bytes N        stop after N bytes (default no limit)
+ *        --labels P       percent of statements with a label
+ *        --macros N       macros defined
+ *        --macro-lines N  instructions in each macro
+ *        --macro-calls P  percent of statements that call a macro
+ *        --data P         percent of statements that are .data/.string
+ *        --strings P      percent of data statements that are .string
+ *        --externs N      .extern symbols
+ *        --entries N      .entry directives
+ *        --modes I,D,R,G  weights of immediate, direct, relative and register operands
+ *        --seed N         random seed */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "workload.h"
+
+static int usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [--lines N] [--bytes N] [--labels P] [--macros N] [--macro-lines N] [--macro-calls P] "
+            "[--data P] [--strings P] [--externs N] [--entries N] [--modes I,D,R,G] [--seed N] output.as\n",
+            program);
+    return 2;
+}
+
+int main(int argc, char *argv[]) {
+    /* generated program parameters */
+    WorkloadConfig config;
+    /* what was generated */
+    WorkloadSummary summary;
+    /* output path */
+    const char *path = NULL;
+    /* current option */
+    const char *option;
+    /* index tracker */
+    int i;
+
+    workload_default_config(&config);
+    for (i = 1; i < argc; i++) {
+        option = argv[i];
+        /* the last argument is the output path */
+        if (option[0] != '-') {
+            path = option;
+            continue;
+        }
+        if (i + 1 >= argc)
+            return usage(argv[0]);
+        if (strcmp(option, "--lines") == 0)
+            config.lines = atol(argv[++i]);
+        else if (strcmp(option, "--bytes") == 0)
+            config.bytes = atol(argv[++i]);
+        else if (strcmp(option, "--labels") == 0)
+            config.label_percent = atoi(argv[++i]);
+        else if (strcmp(option, "--macros") == 0)
+            config.macro_count = atoi(argv[++i]);
+        else if (strcmp(option, "--macro-lines") == 0)
+            config.macro_lines = atoi(argv[++i]);
+        else if (strcmp(option, "--macro-calls") == 0)
+            config.macro_call_percent = atoi(argv[++i]);
+        else if (strcmp(option, "--data") == 0)
+            config.data_percent = atoi(argv[++i]);
+        else if (strcmp(option, "--strings") == 0)
+            config.string_percent = atoi(argv[++i]);
+        else if (strcmp(option, "--externs") == 0)
+            config.extern_count = atoi(argv[++i]);
+        else if (strcmp(option, "--entries") == 0)
+            config.entry_count = atoi(argv[++i]);
+        else if (strcmp(option, "--seed") == 0)
+            config.seed = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(option, "--modes") == 0) {
+            if (sscanf(argv[++i], "%d,%d,%d,%d", &config.mode_weights[0], &config.mode_weights[1],
+                       &config.mode_weights[2], &config.mode_weights[3]) != 4)
+                return usage(argv[0]);
+        } else
+            return usage(argv[0]);
+    }
+    if (!path)
+        return usage(argv[0]);
+
+    if (!generate_workload_file(path, &config, &summary)) {
+        fprintf(stderr, "cannot write %s\n", path);
+        return 1;
+    }
+    printf("%ld lines, %ld bytes, %ld code words, %ld data words\n", summary.lines, summary.bytes, summary.code_words,
+           summary.data_words);
+    return 0;
+}
\ No newline at end of file
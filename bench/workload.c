@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assembler.h"
+#include "bool.h"
+#include "instructions.h"
+#include "workload.h"
+
+/* count of instructions in INSTRUCTION_TABLE */
+#define INSTRUCTION_COUNT 16
+/* address operand words of direct symbols must fit in */
+#define MAX_DIRECT_ADDRESS WORD_VALUE_MASK
+/* how far before an instruction a relative target may be, the operand word holding the distance comes up to two
+ * words after the instruction's address */
+#define MAX_RELATIVE_BACK (-MIN_NUMBER - 2)
+
+/* generator state */
+typedef struct {
+    FILE *out;
+    WorkloadConfig *config;
+    WorkloadSummary *summary;
+    unsigned long random;
+    long ic;          /* address of the next instruction */
+    long label_count; /* code labels L0..L(label_count - 1) were defined */
+    long label_capacity;
+    long *label_addresses; /* address of each code label */
+    long near_labels; /* code labels before L(near_labels) are too far back for a relative operand */
+    long low_labels;  /* code labels L0..L(low_labels - 1) have an address that fits in a word */
+    long data_labels; /* data labels D0..D(data_labels - 1) were defined */
+    int *macro_words; /* words each macro expands to */
+} Generator;
+
+/* returns a pseudo random number in [0, limit), the same on every platform for the same seed */
+static long next_random(Generator *generator, long limit) {
+    generator->random = (generator->random * 1103515245UL + 12345UL) & 0xFFFFFFFFUL;
+    return limit > 0 ? (long)((generator->random >> 8) % (unsigned long)limit) : 0;
+}
+
+/* writes a line (newline added) and counts it */
+static void emit(Generator *generator, const char *line) {
+    fputs(line, generator->out);
+    fputc('\n', generator->out);
+    generator->summary->lines++;
+    generator->summary->bytes += strlen(line) + 1;
+}
+
+/* picks an addressing mode allowed by mask, weighted by config, -1 if mask allows none */
+static int pick_mode(Generator *generator, int mask) {
+    /* sum of weights of allowed modes */
+    long total = 0;
+    /* picked weight */
+    long pick;
+    /* index tracker */
+    int mode;
+
+    for (mode = 0; mode < 4; mode++) {
+        if (mask & (1 << mode))
+            total += generator->config->mode_weights[mode];
+    }
+    /* if no allowed mode has a weight, take the first allowed one */
+    if (total == 0) {
+        for (mode = 0; mode < 4; mode++) {
+            if (mask & (1 << mode))
+                return mode;
+        }
+        return -1;
+    }
+
+    pick = next_random(generator, total);
+    for (mode = 0; mode < 4; mode++) {
+        if (!(mask & (1 << mode)))
+            continue;
+        if (pick < generator->config->mode_weights[mode])
+            return mode;
+        pick -= generator->config->mode_weights[mode];
+    }
+    return -1;
+}
+
+/* writes an operand of mode to operand (in_macro operands don't use labels, the program may not define them yet) */
+static void write_operand(Generator *generator, char *operand, int mode, Bool in_macro) {
+    /* direct operands need a symbol whose address fits, externals always do */
+    long low_symbols = in_macro ? 0 : generator->low_labels;
+    /* chosen symbol */
+    long symbol;
+
+    switch (mode) {
+        case ADDR_IMMEDIATE:
+            sprintf(operand, "#%ld", next_random(generator, 512) - 256);
+            break;
+        case ADDR_RELATIVE:
+            /* the distance must fit in a word, so only earlier code labels close enough work (labels come in address
+             * order, and the instruction counter only grows) */
+            while (generator->near_labels < generator->label_count &&
+                   generator->label_addresses[generator->near_labels] < generator->ic - MAX_RELATIVE_BACK)
+                generator->near_labels++;
+            if (!in_macro && generator->near_labels < generator->label_count) {
+                sprintf(operand, "%%L%ld",
+                        generator->near_labels +
+                            next_random(generator, generator->label_count - generator->near_labels));
+                break;
+            }
+            /* without one (a macro may be expanded anywhere), every instruction taking relative operands also takes
+             * direct ones */
+            /* fall through */
+        case ADDR_DIRECT:
+            /* pick among low labels and externals, START is always there as a fallback */
+            symbol = next_random(generator, low_symbols + generator->config->extern_count);
+            if (symbol < low_symbols)
+                sprintf(operand, "L%ld", symbol);
+            else if (generator->config->extern_count > 0)
+                sprintf(operand, "X%ld", symbol - low_symbols);
+            else
+                strcpy(operand, "START");
+            break;
+        default:
+            sprintf(operand, "r%ld", next_random(generator, 8));
+            break;
+    }
+}
+
+/* writes a random instruction (without label) to text, returns the words it takes */
+static int write_instruction(Generator *generator, char *text, Bool in_macro) {
+    /* chosen instruction */
+    const InstructionInfo *info = &INSTRUCTION_TABLE[next_random(generator, INSTRUCTION_COUNT)];
+    /* operands text */
+    char source[MAX_LINE], destination[MAX_LINE];
+
+    if (info->num_operands == 2) {
+        write_operand(generator, source, pick_mode(generator, info->src_modes), in_macro);
+        write_operand(generator, destination, pick_mode(generator, info->dest_modes), in_macro);
+        sprintf(text, "%s %s, %s", info->name, source, destination);
+    } else if (info->num_operands == 1) {
+        write_operand(generator, destination, pick_mode(generator, info->dest_modes), in_macro);
+        sprintf(text, "%s %s", info->name, destination);
+    } else {
+        strcpy(text, info->name);
+    }
+    return 1 + info->num_operands;
+}
+
+/* writes a .data or .string directive (without label) to text, returns the words it takes */
+static int write_data(Generator *generator, char *text) {
+    /* count of numbers or characters */
+    int count;
+    /* index tracker */
+    int i;
+
+    if (next_random(generator, 100) < generator->config->string_percent) {
+        count = 1 + (int)next_random(generator, 24);
+        strcpy(text, ".string \"");
+        for (i = 0; i < count; i++)
+            text[9 + i] = (char)('a' + next_random(generator, 26));
+        strcpy(text + 9 + count, "\"");
+        return count + 1;
+    }
+
+    count = 1 + (int)next_random(generator, 6);
+    strcpy(text, ".data ");
+    for (i = 0; i < count; i++)
+        sprintf(text + strlen(text), i == 0 ? "%ld" : ", %ld", next_random(generator, 2048) - 1024);
+    return count;
+}
+
+/* checks whether another line fits the configured limits */
+static Bool has_room(Generator *generator) {
+    return (generator->config->lines == 0 || generator->summary->lines < generator->config->lines) &&
+           (generator->config->bytes == 0 || generator->summary->bytes < generator->config->bytes);
+}
+
+void workload_default_config(WorkloadConfig *config) {
+    config->lines = 1000;
+    config->bytes = 0;
+    config->label_percent = 25;
+    config->macro_count = 4;
+    config->macro_lines = 4;
+    config->macro_call_percent = 3;
+    config->data_percent = 15;
+    config->string_percent = 30;
+    config->extern_count = 8;
+    config->entry_count = 8;
+    config->mode_weights[ADDR_IMMEDIATE] = 3;
+    config->mode_weights[ADDR_DIRECT] = 3;
+    config->mode_weights[ADDR_RELATIVE] = 1;
+    config->mode_weights[ADDR_REGISTER] = 4;
+    config->seed = 1;
+}
+
+Bool generate_workload(FILE *out, WorkloadConfig *config, WorkloadSummary *summary) {
+    /* generator state */
+    Generator generator;
+    /* current line (label and statement) */
+    char line[MAX_LABEL + MAX_LINE];
+    /* statement without label */
+    char statement[MAX_LINE];
+    /* words current statement takes */
+    int words;
+    /* whether current statement is data */
+    Bool is_data;
+    /* count of .entry directives */
+    long entries;
+    /* grown label addresses */
+    long *addresses;
+    /* index trackers */
+    int i, j;
+
+    memset(summary, 0, sizeof(WorkloadSummary));
+    generator.out = out;
+    generator.config = config;
+    generator.summary = summary;
+    generator.random = config->seed;
+    generator.ic = IC_START;
+    generator.label_count = 0;
+    generator.label_capacity = 0;
+    generator.label_addresses = NULL;
+    generator.near_labels = 0;
+    generator.low_labels = 0;
+    generator.data_labels = 0;
+    generator.macro_words = malloc((config->macro_count > 0 ? config->macro_count : 1) * sizeof(int));
+    if (!generator.macro_words)
+        return false;
+
+    /* externals first, so direct operands can use them anywhere */
+    emit(&generator, "; generated workload");
+    for (i = 0; i < config->extern_count; i++) {
+        sprintf(line, ".extern X%d", i);
+        emit(&generator, line);
+    }
+
+    /* macros, their bodies only use registers, immediates, externals and START */
+    for (i = 0; i < config->macro_count; i++) {
+        sprintf(line, "mcro m%d", i);
+        emit(&generator, line);
+        generator.macro_words[i] = 0;
+        for (j = 0; j < config->macro_lines; j++) {
+            line[0] = ' ';
+            generator.macro_words[i] += write_instruction(&generator, line + 1, true);
+            emit(&generator, line);
+        }
+        emit(&generator, "mcroend");
+    }
+
+    /* START gives relative and direct operands a target from the first line on */
+    emit(&generator, "START: stop");
+    generator.ic++;
+
+    /* statements until a limit is reached (entries are added after them) */
+    while (has_room(&generator)) {
+        is_data = next_random(&generator, 100) < config->data_percent;
+
+        /* macro call, it can't have a label */
+        if (!is_data && config->macro_count > 0 && next_random(&generator, 100) < config->macro_call_percent) {
+            i = (int)next_random(&generator, config->macro_count);
+            sprintf(line, " m%d", i);
+            emit(&generator, line);
+            generator.ic += generator.macro_words[i];
+            continue;
+        }
+
+        words = is_data ? write_data(&generator, statement) : write_instruction(&generator, statement, false);
+
+        /* label the statement (data labels are never operands, their address is only known at the end) */
+        if (next_random(&generator, 100) < config->label_percent) {
+            if (is_data) {
+                sprintf(line, "D%ld: %s", generator.data_labels++, statement);
+            } else {
+                /* grow the label addresses geometrically, if failed, stop */
+                if (generator.label_count == generator.label_capacity) {
+                    generator.label_capacity = generator.label_capacity ? generator.label_capacity * 2 : 1024;
+                    addresses = realloc(generator.label_addresses, generator.label_capacity * sizeof(long));
+                    if (!addresses) {
+                        free(generator.label_addresses);
+                        free(generator.macro_words);
+                        return false;
+                    }
+                    generator.label_addresses = addresses;
+                }
+                generator.label_addresses[generator.label_count] = generator.ic;
+                sprintf(line, "L%ld: %s", generator.label_count++, statement);
+                if (generator.ic <= MAX_DIRECT_ADDRESS)
+                    generator.low_labels = generator.label_count;
+            }
+        } else {
+            sprintf(line, " %s", statement);
+        }
+        emit(&generator, line);
+
+        if (is_data)
+            summary->data_words += words;
+        else
+            generator.ic += words;
+    }
+
+    /* entries of distinct code labels, spread over the program */
+    entries = config->entry_count < generator.label_count ? config->entry_count : generator.label_count;
+    for (i = 0; i < entries; i++) {
+        sprintf(line, ".entry L%ld", (long)i * generator.label_count / entries);
+        emit(&generator, line);
+    }
+
+    summary->code_words = generator.ic - IC_START;
+    free(generator.label_addresses);
+    free(generator.macro_words);
+    return true;
+}
+
+Bool generate_workload_file(const char *path, WorkloadConfig *config, WorkloadSummary *summary) {
+    /* used to tell the caller whether the file was written or not */
+    Bool success;
+    /* output file */
+    FILE *out = fopen(path, "w");
+
+    if (!out)
+        return false;
+    success = generate_workload(out, config, summary);
+    /* a failed close means buffered text was lost */
+    if (fclose(out) != 0)
+        success = false;
+    return success;
+}
\ No newline at end of file
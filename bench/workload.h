@@ -0,0 +1,45 @@
+/* include guard to define only once */
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+/* needed for FILE, might warn
+ * the below comment tells clangd to keep this include even if it looks unused
+ */
+#include <stdio.h> /* IWYU pragma: keep */
+
+#include "bool.h"
+
+/* percentages are of all statements (instructions, macro calls, .data and .string lines) */
+typedef struct {
+    long lines;            /* stop after this many lines, 0 for no limit */
+    long bytes;            /* stop once this many bytes were written, 0 for no limit */
+    int label_percent;     /* statements with a label */
+    int macro_count;       /* macros defined at the top of the file */
+    int macro_lines;       /* instructions in each macro body */
+    int macro_call_percent; /* statements that call a macro (if there are any) */
+    int data_percent;      /* statements that are .data or .string */
+    int string_percent;    /* of those, the ones that are .string */
+    int extern_count;      /* .extern symbols, used as direct operands */
+    int entry_count;       /* .entry directives (at most one per code label) */
+    int mode_weights[4];   /* relative weight of each addressing mode, indexed by ADDR_* */
+    unsigned long seed;
+} WorkloadConfig;
+
+/* what was generated */
+typedef struct {
+    long lines;
+    long bytes;
+    long code_words; /* words the program will take after expansion */
+    long data_words;
+} WorkloadSummary;
+
+/* fills config with a mix that looks like a typical hand written program */
+void workload_default_config(WorkloadConfig *config);
+/* writes a valid .as program (assembles with no errors given enough memory) to out, returns false if allocation
+ * failed. Direct operands only point at symbols whose address fits in a word, and relative ones at labels at most
+ * 2046 words before the instruction, so any size stays valid */
+Bool generate_workload(FILE *out, WorkloadConfig *config, WorkloadSummary *summary);
+/* generates a program to path, returns false if the file couldn't be written */
+Bool generate_workload_file(const char *path, WorkloadConfig *config, WorkloadSummary *summary);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,42 @@
+/* include guard to define only once */
+#ifndef ADDRESS_SORT_H
+#define ADDRESS_SORT_H
+
+#include "bool.h"
+
+/* capacity an address list starts with on its first push */
+#define INITIAL_ADDRESS_LIST_SIZE 64
+/* widest digit sorted in a single radix pass (2^bits counters must stay small enough for the L1 cache) */
+#define MAX_RADIX_BITS 8
+
+/* a symbol name at an address (a line of .ent, .ext or .sym) */
+typedef struct {
+    const char *name;
+    int address; /* not negative */
+} AddressRecord;
+
+/* growable array of address records, plus the scratch array sorting needs */
+typedef struct {
+    AddressRecord *records;
+    int count;
+    int capacity;
+    AddressRecord *scratch; /* capacity records, allocated by the first sort */
+    int max_address;        /* largest address pushed so far */
+} AddressList;
+
+/* initializes an empty list */
+void address_list_init(AddressList *list);
+/* forgets all records, keeping their capacity */
+void address_list_clear(AddressList *list);
+/* appends name at address (not negative), name must outlive the list's use, returns false if allocation failed */
+Bool address_list_push(AddressList *list, const char *name, int address);
+/* sorts records by address in O(n) with a stable LSD radix sort, so records of equal addresses keep the order they
+ * were pushed in. Passes are as few as the largest address allows, addresses below 2^12 take two 6-bit passes.
+ * Returns false if allocation failed (the records are then left unsorted) */
+Bool address_list_sort(AddressList *list);
+/* binary searches a sorted list, returns the index of the last record at or below address, -1 if there is none */
+int address_list_find(AddressList *list, int address);
+/* frees list data and empties it */
+void address_list_free(AddressList *list);
+
+#endif
\ No newline at end of file
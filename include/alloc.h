@@ -0,0 +1,60 @@
+/* include guard to define only once */
+#ifndef ALLOC_H
+#define ALLOC_H
+
+/* the allocation functions must be declared before they are redirected below */
+#include <stdio.h>  /* IWYU pragma: keep */
+#include <stdlib.h> /* IWYU pragma: keep */
+
+#include "bool.h"
+#include "stats.h"
+
+/* allocations made outside of any phase (setup, driver, teardown) */
+#define ALLOC_OUTSIDE_PHASE PHASE_COUNT
+
+/* allocation counters of a single phase */
+typedef struct {
+    long allocations; /* malloc and calloc calls */
+    long reallocs;    /* realloc calls */
+    long frees;       /* free calls (of non-NULL pointers) */
+    long bytes;       /* bytes requested by allocations and reallocs (the new size) */
+    long largest;     /* largest single request */
+} AllocPhaseStats;
+
+/* allocation counters of the whole process, indexed by Phase, then ALLOC_OUTSIDE_PHASE */
+typedef struct {
+    AllocPhaseStats phases[PHASE_COUNT + 1];
+} AllocStats;
+
+/* building with -DTRACK_ALLOCATIONS sends every malloc, calloc, realloc and free of the files that include this
+ * header through counting wrappers, without it nothing is counted and nothing is added to the calls */
+#ifdef TRACK_ALLOCATIONS
+#define ALLOC_TRACKING true
+/* attributes the following allocations (of every thread) to phase */
+#define ALLOC_PHASE(phase) alloc_set_phase(phase)
+#ifndef ALLOC_IMPLEMENTATION
+#define malloc(size) alloc_malloc(size)
+#define calloc(count, size) alloc_calloc(count, size)
+#define realloc(pointer, size) alloc_realloc(pointer, size)
+#define free(pointer) alloc_free(pointer)
+#endif
+#else
+#define ALLOC_TRACKING false
+#define ALLOC_PHASE(phase) ((void)(phase))
+#endif
+
+/* counting wrappers of the standard functions */
+void *alloc_malloc(size_t size);
+void *alloc_calloc(size_t count, size_t size);
+void *alloc_realloc(void *pointer, size_t size);
+void alloc_free(void *pointer);
+/* attributes the following allocations to phase (or ALLOC_OUTSIDE_PHASE) */
+void alloc_set_phase(int phase);
+/* copies the counters so far to stats */
+void alloc_get_stats(AllocStats *stats);
+/* prints the counters per phase */
+void alloc_print_stats(FILE *out, AllocStats *stats);
+/* returns the peak resident set size of the process in kilobytes, -1 if unknown */
+long peak_rss_kb(void);
+
+#endif
\ No newline at end of file
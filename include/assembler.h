@@ -2,16 +2,22 @@
 #ifndef ASSEMBLER_H
 #define ASSEMBLER_H
 
+#include "address_sort.h"
 #include "bool.h"
+#include "buffer.h"
+#include "diagnostics.h"
 #include "hash_table.h"
+#include "pre_assembler.h"
+#include "stats.h"
+#include "symbol_table.h"
 
-/* max memory */
+/* default memory size in words (see AssemblerState.memory_size) */
 #define MAX_MEMORY 4096
 /* 80 chars + newline + null */
 #define MAX_LINE 82
 /* 31 chars + null */
 #define MAX_LABEL 32
-/* where to start ic count from */
+/* default address to start ic count from (see AssemblerState.ic_start) */
 #define IC_START 100
 /* comment character */
 #define COMMENT_CHAR ';'
@@ -19,6 +25,10 @@
 #define MIN_NUMBER -2048
 /* max number */
 #define MAX_NUMBER 2047
+/* work smaller than this many lines per thread stays on the calling thread */
+#define MIN_LINES_PER_THREAD 2048
+/* max threads used to resolve symbol references of a single file */
+#define SECOND_PASS_THREADS 4
 
 /* reserved words - registers */
 extern const char *REGISTERS[];
@@ -29,33 +39,181 @@ extern const char *DIRECTIVES[];
 /* ARE enum */
 typedef enum { ARE_A, ARE_R, ARE_E } ARE;
 
-/* memory word (stores 12-bit value + ARE marking) */
+/* memory word, packed as 12-bit value (bits 0-11) + ARE marking (bits 12-13) */
+typedef unsigned short Word;
+
+/* mask of the value bits in a word */
+#define WORD_VALUE_MASK 0xFFF
+/* position of the ARE bits in a word */
+#define WORD_ARE_SHIFT 12
+/* packs a value (truncated to 12 bits) and an ARE marking into a word */
+#define MAKE_WORD(value, are) ((Word)(((value) & WORD_VALUE_MASK) | ((are) << WORD_ARE_SHIFT)))
+/* 12-bit value of a word */
+#define WORD_VALUE(word) ((word) & WORD_VALUE_MASK)
+/* ARE marking of a word */
+#define WORD_ARE(word) ((ARE)((word) >> WORD_ARE_SHIFT))
+/* 12-bit value of a word as a signed number (two's complement) */
+#define SIGNED_VALUE(value) ((int)((((value) & WORD_VALUE_MASK) ^ 0x800) - 0x800))
+
+/* capacity a segment starts with on its first write */
+#define INITIAL_SEGMENT_SIZE 64
+
+/* growable array of memory words (code or data) */
+typedef struct {
+    Word *words;
+    int count;    /* words in use */
+    int capacity; /* words allocated */
+} Segment;
+
+/* capacity the references, entries and listing arrays start with on their first use */
+#define INITIAL_REFERENCES_SIZE 64
+
+/* a direct or relative operand word left for the second pass to resolve */
+typedef struct {
+    int code_index; /* index of the operand word in the code segment */
+    int line_num;   /* line of the instruction (for errors) */
+    int name;       /* offset of the symbol name in AssemblerState.names */
+    Bool is_relative;
+} SymbolReference;
+
+/* a .entry directive left for the second pass */
+typedef struct {
+    int line_num;
+    int name; /* offset of the symbol name in AssemblerState.names (empty if none was given) */
+} EntryRequest;
+
+/* an error found by the second pass, reported once all its chunks are done so errors keep their line order */
+typedef struct {
+    int line_num;
+    const char *code;
+    const char *message;
+} PendingError;
+
+/* growable array of pending errors */
 typedef struct {
-    int value;
-    ARE are;
-} Word;
+    PendingError *errors;
+    int count;
+    int capacity;
+    Bool out_of_memory; /* an error couldn't be recorded */
+} PendingErrors;
 
-/* tracks where an external symbol is used (for .ext output) */
+/* a use of an external symbol found by the second pass, recorded on the symbol once all its chunks are done */
 typedef struct {
-    char name[MAX_LABEL];
+    Symbol *symbol;
     int address;
-} External;
+} PendingUse;
+
+/* growable array of pending uses */
+typedef struct {
+    PendingUse *uses; /* in address order */
+    int count;
+    int capacity;
+    Bool out_of_memory; /* a use couldn't be recorded */
+} PendingUses;
+
+/* where the words of a source line start, for the listing (they run up to where the next line's start) */
+typedef struct {
+    int code_index; /* code words encoded before the line */
+    int data_index; /* data words encoded before the line */
+} ListingLine;
+
+/* target memory of every file, see AssemblerState.memory_size and ic_start */
+typedef struct {
+    int memory_size;
+    int ic_start;
+} TargetOptions;
+
+/* optional outputs, kept by reset_assembler_state */
+typedef struct {
+    Bool symbols;     /* write the code and data symbols sorted by address to a .sym file */
+    Bool listing;     /* write every line with its address and words to a .lst file */
+    Bool disassembly; /* write the disassembled image to a .dis file and check it against the lines */
+    Bool source_map;  /* write the .as line (and macro call) of every address to a .map file */
+    Bool dependencies; /* write the files the object depends on (the .as file and its includes) to a .d file */
+} OutputOptions;
+
+/* whether first_pass keeps every line's text and where its words start (for the listing, the disassembly check and
+ * the source map) */
+#define KEEP_LISTING(state) ((state)->outputs.listing || (state)->outputs.disassembly || (state)->outputs.source_map)
 
 /* shared state between assembler passes */
 typedef struct {
     HashTable *symbols;
-    Word *code;
-    Word *data;
-    External *externals;
+    Segment code;
+    Segment data;
     int ic;
     int dc;
-    int ec; /* external count */
+    int ec; /* external uses count (the uses themselves are kept per symbol) */
+    int memory_size; /* words of target memory, MAX_MEMORY unless changed before first_pass */
+    int ic_start;    /* address of the first code word, IC_START unless changed before first_pass */
+    Diagnostics *diagnostics; /* where the passes report errors, NULL to print them to stderr right away */
+    SymbolReference *references; /* in code order, filled by first_pass */
+    int reference_count;
+    int reference_capacity;
+    EntryRequest *entries; /* in line order, filled by first_pass */
+    int entry_count;
+    int entry_capacity;
+    Buffer names; /* NULL terminated symbol names of references and entries */
+    Symbol **spare_symbols; /* symbols of previous files, reused before allocating new ones */
+    int spare_count;
+    int spare_capacity;
+    AssemblerStats *stats; /* counters of the current file, NULL unless stats are enabled */
+    AddressList sorted;    /* records of the output file being written, reused from file to file */
+    OutputOptions outputs; /* all off unless changed before first_pass */
+    ListingLine *listing;  /* one per line of the .am file, filled by first_pass if KEEP_LISTING */
+    int listing_count;
+    int listing_capacity;
+    Buffer listing_text; /* NULL terminated text of every line of the .am file, in line order */
+    LineOrigins origins; /* where each line of the .am file came from, filled by pre_assemble if outputs.source_map */
+    Buffer includes;     /* NULL terminated path of every file the .as file included, replaced by pre_assemble */
+    PreAssemblerBuffers *pre_assembler; /* tables and arrays pre_assemble reuses from file to file */
+    Buffer text;  /* the .am file, read by first_pass */
+    char **lines; /* start of every line of text, split by first_pass */
+    int line_capacity;
+    PendingErrors pending_errors[SECOND_PASS_THREADS]; /* errors of each second_pass chunk */
+    PendingUses pending_uses[SECOND_PASS_THREADS];     /* external uses of each second_pass chunk */
+    PendingErrors entry_errors;                        /* errors of the .entry requests, found by second_pass */
 } AssemblerState;
 
-/* checks if program would have enough memory after adding "additional" to */
-Bool has_memory(int ic, int dc, int additional);
+/* pool of idle assembler states, not thread safe - each thread owns its own pool */
+typedef struct {
+    AssemblerState **states;
+    int count;
+    int capacity;
+} StatePool;
+
+/* checks if program would have enough memory after adding "additional" words to it */
+Bool has_memory(AssemblerState *state, int additional);
+/* makes sure segment has room for additional more words, returns false if allocation failed */
+Bool segment_reserve(Segment *segment, int additional);
+/* appends word to segment, returns false if allocation failed */
+Bool segment_push(Segment *segment, Word word);
+/* records an operand word at code_index that refers to name, returns false if allocation failed */
+Bool add_reference(AssemblerState *state, int code_index, int line_num, char *name, Bool is_relative);
+/* records a .entry of name, returns false if allocation failed */
+Bool add_entry_request(AssemblerState *state, int line_num, char *name);
+/* records where the words of the next line start (the current segment sizes), returns false if allocation failed */
+Bool add_listing_line(AssemblerState *state, int code_index, int data_index);
+/* allocates an empty assembler state, returns NULL if allocation failed */
+AssemblerState *create_assembler_state(void);
+/* empties assembler state for the next file, keeping its tables, segments, symbols, settings and diagnostics */
+void reset_assembler_state(AssemblerState *state);
+/* sets the target memory of an empty state (fresh or reset) */
+void set_assembler_target(AssemblerState *state, TargetOptions *target);
 /* frees assembler state, returns NULL */
 AssemblerState *free_assembler_state(AssemblerState *state);
+/* returns a symbol with no external uses, reusing a spare one if possible, NULL if allocation failed */
+Symbol *acquire_symbol(AssemblerState *state);
+/* initializes an empty pool */
+void state_pool_init(StatePool *pool);
+/* returns an empty state, reusing an idle one if possible, NULL if allocation failed */
+AssemblerState *state_pool_acquire(StatePool *pool);
+/* gives state back to pool for reuse (the state is reset by the next acquire) */
+void state_pool_release(StatePool *pool, AssemblerState *state);
+/* frees pool and all of its idle states */
+void state_pool_free(StatePool *pool);
+/* assembles filename.as into output files using state (must be empty), returns true on success */
+Bool assemble_file(char *filename, AssemblerState *state);
 /* returns addressing mode of operand */
 int get_addressing_mode(char *operand);
 
@@ -0,0 +1,91 @@
+/* include guard to define only once */
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "assembler.h"
+#include "bool.h"
+#include "buffer.h"
+#include "simulator.h"
+
+/* what an instruction does in a batch */
+typedef enum {
+    BATCH_MOV,
+    BATCH_CMP,
+    BATCH_ADD,
+    BATCH_SUB,
+    BATCH_LEA,
+    BATCH_CLR,
+    BATCH_NOT,
+    BATCH_INC,
+    BATCH_DEC,
+    BATCH_JMP,
+    BATCH_BNE,
+    BATCH_JSR,
+    BATCH_RED,
+    BATCH_PRN,
+    BATCH_RTS,
+    BATCH_STOP,
+    BATCH_BAD,       /* not an instruction */
+    BATCH_UNRESOLVED /* has an external operand */
+} BatchOpKind;
+
+/* an instruction decoded once for all lanes, its operands point to the values of lane 0, the values of lane n
+ * follow n ints later */
+typedef struct {
+    BatchOpKind kind;
+    int *src;    /* source operand: a register, or a memory word (an immediate is its own word) */
+    int *dest;   /* destination operand, like src */
+    int value;   /* address lea loads */
+    int target;  /* where jmp, bne and jsr go */
+    int next;    /* address of the instruction after this one */
+    int address;
+} BatchOp;
+
+/* copies of one program run in lockstep, one per lane, with every value stored for all lanes side by side
+ * (structure of arrays), so an instruction that all lanes run together is a loop over contiguous ints. When their
+ * paths split, the lanes at the lowest address run first, so the others wait for them where the paths join again.
+ * Lanes that stopped are dropped from the live ones, so the rest can still run together */
+typedef struct {
+    int lanes;
+    Machine *machine;  /* decodes the program, its memory is the image every lane starts with */
+    BatchOp *ops;      /* one per address plus one for jumps outside memory */
+    Bool writes_code;  /* whether an instruction writes into the code (which lanes would then each decode) */
+    int *registers;    /* register r of lane n at r * lanes + n */
+    int *memory;       /* address a of lane n at a * lanes + n */
+    Bool *zero;        /* cmp's flag of each lane */
+    int *stack;        /* return addresses, lane n's at n * MACHINE_STACK_SIZE */
+    int *depths;       /* stack depth of each lane */
+    int *pcs;          /* next address of each lane (not updated while they are converged) */
+    MachineStatus *statuses;
+    int *fault_addresses;
+    unsigned long *steps; /* instructions each lane ran (without the rounds since they converged) */
+    const char **inputs;  /* what red reads in each lane */
+    long *input_lengths;
+    long *input_positions;
+    Buffer *outputs;      /* what prn wrote in each lane */
+    int *group;           /* lanes that run the next instruction, unless converged */
+    int group_count;
+    int *live;            /* lanes not known to be stopped or at the step limit, in lane order */
+    int live_count;
+    Bool converged;       /* all live lanes are running at pc */
+    int pc;
+    unsigned long rounds; /* instructions all lanes ran since they converged */
+    unsigned long budget; /* rounds left before the first lane reaches the step limit */
+    unsigned long lockstep_steps; /* lane instructions run while all lanes were converged */
+    unsigned long group_steps;    /* lane instructions run in smaller groups */
+} Batch;
+
+/* creates lanes copies of the program loaded in machine, each reading nothing, returns NULL if allocation failed */
+Batch *batch_create(Machine *machine, int lanes);
+/* sets what red reads in lane, length bytes of text (not copied) then -1 */
+void batch_set_input(Batch *batch, int lane, const char *text, long length);
+/* runs every lane until it stops or ran max_steps instructions (0 for no limit) */
+void batch_run(Batch *batch, unsigned long max_steps);
+/* frees batch (not its machine), returns NULL */
+Batch *batch_free(Batch *batch);
+/* runs the program of filename (assembled into state) once per line of options->batch, with the line as its input,
+ * and writes each lane's status, instruction count and output to filename.batch, returns true if every lane ran to
+ * stop */
+Bool run_batch(char *filename, AssemblerState *state, RunOptions *options);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,32 @@
+/* include guard to define only once */
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stddef.h>
+
+#include "bool.h"
+
+/* capacity a buffer starts with on its first append */
+#define INITIAL_BUFFER_SIZE 4096
+
+/* growable text buffer */
+typedef struct {
+    char *data; /* not NULL terminated */
+    size_t length;
+    size_t capacity;
+} Buffer;
+
+/* initializes an empty buffer */
+void buffer_init(Buffer *buffer);
+/* makes sure buffer has room for additional more bytes, returns false if allocation failed */
+Bool buffer_reserve(Buffer *buffer, size_t additional);
+/* appends length bytes of text, returns false if allocation failed */
+Bool buffer_append(Buffer *buffer, const char *text, size_t length);
+/* appends a NULL terminated string, returns false if allocation failed */
+Bool buffer_append_string(Buffer *buffer, const char *text);
+/* appends a number in decimal, returns false if allocation failed */
+Bool buffer_append_number(Buffer *buffer, long number);
+/* frees buffer data and empties it */
+void buffer_free(Buffer *buffer);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,66 @@
+/* include guard to define only once */
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+/* needed for FILE, might warn
+ * the below comment tells clangd to keep this include even if it looks unused
+ */
+#include <stdio.h> /* IWYU pragma: keep */
+
+#include "bool.h"
+#include "buffer.h"
+#include "hash_table.h"
+
+/* capacity of the records array on the first report */
+#define INITIAL_DIAGNOSTICS_SIZE 16
+
+/* severity of a reported record */
+typedef enum { DIAGNOSTIC_ERROR, DIAGNOSTIC_WARNING } DiagnosticSeverity;
+
+/* format used by diagnostics_flush */
+typedef enum { DIAGNOSTICS_TEXT, DIAGNOSTICS_JSON } DiagnosticsFormat;
+
+/* a single reported error or warning */
+typedef struct {
+    int file;                    /* index into Diagnostics.files, -1 if no file was set */
+    int line;                    /* 0 if not tied to a line */
+    int order;                   /* report order, keeps records of the same line in order */
+    DiagnosticSeverity severity;
+    const char *code;            /* name of the message macro, e.g. "ERR_LABEL_TOO_LONG" */
+    const char *message;         /* message text (string literal, not owned) */
+    char *argument;              /* copy of the extra argument (e.g. path), NULL if none */
+    int last_line;               /* the record repeats on every line from line up to this one */
+} Diagnostic;
+
+/* per-job collector of errors and warnings, not thread safe - each job owns its own */
+typedef struct {
+    Diagnostic *records;
+    int count;
+    int capacity;
+    int *files;       /* offset of the name of each file records belong to in file_names */
+    int file_count;
+    int file_capacity;
+    Buffer file_names; /* NULL terminated names of files */
+    HashTable *seen;  /* keys of collected records, used to drop and collapse repeated ones */
+    int error_count;  /* errors collected since the last flush */
+    int max_errors;   /* stop collecting after this many errors, 0 for no limit */
+    int suppressed;   /* repeated records dropped since the last flush */
+} Diagnostics;
+
+/* creates an empty collector that stops after max_errors errors (0 for no limit), NULL if allocation failed */
+Diagnostics *diagnostics_create(int max_errors);
+/* makes the following records belong to file, returns false if allocation failed */
+Bool diagnostics_set_file(Diagnostics *diagnostics, const char *file);
+/* collects a record, prints it to stderr right away if diagnostics is NULL */
+void diagnostics_report(Diagnostics *diagnostics, DiagnosticSeverity severity, int line, const char *code,
+                        const char *message, const char *argument);
+/* checks if the error limit was reached and the passes should stop */
+Bool diagnostics_should_stop(Diagnostics *diagnostics);
+/* writes all records sorted by file and line to out, then empties the collector */
+void diagnostics_flush(Diagnostics *diagnostics, FILE *out, DiagnosticsFormat format);
+/* drops all records without writing them, keeping the collector's arrays for the next job */
+void diagnostics_clear(Diagnostics *diagnostics);
+/* frees collector and its records */
+void diagnostics_free(Diagnostics *diagnostics);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,43 @@
+/* include guard to define only once */
+#ifndef DISASSEMBLER_H
+#define DISASSEMBLER_H
+
+/* needed for FILE, might warn
+ * the below comment tells clangd to keep this include even if it looks unused
+ */
+#include <stdio.h> /* IWYU pragma: keep */
+
+#include "address_sort.h"
+#include "assembler.h"
+#include "bool.h"
+#include "instructions.h"
+
+/* longest text of a decoded instruction: a mnemonic and two operands naming a label each */
+#define MAX_DISASSEMBLY (2 * MAX_LABEL + 16)
+
+/* an instruction decoded from the code segment */
+typedef struct {
+    const InstructionInfo *info;
+    int length;           /* words, 1 + operands */
+    int modes[2];         /* addressing mode of each operand, in source order */
+    int values[2];        /* immediate value, register number, address (direct) or target address (relative) */
+    const char *names[2]; /* symbol a direct or relative operand refers to, NULL if unknown */
+} DecodedInstruction;
+
+/* decodes the instruction at words[0] (of count words) at address of a memory of memory_size words into instruction.
+ * Labels and externals (sorted, see collect_label and collect_external_uses) name direct and relative operands, either
+ * may be NULL. Returns the instruction's length, 0 if words[0] isn't a valid instruction, its operand words don't
+ * match its modes or a relative operand lands outside memory */
+int decode_instruction(const DecodeTable *table, const Word *words, int count, int address, int memory_size,
+                       AddressList *labels, AddressList *externals, DecodedInstruction *instruction);
+/* writes instruction as source text at text (at least MAX_DISASSEMBLY chars), returns the end (NULL terminated) */
+char *format_instruction(DecodedInstruction *instruction, char *text);
+/* writes every code word as an instruction and every data word as .data, in address order, returns false if
+ * allocation failed */
+Bool write_disassembly(FILE *file, AssemblerState *state);
+/* decodes the words of every instruction line kept for the listing (see KEEP_LISTING) and compares them with the
+ * line's text, reports each line that doesn't match to state's diagnostics, returns the count of those lines, -1 if
+ * allocation failed */
+int check_disassembly(AssemblerState *state);
+
+#endif
\ No newline at end of file
@@ -2,10 +2,14 @@
 #ifndef ERRORS_H
 #define ERRORS_H
 
-/* error printing macros */
-#define ERROR(msg) fprintf(stderr, "Error: %s\n", msg)
-#define ERROR_FILE(msg, path) fprintf(stderr, "Error: %s '%s'\n", msg, path)
-#define ERROR_LINE(line, msg) fprintf(stderr, "Error on line %d: %s\n", line, msg)
+#include "diagnostics.h"
+
+/* error reporting macros, msg must be one of the ERR_ macros below (its name becomes the record code) */
+#define ERROR(diagnostics, msg) diagnostics_report(diagnostics, DIAGNOSTIC_ERROR, 0, #msg, msg, NULL)
+#define ERROR_FILE(diagnostics, msg, path) diagnostics_report(diagnostics, DIAGNOSTIC_ERROR, 0, #msg, msg, path)
+#define ERROR_LINE(diagnostics, line, msg) diagnostics_report(diagnostics, DIAGNOSTIC_ERROR, line, #msg, msg, NULL)
+#define ERROR_LINE_ARG(diagnostics, line, msg, argument)                                                              \
+    diagnostics_report(diagnostics, DIAGNOSTIC_ERROR, line, #msg, msg, argument)
 
 /* directive errors */
 #define ERR_DATA_INVALID_NUMBER "invalid number in .data directive"
@@ -51,9 +55,20 @@
 #define ERR_MACRO_NAME_IS_LABEL "macro name conflicts with label name"
 #define ERR_LABEL_BEFORE_MACRO "label cannot appear before macro definition"
 
+/* include errors */
+#define ERR_INCLUDE_NO_NAME "missing quoted file name in .include"
+#define ERR_INCLUDE_CANNOT_OPEN "cannot open included file"
+#define ERR_INCLUDE_INVALID_LINE "included file can only define macros and declare .extern symbols"
+#define ERR_LABEL_BEFORE_INCLUDE "label cannot appear before .include"
+
 /* memory errors */
 #define ERR_MEMORY_ALLOC "memory allocation failed"
 #define ERR_MEMORY_OVERFLOW "memory overflow - program too large"
+#define ERR_ADDRESS_OUT_OF_RANGE "symbol address does not fit in a memory word"
+#define ERR_DISTANCE_OUT_OF_RANGE "relative distance to symbol does not fit in a memory word"
+
+/* diagnostics errors */
+#define ERR_TOO_MANY_ERRORS "too many errors, stopping"
 
 /* number errors */
 #define ERR_NUMBER_OUT_OF_RANGE "number out of range"
@@ -74,4 +89,16 @@
 #define ERR_ENTRY_INVALID_SYMBOL "invalid symbol name in .entry"
 #define ERR_RELATIVE_EXTERNAL "relative addressing cannot use external symbol"
 
+/* disassembly errors */
+#define ERR_DISASSEMBLY_MISMATCH "instruction does not disassemble back to this line"
+
+/* run errors (the argument is the address the program stopped at) */
+#define ERR_RUN_BAD_INSTRUCTION "program executed a word that is not an instruction"
+#define ERR_RUN_UNRESOLVED_EXTERNAL "program used an external symbol, which only a linker can resolve"
+#define ERR_RUN_STACK_OVERFLOW "program nested subroutine calls too deep"
+#define ERR_RUN_STACK_UNDERFLOW "program executed rts outside of a subroutine"
+#define ERR_RUN_STEP_LIMIT "program did not stop within the step limit (instructions run)"
+#define ERR_BATCH_WRITES_CODE "program writes into its code, which a batch cannot run"
+#define ERR_BATCH_LANES_FAILED "lanes of the batch did not stop (see the .batch file)"
+
 #endif
\ No newline at end of file
@@ -3,8 +3,32 @@
 #define FIRST_PASS_H
 
 #include "assembler.h"
+#include "bool.h"
 
-/* parses .am file, builds symbol table, encodes instructions/data, returns AssemblerState on success, NULL on error */
-AssemblerState* first_pass(char *filename);
+/* max threads used to parse a single file */
+#define FIRST_PASS_THREADS 4
+
+/* parses .am file into state (must be empty), builds symbol table, encodes instructions/data, returns true on
+ * success, false on error (the caller still owns state) */
+Bool first_pass(char *filename, AssemblerState *state);
+
+/* checks if operand is valid syntax for addressing mode (as returned by get_addressing_mode) */
+Bool is_valid_addressing_mode(char *operand, int mode);
+
+/* first pass over lines that arrive one at a time instead of being read from the .am file */
+typedef struct {
+    AssemblerState *state;
+    int line_num; /* number of the last fed line */
+    Bool has_errors;
+    Bool memory_overflow_reported;
+    Bool failed; /* a fatal error happened, the following lines are ignored */
+} FirstPassStream;
+
+/* starts a first pass of filename.am into state (must be empty) */
+void first_pass_begin(FirstPassStream *stream, char *filename, AssemblerState *state);
+/* parses the next line (NULL terminated, newline removed, may be modified) */
+void first_pass_feed(FirstPassStream *stream, char *line);
+/* finishes the pass, returns true on success, false on error (like first_pass) */
+Bool first_pass_end(FirstPassStream *stream);
 
 #endif
\ No newline at end of file
@@ -9,6 +9,7 @@
 /* generic node - stores key + any data */
 typedef struct Node {
     char *key;
+    int key_size;      /* bytes allocated for key, kept when the node is recycled */
     void *data;        /* can point to anything */
     struct Node *next; /* for chaining */
 } Node;
@@ -18,6 +19,7 @@ typedef struct {
     Node **buckets; /* array of buckets */
     int size;       /* table size */
     int count;      /* number of key/value pairs stored */
+    Node *free_nodes; /* nodes of cleared pairs, reused by insert before allocating new ones */
 } HashTable;
 
 /* creates new table */
@@ -30,6 +32,8 @@ Bool hash_table_contains_key(HashTable *table, char *key);
 void *hash_table_lookup(HashTable *table, char *key);
 /* loop all data in table and call callback on them */
 void hash_table_foreach(HashTable *table, void (*callback)(char *key, void *data, void *context), void *context);
+/* removes all pairs but keeps buckets and nodes for reuse, calls free_data on each data (if provided) */
+void hash_table_clear(HashTable *table, void (*free_data)(void *));
 /* frees table */
 void hash_table_free(HashTable *table, void (*free_data)(void *));
 
@@ -7,7 +7,21 @@
  */
 #include <stdio.h> /* IWYU pragma: keep */
 
+#include "bool.h"
+#include "buffer.h"
+
+/* size of each read by read_file */
+#define READ_CHUNK_SIZE 65536
+
 /* discards remaining characters in line until newline or EOF */
 void discard_rest_of_line(FILE *file);
+/* reads the whole file into a NULL terminated buffer, returns false if allocation failed */
+Bool read_file(FILE *file, char **buffer, size_t *size);
+/* replaces the contents of buffer with the whole file, NULL terminated (the terminator isn't counted in its length),
+ * reusing its capacity, returns false if allocation failed */
+Bool read_file_to_buffer(FILE *file, Buffer *buffer);
+/* writes value in decimal right aligned to width with pad (wider if it doesn't fit) at out, without a NULL terminator,
+ * returns the end (faster than sprintf for output written a number at a time) */
+char *put_decimal(char *out, unsigned long value, int width, char pad);
 
 #endif
\ No newline at end of file
@@ -12,6 +12,15 @@
 #define ADDR_RELATIVE 2
 #define ADDR_REGISTER 3
 
+/* fields of an instruction's first word, as first_pass encodes it */
+#define WORD_OPCODE(value) (((value) >> 8) & 0xF)
+#define WORD_FUNCT(value) (((value) >> 4) & 0xF)
+#define WORD_SRC_MODE(value) (((value) >> 2) & 0x3)
+#define WORD_DEST_MODE(value) ((value) & 0x3)
+/* opcode and funct together, the index of the decode table */
+#define DECODE_INDEX(value) (((value) >> 4) & 0xFF)
+#define DECODE_TABLE_SIZE 256
+
 /* instruction info struct */
 typedef struct {
     char *name;
@@ -47,11 +56,18 @@ static const InstructionInfo INSTRUCTION_TABLE[] = {
     /* terminator */
     {NULL, 0, 0, 0, 0, 0}};
 
+/* instruction of each opcode and funct pair (see DECODE_INDEX), NULL where there is none */
+typedef struct {
+    const InstructionInfo *instructions[DECODE_TABLE_SIZE];
+} DecodeTable;
+
 /* lookups instruction by name, returns NULL if not found */
 const InstructionInfo *get_instruction_info(char *name);
 /* checks if addressing mode is valid for source operand */
 Bool is_valid_src_mode(const InstructionInfo *info, int mode);
 /* checks if addressing mode is valid for destination operand */
 Bool is_valid_dest_mode(const InstructionInfo *info, int mode);
+/* fills table from INSTRUCTION_TABLE */
+void build_decode_table(DecodeTable *table);
 
 #endif
\ No newline at end of file
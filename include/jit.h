@@ -0,0 +1,62 @@
+/* include guard to define only once */
+#ifndef JIT_H
+#define JIT_H
+
+/* needed for FILE and size_t, might warn
+ * the below comment tells clangd to keep this include even if it looks unused
+ */
+#include <stdio.h> /* IWYU pragma: keep */
+
+#include "bool.h"
+#include "simulator.h"
+
+/* bytes of executable memory for translated blocks, all of them are dropped when it fills up */
+#define JIT_BUFFER_SIZE (4 * 1024 * 1024)
+/* most instructions translated into one block */
+#define JIT_MAX_BLOCK 64
+
+/* a block of machine code that runs the instructions starting at an address. It's called with the machine, its
+ * memory and the count of instructions left to run, and returns the address to continue at */
+typedef int (*JitBlock)(Machine *machine, int *memory, unsigned long *remaining);
+
+/* an exit of a block to a block that wasn't translated yet, patched into a direct jump once it is */
+typedef struct {
+    int target;    /* address the exit goes to */
+    size_t offset; /* of the exit's code in the buffer */
+} JitExit;
+
+/* translation counters */
+typedef struct {
+    long blocks;               /* blocks translated */
+    long translated;           /* instructions translated */
+    long chained;              /* exits that jump straight to the next block */
+    long flushes;              /* times all translations were dropped (a write into the code, or a full buffer) */
+    unsigned long interpreted; /* instructions run by the interpreter (the ones that can't be translated) */
+} JitStats;
+
+/* translates the basic blocks of a machine's program into x86-64 code as they are first run */
+typedef struct {
+    Machine *machine;
+    unsigned char *code; /* executable buffer */
+    size_t used;         /* bytes of the buffer in use */
+    JitBlock *blocks;    /* block starting at each address, NULL if it wasn't translated */
+    int *lengths;        /* instructions in the block starting at each address */
+    Bool *interpreted;   /* addresses where no block can start (their instruction isn't translated) */
+    JitExit *exits;      /* exits that aren't chained yet */
+    int exit_count;
+    int exit_capacity;
+    JitStats stats;
+} Jit;
+
+/* creates a translator of machine, returns NULL if this platform can't run translated code (only x86-64 Linux can)
+ * or allocation failed, then the machine should be run by machine_run */
+Jit *jit_create(Machine *machine);
+/* runs the machine of jit like machine_run, translated blocks run straight through and jump to each other, the
+ * instructions that aren't translated (jsr, rts, red, prn, stop, writes into the code) are run by the interpreter */
+MachineStatus jit_run(Jit *jit, unsigned long max_steps);
+/* prints the translation counters */
+void jit_print_stats(FILE *out, Jit *jit);
+/* frees jit (not its machine), returns NULL */
+Jit *jit_free(Jit *jit);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,11 @@
+/* include guard to define only once */
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "assembler.h"
+#include "bool.h"
+
+/* writes .ob file, and .ent/.ext files if the program has entries/external uses, returns true on success */
+Bool write_output_files(char *filename, AssemblerState *state);
+
+#endif
\ No newline at end of file
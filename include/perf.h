@@ -0,0 +1,30 @@
+/* include guard to define only once */
+#ifndef PERF_H
+#define PERF_H
+
+/* needed for FILE, might warn
+ * the below comment tells clangd to keep this include even if it looks unused
+ */
+#include <stdio.h> /* IWYU pragma: keep */
+
+#include "bool.h"
+#include "stats.h"
+
+/* opens a counter of each hardware event (Linux perf_event_open) for the calling thread and the threads it starts
+ * from now on, returns false if none could be opened (then only timers are reported, see perf_error) */
+Bool perf_open(void);
+/* closes all counters */
+void perf_close(void);
+/* checks if any counter is open */
+Bool perf_enabled(void);
+/* checks if the counter of event is open */
+Bool perf_available(HardwareEvent event);
+/* returns why no counter could be opened */
+const char *perf_error(void);
+/* reads the count of each event so far into values (0 for events that aren't available), a phase's counts are the
+ * difference of two reads. Threads started after perf_open are included once they were joined */
+void perf_read(double values[EVENT_COUNT]);
+/* prints each phase's time and, if counters are available, its IPC and misses per line */
+void perf_print(FILE *out, const char *label, AssemblerStats *stats);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,39 @@
+/* include guard to define only once */
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+/* needed for FILE, might warn
+ * the below comment tells clangd to keep this include even if it looks unused
+ */
+#include <stdio.h> /* IWYU pragma: keep */
+
+#include "assembler.h"
+#include "diagnostics.h"
+
+/* expanded lines passed from the pre-assembler stage to the first pass stage at once */
+#define PIPELINE_BLOCK_LINES 64
+/* blocks of lines in flight between the pre-assembler stage and the first pass stage */
+#define PIPELINE_RING_SIZE 64
+
+/* how often the two ends of a queue had to wait for each other */
+typedef struct {
+    unsigned long full_stalls;  /* producer found the queue full (downstream stage is the bottleneck) */
+    unsigned long empty_stalls; /* consumer found the queue empty (upstream stage is the bottleneck) */
+} QueueStats;
+
+/* stall counters of every queue in the pipeline */
+typedef struct {
+    QueueStats lines; /* pre-assembler -> first pass (expanded lines) */
+    QueueStats files; /* passes -> output writer (finished files) */
+} PipelineStats;
+
+/* assembles files with the pre-assembler, the passes and the output writer overlapping on separate threads (the
+ * writer runs on the calling thread). Each file's errors are flushed to stderr in format, in file order, once the
+ * file is done. target is the memory of every file and outputs are its optional outputs. stats may be NULL. Returns
+ * the count of files that failed */
+int assemble_files_pipelined(char **filenames, int file_count, int max_errors, DiagnosticsFormat format,
+                             TargetOptions *target, OutputOptions *outputs, PipelineStats *stats);
+/* writes stall counters of each queue to out */
+void print_pipeline_stats(FILE *out, PipelineStats *stats);
+
+#endif
\ No newline at end of file
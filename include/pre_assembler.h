@@ -3,14 +3,61 @@
 #define PRE_ASSEMBLER_H
 
 #include "bool.h"
+#include "buffer.h"
+#include "diagnostics.h"
+#include "stats.h"
 
-/* struct for macros */
+/* max threads used to expand macros */
+#define PRE_ASSEMBLER_THREADS 4
+
+/* where a line of the expanded file comes from (macros don't nest, so a call is all the chain there is) */
+typedef struct {
+    int file; /* file with the line's text: 0 the input file, n the nth path of pre_assemble's includes */
+    int line; /* line of file with the line's text (inside the macro definition for an expanded line) */
+    int call; /* line of the input file with the macro call the line was expanded from, 0 if it wasn't */
+} LineOrigin;
+
+/* origin of every line of an expanded file, in line order */
 typedef struct {
-    char **lines; /* array of lines inside macro */
-    int line_count; /* count of lines inside macro */
-} Macro;
+    LineOrigin *lines;
+    int count;
+    int capacity;
+} LineOrigins;
+
+/* tables and arrays pre_assemble fills for each file, kept with their capacity so the next file reuses them */
+typedef struct PreAssemblerBuffers PreAssemblerBuffers;
+
+/* receives a line of the expanded file (not NULL terminated, length includes the newline if any), returns false to
+ * stop the expansion */
+typedef Bool (*LineSink)(const char *text, int length, void *context);
+
+/* initializes empty origins */
+void line_origins_init(LineOrigins *origins);
+/* adds the origin of the next line, returns false if allocation failed */
+Bool line_origins_push(LineOrigins *origins, int file, int line, int call);
+/* frees origins and empties them */
+void line_origins_free(LineOrigins *origins);
+/* allocates empty buffers, returns NULL if allocation failed */
+PreAssemblerBuffers *create_pre_assembler_buffers(void);
+/* empties buffers for the next file (pre_assemble does so too), keeping their memory */
+void reset_pre_assembler_buffers(PreAssemblerBuffers *buffers);
+/* frees buffers (may be NULL), returns NULL */
+PreAssemblerBuffers *free_pre_assembler_buffers(PreAssemblerBuffers *buffers);
 
-/* expands macros from .as file, outputs .am file, returns true on success, false on error */
-Bool pre_assemble(char *filename);
+/* expands macros and .include lines from .as file, outputs .am file, returns true on success, false on error
+ * (reported to diagnostics, or to stderr if NULL), replaces origins (if not NULL) with the origin of each .am line and
+ * includes (if not NULL) with the NULL terminated path of every included file, adds its counters to stats if not NULL,
+ * works in buffers if not NULL (otherwise in buffers of its own, freed before returning).
+ * An included file may only define macros and declare .extern symbols, it is parsed once per run and shared by every
+ * file that includes the same contents */
+Bool pre_assemble(char *filename, Diagnostics *diagnostics, LineOrigins *origins, Buffer *includes,
+                  AssemblerStats *stats, PreAssemblerBuffers *buffers);
+/* like pre_assemble, but expands on the calling thread only and passes each expanded line to sink as soon as it is
+ * expanded, so a consumer can start before the .am file is written */
+Bool pre_assemble_streaming(char *filename, Diagnostics *diagnostics, LineSink sink, void *context,
+                            LineOrigins *origins, Buffer *includes, AssemblerStats *stats,
+                            PreAssemblerBuffers *buffers);
+/* frees every included file parsed so far, once no file is being expanded */
+void free_included_files(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,39 @@
+/* include guard to define only once */
+#ifndef RING_H
+#define RING_H
+
+#include "bool.h"
+
+/* bytes kept between the producer and consumer indexes so they don't share a cache line */
+#define RING_PADDING 64
+
+/* lock-free queue of non-NULL pointers for exactly one producer thread and one consumer thread (head and tail are
+ * only accessed with the compiler's atomic builtins) */
+typedef struct {
+    void **slots;
+    unsigned long mask; /* capacity - 1, capacity is a power of two */
+    char padding1[RING_PADDING];
+    unsigned long head; /* next slot to pop, written by the consumer only */
+    unsigned long empty_stalls;  /* times the consumer had to wait for an item */
+    char padding2[RING_PADDING];
+    unsigned long tail; /* next slot to push, written by the producer only */
+    unsigned long full_stalls;   /* times the producer had to wait for room */
+    char padding3[RING_PADDING];
+} Ring;
+
+/* initializes an empty ring with room for at least capacity items, returns false if allocation failed */
+Bool ring_init(Ring *ring, int capacity);
+/* pushes item if there is room, returns false if the ring is full (producer only) */
+Bool ring_try_push(Ring *ring, void *item);
+/* pops the oldest item, returns NULL if the ring is empty (consumer only) */
+void *ring_try_pop(Ring *ring);
+/* pushes item, waiting while the ring is full (producer only) */
+void ring_push(Ring *ring, void *item);
+/* pops the oldest item, waiting while the ring is empty (consumer only) */
+void *ring_pop(Ring *ring);
+/* returns the count of items in the ring (either side, only a snapshot while the other side runs) */
+unsigned long ring_count(Ring *ring);
+/* frees ring slots (items are owned by the caller) */
+void ring_free(Ring *ring);
+
+#endif
\ No newline at end of file
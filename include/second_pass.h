@@ -5,7 +5,11 @@
 #include "assembler.h"
 #include "bool.h"
 
-/* resolves symbol addresses, processes .entry, returns true on success */
+/* files with fewer references per thread than this are resolved on the calling thread */
+#define MIN_REFERENCES_PER_THREAD 4096
+
+/* resolves symbol references and .entry requests recorded by first_pass, returns true on success (the caller still
+ * owns state) */
 Bool second_pass(char *filename, AssemblerState *state);
 
 #endif
\ No newline at end of file
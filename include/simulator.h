@@ -0,0 +1,102 @@
+/* include guard to define only once */
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+/* needed for FILE, might warn
+ * the below comment tells clangd to keep this include even if it looks unused
+ */
+#include <stdio.h> /* IWYU pragma: keep */
+
+#include "assembler.h"
+#include "address_sort.h"
+#include "bool.h"
+#include "disassembler.h"
+#include "instructions.h"
+
+/* registers r0 to r7 */
+#define MACHINE_REGISTERS 8
+/* return addresses jsr can push before the stack overflows */
+#define MACHINE_STACK_SIZE 1024
+/* most executed addresses printed with the profile summary */
+#define PROFILE_TOP 10
+
+/* ARE marking of the code word at address of machine */
+#define MACHINE_ARE(machine, address) WORD_ARE((machine)->image[(address) - (machine)->code_start])
+
+/* why a machine stopped running */
+typedef enum {
+    MACHINE_RUNNING,             /* not stopped yet (or stopped by the step limit, and can go on) */
+    MACHINE_STOPPED,             /* executed stop */
+    MACHINE_BAD_INSTRUCTION,     /* executed a word that isn't the start of an instruction */
+    MACHINE_UNRESOLVED_EXTERNAL, /* used an external operand, which only a linker can fill */
+    MACHINE_STACK_OVERFLOW,      /* jsr nested deeper than MACHINE_STACK_SIZE */
+    MACHINE_STACK_UNDERFLOW      /* rts without a jsr */
+} MachineStatus;
+
+typedef struct Machine Machine;
+typedef struct MachineOp MachineOp;
+
+/* executes op on machine, returns the op to run next, NULL if the machine stopped (see Machine.status) */
+typedef const MachineOp *(*OpHandler)(Machine *machine, const MachineOp *op);
+
+/* an instruction decoded once when the program is loaded, so running it is a single indirect call (threaded code)
+ * with its operands already resolved to where their values live */
+struct MachineOp {
+    OpHandler run;           /* handler of the instruction, or a check wrapped around it */
+    OpHandler execute;       /* handler of the instruction itself */
+    int *src;                /* source operand: a register, or a memory word (an immediate is its own word) */
+    int *dest;               /* destination operand, like src */
+    int value;               /* address lea loads */
+    const MachineOp *target; /* where jmp, bne and jsr go */
+    const MachineOp *next;   /* the instruction after this one */
+    int address;
+};
+
+/* a machine running an assembled program */
+struct Machine {
+    int registers[MACHINE_REGISTERS];
+    int *memory;        /* signed 12-bit value of every word, code at ic_start then data */
+    int memory_size;    /* words, the image and nothing more (no operand can address beyond it) */
+    Word *image;        /* code words with their ARE markings, to decode words the program wrote again */
+    int code_start;     /* address of the first code word */
+    int code_end;       /* address after the last code word */
+    MachineOp *ops;     /* one per address plus one for jumps outside memory, instructions start at a few of them */
+    Bool *starts;       /* whether an instruction starts at each address */
+    DecodeTable table;  /* decodes the instructions of the image */
+    Bool zero;          /* set by cmp when its operands are equal */
+    const MachineOp *stack[MACHINE_STACK_SIZE]; /* return addresses of jsr */
+    int stack_depth;
+    const MachineOp *pc; /* next instruction to run */
+    MachineStatus status;
+    int fault_address;      /* address of the instruction that stopped the machine with an error */
+    unsigned long steps;    /* instructions executed so far */
+    unsigned long *counts;  /* executions of each address, NULL unless profiling */
+    FILE *input;            /* what red reads */
+    FILE *output;           /* what prn writes */
+};
+
+/* options of running a program */
+typedef struct {
+    Bool profile;            /* count executions of each address, write them to a .prof file and print a summary */
+    Bool jit;                /* translate the program into x86-64 code where possible (ignored when profiling) */
+    Bool stats;              /* print the instructions per second (and the translation counters) */
+    char *batch;             /* file with the input of each lane of a batch run, a line each, NULL to run once */
+    unsigned long max_steps; /* stop after this many instructions, 0 for no limit */
+} RunOptions;
+
+/* loads the code and data of state (assembled without errors) into a new machine and decodes its instructions,
+ * profile allocates execution counters, returns NULL if allocation failed */
+Machine *machine_create(AssemblerState *state, Bool profile);
+/* decodes the instruction at address of machine as its words are now into instruction (see decode_instruction),
+ * returns its length, 0 if there is no valid instruction there */
+int machine_decode(Machine *machine, int address, AddressList *labels, AddressList *externals,
+                   DecodedInstruction *instruction);
+/* runs machine for at most max_steps instructions (0 for no limit) or until it stops, returns its status */
+MachineStatus machine_run(Machine *machine, unsigned long max_steps);
+/* frees machine, returns NULL */
+Machine *machine_free(Machine *machine);
+/* runs the program of filename (assembled into state), reading stdin and writing stdout, reports why it stopped if
+ * that wasn't stop, returns true if it ran to stop */
+Bool run_program(char *filename, AssemblerState *state, RunOptions *options);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+/* include guard to define only once */
+#ifndef SOURCE_MAP_H
+#define SOURCE_MAP_H
+
+/* needed for FILE, might warn
+ * the below comment tells clangd to keep this include even if it looks unused
+ */
+#include <stdio.h> /* IWYU pragma: keep */
+
+#include "assembler.h"
+#include "bool.h"
+#include "buffer.h"
+
+/* addresses from address up to the next entry's come from line of file (0 the .as file, n its nth included file),
+ * expanded from the macro call at line call of the .as file (0 if none) */
+typedef struct {
+    int address;
+    int file;
+    int line;
+    int call;
+} SourceMapEntry;
+
+/* where every word of an image comes from, in address order */
+typedef struct {
+    SourceMapEntry *entries;
+    int count;
+    int capacity;
+} SourceMap;
+
+/* initializes an empty map */
+void source_map_init(SourceMap *map);
+/* fills map from the listing and origins state kept (see KEEP_LISTING and outputs.source_map), a run of lines with
+ * the same origin is one entry, returns false if allocation failed */
+Bool source_map_build(SourceMap *map, AssemblerState *state);
+/* returns the entry of address, NULL if it is before the first one */
+const SourceMapEntry *source_map_find(SourceMap *map, int address);
+/* returns the name of file number file of an entry: source (the .as file name) for 0, else the nth path of includes
+ * (the NUL separated paths pre_assemble recorded), NULL if there is no such file */
+const char *source_map_file_name(const char *source, const Buffer *includes, int file);
+/* writes map of source and includes (see source_map_file_name): the file table first, a name per line from source and
+ * an empty line after the last, then every entry's address, file, line and call as the difference from the previous
+ * entry's (starting from 0 0 0 0), each a base64 VLQ like in JavaScript source maps: the sign in the lowest bit, then
+ * 5 bits per digit from the lowest, 32 added to every digit but the last */
+void source_map_write(FILE *file, const char *source, const Buffer *includes, SourceMap *map);
+/* frees map and empties it */
+void source_map_free(SourceMap *map);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,70 @@
+/* include guard to define only once */
+#ifndef STATS_H
+#define STATS_H
+
+/* needed for FILE, might warn
+ * the below comment tells clangd to keep this include even if it looks unused
+ */
+#include <stdio.h> /* IWYU pragma: keep */
+
+/* phases of assembling a file, in the order they run */
+typedef enum { PHASE_PRE_ASSEMBLE, PHASE_FIRST_PASS, PHASE_SECOND_PASS, PHASE_OUTPUT, PHASE_COUNT } Phase;
+
+/* phase names, indexed by Phase */
+extern const char *PHASE_NAMES[];
+
+/* hardware events counted per phase when profiling (see perf.h) */
+typedef enum {
+    EVENT_CYCLES,
+    EVENT_INSTRUCTIONS,
+    EVENT_BRANCH_MISSES,
+    EVENT_L1D_MISSES,
+    EVENT_LLC_MISSES,
+    EVENT_COUNT
+} HardwareEvent;
+
+/* counters of a single phase */
+typedef struct {
+    double seconds;     /* wall time */
+    long lines_read;
+    long bytes_read;
+    long bytes_written;
+    long hash_lookups;  /* lookups and contains checks */
+    long hash_inserts;
+    double events[EVENT_COUNT]; /* hardware event counts, all 0 unless profiling */
+} PhaseStats;
+
+/* counters of one or more assembled files */
+typedef struct {
+    PhaseStats phases[PHASE_COUNT];
+    long macros_defined;
+    long expanded_lines; /* lines written in place of macro calls */
+    long includes;        /* .include lines */
+    long includes_parsed; /* included files parsed, the others were already parsed by an earlier file */
+    long symbols;
+    long external_uses;
+    long entries;
+    int files;
+} AssemblerStats;
+
+/* adds n to field of stats, does nothing if stats is NULL (n is not even evaluated) */
+#define STATS_ADD(stats, field, n)                                                                                    \
+    do {                                                                                                               \
+        if (stats)                                                                                                     \
+            (stats)->field += (n);                                                                                     \
+    } while (0)
+/* returns the counters of phase in stats, NULL if stats is NULL */
+#define STATS_PHASE(stats, phase) ((stats) ? &(stats)->phases[phase] : (PhaseStats *)NULL)
+
+/* returns the current time in seconds (monotonic, only differences are meaningful) */
+double stats_now(void);
+/* zeroes all counters */
+void stats_reset(AssemblerStats *stats);
+/* adds all counters of source to total */
+void stats_add(AssemblerStats *total, AssemblerStats *source);
+/* returns the count of lines phase worked on (the passes after the first one work on the first pass's lines) */
+long stats_phase_lines(AssemblerStats *stats, Phase phase);
+/* prints counters as a table titled label */
+void stats_print(FILE *out, const char *label, AssemblerStats *stats);
+
+#endif
\ No newline at end of file
@@ -2,16 +2,42 @@
 #ifndef SYMBOL_TABLE_H
 #define SYMBOL_TABLE_H
 
+#include "address_sort.h"
 #include "bool.h"
 
 /* an enum to indicate symbol type */
 typedef enum { SYMBOL_CODE, SYMBOL_DATA, SYMBOL_EXTERNAL } SymbolType;
 
+/* capacity of the external uses array on the first use */
+#define INITIAL_USES_SIZE 4
+
+/* growable array of the addresses an external symbol is used at (for .ext output) */
+typedef struct {
+    int *addresses;
+    int count;
+    int capacity;
+} ExternalUses;
+
 /* a struct with data about a symbol */
 typedef struct {
     int address;
     SymbolType type;
     Bool is_entry;
+    ExternalUses uses; /* stays empty unless type is SYMBOL_EXTERNAL */
 } Symbol;
 
+/* records a use of external symbol at address, returns false if allocation failed */
+Bool add_external_use(Symbol *symbol, int address);
+/* frees symbol and its external uses (matches hash_table_free free_data) */
+void free_symbol(void *data);
+
+/* hash_table_foreach callbacks that push symbols into the AddressList context, named by their keys. A push that
+ * fails makes the list's count negative (hash_table_foreach can't be stopped), the list must be cleared after that */
+/* pushes entry symbols at their addresses */
+void collect_entry(char *key, void *data, void *context);
+/* pushes every use of external symbols at the address of the operand word */
+void collect_external_uses(char *key, void *data, void *context);
+/* pushes code and data symbols at their addresses */
+void collect_label(char *key, void *data, void *context);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,26 @@
+/* include guard to define only once */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "bool.h"
+
+/* threads told apart in a trace, later threads all share the last id */
+#define MAX_TRACE_THREADS 64
+
+/* starts writing Chrome trace events (viewable in chrome://tracing or Perfetto) to path, returns false if it
+ * couldn't be created. Must be called before any thread that traces is started */
+Bool trace_open(const char *path);
+/* ends the trace and closes its file, returns false if anything failed to be written. Must be called after every
+ * thread that traces was joined */
+Bool trace_close(void);
+/* checks if a trace is being written */
+Bool trace_enabled(void);
+/* returns the start time of a span (see stats_now), 0 if no trace is being written */
+double trace_now(void);
+/* writes a span of name on the calling thread, from start (as returned by trace_now) until now, tagged with file
+ * (if not NULL) and lines (if not negative), does nothing if no trace is being written */
+void trace_span(const char *name, double start, const char *file, long lines);
+/* writes the current value of counter name, does nothing if no trace is being written */
+void trace_counter(const char *name, long value);
+
+#endif
\ No newline at end of file
@@ -2,8 +2,10 @@
 #ifndef WARNS_H
 #define WARNS_H
 
-/* warning printing macros */
-#define WARN_LINE(line, msg) fprintf(stderr, "Warning on line %d: %s\n", line, msg)
+#include "diagnostics.h"
+
+/* warning reporting macros, msg must be one of the WARN_ macros below (its name becomes the record code) */
+#define WARN_LINE(diagnostics, line, msg) diagnostics_report(diagnostics, DIAGNOSTIC_WARNING, line, #msg, msg, NULL)
 
 /* directive warnings */
 #define WARN_LABEL_BEFORE_EXTERN "label before .extern is meaningless"
@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "address_sort.h"
+#include "bool.h"
+
+void address_list_init(AddressList *list) {
+    /* list starts with no records */
+    list->records = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    list->scratch = NULL;
+    list->max_address = 0;
+}
+
+void address_list_clear(AddressList *list) {
+    list->count = 0;
+    list->max_address = 0;
+}
+
+Bool address_list_push(AddressList *list, const char *name, int address) {
+    /* new capacity if records array needs to grow */
+    int new_capacity;
+    /* grown records array */
+    AddressRecord *new_records;
+
+    /* if records array is full, grow it geometrically */
+    if (list->count == list->capacity) {
+        new_capacity = list->capacity ? list->capacity * 2 : INITIAL_ADDRESS_LIST_SIZE;
+        /* realloc records, if failed, keep the old ones and return false */
+        new_records = realloc(list->records, new_capacity * sizeof(AddressRecord));
+        if (!new_records)
+            return false;
+        list->records = new_records;
+        list->capacity = new_capacity;
+        /* the scratch array no longer fits, the next sort allocates a new one */
+        free(list->scratch);
+        list->scratch = NULL;
+    }
+
+    list->records[list->count].name = name;
+    list->records[list->count].address = address;
+    list->count++;
+    if (address > list->max_address)
+        list->max_address = address;
+    return true;
+}
+
+Bool address_list_sort(AddressList *list) {
+    /* records of each digit value, then where they go */
+    int counts[1 << MAX_RADIX_BITS];
+    /* bits of the largest address, digit passes and bits per pass */
+    int bits = 0, passes, digit_bits;
+    /* records sorted so far and where the current pass puts them */
+    AddressRecord *from = list->records, *to, *swap;
+    /* digit of the current record */
+    int digit;
+    /* running total of counts */
+    int total, count;
+    /* index trackers */
+    int pass, i;
+
+    if (list->count < 2)
+        return true;
+    if (!list->scratch) {
+        list->scratch = malloc(list->capacity * sizeof(AddressRecord));
+        if (!list->scratch)
+            return false;
+    }
+    to = list->scratch;
+
+    /* as few passes as the largest address needs, with equal digits so none of them is wasted on a few bits */
+    while (bits < (int)sizeof(int) * 8 - 1 && (list->max_address >> bits) != 0)
+        bits++;
+    passes = (bits + MAX_RADIX_BITS - 1) / MAX_RADIX_BITS;
+    if (passes == 0)
+        return true;
+    digit_bits = (bits + passes - 1) / passes;
+
+    for (pass = 0; pass < passes; pass++) {
+        /* count records of each digit value */
+        memset(counts, 0, sizeof(int) * (1 << digit_bits));
+        for (i = 0; i < list->count; i++)
+            counts[(from[i].address >> (pass * digit_bits)) & ((1 << digit_bits) - 1)]++;
+        /* turn counts into where each digit value starts */
+        total = 0;
+        for (i = 0; i < 1 << digit_bits; i++) {
+            count = counts[i];
+            counts[i] = total;
+            total += count;
+        }
+        /* scatter in order, which keeps the sort stable */
+        for (i = 0; i < list->count; i++) {
+            digit = (from[i].address >> (pass * digit_bits)) & ((1 << digit_bits) - 1);
+            to[counts[digit]++] = from[i];
+        }
+        swap = from;
+        from = to;
+        to = swap;
+    }
+
+    /* after an odd count of passes the result is in scratch, swap the arrays instead of copying */
+    if (from != list->records) {
+        list->scratch = list->records;
+        list->records = from;
+    }
+    return true;
+}
+
+int address_list_find(AddressList *list, int address) {
+    /* search range, the answer is below high */
+    int low = 0, high = list->count;
+    /* middle of the range */
+    int middle;
+
+    /* find the first record above address */
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (list->records[middle].address <= address)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    /* the record before it is the last one at or below address */
+    return low - 1;
+}
+
+void address_list_free(AddressList *list) {
+    /* free records and scratch, then start over empty */
+    free(list->records);
+    free(list->scratch);
+    address_list_init(list);
+}
\ No newline at end of file
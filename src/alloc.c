@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* this file calls the real functions */
+#define ALLOC_IMPLEMENTATION
+
+#include "alloc.h"
+#include "bool.h"
+#include "stats.h"
+
+/* length of a line of /proc/self/status worth reading */
+#define MAX_STATUS_LINE 256
+
+/* counters of every phase, only accessed with the compiler's atomic builtins since any thread may allocate */
+static AllocStats counters;
+/* phase the following allocations belong to */
+static int current_phase = ALLOC_OUTSIDE_PHASE;
+
+/* counts a malloc/calloc (or a realloc if is_realloc) of size bytes to the current phase */
+static void count_request(Bool is_realloc, size_t size) {
+    /* counters of the current phase */
+    AllocPhaseStats *phase = &counters.phases[__atomic_load_n(&current_phase, __ATOMIC_RELAXED)];
+    /* largest request so far */
+    long largest = __atomic_load_n(&phase->largest, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(is_realloc ? &phase->reallocs : &phase->allocations, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&phase->bytes, (long)size, __ATOMIC_RELAXED);
+    /* raise largest unless another thread raised it higher meanwhile */
+    while ((long)size > largest &&
+           !__atomic_compare_exchange_n(&phase->largest, &largest, (long)size, false, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+        ;
+}
+
+void *alloc_malloc(size_t size) {
+    count_request(false, size);
+    return malloc(size);
+}
+
+void *alloc_calloc(size_t count, size_t size) {
+    count_request(false, count * size);
+    return calloc(count, size);
+}
+
+void *alloc_realloc(void *pointer, size_t size) {
+    count_request(true, size);
+    return realloc(pointer, size);
+}
+
+void alloc_free(void *pointer) {
+    if (pointer)
+        __atomic_fetch_add(&counters.phases[__atomic_load_n(&current_phase, __ATOMIC_RELAXED)].frees, 1,
+                           __ATOMIC_RELAXED);
+    free(pointer);
+}
+
+void alloc_set_phase(int phase) {
+    __atomic_store_n(&current_phase, phase, __ATOMIC_RELAXED);
+}
+
+void alloc_get_stats(AllocStats *stats) {
+    /* index tracker */
+    int i;
+
+    for (i = 0; i <= PHASE_COUNT; i++) {
+        stats->phases[i].allocations = __atomic_load_n(&counters.phases[i].allocations, __ATOMIC_RELAXED);
+        stats->phases[i].reallocs = __atomic_load_n(&counters.phases[i].reallocs, __ATOMIC_RELAXED);
+        stats->phases[i].frees = __atomic_load_n(&counters.phases[i].frees, __ATOMIC_RELAXED);
+        stats->phases[i].bytes = __atomic_load_n(&counters.phases[i].bytes, __ATOMIC_RELAXED);
+        stats->phases[i].largest = __atomic_load_n(&counters.phases[i].largest, __ATOMIC_RELAXED);
+    }
+}
+
+void alloc_print_stats(FILE *out, AllocStats *stats) {
+    /* current phase counters */
+    AllocPhaseStats *phase;
+    /* index tracker */
+    int i;
+
+    fprintf(out, "allocations:\n");
+    fprintf(out, "  %-13s %10s %10s %10s %14s %12s\n", "phase", "allocs", "reallocs", "frees", "bytes", "largest");
+    for (i = 0; i <= PHASE_COUNT; i++) {
+        phase = &stats->phases[i];
+        fprintf(out, "  %-13s %10ld %10ld %10ld %14ld %12ld\n", i < PHASE_COUNT ? PHASE_NAMES[i] : "other",
+                phase->allocations, phase->reallocs, phase->frees, phase->bytes, phase->largest);
+    }
+}
+
+long peak_rss_kb(void) {
+    /* status of this process (Linux only) */
+    FILE *status = fopen("/proc/self/status", "r");
+    /* current line of status */
+    char line[MAX_STATUS_LINE];
+    /* the peak, -1 until found */
+    long peak = -1;
+
+    if (!status)
+        return -1;
+    /* the high water mark of the resident set is the VmHWM line */
+    while (peak < 0 && fgets(line, sizeof(line), status)) {
+        if (strncmp(line, "VmHWM:", 6) == 0)
+            peak = atol(line + 6);
+    }
+    fclose(status);
+    return peak;
+}
\ No newline at end of file
@@ -1,25 +1,304 @@
 #include <stdlib.h>
+#include <string.h>
 
+#include "alloc.h"
+#include "address_sort.h"
 #include "assembler.h"
 #include "bool.h"
+#include "buffer.h"
+#include "first_pass.h"
 #include "hash_table.h"
 #include "instructions.h"
+#include "output.h"
+#include "perf.h"
+#include "pre_assembler.h"
+#include "second_pass.h"
+#include "stats.h"
+#include "symbol_table.h"
+#include "trace.h"
 
-Bool has_memory(int ic, int dc, int additional) {
-    return ic + dc + additional <= MAX_MEMORY;
+Bool has_memory(AssemblerState *state, int additional) {
+    return state->ic + state->dc + additional <= state->memory_size;
+}
+
+Bool segment_reserve(Segment *segment, int additional) {
+    /* new capacity if segment needs to grow */
+    int new_capacity;
+    /* grown words array */
+    Word *new_words;
+
+    /* if there is already enough room, nothing to do */
+    if (segment->count + additional <= segment->capacity)
+        return true;
+
+    /* grow geometrically so filling a segment stays linear */
+    new_capacity = segment->capacity ? segment->capacity * 2 : INITIAL_SEGMENT_SIZE;
+    while (new_capacity < segment->count + additional)
+        new_capacity *= 2;
+
+    /* realloc words array, if failed, keep the old one and return false */
+    new_words = realloc(segment->words, new_capacity * sizeof(Word));
+    if (!new_words)
+        return false;
+
+    segment->words = new_words;
+    segment->capacity = new_capacity;
+    return true;
+}
+
+Bool segment_push(Segment *segment, Word word) {
+    /* make sure there is room for one more word */
+    if (!segment_reserve(segment, 1))
+        return false;
+
+    /* store word and advance count */
+    segment->words[segment->count++] = word;
+    return true;
+}
+
+/* copies name (with its NULL terminator) to state names, returns its offset, -1 if allocation failed */
+static int store_name(AssemblerState *state, char *name) {
+    /* offset the name will be stored at */
+    int offset = (int)state->names.length;
+
+    if (!buffer_append(&state->names, name, strlen(name) + 1))
+        return -1;
+    return offset;
+}
+
+Bool add_reference(AssemblerState *state, int code_index, int line_num, char *name, Bool is_relative) {
+    /* new capacity if references array needs to grow */
+    int new_capacity;
+    /* grown references array */
+    SymbolReference *new_references;
+    /* the reference to fill */
+    SymbolReference *reference;
+
+    /* if references array is full, grow it geometrically */
+    if (state->reference_count == state->reference_capacity) {
+        new_capacity = state->reference_capacity ? state->reference_capacity * 2 : INITIAL_REFERENCES_SIZE;
+        new_references = realloc(state->references, new_capacity * sizeof(SymbolReference));
+        if (!new_references)
+            return false;
+        state->references = new_references;
+        state->reference_capacity = new_capacity;
+    }
+
+    reference = &state->references[state->reference_count];
+    /* store name, if failed, return false */
+    reference->name = store_name(state, name);
+    if (reference->name < 0)
+        return false;
+    reference->code_index = code_index;
+    reference->line_num = line_num;
+    reference->is_relative = is_relative;
+    state->reference_count++;
+    return true;
+}
+
+Bool add_entry_request(AssemblerState *state, int line_num, char *name) {
+    /* new capacity if entries array needs to grow */
+    int new_capacity;
+    /* grown entries array */
+    EntryRequest *new_entries;
+    /* the entry to fill */
+    EntryRequest *entry;
+
+    /* if entries array is full, grow it geometrically */
+    if (state->entry_count == state->entry_capacity) {
+        new_capacity = state->entry_capacity ? state->entry_capacity * 2 : INITIAL_REFERENCES_SIZE;
+        new_entries = realloc(state->entries, new_capacity * sizeof(EntryRequest));
+        if (!new_entries)
+            return false;
+        state->entries = new_entries;
+        state->entry_capacity = new_capacity;
+    }
+
+    entry = &state->entries[state->entry_count];
+    /* store name, if failed, return false */
+    entry->name = store_name(state, name);
+    if (entry->name < 0)
+        return false;
+    entry->line_num = line_num;
+    state->entry_count++;
+    return true;
+}
+
+Bool add_listing_line(AssemblerState *state, int code_index, int data_index) {
+    /* new capacity if listing array needs to grow */
+    int new_capacity;
+    /* grown listing array */
+    ListingLine *new_listing;
+
+    /* if listing array is full, grow it geometrically */
+    if (state->listing_count == state->listing_capacity) {
+        new_capacity = state->listing_capacity ? state->listing_capacity * 2 : INITIAL_REFERENCES_SIZE;
+        new_listing = realloc(state->listing, new_capacity * sizeof(ListingLine));
+        if (!new_listing)
+            return false;
+        state->listing = new_listing;
+        state->listing_capacity = new_capacity;
+    }
+
+    state->listing[state->listing_count].code_index = code_index;
+    state->listing[state->listing_count].data_index = data_index;
+    state->listing_count++;
+    return true;
+}
+
+AssemblerState *create_assembler_state(void) {
+    /* allocate state with all fields zeroed (empty segments, no external uses) */
+    AssemblerState *state = calloc(1, sizeof(AssemblerState));
+    /* if allocation failed, return NULL */
+    if (!state)
+        return NULL;
+
+    /* create symbols table and the pre-assembler's buffers, if failed, free state and return NULL */
+    state->symbols = hash_table_create();
+    state->pre_assembler = create_pre_assembler_buffers();
+    if (!state->symbols || !state->pre_assembler) {
+        if (state->symbols)
+            hash_table_free(state->symbols, NULL);
+        free_pre_assembler_buffers(state->pre_assembler);
+        free(state);
+        return NULL;
+    }
+
+    /* default target memory */
+    state->memory_size = MAX_MEMORY;
+    state->ic_start = IC_START;
+    /* set initial ic to ic_start */
+    state->ic = state->ic_start;
+    return state;
+}
+
+static void recycle_symbol(char *key, void *data, void *context) {
+    /* cast data to Symbol pointer */
+    Symbol *symbol = (Symbol *)data;
+    /* cast context to AssemblerState pointer */
+    AssemblerState *state = (AssemblerState *)context;
+    /* silence unused parameter warning */
+    (void)key;
+    /* forget previous uses but keep the addresses array */
+    symbol->uses.count = 0;
+    /* store symbol as spare (room was reserved by reset_assembler_state) */
+    state->spare_symbols[state->spare_count++] = symbol;
+}
+
+void reset_assembler_state(AssemblerState *state) {
+    /* needed spare capacity */
+    int needed = state->spare_count + state->symbols->count;
+    /* grown spare symbols array */
+    Symbol **new_spare_symbols;
+    /* index tracker */
+    int i;
+
+    /* make room for all current symbols in the spare array */
+    if (needed > state->spare_capacity) {
+        new_spare_symbols = realloc(state->spare_symbols, needed * sizeof(Symbol *));
+        if (new_spare_symbols) {
+            state->spare_symbols = new_spare_symbols;
+            state->spare_capacity = needed;
+        }
+    }
+
+    /* keep symbols as spares if there is room, otherwise just free them */
+    if (needed <= state->spare_capacity) {
+        hash_table_foreach(state->symbols, recycle_symbol, state);
+        hash_table_clear(state->symbols, NULL);
+    } else {
+        hash_table_clear(state->symbols, free_symbol);
+    }
+
+    /* empty segments, keeping their capacity */
+    state->code.count = 0;
+    state->data.count = 0;
+    /* forget references, entries and their names, keeping their capacity */
+    state->reference_count = 0;
+    state->entry_count = 0;
+    state->names.length = 0;
+    /* forget the listing, keeping its capacity */
+    state->listing_count = 0;
+    state->listing_text.length = 0;
+    state->origins.count = 0;
+    /* forget the macros and lines of the pre-assembler and the first pass, keeping their capacity */
+    reset_pre_assembler_buffers(state->pre_assembler);
+    state->text.length = 0;
+    /* forget the second pass's pending errors and uses, keeping their capacity */
+    for (i = 0; i < SECOND_PASS_THREADS; i++) {
+        state->pending_errors[i].count = 0;
+        state->pending_errors[i].out_of_memory = false;
+        state->pending_uses[i].count = 0;
+        state->pending_uses[i].out_of_memory = false;
+    }
+    state->entry_errors.count = 0;
+    state->entry_errors.out_of_memory = false;
+    /* set counters to their initial values */
+    state->ic = state->ic_start;
+    state->dc = 0;
+    state->ec = 0;
+}
+
+Symbol *acquire_symbol(AssemblerState *state) {
+    /* the symbol to return */
+    Symbol *symbol;
+
+    /* if there is a spare symbol, reuse it */
+    if (state->spare_count > 0)
+        return state->spare_symbols[--state->spare_count];
+
+    /* allocate new symbol with no external uses */
+    symbol = malloc(sizeof(Symbol));
+    if (symbol) {
+        symbol->uses.addresses = NULL;
+        symbol->uses.count = 0;
+        symbol->uses.capacity = 0;
+    }
+    return symbol;
+}
+
+void set_assembler_target(AssemblerState *state, TargetOptions *target) {
+    state->memory_size = target->memory_size;
+    state->ic_start = target->ic_start;
+    /* an empty state counts from ic_start */
+    state->ic = state->ic_start;
 }
 
 AssemblerState *free_assembler_state(AssemblerState *state) {
+    /* index tracker */
+    int i;
+
     /* if state is not NULL, free its child along with it */
     if (state) {
-        /* free symbols table */
-        hash_table_free(state->symbols, free);
-        /* free code array */
-        free(state->code);
-        /* free data array */
-        free(state->data);
-        /* free externals array */
-        free(state->externals);
+        /* free symbols table along with each symbol's external uses */
+        hash_table_free(state->symbols, free_symbol);
+        /* free code words */
+        free(state->code.words);
+        /* free data words */
+        free(state->data.words);
+        /* free references, entries and their names */
+        free(state->references);
+        free(state->entries);
+        buffer_free(&state->names);
+        /* free spare symbols */
+        for (i = 0; i < state->spare_count; i++)
+            free_symbol(state->spare_symbols[i]);
+        free(state->spare_symbols);
+        /* free output records and the listing */
+        address_list_free(&state->sorted);
+        free(state->listing);
+        buffer_free(&state->listing_text);
+        line_origins_free(&state->origins);
+        buffer_free(&state->includes);
+        /* free the passes' buffers */
+        free_pre_assembler_buffers(state->pre_assembler);
+        buffer_free(&state->text);
+        free(state->lines);
+        for (i = 0; i < SECOND_PASS_THREADS; i++) {
+            free(state->pending_errors[i].errors);
+            free(state->pending_uses[i].uses);
+        }
+        free(state->entry_errors.errors);
         /* free state */
         free(state);
     }
@@ -28,6 +307,126 @@ AssemblerState *free_assembler_state(AssemblerState *state) {
     return NULL;
 }
 
+void state_pool_init(StatePool *pool) {
+    /* pool starts with no states */
+    pool->states = NULL;
+    pool->count = 0;
+    pool->capacity = 0;
+}
+
+AssemblerState *state_pool_acquire(StatePool *pool) {
+    /* the state to return */
+    AssemblerState *state;
+
+    /* if pool is empty, create a new state */
+    if (pool->count == 0)
+        return create_assembler_state();
+
+    /* reuse the most recently released state (its memory is the most likely to be cached) */
+    state = pool->states[--pool->count];
+    reset_assembler_state(state);
+    return state;
+}
+
+void state_pool_release(StatePool *pool, AssemblerState *state) {
+    /* new capacity if pool needs to grow */
+    int new_capacity;
+    /* grown states array */
+    AssemblerState **new_states;
+
+    /* if pool is full, grow it geometrically */
+    if (pool->count == pool->capacity) {
+        new_capacity = pool->capacity ? pool->capacity * 2 : 1;
+        new_states = realloc(pool->states, new_capacity * sizeof(AssemblerState *));
+        /* if failed, the state can't be kept, so free it */
+        if (!new_states) {
+            free_assembler_state(state);
+            return;
+        }
+        pool->states = new_states;
+        pool->capacity = new_capacity;
+    }
+
+    /* keep state for the next acquire */
+    pool->states[pool->count++] = state;
+}
+
+void state_pool_free(StatePool *pool) {
+    /* index tracker */
+    int i;
+    /* free all idle states */
+    for (i = 0; i < pool->count; i++)
+        free_assembler_state(pool->states[i]);
+    /* free states array and empty the pool */
+    free(pool->states);
+    state_pool_init(pool);
+}
+
+/* marks the start of phase, reads hardware events into events if profiling, returns the time it started (0 without
+ * stats or a trace, the clock is only read for them) */
+static double begin_phase(AssemblerState *state, Phase phase, double events[EVENT_COUNT]) {
+    ALLOC_PHASE(phase);
+    if (state->stats && perf_enabled())
+        perf_read(events);
+    return state->stats || trace_enabled() ? stats_now() : 0;
+}
+
+/* marks the end of phase of filename that started at start with events */
+static void end_phase(AssemblerState *state, Phase phase, double start, double events[EVENT_COUNT], char *filename) {
+    /* counters of the file, NULL if disabled */
+    AssemblerStats *stats = state->stats;
+    /* hardware events at the end of the phase */
+    double end_events[EVENT_COUNT];
+    /* index tracker */
+    int i;
+
+    ALLOC_PHASE(ALLOC_OUTSIDE_PHASE);
+    if (stats)
+        stats->phases[phase].seconds += stats_now() - start;
+    if (stats && perf_enabled()) {
+        perf_read(end_events);
+        for (i = 0; i < EVENT_COUNT; i++)
+            stats->phases[phase].events[i] += end_events[i] - events[i];
+    }
+    trace_span(PHASE_NAMES[phase], start, filename, stats ? stats_phase_lines(stats, phase) : -1);
+}
+
+Bool assemble_file(char *filename, AssemblerState *state) {
+    /* whether the current phase succeeded */
+    Bool success;
+    /* when the current phase started */
+    double start;
+    /* hardware events when the current phase started */
+    double events[EVENT_COUNT];
+
+    STATS_ADD(state->stats, files, 1);
+
+    /* each phase runs only if the previous one succeeded (errors are reported inside) */
+    start = begin_phase(state, PHASE_PRE_ASSEMBLE, events);
+    success = pre_assemble(filename, state->diagnostics, state->outputs.source_map ? &state->origins : NULL,
+                           &state->includes, state->stats, state->pre_assembler);
+    end_phase(state, PHASE_PRE_ASSEMBLE, start, events, filename);
+    if (!success)
+        return false;
+
+    start = begin_phase(state, PHASE_FIRST_PASS, events);
+    success = first_pass(filename, state);
+    end_phase(state, PHASE_FIRST_PASS, start, events, filename);
+    if (!success)
+        return false;
+
+    start = begin_phase(state, PHASE_SECOND_PASS, events);
+    success = second_pass(filename, state);
+    end_phase(state, PHASE_SECOND_PASS, start, events, filename);
+    if (!success)
+        return false;
+
+    start = begin_phase(state, PHASE_OUTPUT, events);
+    success = write_output_files(filename, state);
+    end_phase(state, PHASE_OUTPUT, start, events, filename);
+    return success;
+}
+
 int get_addressing_mode(char *operand) {
     if (*operand == '#')
         return ADDR_IMMEDIATE;
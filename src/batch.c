@@ -0,0 +1,558 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "assembler.h"
+#include "batch.h"
+#include "bool.h"
+#include "buffer.h"
+#include "diagnostics.h"
+#include "disassembler.h"
+#include "errors.h"
+#include "helpers.h"
+#include "instructions.h"
+#include "simulator.h"
+#include "stats.h"
+#include "trace.h"
+
+/* runs body for every lane of the current group, lane and i being ints of the caller. Converged lanes are the live
+ * ones, while none has stopped that is all of them in order, a loop the compiler can vectorize */
+#define FOR_GROUP(batch, body)                                                                                         \
+    do {                                                                                                               \
+        if ((batch)->converged && (batch)->live_count == (batch)->lanes) {                                             \
+            for (lane = 0; lane < (batch)->lanes; lane++) {                                                            \
+                body;                                                                                                  \
+            }                                                                                                          \
+        } else if ((batch)->converged) {                                                                               \
+            for (i = 0; i < (batch)->live_count; i++) {                                                                \
+                lane = (batch)->live[i];                                                                               \
+                body;                                                                                                  \
+            }                                                                                                          \
+        } else {                                                                                                       \
+            for (i = 0; i < (batch)->group_count; i++) {                                                               \
+                lane = (batch)->group[i];                                                                              \
+                body;                                                                                                  \
+            }                                                                                                          \
+        }                                                                                                              \
+    } while (0)
+
+/* what each instruction of INSTRUCTION_TABLE does by name, and whether it writes its destination */
+static const struct {
+    const char *name;
+    BatchOpKind kind;
+    Bool writes;
+} BATCH_OPS[] = {{"mov", BATCH_MOV, true},   {"cmp", BATCH_CMP, false}, {"add", BATCH_ADD, true},
+                 {"sub", BATCH_SUB, true},   {"lea", BATCH_LEA, true},  {"clr", BATCH_CLR, true},
+                 {"not", BATCH_NOT, true},   {"inc", BATCH_INC, true},  {"dec", BATCH_DEC, true},
+                 {"jmp", BATCH_JMP, false},  {"bne", BATCH_BNE, false}, {"jsr", BATCH_JSR, false},
+                 {"red", BATCH_RED, true},   {"prn", BATCH_PRN, false}, {"rts", BATCH_RTS, false},
+                 {"stop", BATCH_STOP, false}, {NULL, BATCH_BAD, false}};
+
+/* status of a lane in the .batch file, indexed by MachineStatus */
+static const char *STATUS_NAMES[] = {"limit",          "stop",           "bad-instruction", "unresolved-external",
+                                     "stack-overflow", "stack-underflow"};
+
+/* decodes the instruction at address into its op */
+static void decode_op(Batch *batch, int address) {
+    /* the machine of the program */
+    Machine *machine = batch->machine;
+    /* the op to fill */
+    BatchOp *op = &batch->ops[address];
+    /* the decoded instruction */
+    DecodedInstruction instruction;
+    /* storage of each operand */
+    int *operands[2];
+    /* whether the instruction writes its destination */
+    Bool writes = false;
+    /* count of operands */
+    int operand_count;
+    /* index tracker */
+    int i;
+
+    op->address = address;
+    op->kind = BATCH_BAD;
+    op->src = op->dest = NULL;
+    op->next = address + 1;
+    if (!machine->starts[address] || !machine_decode(machine, address, NULL, NULL, &instruction))
+        return;
+    for (i = 0; BATCH_OPS[i].name != NULL; i++) {
+        if (strcmp(BATCH_OPS[i].name, instruction.info->name) == 0) {
+            op->kind = BATCH_OPS[i].kind;
+            writes = BATCH_OPS[i].writes;
+        }
+    }
+
+    operand_count = instruction.info->num_operands;
+    for (i = 0; i < operand_count; i++) {
+        operands[i] = NULL;
+        if (instruction.modes[i] == ADDR_IMMEDIATE)
+            /* immediates are read from their own word */
+            operands[i] = &batch->memory[(address + 1 + i) * batch->lanes];
+        else if (instruction.modes[i] == ADDR_REGISTER)
+            operands[i] = &batch->registers[instruction.values[i] * batch->lanes];
+        else if (instruction.modes[i] == ADDR_DIRECT && MACHINE_ARE(machine, address + 1 + i) == ARE_E)
+            op->kind = BATCH_UNRESOLVED;
+        else if (instruction.modes[i] == ADDR_DIRECT && instruction.values[i] < machine->memory_size)
+            operands[i] = &batch->memory[instruction.values[i] * batch->lanes];
+        /* like the interpreter, only a jump may name an address outside of the image (and faults when it gets there) */
+        else if (instruction.modes[i] == ADDR_DIRECT && op->kind != BATCH_JMP && op->kind != BATCH_BNE &&
+                 op->kind != BATCH_JSR && op->kind != BATCH_UNRESOLVED)
+            op->kind = BATCH_BAD;
+    }
+
+    op->next = address + instruction.length;
+    op->src = operand_count == 2 ? operands[0] : NULL;
+    op->dest = operand_count > 0 ? operands[operand_count - 1] : NULL;
+    op->target = operand_count > 0 ? instruction.values[operand_count - 1] : 0;
+    if (op->target < 0 || op->target > machine->memory_size)
+        op->target = machine->memory_size;
+    op->value = instruction.values[0];
+    if (writes && op->dest >= batch->memory + machine->code_start * batch->lanes &&
+        op->dest < batch->memory + machine->code_end * batch->lanes)
+        batch->writes_code = true;
+}
+
+Batch *batch_create(Machine *machine, int lanes) {
+    /* the batch to return */
+    Batch *batch = calloc(1, sizeof(Batch));
+    /* index trackers */
+    int address, lane;
+
+    if (!batch)
+        return NULL;
+    batch->lanes = lanes;
+    batch->machine = machine;
+    /* at least one of each, so an empty batch isn't an allocation failure */
+    lanes = lanes > 0 ? lanes : 1;
+    batch->ops = malloc((machine->memory_size + 1) * sizeof(BatchOp));
+    batch->registers = calloc(MACHINE_REGISTERS * lanes, sizeof(int));
+    batch->memory = malloc(((size_t)machine->memory_size + 1) * lanes * sizeof(int));
+    batch->zero = calloc(lanes, sizeof(Bool));
+    batch->stack = malloc((size_t)MACHINE_STACK_SIZE * lanes * sizeof(int));
+    batch->depths = calloc(lanes, sizeof(int));
+    batch->pcs = malloc(lanes * sizeof(int));
+    batch->statuses = malloc(lanes * sizeof(MachineStatus));
+    batch->fault_addresses = calloc(lanes, sizeof(int));
+    batch->steps = calloc(lanes, sizeof(unsigned long));
+    batch->inputs = calloc(lanes, sizeof(char *));
+    batch->input_lengths = calloc(lanes, sizeof(long));
+    batch->input_positions = calloc(lanes, sizeof(long));
+    batch->outputs = malloc(lanes * sizeof(Buffer));
+    batch->group = malloc(lanes * sizeof(int));
+    batch->live = malloc(lanes * sizeof(int));
+    if (!batch->ops || !batch->registers || !batch->memory || !batch->zero || !batch->stack || !batch->depths ||
+        !batch->pcs || !batch->statuses || !batch->fault_addresses || !batch->steps || !batch->inputs ||
+        !batch->input_lengths || !batch->input_positions || !batch->outputs || !batch->group ||
+        !batch->live) {
+        /* outputs are freed one by one, none was started */
+        batch->lanes = 0;
+        return batch_free(batch);
+    }
+
+    /* every lane starts with the image at the first instruction */
+    for (address = 0; address < machine->memory_size; address++) {
+        for (lane = 0; lane < batch->lanes; lane++)
+            batch->memory[address * batch->lanes + lane] = machine->memory[address];
+    }
+    for (lane = 0; lane < batch->lanes; lane++) {
+        batch->pcs[lane] = machine->code_start;
+        batch->statuses[lane] = MACHINE_RUNNING;
+        buffer_init(&batch->outputs[lane]);
+        batch->live[lane] = lane;
+    }
+    batch->live_count = batch->lanes;
+    for (address = 0; address <= machine->memory_size; address++)
+        decode_op(batch, address);
+    return batch;
+}
+
+void batch_set_input(Batch *batch, int lane, const char *text, long length) {
+    batch->inputs[lane] = text;
+    batch->input_lengths[lane] = length;
+    batch->input_positions[lane] = 0;
+}
+
+/* stops running the live lanes together, from now on each keeps its own pc */
+static void diverge(Batch *batch) {
+    /* index trackers */
+    int lane, i;
+
+    for (i = 0; i < batch->live_count; i++) {
+        lane = batch->live[i];
+        batch->pcs[lane] = batch->pc;
+        batch->steps[lane] += batch->rounds;
+        batch->group[i] = lane;
+    }
+    batch->lockstep_steps += batch->rounds * batch->live_count;
+    batch->rounds = 0;
+    batch->group_count = batch->live_count;
+    batch->converged = false;
+}
+
+/* drops the lanes that stopped or reached limit from the live ones, then picks the lanes that run next: the ones at
+ * the lowest address, returns false if there are none */
+static Bool gather(Batch *batch, unsigned long limit) {
+    /* lowest address of a lane */
+    int lowest = INT_MAX;
+    /* most instructions a lane ran */
+    unsigned long most = 0;
+    /* live lanes kept so far */
+    int kept = 0;
+    /* index trackers */
+    int lane, i;
+
+    batch->group_count = 0;
+    for (i = 0; i < batch->live_count; i++) {
+        lane = batch->live[i];
+        if (batch->statuses[lane] != MACHINE_RUNNING || batch->steps[lane] >= limit)
+            continue;
+        batch->live[kept++] = lane;
+        if (batch->pcs[lane] < lowest) {
+            lowest = batch->pcs[lane];
+            batch->group_count = 0;
+        }
+        if (batch->pcs[lane] == lowest)
+            batch->group[batch->group_count++] = lane;
+        if (batch->steps[lane] > most)
+            most = batch->steps[lane];
+    }
+
+    batch->live_count = kept;
+
+    /* all live lanes at one address run together until the first of them reaches the limit */
+    if (batch->group_count == batch->live_count && batch->live_count > 0) {
+        batch->converged = true;
+        batch->pc = lowest;
+        batch->rounds = 0;
+        batch->budget = limit - most;
+    }
+    return batch->group_count > 0;
+}
+
+/* sets the pc of every lane of the group to address */
+static void jump(Batch *batch, int address) {
+    /* index trackers */
+    int lane, i;
+
+    if (batch->converged)
+        batch->pc = address;
+    else
+        FOR_GROUP(batch, batch->pcs[lane] = address);
+}
+
+/* stops every lane of the group with status at op */
+static void stop_group(Batch *batch, BatchOp *op, MachineStatus status) {
+    /* index trackers */
+    int lane, i;
+
+    if (batch->converged)
+        diverge(batch);
+    FOR_GROUP(batch, {
+        batch->statuses[lane] = status;
+        batch->fault_addresses[lane] = op->address;
+    });
+}
+
+/* runs op in every lane of the group */
+static void execute(Batch *batch, BatchOp *op) {
+    /* operands of lane 0 */
+    int *src = op->src, *dest = op->dest;
+    /* lane's value of a register or word */
+    int value;
+    /* whether the lanes go the same way */
+    Bool agree;
+    /* first live lane, the others are compared with it */
+    int first;
+    /* index trackers */
+    int lane, i;
+
+    switch (op->kind) {
+    case BATCH_MOV:
+        FOR_GROUP(batch, dest[lane] = src[lane]);
+        break;
+    case BATCH_CMP:
+        FOR_GROUP(batch, batch->zero[lane] = src[lane] == dest[lane]);
+        break;
+    case BATCH_ADD:
+        FOR_GROUP(batch, dest[lane] = SIGNED_VALUE(dest[lane] + src[lane]));
+        break;
+    case BATCH_SUB:
+        FOR_GROUP(batch, dest[lane] = SIGNED_VALUE(dest[lane] - src[lane]));
+        break;
+    case BATCH_LEA:
+        value = SIGNED_VALUE(op->value);
+        FOR_GROUP(batch, dest[lane] = value);
+        break;
+    case BATCH_CLR:
+        FOR_GROUP(batch, dest[lane] = 0);
+        break;
+    case BATCH_NOT:
+        FOR_GROUP(batch, dest[lane] = SIGNED_VALUE(~dest[lane]));
+        break;
+    case BATCH_INC:
+        FOR_GROUP(batch, dest[lane] = SIGNED_VALUE(dest[lane] + 1));
+        break;
+    case BATCH_DEC:
+        FOR_GROUP(batch, dest[lane] = SIGNED_VALUE(dest[lane] - 1));
+        break;
+    case BATCH_RED:
+        FOR_GROUP(batch, {
+            dest[lane] = batch->input_positions[lane] < batch->input_lengths[lane]
+                             ? SIGNED_VALUE((unsigned char)batch->inputs[lane][batch->input_positions[lane]++])
+                             : -1;
+        });
+        break;
+    case BATCH_PRN:
+        /* an output that can't grow drops the value, like a full disk would */
+        FOR_GROUP(batch, {
+            buffer_append(&batch->outputs[lane], " ", 1);
+            buffer_append_number(&batch->outputs[lane], dest[lane]);
+        });
+        break;
+    case BATCH_JMP:
+        jump(batch, op->target);
+        return;
+    case BATCH_BNE:
+        /* lanes that all go the same way stay together */
+        if (batch->converged) {
+            value = 0;
+            FOR_GROUP(batch, value += batch->zero[lane] != false);
+            if (value == 0 || value == batch->live_count) {
+                batch->pc = value ? op->next : op->target;
+                return;
+            }
+            diverge(batch);
+        }
+        FOR_GROUP(batch, batch->pcs[lane] = batch->zero[lane] ? op->next : op->target);
+        return;
+    case BATCH_JSR:
+        if (batch->converged) {
+            agree = true;
+            FOR_GROUP(batch, agree = agree && batch->depths[lane] < MACHINE_STACK_SIZE);
+            if (!agree)
+                diverge(batch);
+        }
+        FOR_GROUP(batch, {
+            if (batch->depths[lane] == MACHINE_STACK_SIZE) {
+                batch->statuses[lane] = MACHINE_STACK_OVERFLOW;
+                batch->fault_addresses[lane] = op->address;
+            } else {
+                batch->stack[lane * MACHINE_STACK_SIZE + batch->depths[lane]++] = op->next;
+            }
+        });
+        jump(batch, op->target);
+        return;
+    case BATCH_RTS:
+        /* lanes returning to the same address as the first live one stay together */
+        if (batch->converged) {
+            first = batch->live[0];
+            agree = batch->depths[first] > 0;
+            FOR_GROUP(batch, {
+                agree = agree && batch->depths[lane] > 0 &&
+                        batch->stack[lane * MACHINE_STACK_SIZE + batch->depths[lane] - 1] ==
+                            batch->stack[first * MACHINE_STACK_SIZE + batch->depths[first] - 1];
+            });
+            if (!agree)
+                diverge(batch);
+        }
+        FOR_GROUP(batch, {
+            if (batch->depths[lane] == 0) {
+                batch->statuses[lane] = MACHINE_STACK_UNDERFLOW;
+                batch->fault_addresses[lane] = op->address;
+            } else {
+                batch->pcs[lane] = batch->stack[lane * MACHINE_STACK_SIZE + --batch->depths[lane]];
+            }
+        });
+        if (batch->converged)
+            batch->pc = batch->pcs[batch->live[0]];
+        return;
+    case BATCH_STOP:
+        stop_group(batch, op, MACHINE_STOPPED);
+        return;
+    case BATCH_BAD:
+        stop_group(batch, op, MACHINE_BAD_INSTRUCTION);
+        return;
+    case BATCH_UNRESOLVED:
+        stop_group(batch, op, MACHINE_UNRESOLVED_EXTERNAL);
+        return;
+    }
+    jump(batch, op->next);
+}
+
+void batch_run(Batch *batch, unsigned long max_steps) {
+    /* most instructions a lane may run */
+    unsigned long limit = max_steps ? max_steps : ULONG_MAX;
+    /* index trackers */
+    int lane, i;
+
+    for (;;) {
+        if (!batch->converged && !gather(batch, limit))
+            break;
+
+        /* count the instruction before running it, a lane it stops still ran it */
+        if (batch->converged) {
+            batch->rounds++;
+            batch->budget--;
+            execute(batch, &batch->ops[batch->pc]);
+        } else {
+            FOR_GROUP(batch, batch->steps[lane]++);
+            batch->group_steps += batch->group_count;
+            execute(batch, &batch->ops[batch->pcs[batch->group[0]]]);
+        }
+        /* the first lane to reach the limit ends the lockstep, the others go on without it */
+        if (batch->converged && batch->budget == 0)
+            diverge(batch);
+    }
+}
+
+Batch *batch_free(Batch *batch) {
+    /* index tracker */
+    int lane;
+
+    if (batch) {
+        for (lane = 0; batch->outputs && lane < batch->lanes; lane++)
+            buffer_free(&batch->outputs[lane]);
+        free(batch->ops);
+        free(batch->registers);
+        free(batch->memory);
+        free(batch->zero);
+        free(batch->stack);
+        free(batch->depths);
+        free(batch->pcs);
+        free(batch->statuses);
+        free(batch->fault_addresses);
+        free(batch->steps);
+        free(batch->inputs);
+        free(batch->input_lengths);
+        free(batch->input_positions);
+        free(batch->outputs);
+        free(batch->group);
+        free(batch->live);
+        free(batch);
+    }
+    return NULL;
+}
+
+/* writes a line per lane to filename.batch: lane, status (with the address of a fault), instructions run and the
+ * values it printed, returns false if it couldn't be written */
+static Bool write_batch(char *filename, Diagnostics *diagnostics, Batch *batch) {
+    /* output path */
+    char path[MAX_LINE];
+    /* output file */
+    FILE *file;
+    /* whether a write failed or not */
+    Bool failed;
+    /* index tracker */
+    int lane;
+
+    sprintf(path, "%s.batch", filename);
+    file = fopen(path, "w");
+    if (!file) {
+        ERROR_FILE(diagnostics, ERR_CANNOT_CREATE_FILE, path);
+        return false;
+    }
+    for (lane = 0; lane < batch->lanes; lane++) {
+        fprintf(file, "%d %s", lane, STATUS_NAMES[batch->statuses[lane]]);
+        if (batch->statuses[lane] != MACHINE_RUNNING && batch->statuses[lane] != MACHINE_STOPPED)
+            fprintf(file, "@%04d", batch->fault_addresses[lane]);
+        fprintf(file, " %lu:", batch->steps[lane]);
+        fwrite(batch->outputs[lane].data, 1, batch->outputs[lane].length, file);
+        fputc('\n', file);
+    }
+    failed = ferror(file) != 0;
+    /* closing flushes the buffer, which can fail too */
+    if (fclose(file) != 0)
+        failed = true;
+    if (failed)
+        ERROR_FILE(diagnostics, ERR_CANNOT_WRITE_FILE, path);
+    return !failed;
+}
+
+Bool run_batch(char *filename, AssemblerState *state, RunOptions *options) {
+    /* where to report errors */
+    Diagnostics *diagnostics = state->diagnostics;
+    /* the input vectors, a lane per line */
+    FILE *file;
+    char *inputs = NULL;
+    size_t size;
+    /* the current and the next line */
+    char *line, *end;
+    /* count of lanes */
+    int lanes = 0;
+    /* the machine the program is loaded into, and its lanes */
+    Machine *machine = NULL;
+    Batch *batch = NULL;
+    /* when the lanes started, and how long they ran */
+    double start, seconds;
+    /* lanes that didn't run to stop, as a number and as text */
+    int failures = 0;
+    char count[32];
+    /* used to tell the caller whether every lane ran to stop or not */
+    Bool success = false;
+    /* index tracker */
+    int lane;
+
+    file = fopen(options->batch, "r");
+    if (!file) {
+        ERROR_FILE(diagnostics, ERR_CANNOT_OPEN_FILE, options->batch);
+        return false;
+    }
+    if (!read_file(file, &inputs, &size)) {
+        ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+
+    /* a lane per line, the last one may lack its newline */
+    for (line = inputs; line < inputs + size; line = end + 1) {
+        end = memchr(line, '\n', inputs + size - line);
+        end = end ? end : inputs + size;
+        lanes++;
+    }
+    machine = machine_create(state, false);
+    batch = machine ? batch_create(machine, lanes) : NULL;
+    if (!batch) {
+        ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        goto cleanup;
+    }
+    if (batch->writes_code) {
+        ERROR_FILE(diagnostics, ERR_BATCH_WRITES_CODE, filename);
+        goto cleanup;
+    }
+    for (line = inputs, lane = 0; line < inputs + size; line = end + 1, lane++) {
+        end = memchr(line, '\n', inputs + size - line);
+        end = end ? end : inputs + size;
+        batch_set_input(batch, lane, line, end - line);
+    }
+
+    start = stats_now();
+    batch_run(batch, options->max_steps);
+    seconds = stats_now() - start;
+    trace_span("batch", start, filename, lanes);
+
+    for (lane = 0; lane < lanes; lane++) {
+        if (batch->statuses[lane] != MACHINE_STOPPED)
+            failures++;
+    }
+    if (failures > 0) {
+        sprintf(count, "%d", failures);
+        ERROR_FILE(diagnostics, ERR_BATCH_LANES_FAILED, count);
+    }
+    if (options->stats)
+        fprintf(stderr, "batch: %s (%d lanes, %lu instructions in %.3f s, %.1f MIPS, %.1f%% in lockstep)\n", filename,
+                lanes, batch->lockstep_steps + batch->group_steps, seconds,
+                seconds > 0 ? (batch->lockstep_steps + batch->group_steps) / seconds / 1e6 : 0.0,
+                batch->lockstep_steps + batch->group_steps > 0
+                    ? 100.0 * batch->lockstep_steps / (batch->lockstep_steps + batch->group_steps)
+                    : 0.0);
+    success = write_batch(filename, diagnostics, batch) && failures == 0;
+
+cleanup:
+    batch_free(batch);
+    machine_free(machine);
+    free(inputs);
+    return success;
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "bool.h"
+#include "buffer.h"
+
+void buffer_init(Buffer *buffer) {
+    /* buffer starts with no data */
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+}
+
+Bool buffer_reserve(Buffer *buffer, size_t additional) {
+    /* new capacity if buffer needs to grow */
+    size_t new_capacity;
+    /* grown data array */
+    char *new_data;
+
+    /* if there is already enough room, nothing to do */
+    if (buffer->length + additional <= buffer->capacity)
+        return true;
+
+    /* grow geometrically so appending stays linear */
+    new_capacity = buffer->capacity ? buffer->capacity * 2 : INITIAL_BUFFER_SIZE;
+    while (new_capacity < buffer->length + additional)
+        new_capacity *= 2;
+    /* realloc data, if failed, keep the old one and return false */
+    new_data = realloc(buffer->data, new_capacity);
+    if (!new_data)
+        return false;
+    buffer->data = new_data;
+    buffer->capacity = new_capacity;
+    return true;
+}
+
+Bool buffer_append(Buffer *buffer, const char *text, size_t length) {
+    /* make sure there is room for text */
+    if (!buffer_reserve(buffer, length))
+        return false;
+
+    /* copy text to the end of buffer */
+    memcpy(buffer->data + buffer->length, text, length);
+    buffer->length += length;
+    return true;
+}
+
+Bool buffer_append_string(Buffer *buffer, const char *text) {
+    return buffer_append(buffer, text, strlen(text));
+}
+
+Bool buffer_append_number(Buffer *buffer, long number) {
+    /* enough for any 64-bit long with sign and NULL terminator */
+    char digits[32];
+    sprintf(digits, "%ld", number);
+    return buffer_append_string(buffer, digits);
+}
+
+void buffer_free(Buffer *buffer) {
+    /* free data and start over empty */
+    free(buffer->data);
+    buffer_init(buffer);
+}
\ No newline at end of file
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "bool.h"
+#include "buffer.h"
+#include "diagnostics.h"
+#include "errors.h"
+#include "hash_table.h"
+
+/* name of the file at index in the files of diagnostics */
+#define FILE_NAME(diagnostics, index) ((diagnostics)->file_names.data + (diagnostics)->files[index])
+
+/* enough for two numbers and the code and argument (both truncated) */
+#define MAX_DIAGNOSTIC_KEY 256
+
+/* the word printed before each record, indexed by DiagnosticSeverity */
+static const char *SEVERITY_NAMES[] = {"Error", "Warning"};
+/* the severity written to json, indexed by DiagnosticSeverity */
+static const char *SEVERITY_JSON_NAMES[] = {"error", "warning"};
+
+/* prints a single record to stderr in text format (used when there is no collector) */
+static void print_record(DiagnosticSeverity severity, int line, const char *message, const char *argument) {
+    fprintf(stderr, "%s", SEVERITY_NAMES[severity]);
+    if (line > 0)
+        fprintf(stderr, " on line %d", line);
+    fprintf(stderr, ": %s", message);
+    if (argument)
+        fprintf(stderr, " '%s'", argument);
+    fprintf(stderr, "\n");
+}
+
+/* orders records by file, then line, then report order */
+static int compare_records(const void *a, const void *b) {
+    /* cast a and b to Diagnostic pointers */
+    const Diagnostic *first = (const Diagnostic *)a;
+    const Diagnostic *second = (const Diagnostic *)b;
+
+    if (first->file != second->file)
+        return first->file < second->file ? -1 : 1;
+    if (first->line != second->line)
+        return first->line < second->line ? -1 : 1;
+    return first->order < second->order ? -1 : first->order > second->order;
+}
+
+/* appends text with json escaping, returns false if allocation failed */
+static Bool append_json_string(Buffer *buffer, const char *text) {
+    /* escape sequence for control characters */
+    char escaped[8];
+
+    if (!buffer_append(buffer, "\"", 1))
+        return false;
+    for (; *text != '\0'; text++) {
+        if (*text == '"' || *text == '\\') {
+            if (!buffer_append(buffer, "\\", 1) || !buffer_append(buffer, text, 1))
+                return false;
+        } else if ((unsigned char)*text < 0x20) {
+            sprintf(escaped, "\\u%04x", (unsigned char)*text);
+            if (!buffer_append_string(buffer, escaped))
+                return false;
+        } else if (!buffer_append(buffer, text, 1)) {
+            return false;
+        }
+    }
+    return buffer_append(buffer, "\"", 1);
+}
+
+/* appends a record in text format, returns false if allocation failed */
+static Bool append_text(Buffer *buffer, Diagnostics *diagnostics, Diagnostic *record) {
+    /* file name prefix */
+    if (record->file >= 0 &&
+        (!buffer_append_string(buffer, FILE_NAME(diagnostics, record->file)) || !buffer_append_string(buffer, ": ")))
+        return false;
+    if (!buffer_append_string(buffer, SEVERITY_NAMES[record->severity]))
+        return false;
+    /* line number, or the lines the record repeats on */
+    if (record->line > 0 && record->last_line == record->line &&
+        (!buffer_append_string(buffer, " on line ") || !buffer_append_number(buffer, record->line)))
+        return false;
+    if (record->last_line > record->line &&
+        (!buffer_append_string(buffer, " on lines ") || !buffer_append_number(buffer, record->line) ||
+         !buffer_append_string(buffer, "-") || !buffer_append_number(buffer, record->last_line)))
+        return false;
+    if (!buffer_append_string(buffer, ": ") || !buffer_append_string(buffer, record->message))
+        return false;
+    /* extra argument in quotes */
+    if (record->argument && (!buffer_append_string(buffer, " '") || !buffer_append_string(buffer, record->argument) ||
+                             !buffer_append_string(buffer, "'")))
+        return false;
+    return buffer_append_string(buffer, "\n");
+}
+
+/* appends a record as a json object, returns false if allocation failed */
+static Bool append_json(Buffer *buffer, Diagnostics *diagnostics, Diagnostic *record) {
+    if (!buffer_append_string(buffer, "{\"file\":"))
+        return false;
+    if (record->file >= 0 ? !append_json_string(buffer, FILE_NAME(diagnostics, record->file))
+                          : !buffer_append_string(buffer, "null"))
+        return false;
+    if (!buffer_append_string(buffer, ",\"line\":") || !buffer_append_number(buffer, record->line) ||
+        !buffer_append_string(buffer, ",\"severity\":") ||
+        !append_json_string(buffer, SEVERITY_JSON_NAMES[record->severity]) ||
+        !buffer_append_string(buffer, ",\"code\":") || !append_json_string(buffer, record->code) ||
+        !buffer_append_string(buffer, ",\"message\":") || !append_json_string(buffer, record->message))
+        return false;
+    if (record->argument && (!buffer_append_string(buffer, ",\"argument\":") ||
+                             !append_json_string(buffer, record->argument)))
+        return false;
+    if (record->last_line > record->line &&
+        (!buffer_append_string(buffer, ",\"last_line\":") || !buffer_append_number(buffer, record->last_line)))
+        return false;
+    return buffer_append_string(buffer, "}");
+}
+
+/* collects a record without checking the limit, returns false if allocation failed */
+static Bool add_record(Diagnostics *diagnostics, DiagnosticSeverity severity, int line, const char *code,
+                       const char *message, const char *argument) {
+    /* new capacity if records array needs to grow */
+    int new_capacity;
+    /* grown records array */
+    Diagnostic *new_records;
+    /* the record to fill */
+    Diagnostic *record;
+
+    /* if records array is full, grow it geometrically */
+    if (diagnostics->count == diagnostics->capacity) {
+        new_capacity = diagnostics->capacity ? diagnostics->capacity * 2 : INITIAL_DIAGNOSTICS_SIZE;
+        new_records = realloc(diagnostics->records, new_capacity * sizeof(Diagnostic));
+        if (!new_records)
+            return false;
+        diagnostics->records = new_records;
+        diagnostics->capacity = new_capacity;
+    }
+
+    record = &diagnostics->records[diagnostics->count];
+    /* copy argument, it may live on the reporter's stack */
+    record->argument = NULL;
+    if (argument) {
+        record->argument = malloc(strlen(argument) + 1);
+        if (!record->argument)
+            return false;
+        strcpy(record->argument, argument);
+    }
+    record->file = diagnostics->file_count - 1;
+    record->line = line;
+    record->order = diagnostics->count;
+    record->severity = severity;
+    record->code = code;
+    record->message = message;
+    record->last_line = line;
+    diagnostics->count++;
+    return true;
+}
+
+Diagnostics *diagnostics_create(int max_errors) {
+    /* allocate collector with all fields zeroed */
+    Diagnostics *diagnostics = calloc(1, sizeof(Diagnostics));
+    /* if allocation failed, return NULL */
+    if (!diagnostics)
+        return NULL;
+
+    /* create table of seen keys, if failed, free collector and return NULL */
+    diagnostics->seen = hash_table_create();
+    if (!diagnostics->seen) {
+        free(diagnostics);
+        return NULL;
+    }
+
+    diagnostics->max_errors = max_errors;
+    return diagnostics;
+}
+
+Bool diagnostics_set_file(Diagnostics *diagnostics, const char *file) {
+    /* new capacity if files array needs to grow */
+    int new_capacity;
+    /* grown files array */
+    int *new_files;
+
+    /* nothing to remember without a collector */
+    if (!diagnostics)
+        return true;
+    /* if file is already the current one, keep using it */
+    if (diagnostics->file_count > 0 && strcmp(FILE_NAME(diagnostics, diagnostics->file_count - 1), file) == 0)
+        return true;
+
+    /* if files array is full, grow it geometrically */
+    if (diagnostics->file_count == diagnostics->file_capacity) {
+        new_capacity = diagnostics->file_capacity ? diagnostics->file_capacity * 2 : INITIAL_DIAGNOSTICS_SIZE;
+        new_files = realloc(diagnostics->files, new_capacity * sizeof(int));
+        if (!new_files)
+            return false;
+        diagnostics->files = new_files;
+        diagnostics->file_capacity = new_capacity;
+    }
+
+    /* copy file name (with its NULL terminator) */
+    diagnostics->files[diagnostics->file_count] = (int)diagnostics->file_names.length;
+    if (!buffer_append(&diagnostics->file_names, file, strlen(file) + 1))
+        return false;
+    diagnostics->file_count++;
+    return true;
+}
+
+void diagnostics_report(Diagnostics *diagnostics, DiagnosticSeverity severity, int line, const char *code,
+                        const char *message, const char *argument) {
+    /* deduplication key, and the key of the last record with the same code and argument on any line */
+    char key[MAX_DIAGNOSTIC_KEY], repeat_key[MAX_DIAGNOSTIC_KEY];
+    /* index of the last record with repeat_key, NULL if none */
+    int *last;
+
+    /* without a collector, print right away */
+    if (!diagnostics) {
+        print_record(severity, line, message, argument);
+        return;
+    }
+
+    /* once the limit was reached, drop everything */
+    if (diagnostics_should_stop(diagnostics))
+        return;
+
+    /* drop record if an identical one was already collected */
+    sprintf(key, "%d:%d:%.100s:%.100s", diagnostics->file_count - 1, line, code, argument ? argument : "");
+    if (hash_table_contains_key(diagnostics->seen, key)) {
+        diagnostics->suppressed++;
+        return;
+    }
+
+    /* a repeat on the line after the last record with the same code and argument extends it, so every line is still
+     * shown (the key has no line, so it can't be a record key, whose second field is a number and not a code) */
+    sprintf(repeat_key, "%d:%.100s:%.100s", diagnostics->file_count - 1, code, argument ? argument : "");
+    last = hash_table_lookup(diagnostics->seen, repeat_key);
+    if (last && line > 0 && diagnostics->records[*last].last_line == line - 1) {
+        diagnostics->records[*last].last_line = line;
+    } else {
+        /* collect record, if out of memory, print it right away so it isn't lost */
+        if (!add_record(diagnostics, severity, line, code, message, argument)) {
+            print_record(severity, line, message, argument);
+            return;
+        }
+        /* without memory for its key, repeats of it are collected as records of their own */
+        if (last) {
+            *last = diagnostics->count - 1;
+        } else if ((last = malloc(sizeof(int)))) {
+            *last = diagnostics->count - 1;
+            if (!hash_table_insert(diagnostics->seen, repeat_key, last))
+                free(last);
+        }
+    }
+    hash_table_insert(diagnostics->seen, key, NULL);
+
+    /* only errors count towards the limit */
+    if (severity == DIAGNOSTIC_ERROR)
+        diagnostics->error_count++;
+    /* if this error reached the limit, say so right after it */
+    if (diagnostics_should_stop(diagnostics))
+        add_record(diagnostics, DIAGNOSTIC_ERROR, line, "ERR_TOO_MANY_ERRORS", ERR_TOO_MANY_ERRORS, NULL);
+}
+
+Bool diagnostics_should_stop(Diagnostics *diagnostics) {
+    return diagnostics && diagnostics->max_errors > 0 && diagnostics->error_count >= diagnostics->max_errors;
+}
+
+void diagnostics_flush(Diagnostics *diagnostics, FILE *out, DiagnosticsFormat format) {
+    /* the whole output, written with a single fwrite */
+    Buffer buffer;
+    /* whether formatting ran out of memory */
+    Bool failed = false;
+    /* index tracker */
+    int i;
+
+    if (!diagnostics)
+        return;
+    buffer_init(&buffer);
+
+    /* sort records by file and line, records of the same line keep their report order */
+    qsort(diagnostics->records, diagnostics->count, sizeof(Diagnostic), compare_records);
+
+    /* format all records */
+    if (format == DIAGNOSTICS_JSON)
+        failed = !buffer_append_string(&buffer, "{\"diagnostics\":[");
+    for (i = 0; i < diagnostics->count && !failed; i++) {
+        if (format == DIAGNOSTICS_JSON)
+            failed = (i > 0 && !buffer_append_string(&buffer, ",")) ||
+                     !append_json(&buffer, diagnostics, &diagnostics->records[i]);
+        else
+            failed = !append_text(&buffer, diagnostics, &diagnostics->records[i]);
+    }
+    if (format == DIAGNOSTICS_JSON && !failed)
+        failed = !buffer_append_string(&buffer, "],\"errors\":") ||
+                 !buffer_append_number(&buffer, diagnostics->error_count) ||
+                 !buffer_append_string(&buffer, ",\"suppressed\":") ||
+                 !buffer_append_number(&buffer, diagnostics->suppressed) ||
+                 !buffer_append_string(&buffer, ",\"stopped\":") ||
+                 !buffer_append_string(&buffer, diagnostics_should_stop(diagnostics) ? "true}\n" : "false}\n");
+
+    /* write everything at once, if formatting failed, fall back to printing records one by one */
+    if (!failed) {
+        fwrite(buffer.data, 1, buffer.length, out);
+    } else {
+        for (i = 0; i < diagnostics->count; i++)
+            print_record(diagnostics->records[i].severity, diagnostics->records[i].line,
+                         diagnostics->records[i].message, diagnostics->records[i].argument);
+    }
+    fflush(out);
+    buffer_free(&buffer);
+
+    /* empty the collector */
+    diagnostics_clear(diagnostics);
+}
+
+void diagnostics_clear(Diagnostics *diagnostics) {
+    /* index tracker */
+    int i;
+
+    if (!diagnostics)
+        return;
+    /* free records' arguments and forget file names, keeping the arrays for the next job */
+    for (i = 0; i < diagnostics->count; i++)
+        free(diagnostics->records[i].argument);
+    hash_table_clear(diagnostics->seen, free);
+    diagnostics->count = 0;
+    diagnostics->file_count = 0;
+    diagnostics->file_names.length = 0;
+    diagnostics->error_count = 0;
+    diagnostics->suppressed = 0;
+}
+
+void diagnostics_free(Diagnostics *diagnostics) {
+    /* index tracker */
+    int i;
+
+    if (!diagnostics)
+        return;
+    /* free records' arguments */
+    for (i = 0; i < diagnostics->count; i++)
+        free(diagnostics->records[i].argument);
+    /* free arrays, file names, seen table and the collector itself */
+    free(diagnostics->records);
+    free(diagnostics->files);
+    buffer_free(&diagnostics->file_names);
+    hash_table_free(diagnostics->seen, free);
+    free(diagnostics);
+}
\ No newline at end of file
@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "address_sort.h"
+#include "assembler.h"
+#include "bool.h"
+#include "diagnostics.h"
+#include "disassembler.h"
+#include "errors.h"
+#include "hash_table.h"
+#include "helpers.h"
+#include "instructions.h"
+#include "parser.h"
+#include "symbol_table.h"
+
+/* stdio buffer of the disassembly file */
+#define DISASSEMBLY_BUFFER_SIZE (1 << 16)
+
+/* returns the name of the record at exactly address in list, NULL if there is none */
+static const char *find_name(AddressList *list, int address) {
+    /* index of the last record at or below address */
+    int index;
+
+    if (!list)
+        return NULL;
+    index = address_list_find(list, address);
+    return index >= 0 && list->records[index].address == address ? list->records[index].name : NULL;
+}
+
+/* decodes an operand word of mode at address (of memory_size words) into operand i of instruction, returns false if
+ * it doesn't match mode */
+static Bool decode_operand(Word word, int mode, int address, int memory_size, AddressList *labels,
+                           AddressList *externals, DecodedInstruction *instruction, int i) {
+    /* value bits of the word */
+    int value = WORD_VALUE(word);
+    /* register number */
+    int reg;
+
+    instruction->modes[i] = mode;
+    instruction->names[i] = NULL;
+    switch (mode) {
+    case ADDR_IMMEDIATE:
+        instruction->values[i] = SIGNED_VALUE(value);
+        return WORD_ARE(word) == ARE_A;
+    case ADDR_REGISTER:
+        /* a register operand is a single bit */
+        for (reg = 0; reg < 8 && value != 1 << reg; reg++)
+            ;
+        instruction->values[i] = reg;
+        return WORD_ARE(word) == ARE_A && reg < 8;
+    case ADDR_RELATIVE:
+        /* the distance is from the operand word, and lands in memory */
+        instruction->values[i] = address + SIGNED_VALUE(value);
+        instruction->names[i] = find_name(labels, instruction->values[i]);
+        return WORD_ARE(word) == ARE_A && instruction->values[i] >= 0 && instruction->values[i] < memory_size;
+    default:
+        /* an external operand is named by where it is used, a local one by its address */
+        instruction->values[i] = value;
+        if (WORD_ARE(word) == ARE_E)
+            instruction->names[i] = find_name(externals, address);
+        else
+            instruction->names[i] = find_name(labels, value);
+        return WORD_ARE(word) != ARE_A;
+    }
+}
+
+int decode_instruction(const DecodeTable *table, const Word *words, int count, int address, int memory_size,
+                       AddressList *labels, AddressList *externals, DecodedInstruction *instruction) {
+    /* value bits of the first word */
+    int value = WORD_VALUE(words[0]);
+    /* the instruction of the first word */
+    const InstructionInfo *info = table->instructions[DECODE_INDEX(value)];
+    /* addressing modes of the first word */
+    int src_mode = WORD_SRC_MODE(value), dest_mode = WORD_DEST_MODE(value);
+
+    if (!info || WORD_ARE(words[0]) != ARE_A || count < 1 + info->num_operands)
+        return 0;
+    instruction->info = info;
+    instruction->length = 1 + info->num_operands;
+
+    /* every operand takes one word whatever its mode, unused modes are 0 */
+    if (info->num_operands == 2) {
+        if (!is_valid_src_mode(info, src_mode) || !is_valid_dest_mode(info, dest_mode) ||
+            !decode_operand(words[1], src_mode, address + 1, memory_size, labels, externals, instruction, 0) ||
+            !decode_operand(words[2], dest_mode, address + 2, memory_size, labels, externals, instruction, 1))
+            return 0;
+    } else if (info->num_operands == 1) {
+        if (src_mode != 0 || !is_valid_dest_mode(info, dest_mode) ||
+            !decode_operand(words[1], dest_mode, address + 1, memory_size, labels, externals, instruction, 0))
+            return 0;
+    } else if (src_mode != 0 || dest_mode != 0) {
+        return 0;
+    }
+    return instruction->length;
+}
+
+/* writes operand i of instruction at text, returns the end */
+static char *format_operand(DecodedInstruction *instruction, int i, char *text) {
+    /* value of the operand */
+    int value = instruction->values[i];
+
+    switch (instruction->modes[i]) {
+    case ADDR_IMMEDIATE:
+        *text++ = '#';
+        if (value < 0)
+            *text++ = '-';
+        return put_decimal(text, value < 0 ? -value : value, 1, '0');
+    case ADDR_REGISTER:
+        *text++ = 'r';
+        *text++ = (char)('0' + value);
+        return text;
+    case ADDR_RELATIVE:
+        *text++ = '%';
+        break;
+    }
+    /* a direct or relative operand without a name is shown by its address */
+    if (!instruction->names[i]) {
+        if (value < 0)
+            *text++ = '-';
+        return put_decimal(text, value < 0 ? -value : value, 4, '0');
+    }
+    strcpy(text, instruction->names[i]);
+    return text + strlen(text);
+}
+
+char *format_instruction(DecodedInstruction *instruction, char *text) {
+    /* index tracker */
+    int i;
+
+    strcpy(text, instruction->info->name);
+    text += strlen(text);
+    for (i = 0; i < instruction->info->num_operands; i++) {
+        *text++ = i == 0 ? ' ' : ',';
+        if (i > 0)
+            *text++ = ' ';
+        text = format_operand(instruction, i, text);
+    }
+    *text = '\0';
+    return text;
+}
+
+/* fills labels and externals with the symbols of state, sorted by address, returns false if allocation failed */
+static Bool collect_names(AssemblerState *state, AddressList *labels, AddressList *externals) {
+    address_list_init(labels);
+    address_list_init(externals);
+    hash_table_foreach(state->symbols, collect_label, labels);
+    hash_table_foreach(state->symbols, collect_external_uses, externals);
+    if (labels->count >= 0 && externals->count >= 0 && address_list_sort(labels) && address_list_sort(externals))
+        return true;
+
+    address_list_free(labels);
+    address_list_free(externals);
+    return false;
+}
+
+Bool write_disassembly(FILE *file, AssemblerState *state) {
+    /* decode table, built for every file since it is cheap next to the file itself */
+    DecodeTable table;
+    /* names of labels and of external operands */
+    AddressList labels, externals;
+    /* the current instruction */
+    DecodedInstruction instruction;
+    /* the current line */
+    char line[MAX_DISASSEMBLY + 16];
+    /* end of the line so far */
+    char *end;
+    /* words of the current instruction */
+    int length;
+    /* index tracker */
+    int i;
+
+    if (!collect_names(state, &labels, &externals))
+        return false;
+    build_decode_table(&table);
+    setvbuf(file, NULL, _IOFBF, DISASSEMBLY_BUFFER_SIZE);
+
+    /* the code is instructions back to back, a word that isn't one is shown as a number */
+    for (i = 0; i < state->code.count; i += length) {
+        end = put_decimal(line, state->ic_start + i, 4, '0');
+        *end++ = ' ';
+        *end++ = ' ';
+        length = decode_instruction(&table, state->code.words + i, state->code.count - i, state->ic_start + i,
+                                    state->memory_size, &labels, &externals, &instruction);
+        if (length > 0) {
+            end = format_instruction(&instruction, end);
+        } else {
+            length = 1;
+            strcpy(end, ".word ");
+            end = put_decimal(end + strlen(end), WORD_VALUE(state->code.words[i]), 1, '0');
+        }
+        *end++ = '\n';
+        fwrite(line, 1, end - line, file);
+    }
+    /* data follows the code */
+    for (i = 0; i < state->data.count; i++) {
+        end = put_decimal(line, state->ic + i, 4, '0');
+        strcpy(end, "  .data ");
+        end += strlen(end);
+        if (SIGNED_VALUE(WORD_VALUE(state->data.words[i])) < 0)
+            *end++ = '-';
+        end = put_decimal(end, abs(SIGNED_VALUE(WORD_VALUE(state->data.words[i]))), 1, '0');
+        *end++ = '\n';
+        fwrite(line, 1, end - line, file);
+    }
+
+    address_list_free(&labels);
+    address_list_free(&externals);
+    return true;
+}
+
+/* checks if operand (source text) is operand i of instruction */
+static Bool matches_operand(char *operand, DecodedInstruction *instruction, int i) {
+    /* end of a parsed number */
+    char *number_end;
+
+    switch (instruction->modes[i]) {
+    case ADDR_IMMEDIATE:
+        /* numbers are compared by value, so +5 and 05 match 5 */
+        return operand[0] == '#' && strtol(operand + 1, &number_end, 10) == instruction->values[i] &&
+               number_end != operand + 1 && *number_end == '\0';
+    case ADDR_REGISTER:
+        return operand[0] == 'r' && operand[1] == '0' + instruction->values[i] && operand[2] == '\0';
+    case ADDR_RELATIVE:
+        return operand[0] == '%' && instruction->names[i] && strcmp(operand + 1, instruction->names[i]) == 0;
+    default:
+        return instruction->names[i] && strcmp(operand, instruction->names[i]) == 0;
+    }
+}
+
+/* checks if text (a source line) is instruction, ignoring its label, comment and spacing */
+static Bool matches_source(const char *text, DecodedInstruction *instruction) {
+    /* copy of the line, parsing changes it */
+    char line[MAX_LINE];
+    /* current token */
+    char token[MAX_LINE];
+    /* rest of the line, and its next comma */
+    char *rest, *comma;
+    /* index tracker */
+    int i;
+
+    if (strlen(text) >= MAX_LINE)
+        return false;
+    strcpy(line, text);
+    /* strip the comment */
+    if ((rest = strchr(line, COMMENT_CHAR)))
+        *rest = '\0';
+    /* skip the label */
+    rest = get_token(line, token);
+    if (token[0] != '\0' && token[strlen(token) - 1] == ':')
+        rest = get_token(rest, token);
+    if (strcmp(token, instruction->info->name) != 0)
+        return false;
+
+    /* operands are separated by a comma, with or without spaces around it */
+    for (i = 0; i < instruction->info->num_operands; i++) {
+        comma = i + 1 < instruction->info->num_operands ? strchr(rest, ',') : NULL;
+        if (comma)
+            *comma = '\0';
+        else if (i + 1 < instruction->info->num_operands)
+            return false;
+        rest = get_token(rest, token);
+        if (!is_empty(rest) || !matches_operand(token, instruction, i))
+            return false;
+        if (comma)
+            rest = comma + 1;
+    }
+    return is_empty(rest);
+}
+
+int check_disassembly(AssemblerState *state) {
+    /* count of lines that don't match */
+    int mismatches = 0;
+    /* decode table */
+    DecodeTable table;
+    /* names of labels and of external operands */
+    AddressList labels, externals;
+    /* the current instruction */
+    DecodedInstruction instruction;
+    /* text of the current line */
+    char *text = state->listing_text.data;
+    /* code words of the current line */
+    int first_word, word_count;
+    /* index tracker */
+    int i;
+
+    if (!collect_names(state, &labels, &externals))
+        return -1;
+    build_decode_table(&table);
+
+    for (i = 0; i < state->listing_count; i++) {
+        /* a line's words run up to where the next line's start */
+        first_word = state->listing[i].code_index;
+        word_count = (i + 1 < state->listing_count ? state->listing[i + 1].code_index : state->code.count) - first_word;
+        /* the line must decode to exactly its own words, and back to its own text */
+        if (word_count > 0 &&
+            (decode_instruction(&table, state->code.words + first_word, word_count, state->ic_start + first_word,
+                                state->memory_size, &labels, &externals, &instruction) != word_count ||
+             !matches_source(text, &instruction))) {
+            ERROR_LINE(state->diagnostics, i + 1, ERR_DISASSEMBLY_MISMATCH);
+            mismatches++;
+        }
+        text += strlen(text) + 1;
+    }
+
+    address_list_free(&labels);
+    address_list_free(&externals);
+    return mismatches;
+}
\ No newline at end of file
@@ -1,20 +1,45 @@
 #include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "alloc.h"
 #include "assembler.h"
 #include "bool.h"
+#include "buffer.h"
+#include "diagnostics.h"
 #include "errors.h"
 #include "first_pass.h"
 #include "hash_table.h"
 #include "helpers.h"
 #include "instructions.h"
 #include "parser.h"
+#include "stats.h"
 #include "symbol_table.h"
+#include "trace.h"
 #include "warns.h"
 
-static void report_memory_overflow(int line_num, Bool *already_reported) {
+/* a range of lines parsed by one thread into its own state */
+typedef struct {
+    char **lines;       /* first line of the chunk */
+    int line_count;     /* count of lines in the chunk */
+    int first_line_num; /* line number of the first line */
+    AssemblerState *state; /* private state, symbol addresses are relative to the chunk */
+    AssemblerStats stats;  /* private counters, used if the file's state has counters */
+    Bool success;       /* false if the chunk had any error */
+} FirstPassChunk;
+
+/* context for merging a chunk's symbols into the file's symbols table */
+typedef struct {
+    AssemblerState *state;
+    int code_offset; /* code words of all previous chunks */
+    int data_offset; /* data words of all previous chunks */
+    Bool success;
+} SymbolMerge;
+
+static void report_memory_overflow(Diagnostics *diagnostics, int line_num, Bool *already_reported) {
     /* if already reported, return so we not spam */
     if (*already_reported)
         return;
@@ -22,25 +47,31 @@ static void report_memory_overflow(int line_num, Bool *already_reported) {
     /* mark already_reported as true */
     *already_reported = true;
     /* report memory overflow error */
-    ERROR_LINE(line_num, ERR_MEMORY_OVERFLOW);
+    ERROR_LINE(diagnostics, line_num, ERR_MEMORY_OVERFLOW);
 }
 
 typedef enum { SYMBOL_OK, SYMBOL_ERROR_CONTINUE, SYMBOL_ERROR_FATAL } SymbolResult;
 static SymbolResult add_symbol(AssemblerState *state, char *label, int address, SymbolType type, Bool is_entry,
                                int line_num, Bool *has_errors) {
+    /* where to report errors */
+    Diagnostics *diagnostics = state->diagnostics;
     /* the symbol to add to symbols table */
     Symbol *symbol = NULL;
+    /* counters of this pass, NULL if disabled */
+    PhaseStats *stats = STATS_PHASE(state->stats, PHASE_FIRST_PASS);
     /* existing symbol with same name, NULL if not found */
     Symbol *existing = hash_table_lookup(state->symbols, label);
 
+    STATS_ADD(stats, hash_lookups, 1);
+
     /* if symbol with label already exists and either of them is not external, report error */
     if (existing && (type != SYMBOL_EXTERNAL || existing->type != SYMBOL_EXTERNAL)) {
         /* if either of them is external, report ERR_EXTERN_AND_LOCAL error */
         if (type == SYMBOL_EXTERNAL || existing->type == SYMBOL_EXTERNAL)
-            ERROR_LINE(line_num, ERR_EXTERN_AND_LOCAL);
+            ERROR_LINE(diagnostics, line_num, ERR_EXTERN_AND_LOCAL);
         /* in any other case, report ERR_LABEL_ALREADY_DEFINED error */
         else
-            ERROR_LINE(line_num, ERR_LABEL_ALREADY_DEFINED);
+            ERROR_LINE(diagnostics, line_num, ERR_LABEL_ALREADY_DEFINED);
         /* set has_errors to true */
         *has_errors = true;
         /* tells loop to skip to next line */
@@ -49,11 +80,11 @@ static SymbolResult add_symbol(AssemblerState *state, char *label, int address,
 
     /* if symbols table doesn't have a symbol with key label, add a new one */
     if (!existing) {
-        /* allocate new symbol */
-        symbol = malloc(sizeof(Symbol));
+        /* get a symbol (reused from a previous file if possible) */
+        symbol = acquire_symbol(state);
         /* if allocation failed, throw error and cleanup */
         if (!symbol) {
-            ERROR(ERR_MEMORY_ALLOC);
+            ERROR(diagnostics, ERR_MEMORY_ALLOC);
             /* tells loop to cleanup */
             return SYMBOL_ERROR_FATAL;
         }
@@ -64,9 +95,10 @@ static SymbolResult add_symbol(AssemblerState *state, char *label, int address,
         /* set symbol is_entry to is_entry */
         symbol->is_entry = is_entry;
         /* if insertion failed, throw error and cleanup */
+        STATS_ADD(stats, hash_inserts, 1);
         if (!hash_table_insert(state->symbols, label, symbol)) {
-            ERROR(ERR_MEMORY_ALLOC);
-            free(symbol);
+            ERROR(diagnostics, ERR_MEMORY_ALLOC);
+            free_symbol(symbol);
             /* tells loop to cleanup */
             return SYMBOL_ERROR_FATAL;
         }
@@ -98,31 +130,31 @@ static Bool is_label_alphanumeric(char *label) {
     return true;
 }
 
-static Bool is_valid_label(char *label, int line_num, Bool *has_errors) {
+static Bool is_valid_label(Diagnostics *diagnostics, char *label, int line_num, Bool *has_errors) {
     /* if label is longer or equal to MAX_LABEL, report error and skip to next line */
     if (is_label_too_long(label)) {
-        ERROR_LINE(line_num, ERR_LABEL_TOO_LONG);
+        ERROR_LINE(diagnostics, line_num, ERR_LABEL_TOO_LONG);
         *has_errors = true;
         return false;
     }
 
     /* if label doesn't start with a letter, report error and skip to next line */
     if (!is_label_starts_with_letter(label)) {
-        ERROR_LINE(line_num, ERR_LABEL_START_LETTER);
+        ERROR_LINE(diagnostics, line_num, ERR_LABEL_START_LETTER);
         *has_errors = true;
         return false;
     }
 
     /* if label name contains an invalid character, report error and skip to next line */
     if (!is_label_alphanumeric(label)) {
-        ERROR_LINE(line_num, ERR_LABEL_INVALID_CHAR);
+        ERROR_LINE(diagnostics, line_num, ERR_LABEL_INVALID_CHAR);
         *has_errors = true;
         return false;
     }
 
     /* if label is a reserved word, report error and skip to next line */
     if (is_reserved_word(label)) {
-        ERROR_LINE(line_num, ERR_LABEL_RESERVED);
+        ERROR_LINE(diagnostics, line_num, ERR_LABEL_RESERVED);
         *has_errors = true;
         return false;
     }
@@ -170,21 +202,14 @@ static void update_symbol_data_address(char *key, void *data, void *context) {
         symbol->address += final_ic;
 }
 
-AssemblerState *first_pass(char *filename) {
-    /* assembler state */
-    AssemblerState *state = NULL;
-    /* used to tell cleanup whether to free state variable or not */
-    Bool success = false;
-    /* a flag to tell whether the file has any errors or not */
-    Bool has_errors = false;
+/* parses a single line (NULL terminated, newline removed) into state, returns false on fatal error (errors are
+ * reported inside, and has_errors becomes true on any error) */
+static Bool parse_line(AssemblerState *state, char *line, int line_num, Bool *has_errors,
+                       Bool *memory_overflow_reported) {
+    /* where to report errors */
+    Diagnostics *diagnostics = state->diagnostics;
     /* indicates whether this line has a label or not */
     Bool has_label = false;
-    /* a flag to tell whether memory overflow error was already reported or not */
-    Bool memory_overflow_reported = false;
-    /* current line from fgets */
-    char line[MAX_LINE];
-    /* used to track current line num */
-    int line_num = 0;
     /* a word from line */
     char token[MAX_LINE];
     /* pointer to text after token */
@@ -213,607 +238,993 @@ AssemblerState *first_pass(char *filename) {
     int instruction_length;
     /* instruction src and dest modes */
     int src_mode, dest_mode;
-    /* would store state->ic - IC_START */
+    /* would store state->ic - state->ic_start */
     int code_index;
-    /* input file path */
-    char input_file_path[MAX_LINE];
-    /* original file */
-    FILE *input_file = NULL;
 
-    /* write input path to input_file_path */
-    sprintf(input_file_path, "%s.am", filename);
-
-    /* open input_file as read-only */
-    input_file = fopen(input_file_path, "r");
-    /* if failed, throw error and cleanup */
-    if (!input_file) {
-        ERROR_FILE(ERR_CANNOT_OPEN_FILE, input_file_path);
-        goto cleanup;
+    /* if line is longer than MAX_LINE, report error and skip to next line */
+    if (strlen(line) > MAX_LINE - 2) {
+        ERROR_LINE(diagnostics, line_num, ERR_LINE_TOO_LONG);
+        *has_errors = true;
+        return true;
     }
 
-    /* allocate new AssemblerState */
-    state = malloc(sizeof(AssemblerState));
-    /* if allocation failed, throw error and cleanup */
-    if (!state) {
-        ERROR(ERR_MEMORY_ALLOC);
-        goto cleanup;
-    }
+    /* finds first comment char in line */
+    comment_start = strchr(line, COMMENT_CHAR);
+    /* if found, strips it and what's after */
+    if (comment_start)
+        *comment_start = '\0';
+
+    /* if line is empty or comment, skip to next line */
+    if (is_empty(line))
+        return true;
+
+    /* gets first word from line */
+    token_ptr = get_token(line, token);
+
+    /* if token is a label */
+    if (token[0] != '\0' && token[strlen(token) - 1] == ':') {
+        /* truncate ':' */
+        token[strlen(token) - 1] = '\0';
+
+        /* if label is invalid, continue (errors reported inside and has_errors becomes true inside too) */
+        if (!is_valid_label(diagnostics, token, line_num, has_errors))
+            return true;
+
+        /* if label is already defined, report error and skip to next line */
+        STATS_ADD(state->stats, phases[PHASE_FIRST_PASS].hash_lookups, 1);
+        if (hash_table_contains_key(state->symbols, token)) {
+            ERROR_LINE(diagnostics, line_num, ERR_LABEL_ALREADY_DEFINED);
+            *has_errors = true;
+            return true;
+        }
 
-    /* create symbols table */
-    state->symbols = hash_table_create();
-    /* if failed, throw error and cleanup */
-    if (!state->symbols) {
-        ERROR(ERR_MEMORY_ALLOC);
-        goto cleanup;
-    }
+        /* save label name for later */
+        strcpy(label, token);
+        /* mark has_label as true */
+        has_label = true;
 
-    /* allocate code words array */
-    state->code = malloc(MAX_MEMORY * sizeof(Word));
-    /* if failed, throw error and cleanup */
-    if (!state->code) {
-        ERROR(ERR_MEMORY_ALLOC);
-        goto cleanup;
-    }
+        /* restore ':' */
+        token[strlen(token)] = ':';
 
-    /* allocate data words array */
-    state->data = malloc(MAX_MEMORY * sizeof(Word));
-    /* if failed, throw error and cleanup */
-    if (!state->data) {
-        ERROR(ERR_MEMORY_ALLOC);
-        goto cleanup;
+        /* get next word after label */
+        token_ptr = get_token(token_ptr, token);
     }
 
-    /* set initial ic to IC_START */
-    state->ic = IC_START;
-    /* set initial dc to 0 */
-    state->dc = 0;
-
-    /* while there are lines to read */
-    while (fgets(line, MAX_LINE, input_file)) {
-        /* increase line counter */
-        line_num++;
-        /* reset has_label flag */
-        has_label = false;
-
-        /* if line is longer than MAX_LINE, report error and skip to next line */
-        if (strchr(line, '\n') == NULL && !feof(input_file)) {
-            ERROR_LINE(line_num, ERR_LINE_TOO_LONG);
-            has_errors = true;
-            discard_rest_of_line(input_file);
-            continue;
+    /* if token starts with '.', it is probably a directive */
+    if (token[0] == '.') {
+        /* if token is an unknown directive, report error and skip to next line */
+        if (!is_directive(token)) {
+            ERROR_LINE(diagnostics, line_num, ERR_UNKNOWN_DIRECTIVE);
+            *has_errors = true;
+            return true;
         }
 
-        /* finds first comment char in line */
-        comment_start = strchr(line, COMMENT_CHAR);
-        /* if found, strips it and what's after */
-        if (comment_start)
-            *comment_start = '\0';
-
-        /* if line is empty or comment, skip to next line */
-        if (is_empty(line))
-            continue;
-
-        /* gets first word from line */
-        token_ptr = get_token(line, token);
-
-        /* if token is a label */
-        if (token[0] != '\0' && token[strlen(token) - 1] == ':') {
-            /* truncate ':' */
-            token[strlen(token) - 1] = '\0';
-
-            /* if label is invalid, continue (errors reported inside and has_errors becomes true inside too) */
-            if (!is_valid_label(token, line_num, &has_errors))
-                continue;
+        if (strcmp(token, ".data") == 0) {
+            /* if has_label, add it to symbols table */
+            if (has_label) {
+                /* store add_symbol result */
+                symbol_result = add_symbol(state, label, state->dc, SYMBOL_DATA, false, line_num, has_errors);
+                /* if insertion failed, either go to cleanup or skip to next line (error already reported) */
+                if (symbol_result == SYMBOL_ERROR_FATAL)
+                    return false;
+                else if (symbol_result == SYMBOL_ERROR_CONTINUE)
+                    return true;
+            }
 
-            /* if label is already defined, report error and skip to next line */
-            if (hash_table_contains_key(state->symbols, token)) {
-                ERROR_LINE(line_num, ERR_LABEL_ALREADY_DEFINED);
-                has_errors = true;
-                continue;
+            /* if token_ptr is empty, report error and skip to next line */
+            if (is_empty(token_ptr)) {
+                ERROR_LINE(diagnostics, line_num, ERR_DATA_MISSING_NUMBERS);
+                *has_errors = true;
+                return true;
             }
 
-            /* save label name for later */
-            strcpy(label, token);
-            /* mark has_label as true */
-            has_label = true;
+            /* skip leading whitespace */
+            token_ptr = skip_whitespace(token_ptr);
+            /* if token_ptr starts with a comma, report error and skip to next line  */
+            if (token_ptr[0] == ',') {
+                ERROR_LINE(diagnostics, line_num, ERR_DATA_ILLEGAL_COMMA);
+                *has_errors = true;
+                return true;
+            }
 
-            /* restore ':' */
-            token[strlen(token)] = ':';
+            /* loop token_ptr until it is empty */
+            while (!is_empty(token_ptr)) {
+                /* backup token_ptr to data_pos */
+                data_pos = token_ptr;
+                /* parse with strtol base 10 */
+                data_num = strtol(token_ptr, &token_ptr, 10);
+
+                /* if token_ptr hasn't moved, parse failed, report error and skip to next line */
+                if (token_ptr == data_pos) {
+                    ERROR_LINE(diagnostics, line_num, ERR_DATA_INVALID_NUMBER);
+                    *has_errors = true;
+                    return true;
+                }
 
-            /* get next word after label */
-            token_ptr = get_token(token_ptr, token);
-        }
+                /* if number is out of range, report error and skip to next line */
+                if (!is_number_in_range(data_num)) {
+                    ERROR_LINE(diagnostics, line_num, ERR_NUMBER_OUT_OF_RANGE);
+                    *has_errors = true;
+                    return true;
+                }
 
-        /* if token starts with '.', it is probably a directive */
-        if (token[0] == '.') {
-            /* if token is an unknown directive, report error and skip to next line */
-            if (!is_directive(token)) {
-                ERROR_LINE(line_num, ERR_UNKNOWN_DIRECTIVE);
-                has_errors = true;
-                continue;
-            }
-
-            if (strcmp(token, ".data") == 0) {
-                /* if has_label, add it to symbols table */
-                if (has_label) {
-                    /* store add_symbol result */
-                    symbol_result = add_symbol(state, label, state->dc, SYMBOL_DATA, false, line_num, &has_errors);
-                    /* if insertion failed, either go to cleanup or skip to next line (error already reported) */
-                    if (symbol_result == SYMBOL_ERROR_FATAL)
-                        goto cleanup;
-                    else if (symbol_result == SYMBOL_ERROR_CONTINUE)
-                        continue;
+                /* if memory overflow, report error and skip to next line */
+                if (!has_memory(state, 1)) {
+                    report_memory_overflow(diagnostics, line_num, memory_overflow_reported);
+                    *has_errors = true;
+                    return true;
                 }
 
-                /* if token_ptr is empty, report error and skip to next line */
-                if (is_empty(token_ptr)) {
-                    ERROR_LINE(line_num, ERR_DATA_MISSING_NUMBERS);
-                    has_errors = true;
-                    continue;
+                /* store num in data segment as ARE_A (absolute), if failed, throw error and cleanup */
+                if (!segment_push(&state->data, MAKE_WORD(data_num, ARE_A))) {
+                    ERROR(diagnostics, ERR_MEMORY_ALLOC);
+                    return false;
                 }
+                /* advance dc */
+                state->dc++;
 
                 /* skip leading whitespace */
                 token_ptr = skip_whitespace(token_ptr);
-                /* if token_ptr starts with a comma, report error and skip to next line  */
-                if (token_ptr[0] == ',') {
-                    ERROR_LINE(line_num, ERR_DATA_ILLEGAL_COMMA);
-                    has_errors = true;
-                    continue;
-                }
-
-                /* loop token_ptr until it is empty */
-                while (!is_empty(token_ptr)) {
-                    /* backup token_ptr to data_pos */
-                    data_pos = token_ptr;
-                    /* parse with strtol base 10 */
-                    data_num = strtol(token_ptr, &token_ptr, 10);
-
-                    /* if token_ptr hasn't moved, parse failed, report error and skip to next line */
-                    if (token_ptr == data_pos) {
-                        ERROR_LINE(line_num, ERR_DATA_INVALID_NUMBER);
-                        has_errors = true;
-                        goto next_line;
-                    }
-
-                    /* if number is out of range, report error and skip to next line */
-                    if (!is_number_in_range(data_num)) {
-                        ERROR_LINE(line_num, ERR_NUMBER_OUT_OF_RANGE);
-                        has_errors = true;
-                        goto next_line;
-                    }
-
-                    /* if memory overflow, report error and skip to next line */
-                    if (!has_memory(state->ic, state->dc, 1)) {
-                        report_memory_overflow(line_num, &memory_overflow_reported);
-                        has_errors = true;
-                        goto next_line;
-                    }
-
-                    /* store num in data state array */
-                    state->data[state->dc].value = data_num;
-                    /* set type to ARE_A (absolute) */
-                    state->data[state->dc].are = ARE_A;
-                    /* advance dc */
-                    state->dc++;
-
+                /* if comma found, skip it and check for trailing comma */
+                if (*token_ptr == ',') {
+                    /* advance token_ptr to next character */
+                    token_ptr++;
                     /* skip leading whitespace */
                     token_ptr = skip_whitespace(token_ptr);
-                    /* if comma found, skip it and check for trailing comma */
+
+                    /* if another comma was found, report error and skip to next line */
                     if (*token_ptr == ',') {
-                        /* advance token_ptr to next character */
-                        token_ptr++;
-                        /* skip leading whitespace */
-                        token_ptr = skip_whitespace(token_ptr);
-
-                        /* if another comma was found, report error and skip to next line */
-                        if (*token_ptr == ',') {
-                            ERROR_LINE(line_num, ERR_DATA_EXTRA_COMMA);
-                            has_errors = true;
-                            goto next_line;
-                        }
-
-                        /* if token_ptr is empty, report error and skip to next line */
-                        if (is_empty(token_ptr)) {
-                            ERROR_LINE(line_num, ERR_DATA_ILLEGAL_COMMA);
-                            has_errors = true;
-                            goto next_line;
-                        }
-                        /* if token_ptr is not empty, report error and skip to next line */
-                    } else if (!is_empty(token_ptr)) {
-                        ERROR_LINE(line_num, ERR_DATA_EXPECTED_COMMA);
-                        has_errors = true;
-                        goto next_line;
+                        ERROR_LINE(diagnostics, line_num, ERR_DATA_EXTRA_COMMA);
+                        *has_errors = true;
+                        return true;
                     }
-                }
-            } else if (strcmp(token, ".string") == 0) {
-                /* if has_label, add it to symbols table */
-                if (has_label) {
-                    /* store add_symbol result */
-                    symbol_result = add_symbol(state, label, state->dc, SYMBOL_DATA, false, line_num, &has_errors);
-                    /* if insertion failed, either go to cleanup or skip to next line (error already reported) */
-                    if (symbol_result == SYMBOL_ERROR_FATAL)
-                        goto cleanup;
-                    else if (symbol_result == SYMBOL_ERROR_CONTINUE)
-                        continue;
-                }
 
-                /* skip leading whitespace */
-                token_ptr = skip_whitespace(token_ptr);
-
-                /* if token_ptr is empty, report error and skip to next line */
-                if (is_empty(token_ptr)) {
-                    ERROR_LINE(line_num, ERR_STRING_MISSING);
-                    has_errors = true;
-                    continue;
-                }
-
-                /* if first char of token_ptr is not ", report error and skip to next line */
-                if (*token_ptr != '"') {
-                    ERROR_LINE(line_num, ERR_STRING_INVALID);
-                    has_errors = true;
-                    continue;
+                    /* if token_ptr is empty, report error and skip to next line */
+                    if (is_empty(token_ptr)) {
+                        ERROR_LINE(diagnostics, line_num, ERR_DATA_ILLEGAL_COMMA);
+                        *has_errors = true;
+                        return true;
+                    }
+                    /* if token_ptr is not empty, report error and skip to next line */
+                } else if (!is_empty(token_ptr)) {
+                    ERROR_LINE(diagnostics, line_num, ERR_DATA_EXPECTED_COMMA);
+                    *has_errors = true;
+                    return true;
                 }
+            }
+        } else if (strcmp(token, ".string") == 0) {
+            /* if has_label, add it to symbols table */
+            if (has_label) {
+                /* store add_symbol result */
+                symbol_result = add_symbol(state, label, state->dc, SYMBOL_DATA, false, line_num, has_errors);
+                /* if insertion failed, either go to cleanup or skip to next line (error already reported) */
+                if (symbol_result == SYMBOL_ERROR_FATAL)
+                    return false;
+                else if (symbol_result == SYMBOL_ERROR_CONTINUE)
+                    return true;
+            }
 
-                /* advance token_ptr to next character (skips leading ") */
-                token_ptr++;
+            /* skip leading whitespace */
+            token_ptr = skip_whitespace(token_ptr);
 
-                while (*token_ptr != '"' && !is_empty(token_ptr)) {
-                    /* if memory overflow, report error and skip to next line */
-                    if (!has_memory(state->ic, state->dc, 1)) {
-                        report_memory_overflow(line_num, &memory_overflow_reported);
-                        has_errors = true;
-                        goto next_line;
-                    }
+            /* if token_ptr is empty, report error and skip to next line */
+            if (is_empty(token_ptr)) {
+                ERROR_LINE(diagnostics, line_num, ERR_STRING_MISSING);
+                *has_errors = true;
+                return true;
+            }
 
-                    /* store num in data state array */
-                    state->data[state->dc].value = *token_ptr;
-                    /* set type to ARE_A (absolute) */
-                    state->data[state->dc].are = ARE_A;
-                    /* advance dc */
-                    state->dc++;
-                    /* advance token_ptr to next character */
-                    token_ptr++;
-                }
+            /* if first char of token_ptr is not ", report error and skip to next line */
+            if (*token_ptr != '"') {
+                ERROR_LINE(diagnostics, line_num, ERR_STRING_INVALID);
+                *has_errors = true;
+                return true;
+            }
 
-                /* if last char of token_ptr is not ", report error and skip to next line */
-                if (*token_ptr != '"') {
-                    ERROR_LINE(line_num, ERR_STRING_INVALID);
-                    has_errors = true;
-                    continue;
-                }
+            /* advance token_ptr to next character (skips leading ") */
+            token_ptr++;
 
+            while (*token_ptr != '"' && !is_empty(token_ptr)) {
                 /* if memory overflow, report error and skip to next line */
-                if (!has_memory(state->ic, state->dc, 1)) {
-                    report_memory_overflow(line_num, &memory_overflow_reported);
-                    has_errors = true;
-                    goto next_line;
+                if (!has_memory(state, 1)) {
+                    report_memory_overflow(diagnostics, line_num, memory_overflow_reported);
+                    *has_errors = true;
+                    return true;
                 }
 
-                /* add NULL terminator */
-                state->data[state->dc].value = '\0';
-                /* type ARE_A (absolute) */
-                state->data[state->dc].are = ARE_A;
+                /* store char in data segment as ARE_A (absolute), if failed, throw error and cleanup */
+                if (!segment_push(&state->data, MAKE_WORD(*token_ptr, ARE_A))) {
+                    ERROR(diagnostics, ERR_MEMORY_ALLOC);
+                    return false;
+                }
                 /* advance dc */
                 state->dc++;
-            } else if (strcmp(token, ".entry") == 0) {
-                /* handled in second pass */
-                continue;
-            } else if (strcmp(token, ".extern") == 0) {
-                /* warn if line has label, then continue as usual */
-                if (has_label)
-                    WARN_LINE(line_num, WARN_LABEL_BEFORE_EXTERN);
-
-                /* get next word */
-                token_ptr = get_token(token_ptr, token);
-
-                /* if token is empty, report error and skip to next line */
-                if (is_empty(token)) {
-                    ERROR_LINE(line_num, ERR_EXTERN_INVALID_SYMBOL);
-                    has_errors = true;
-                    continue;
-                }
+                /* advance token_ptr to next character */
+                token_ptr++;
+            }
 
-                /* if label is invalid, continue (errors reported inside and has_errors becomes true inside too) */
-                if (!is_valid_label(token, line_num, &has_errors))
-                    continue;
+            /* if last char of token_ptr is not ", report error and skip to next line */
+            if (*token_ptr != '"') {
+                ERROR_LINE(diagnostics, line_num, ERR_STRING_INVALID);
+                *has_errors = true;
+                return true;
+            }
 
-                /* skip leading whitespace */
-                token_ptr = skip_whitespace(token_ptr);
-                /* if token_ptr is not empty, report error and skip to next line */
-                if (!is_empty(token_ptr)) {
-                    ERROR_LINE(line_num, ERR_EXTRA_TEXT);
-                    has_errors = true;
-                    continue;
-                }
+            /* if memory overflow, report error and skip to next line */
+            if (!has_memory(state, 1)) {
+                report_memory_overflow(diagnostics, line_num, memory_overflow_reported);
+                *has_errors = true;
+                return true;
+            }
 
-                /* store add_symbol result */
-                symbol_result = add_symbol(state, token, 0, SYMBOL_EXTERNAL, false, line_num, &has_errors);
-                /* if insertion failed, go to cleanup (error already reported) */
-                if (symbol_result == SYMBOL_ERROR_FATAL)
-                    goto cleanup;
+            /* add NULL terminator as ARE_A (absolute), if failed, throw error and cleanup */
+            if (!segment_push(&state->data, MAKE_WORD('\0', ARE_A))) {
+                ERROR(diagnostics, ERR_MEMORY_ALLOC);
+                return false;
             }
-            /* if token is not empty, it is probably an instruction */
-        } else if (!is_empty(token)) {
-            /* if token is an unknown instruction, report error and skip to next line */
-            if (!is_instruction(token)) {
-                ERROR_LINE(line_num, ERR_UNKNOWN_INSTRUCTION);
-                has_errors = true;
-                continue;
+            /* advance dc */
+            state->dc++;
+        } else if (strcmp(token, ".entry") == 0) {
+            /* get symbol name (checked in second pass, once all symbols are known) */
+            get_token(token_ptr, token);
+            /* record entry for second pass, if failed, throw error and cleanup */
+            if (!add_entry_request(state, line_num, token)) {
+                ERROR(diagnostics, ERR_MEMORY_ALLOC);
+                return false;
             }
+        } else if (strcmp(token, ".extern") == 0) {
+            /* warn if line has label, then continue as usual */
+            if (has_label)
+                WARN_LINE(diagnostics, line_num, WARN_LABEL_BEFORE_EXTERN);
 
-            /* if has_label, add it to symbols table */
-            if (has_label) {
-                /* store add_symbol result */
-                symbol_result = add_symbol(state, label, state->ic, SYMBOL_CODE, false, line_num, &has_errors);
-                /* if insertion failed, either go to cleanup or skip to next line (error already reported) */
-                if (symbol_result == SYMBOL_ERROR_FATAL)
-                    goto cleanup;
-                else if (symbol_result == SYMBOL_ERROR_CONTINUE)
-                    continue;
+            /* get next word */
+            token_ptr = get_token(token_ptr, token);
+
+            /* if token is empty, report error and skip to next line */
+            if (is_empty(token)) {
+                ERROR_LINE(diagnostics, line_num, ERR_EXTERN_INVALID_SYMBOL);
+                *has_errors = true;
+                return true;
             }
 
-            /* get instruction info of current instruction */
-            instruction_info = get_instruction_info(token);
+            /* if label is invalid, continue (errors reported inside and has_errors becomes true inside too) */
+            if (!is_valid_label(diagnostics, token, line_num, has_errors))
+                return true;
 
-            /* handle 1-operand instruction */
-            if (instruction_info->num_operands == 1) {
-                /* get first operand */
-                token_ptr = get_token(token_ptr, operand1);
+            /* skip leading whitespace */
+            token_ptr = skip_whitespace(token_ptr);
+            /* if token_ptr is not empty, report error and skip to next line */
+            if (!is_empty(token_ptr)) {
+                ERROR_LINE(diagnostics, line_num, ERR_EXTRA_TEXT);
+                *has_errors = true;
+                return true;
+            }
 
-                /* if operand1 is empty, report error and skip to next line */
-                if (is_empty(operand1)) {
-                    ERROR_LINE(line_num, ERR_MISSING_OPERAND);
-                    has_errors = true;
-                    continue;
-                }
+            /* store add_symbol result */
+            symbol_result = add_symbol(state, token, 0, SYMBOL_EXTERNAL, false, line_num, has_errors);
+            /* if insertion failed, go to cleanup (error already reported) */
+            if (symbol_result == SYMBOL_ERROR_FATAL)
+                return false;
+        }
+        /* if token is not empty, it is probably an instruction */
+    } else if (!is_empty(token)) {
+        /* if token is an unknown instruction, report error and skip to next line */
+        if (!is_instruction(token)) {
+            ERROR_LINE(diagnostics, line_num, ERR_UNKNOWN_INSTRUCTION);
+            *has_errors = true;
+            return true;
+        }
 
-                /* set operand1_length to operand1 length */
-                operand1_length = strlen(operand1);
-                /* skip leading whitespace */
-                token_ptr = skip_whitespace(token_ptr);
-                /* if operand1 starts or ends with a comma found, report error and skip to next line */
-                if (*operand1 == ',' || operand1[operand1_length - 1] == ',' || *token_ptr == ',') {
-                    ERROR_LINE(line_num, ERR_OPERAND_ILLEGAL_COMMA);
-                    has_errors = true;
-                    continue;
-                }
+        /* if has_label, add it to symbols table */
+        if (has_label) {
+            /* store add_symbol result */
+            symbol_result = add_symbol(state, label, state->ic, SYMBOL_CODE, false, line_num, has_errors);
+            /* if insertion failed, either go to cleanup or skip to next line (error already reported) */
+            if (symbol_result == SYMBOL_ERROR_FATAL)
+                return false;
+            else if (symbol_result == SYMBOL_ERROR_CONTINUE)
+                return true;
+        }
+
+        /* get instruction info of current instruction */
+        instruction_info = get_instruction_info(token);
+
+        /* handle 1-operand instruction */
+        if (instruction_info->num_operands == 1) {
+            /* get first operand */
+            token_ptr = get_token(token_ptr, operand1);
+
+            /* if operand1 is empty, report error and skip to next line */
+            if (is_empty(operand1)) {
+                ERROR_LINE(diagnostics, line_num, ERR_MISSING_OPERAND);
+                *has_errors = true;
+                return true;
             }
 
-            /* handle 2-operand instruction */
-            if (instruction_info->num_operands == 2) {
-                /* skip leading whitespace */
-                token_ptr = skip_whitespace(token_ptr);
+            /* set operand1_length to operand1 length */
+            operand1_length = strlen(operand1);
+            /* skip leading whitespace */
+            token_ptr = skip_whitespace(token_ptr);
+            /* if operand1 starts or ends with a comma found, report error and skip to next line */
+            if (*operand1 == ',' || operand1[operand1_length - 1] == ',' || *token_ptr == ',') {
+                ERROR_LINE(diagnostics, line_num, ERR_OPERAND_ILLEGAL_COMMA);
+                *has_errors = true;
+                return true;
+            }
+        }
 
-                /* get pointer to first comma */
-                comma_ptr = strchr(token_ptr, ',');
+        /* handle 2-operand instruction */
+        if (instruction_info->num_operands == 2) {
+            /* skip leading whitespace */
+            token_ptr = skip_whitespace(token_ptr);
 
-                /* if no comma found, report error and skip to next line */
-                if (!comma_ptr) {
-                    ERROR_LINE(line_num, ERR_OPERAND_EXPECTED_COMMA);
-                    has_errors = true;
-                    continue;
-                }
+            /* get pointer to first comma */
+            comma_ptr = strchr(token_ptr, ',');
 
-                /* if comma_ptr is at the start of token_ptr, report error and skip to next line */
-                if (comma_ptr == token_ptr) {
-                    ERROR_LINE(line_num, ERR_OPERAND_ILLEGAL_COMMA);
-                    has_errors = true;
-                    continue;
-                }
+            /* if no comma found, report error and skip to next line */
+            if (!comma_ptr) {
+                ERROR_LINE(diagnostics, line_num, ERR_OPERAND_EXPECTED_COMMA);
+                *has_errors = true;
+                return true;
+            }
 
-                /* copy all characters before comma to operand1 */
-                strncpy(operand1, token_ptr, comma_ptr - token_ptr);
-                /* add NULL terminator at the end of operand1 */
-                operand1[comma_ptr - token_ptr] = '\0';
-
-                /* skip trailing whitespace from operand1 */
-                operand1_length = strlen(operand1);
-                while (operand1_length > 0 &&
-                       (operand1[operand1_length - 1] == ' ' || operand1[operand1_length - 1] == '\t')) {
-                    operand1[operand1_length - 1] = '\0';
-                    operand1_length--;
-                }
+            /* if comma_ptr is at the start of token_ptr, report error and skip to next line */
+            if (comma_ptr == token_ptr) {
+                ERROR_LINE(diagnostics, line_num, ERR_OPERAND_ILLEGAL_COMMA);
+                *has_errors = true;
+                return true;
+            }
 
-                /* skip comma */
-                token_ptr = comma_ptr + 1;
+            /* copy all characters before comma to operand1 */
+            strncpy(operand1, token_ptr, comma_ptr - token_ptr);
+            /* add NULL terminator at the end of operand1 */
+            operand1[comma_ptr - token_ptr] = '\0';
+
+            /* skip trailing whitespace from operand1 */
+            operand1_length = strlen(operand1);
+            while (operand1_length > 0 &&
+                   (operand1[operand1_length - 1] == ' ' || operand1[operand1_length - 1] == '\t')) {
+                operand1[operand1_length - 1] = '\0';
+                operand1_length--;
+            }
 
-                /* skip leading whitespace */
-                token_ptr = skip_whitespace(token_ptr);
-                /* if token_ptr starts with a comma, report error and skip to next line */
-                if (*token_ptr == ',') {
-                    ERROR_LINE(line_num, ERR_OPERAND_EXTRA_COMMA);
-                    has_errors = true;
-                    continue;
-                }
+            /* skip comma */
+            token_ptr = comma_ptr + 1;
 
-                /* extract operand2 from token_ptr */
-                token_ptr = get_token(token_ptr, operand2);
-                /* if either operand1 or operand2 are empty, report error and skip to next line */
-                if (is_empty(operand1) || is_empty(operand2)) {
-                    ERROR_LINE(line_num, ERR_MISSING_OPERAND);
-                    has_errors = true;
-                    continue;
-                }
+            /* skip leading whitespace */
+            token_ptr = skip_whitespace(token_ptr);
+            /* if token_ptr starts with a comma, report error and skip to next line */
+            if (*token_ptr == ',') {
+                ERROR_LINE(diagnostics, line_num, ERR_OPERAND_EXTRA_COMMA);
+                *has_errors = true;
+                return true;
+            }
 
-                /* set operand2_length to operand2 length */
-                operand2_length = strlen(operand2);
-                /* skip leading whitespace */
-                token_ptr = skip_whitespace(token_ptr);
-                /* if operand2 ends with a comma found, report error and skip to next line */
-                if (operand2[operand2_length - 1] == ',' || *token_ptr == ',') {
-                    ERROR_LINE(line_num, ERR_OPERAND_ILLEGAL_COMMA);
-                    has_errors = true;
-                    continue;
-                }
+            /* extract operand2 from token_ptr */
+            token_ptr = get_token(token_ptr, operand2);
+            /* if either operand1 or operand2 are empty, report error and skip to next line */
+            if (is_empty(operand1) || is_empty(operand2)) {
+                ERROR_LINE(diagnostics, line_num, ERR_MISSING_OPERAND);
+                *has_errors = true;
+                return true;
             }
 
-            /* if token_ptr is not empty, report error and skip to next line */
-            if (!is_empty(token_ptr)) {
-                ERROR_LINE(line_num, ERR_TOO_MANY_OPERANDS);
-                has_errors = true;
-                continue;
-            }
-
-            if (instruction_info->num_operands == 0) {
-                /* set both src and dest modes to 0 */
-                src_mode = 0;
-                dest_mode = 0;
-            } else if (instruction_info->num_operands == 1) {
-                /* get addressing mode for operand1 */
-                operand1_addressing_mode = get_addressing_mode(operand1);
-
-                /* if operand1 is invalid, report error and skip to next line */
-                if (!is_valid_addressing_mode(operand1, operand1_addressing_mode)) {
-                    ERROR_LINE(line_num, ERR_INVALID_OPERAND);
-                    has_errors = true;
-                    continue;
-                }
+            /* set operand2_length to operand2 length */
+            operand2_length = strlen(operand2);
+            /* skip leading whitespace */
+            token_ptr = skip_whitespace(token_ptr);
+            /* if operand2 ends with a comma found, report error and skip to next line */
+            if (operand2[operand2_length - 1] == ',' || *token_ptr == ',') {
+                ERROR_LINE(diagnostics, line_num, ERR_OPERAND_ILLEGAL_COMMA);
+                *has_errors = true;
+                return true;
+            }
+        }
 
-                /* if number is out of range, report error and skip to next line */
-                if (operand1_addressing_mode == ADDR_IMMEDIATE && !is_number_in_range(strtol(operand1 + 1, NULL, 10))) {
-                    ERROR_LINE(line_num, ERR_NUMBER_OUT_OF_RANGE);
-                    has_errors = true;
-                    goto next_line;
-                }
+        /* if token_ptr is not empty, report error and skip to next line */
+        if (!is_empty(token_ptr)) {
+            ERROR_LINE(diagnostics, line_num, ERR_TOO_MANY_OPERANDS);
+            *has_errors = true;
+            return true;
+        }
 
-                /* if invalid dest mode, report error and skip to next line */
-                if (!is_valid_dest_mode(instruction_info, operand1_addressing_mode)) {
-                    ERROR_LINE(line_num, ERR_INVALID_DEST_MODE);
-                    has_errors = true;
-                    continue;
-                }
+        if (instruction_info->num_operands == 0) {
+            /* set both src and dest modes to 0 */
+            src_mode = 0;
+            dest_mode = 0;
+        } else if (instruction_info->num_operands == 1) {
+            /* get addressing mode for operand1 */
+            operand1_addressing_mode = get_addressing_mode(operand1);
+
+            /* if operand1 is invalid, report error and skip to next line */
+            if (!is_valid_addressing_mode(operand1, operand1_addressing_mode)) {
+                ERROR_LINE(diagnostics, line_num, ERR_INVALID_OPERAND);
+                *has_errors = true;
+                return true;
+            }
 
-                /* assign src and dest modes */
-                src_mode = 0;
-                dest_mode = operand1_addressing_mode;
-            } else if (instruction_info->num_operands == 2) {
-                /* get addressing mode for operand1 */
-                operand1_addressing_mode = get_addressing_mode(operand1);
-
-                /* if operand1 is invalid, report error and skip to next line */
-                if (!is_valid_addressing_mode(operand1, operand1_addressing_mode)) {
-                    ERROR_LINE(line_num, ERR_INVALID_OPERAND);
-                    has_errors = true;
-                    continue;
-                }
+            /* if number is out of range, report error and skip to next line */
+            if (operand1_addressing_mode == ADDR_IMMEDIATE && !is_number_in_range(strtol(operand1 + 1, NULL, 10))) {
+                ERROR_LINE(diagnostics, line_num, ERR_NUMBER_OUT_OF_RANGE);
+                *has_errors = true;
+                return true;
+            }
 
-                /* if number is out of range, report error and skip to next line */
-                if (operand1_addressing_mode == ADDR_IMMEDIATE && !is_number_in_range(strtol(operand1 + 1, NULL, 10))) {
-                    ERROR_LINE(line_num, ERR_NUMBER_OUT_OF_RANGE);
-                    has_errors = true;
-                    continue;
-                }
+            /* if invalid dest mode, report error and skip to next line */
+            if (!is_valid_dest_mode(instruction_info, operand1_addressing_mode)) {
+                ERROR_LINE(diagnostics, line_num, ERR_INVALID_DEST_MODE);
+                *has_errors = true;
+                return true;
+            }
 
-                /* if invalid src mode, report error and skip to next line */
-                if (!is_valid_src_mode(instruction_info, operand1_addressing_mode)) {
-                    ERROR_LINE(line_num, ERR_INVALID_SOURCE_MODE);
-                    has_errors = true;
-                    continue;
-                }
+            /* assign src and dest modes */
+            src_mode = 0;
+            dest_mode = operand1_addressing_mode;
+        } else if (instruction_info->num_operands == 2) {
+            /* get addressing mode for operand1 */
+            operand1_addressing_mode = get_addressing_mode(operand1);
+
+            /* if operand1 is invalid, report error and skip to next line */
+            if (!is_valid_addressing_mode(operand1, operand1_addressing_mode)) {
+                ERROR_LINE(diagnostics, line_num, ERR_INVALID_OPERAND);
+                *has_errors = true;
+                return true;
+            }
 
-                /* get addressing mode for operand2 */
-                operand2_addressing_mode = get_addressing_mode(operand2);
+            /* if number is out of range, report error and skip to next line */
+            if (operand1_addressing_mode == ADDR_IMMEDIATE && !is_number_in_range(strtol(operand1 + 1, NULL, 10))) {
+                ERROR_LINE(diagnostics, line_num, ERR_NUMBER_OUT_OF_RANGE);
+                *has_errors = true;
+                return true;
+            }
 
-                /* if operand2 is invalid, report error and skip to next line */
-                if (!is_valid_addressing_mode(operand2, operand2_addressing_mode)) {
-                    ERROR_LINE(line_num, ERR_INVALID_OPERAND);
-                    has_errors = true;
-                    continue;
-                }
+            /* if invalid src mode, report error and skip to next line */
+            if (!is_valid_src_mode(instruction_info, operand1_addressing_mode)) {
+                ERROR_LINE(diagnostics, line_num, ERR_INVALID_SOURCE_MODE);
+                *has_errors = true;
+                return true;
+            }
 
-                /* if number is out of range, report error and skip to next line */
-                if (operand2_addressing_mode == ADDR_IMMEDIATE && !is_number_in_range(strtol(operand2 + 1, NULL, 10))) {
-                    ERROR_LINE(line_num, ERR_NUMBER_OUT_OF_RANGE);
-                    has_errors = true;
-                    continue;
-                }
+            /* get addressing mode for operand2 */
+            operand2_addressing_mode = get_addressing_mode(operand2);
 
-                /* if invalid dest mode, report error and skip to next line */
-                if (!is_valid_dest_mode(instruction_info, operand2_addressing_mode)) {
-                    ERROR_LINE(line_num, ERR_INVALID_DEST_MODE);
-                    has_errors = true;
-                    continue;
-                }
+            /* if operand2 is invalid, report error and skip to next line */
+            if (!is_valid_addressing_mode(operand2, operand2_addressing_mode)) {
+                ERROR_LINE(diagnostics, line_num, ERR_INVALID_OPERAND);
+                *has_errors = true;
+                return true;
+            }
 
-                /* assign src and dest modes */
-                src_mode = operand1_addressing_mode;
-                dest_mode = operand2_addressing_mode;
+            /* if number is out of range, report error and skip to next line */
+            if (operand2_addressing_mode == ADDR_IMMEDIATE && !is_number_in_range(strtol(operand2 + 1, NULL, 10))) {
+                ERROR_LINE(diagnostics, line_num, ERR_NUMBER_OUT_OF_RANGE);
+                *has_errors = true;
+                return true;
             }
 
-            /* calculate instruction length */
-            instruction_length = 1 + instruction_info->num_operands;
+            /* if invalid dest mode, report error and skip to next line */
+            if (!is_valid_dest_mode(instruction_info, operand2_addressing_mode)) {
+                ERROR_LINE(diagnostics, line_num, ERR_INVALID_DEST_MODE);
+                *has_errors = true;
+                return true;
+            }
 
-            /* if memory overflow, report error and skip to next line */
-            if (!has_memory(state->ic, state->dc, instruction_length)) {
-                report_memory_overflow(line_num, &memory_overflow_reported);
-                has_errors = true;
-                goto next_line;
-            }
-
-            /* calculate index */
-            code_index = state->ic - IC_START;
-
-            /* encode first word */
-            state->code[code_index].value =
-                (instruction_info->opcode << 8) | (instruction_info->funct << 4) | (src_mode << 2) | dest_mode;
-            state->code[code_index].are = ARE_A;
-
-            /* encode operand1 */
-            if (instruction_info->num_operands >= 1) {
-                /* advance code_index to next word */
-                code_index++;
-                /* if addressing mode is immediate, store the number value (skip '#') */
-                if (operand1_addressing_mode == ADDR_IMMEDIATE) {
-                    state->code[code_index].value = strtol(operand1 + 1, NULL, 10);
-                    state->code[code_index].are = ARE_A;
-                    /* if addressing mode is register, store bitmask (bit N set for rN) */
-                } else if (operand1_addressing_mode == ADDR_REGISTER) {
-                    state->code[code_index].value = 1 << (operand1[1] - '0');
-                    state->code[code_index].are = ARE_A;
-                    /* if addressing mode is direct or relative, placeholder for second pass */
-                } else {
-                    state->code[code_index].value = 0;
-                    state->code[code_index].are = ARE_A;
+            /* assign src and dest modes */
+            src_mode = operand1_addressing_mode;
+            dest_mode = operand2_addressing_mode;
+        }
+
+        /* calculate instruction length */
+        instruction_length = 1 + instruction_info->num_operands;
+
+        /* if memory overflow, report error and skip to next line */
+        if (!has_memory(state, instruction_length)) {
+            report_memory_overflow(diagnostics, line_num, memory_overflow_reported);
+            *has_errors = true;
+            return true;
+        }
+
+        /* make sure code segment has room for the whole instruction, if failed, throw error and cleanup */
+        if (!segment_reserve(&state->code, instruction_length)) {
+            ERROR(diagnostics, ERR_MEMORY_ALLOC);
+            return false;
+        }
+
+        /* calculate index */
+        code_index = state->ic - state->ic_start;
+
+        /* encode first word */
+        state->code.words[code_index] = MAKE_WORD(
+            (instruction_info->opcode << 8) | (instruction_info->funct << 4) | (src_mode << 2) | dest_mode, ARE_A);
+
+        /* encode operand1 */
+        if (instruction_info->num_operands >= 1) {
+            /* advance code_index to next word */
+            code_index++;
+            /* if addressing mode is immediate, store the number value (skip '#') */
+            if (operand1_addressing_mode == ADDR_IMMEDIATE)
+                state->code.words[code_index] = MAKE_WORD(strtol(operand1 + 1, NULL, 10), ARE_A);
+            /* if addressing mode is register, store bitmask (bit N set for rN) */
+            else if (operand1_addressing_mode == ADDR_REGISTER)
+                state->code.words[code_index] = MAKE_WORD(1 << (operand1[1] - '0'), ARE_A);
+            /* if addressing mode is direct or relative, placeholder for second pass */
+            else {
+                state->code.words[code_index] = MAKE_WORD(0, ARE_A);
+                /* record symbol name (skip '%' if relative), if failed, throw error and cleanup */
+                if (!add_reference(state, code_index, line_num,
+                                   operand1 + (operand1_addressing_mode == ADDR_RELATIVE ? 1 : 0),
+                                   operand1_addressing_mode == ADDR_RELATIVE)) {
+                    ERROR(diagnostics, ERR_MEMORY_ALLOC);
+                    return false;
                 }
             }
+        }
 
-            /* encode operand2 */
-            if (instruction_info->num_operands == 2) {
-                /* advance code_index to next word */
-                code_index++;
-                /* if addressing mode is immediate, store the number value (skip '#') */
-                if (operand2_addressing_mode == ADDR_IMMEDIATE) {
-                    state->code[code_index].value = strtol(operand2 + 1, NULL, 10);
-                    state->code[code_index].are = ARE_A;
-                    /* if addressing mode is register, store bitmask (bit N set for rN) */
-                } else if (operand2_addressing_mode == ADDR_REGISTER) {
-                    state->code[code_index].value = 1 << (operand2[1] - '0');
-                    state->code[code_index].are = ARE_A;
-                    /* if addressing mode is direct or relative, placeholder for second pass */
-                } else {
-                    state->code[code_index].value = 0;
-                    state->code[code_index].are = ARE_A;
+        /* encode operand2 */
+        if (instruction_info->num_operands == 2) {
+            /* advance code_index to next word */
+            code_index++;
+            /* if addressing mode is immediate, store the number value (skip '#') */
+            if (operand2_addressing_mode == ADDR_IMMEDIATE)
+                state->code.words[code_index] = MAKE_WORD(strtol(operand2 + 1, NULL, 10), ARE_A);
+            /* if addressing mode is register, store bitmask (bit N set for rN) */
+            else if (operand2_addressing_mode == ADDR_REGISTER)
+                state->code.words[code_index] = MAKE_WORD(1 << (operand2[1] - '0'), ARE_A);
+            /* if addressing mode is direct or relative, placeholder for second pass */
+            else {
+                state->code.words[code_index] = MAKE_WORD(0, ARE_A);
+                /* record symbol name (skip '%' if relative), if failed, throw error and cleanup */
+                if (!add_reference(state, code_index, line_num,
+                                   operand2 + (operand2_addressing_mode == ADDR_RELATIVE ? 1 : 0),
+                                   operand2_addressing_mode == ADDR_RELATIVE)) {
+                    ERROR(diagnostics, ERR_MEMORY_ALLOC);
+                    return false;
                 }
             }
+        }
+
+        /* advance ic and code segment past the instruction */
+        state->ic += instruction_length;
+        state->code.count += instruction_length;
+    }
+
+    return true;
+}
+
+/* parses lines into state until the error limit is reached, returns false on fatal error */
+static Bool parse_lines(AssemblerState *state, char **lines, int line_count, int first_line_num, Bool *has_errors) {
+    /* a flag to tell whether memory overflow error was already reported or not */
+    Bool memory_overflow_reported = false;
+    /* index tracker */
+    int i;
 
-            state->ic += instruction_length;
+    /* while there are lines to parse and the error limit wasn't reached */
+    for (i = 0; i < line_count && !diagnostics_should_stop(state->diagnostics); i++) {
+        /* the listing needs where each line's words start */
+        if (KEEP_LISTING(state) && !add_listing_line(state, state->code.count, state->data.count)) {
+            ERROR(state->diagnostics, ERR_MEMORY_ALLOC);
+            return false;
         }
+        if (!parse_line(state, lines[i], first_line_num + i, has_errors, &memory_overflow_reported))
+            return false;
+    }
+    return true;
+}
 
-next_line:;
+/* splits text of state to state lines in place (newlines become NULL terminators), returns false if allocation
+ * failed */
+static Bool split_lines(AssemblerState *state, int *line_count) {
+    /* lines array */
+    char **lines;
+    /* current position in text */
+    char *current;
+    /* end of text */
+    char *end = state->text.data + state->text.length;
+    /* next newline */
+    char *newline;
+
+    /* count lines first so the array is allocated once */
+    *line_count = 0;
+    for (current = state->text.data; current < end; current = newline + 1) {
+        newline = memchr(current, '\n', end - current);
+        (*line_count)++;
+        if (!newline)
+            break;
+    }
+
+    /* grow lines array if the previous files' one is too small */
+    if (*line_count > state->line_capacity) {
+        lines = realloc(state->lines, *line_count * sizeof(char *));
+        if (!lines)
+            return false;
+        state->lines = lines;
+        state->line_capacity = *line_count;
+    }
+    lines = state->lines;
+
+    /* store each line start and terminate the line */
+    *line_count = 0;
+    for (current = state->text.data; current < end; current = newline + 1) {
+        lines[(*line_count)++] = current;
+        newline = memchr(current, '\n', end - current);
+        if (!newline)
+            break;
+        *newline = '\0';
+    }
+    return true;
+}
+
+/* parses a range of lines on its own thread into a private state */
+static void *parse_chunk(void *arg) {
+    /* the chunk to parse */
+    FirstPassChunk *chunk = (FirstPassChunk *)arg;
+    /* a flag to tell whether the chunk has any errors or not */
+    Bool has_errors = false;
+    /* when the chunk started, for the trace */
+    double start = trace_now();
+
+    /* a chunk with errors is thrown away, so a fatal error and a regular one are the same here */
+    chunk->success = parse_lines(chunk->state, chunk->lines, chunk->line_count, chunk->first_line_num, &has_errors) &&
+                     !has_errors;
+    trace_span("parse_chunk", start, NULL, chunk->line_count);
+    return NULL;
+}
+
+static void merge_chunk_symbol(char *key, void *data, void *context) {
+    /* cast data to Symbol pointer */
+    Symbol *chunk_symbol = (Symbol *)data;
+    /* cast context to SymbolMerge pointer */
+    SymbolMerge *merge = (SymbolMerge *)context;
+    /* existing symbol with same name from a previous chunk, NULL if not found */
+    Symbol *existing;
+    /* the merged symbol */
+    Symbol *symbol;
+
+    /* nothing to do once the merge failed */
+    if (!merge->success)
+        return;
+
+    /* two externals with the same name are fine, any other clash is an error the serial pass should report */
+    existing = hash_table_lookup(merge->state->symbols, key);
+    STATS_ADD(merge->state->stats, phases[PHASE_FIRST_PASS].hash_lookups, 1);
+    if (existing) {
+        merge->success = existing->type == SYMBOL_EXTERNAL && chunk_symbol->type == SYMBOL_EXTERNAL;
+        return;
+    }
+
+    /* copy symbol, moving chunk-relative addresses by the size of all previous chunks */
+    symbol = acquire_symbol(merge->state);
+    if (!symbol) {
+        merge->success = false;
+        return;
+    }
+    symbol->type = chunk_symbol->type;
+    symbol->is_entry = chunk_symbol->is_entry;
+    symbol->address = chunk_symbol->address;
+    if (symbol->type == SYMBOL_CODE)
+        symbol->address += merge->code_offset;
+    else if (symbol->type == SYMBOL_DATA)
+        symbol->address += merge->data_offset;
+
+    /* if insertion failed, free symbol and fail the merge */
+    STATS_ADD(merge->state->stats, phases[PHASE_FIRST_PASS].hash_inserts, 1);
+    if (!hash_table_insert(merge->state->symbols, key, symbol)) {
+        free_symbol(symbol);
+        merge->success = false;
+    }
+}
+
+/* appends words of a chunk segment to segment, returns false if allocation failed */
+static Bool append_segment(Segment *segment, Segment *chunk_segment) {
+    if (!segment_reserve(segment, chunk_segment->count))
+        return false;
+    if (chunk_segment->count > 0)
+        memcpy(segment->words + segment->count, chunk_segment->words, chunk_segment->count * sizeof(Word));
+    segment->count += chunk_segment->count;
+    return true;
+}
+
+/* appends references and entries of a chunk to state, moving their code indexes by code_offset, returns false if
+ * allocation failed */
+static Bool append_requests(AssemblerState *state, AssemblerState *chunk_state, int code_offset) {
+    /* current reference or entry of the chunk */
+    SymbolReference *reference;
+    EntryRequest *entry;
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < chunk_state->reference_count; i++) {
+        reference = &chunk_state->references[i];
+        if (!add_reference(state, reference->code_index + code_offset, reference->line_num,
+                           chunk_state->names.data + reference->name, reference->is_relative))
+            return false;
+    }
+    for (i = 0; i < chunk_state->entry_count; i++) {
+        entry = &chunk_state->entries[i];
+        if (!add_entry_request(state, entry->line_num, chunk_state->names.data + entry->name))
+            return false;
+    }
+    return true;
+}
+
+/* appends listing lines of a chunk to state, moving them by the code and data words of the previous chunks, returns
+ * false if allocation failed */
+static Bool append_listing(AssemblerState *state, AssemblerState *chunk_state, int code_offset, int data_offset) {
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < chunk_state->listing_count; i++) {
+        if (!add_listing_line(state, chunk_state->listing[i].code_index + code_offset,
+                              chunk_state->listing[i].data_index + data_offset))
+            return false;
+    }
+    return true;
+}
+
+/* keeps the text of the whole file (lines already split) for the listing, returns false if allocation failed */
+static Bool keep_listing_text(AssemblerState *state, char *buffer, size_t size) {
+    /* the NULL terminator after the last line is kept too, in case it didn't end with a newline */
+    return !KEEP_LISTING(state) || buffer_append(&state->listing_text, buffer, size + 1);
+}
+
+/* parses lines on several threads and merges the results into state, returns false if the serial pass should run
+ * instead (any error, including a clash only visible across chunks, is left for it to report in order) */
+static Bool parse_parallel(AssemblerState *state, char **lines, int line_count) {
+    /* used to tell the caller whether the merged state can be used or not */
+    Bool success = false;
+    /* chunks, one per thread */
+    FirstPassChunk chunks[FIRST_PASS_THREADS];
+    /* parsing threads */
+    pthread_t threads[FIRST_PASS_THREADS];
+    /* whether threads[i] was started */
+    Bool thread_started[FIRST_PASS_THREADS];
+    /* count of chunks */
+    int chunk_count;
+    /* lines per chunk */
+    int lines_per_chunk;
+    /* context for merging each chunk's symbols */
+    SymbolMerge merge;
+    /* a collected warning to pass on */
+    Diagnostic *record;
+    /* counters of this pass, NULL if disabled */
+    PhaseStats *stats = STATS_PHASE(state->stats, PHASE_FIRST_PASS);
+    /* index trackers */
+    int i, j;
+
+    /* split lines to chunks */
+    chunk_count = line_count / MIN_LINES_PER_THREAD;
+    if (chunk_count > FIRST_PASS_THREADS)
+        chunk_count = FIRST_PASS_THREADS;
+    lines_per_chunk = (line_count + chunk_count - 1) / chunk_count;
+    for (i = 0; i < chunk_count; i++) {
+        chunks[i].lines = lines + i * lines_per_chunk;
+        chunks[i].first_line_num = 1 + i * lines_per_chunk;
+        chunks[i].line_count = line_count - i * lines_per_chunk;
+        if (chunks[i].line_count > lines_per_chunk)
+            chunks[i].line_count = lines_per_chunk;
+        chunks[i].success = false;
+        thread_started[i] = false;
+        /* each chunk counts ic from ic_start and dc from 0, memory is checked after the merge */
+        chunks[i].state = create_assembler_state();
+        if (chunks[i].state) {
+            chunks[i].state->ic_start = state->ic_start;
+            chunks[i].state->ic = state->ic_start;
+            chunks[i].state->memory_size = INT_MAX;
+            chunks[i].state->diagnostics = diagnostics_create(0);
+            chunks[i].state->outputs = state->outputs;
+            /* threads can't share the file's counters, each chunk counts on its own */
+            stats_reset(&chunks[i].stats);
+            if (state->stats)
+                chunks[i].state->stats = &chunks[i].stats;
+        }
+    }
+
+    /* parse all chunks but the first on their own threads */
+    for (i = 1; i < chunk_count; i++) {
+        if (chunks[i].state && chunks[i].state->diagnostics)
+            thread_started[i] = pthread_create(&threads[i], NULL, parse_chunk, &chunks[i]) == 0;
+    }
+    /* parse the first chunk, and any chunk whose thread failed to start, on this thread */
+    for (i = 0; i < chunk_count; i++) {
+        if (!thread_started[i] && chunks[i].state && chunks[i].state->diagnostics)
+            parse_chunk(&chunks[i]);
+    }
+    /* wait for all threads */
+    for (i = 1; i < chunk_count; i++) {
+        if (thread_started[i])
+            pthread_join(threads[i], NULL);
+    }
+
+    /* the chunks' work counts even if the serial pass has to redo it */
+    for (i = 0; i < chunk_count; i++) {
+        STATS_ADD(stats, hash_lookups, chunks[i].stats.phases[PHASE_FIRST_PASS].hash_lookups);
+        STATS_ADD(stats, hash_inserts, chunks[i].stats.phases[PHASE_FIRST_PASS].hash_inserts);
+    }
+
+    /* if any chunk failed, let the serial pass run */
+    for (i = 0; i < chunk_count; i++) {
+        if (!chunks[i].success)
+            goto cleanup;
+    }
+
+    /* merge chunks in order, prefix sums of code and data sizes give each chunk's offsets */
+    merge.state = state;
+    merge.code_offset = 0;
+    merge.data_offset = 0;
+    merge.success = true;
+    for (i = 0; i < chunk_count && merge.success; i++) {
+        hash_table_foreach(chunks[i].state->symbols, merge_chunk_symbol, &merge);
+        if (!append_segment(&state->code, &chunks[i].state->code) ||
+            !append_segment(&state->data, &chunks[i].state->data) ||
+            !append_requests(state, chunks[i].state, merge.code_offset) ||
+            !append_listing(state, chunks[i].state, merge.code_offset, merge.data_offset))
+            merge.success = false;
+        merge.code_offset += chunks[i].state->code.count;
+        merge.data_offset += chunks[i].state->data.count;
+    }
+    if (!merge.success)
+        goto cleanup;
+
+    /* set final counters */
+    state->ic = state->ic_start + state->code.count;
+    state->dc = state->data.count;
+    /* if the program doesn't fit in memory, let the serial pass report where */
+    if (!has_memory(state, 0))
+        goto cleanup;
+
+    /* pass on the chunks' warnings in line order */
+    for (i = 0; i < chunk_count; i++) {
+        for (j = 0; j < chunks[i].state->diagnostics->count; j++) {
+            record = &chunks[i].state->diagnostics->records[j];
+            diagnostics_report(state->diagnostics, record->severity, record->line, record->code, record->message,
+                               record->argument);
+        }
+    }
+
+    success = true;
+
+cleanup:
+    /* free chunk states and their collectors */
+    for (i = 0; i < chunk_count; i++) {
+        if (chunks[i].state) {
+            diagnostics_free(chunks[i].state->diagnostics);
+            free_assembler_state(chunks[i].state);
+        }
+    }
+
+    return success;
+}
+
+Bool first_pass(char *filename, AssemblerState *state) {
+    /* where to report errors */
+    Diagnostics *diagnostics = state->diagnostics;
+    /* used to tell the caller whether the pass succeeded or not */
+    Bool success = false;
+    /* a flag to tell whether the file has any errors or not */
+    Bool has_errors = false;
+    /* count of lines */
+    int line_count;
+    /* input file path */
+    char input_file_path[MAX_LINE];
+    /* original file */
+    FILE *input_file = NULL;
+    /* counters of this pass, NULL if disabled */
+    PhaseStats *stats = STATS_PHASE(state->stats, PHASE_FIRST_PASS);
+    /* length of the listing's copy of the lines */
+    size_t listing_text_length;
+    /* count of the lines' origins */
+    int origin_count;
+
+    /* write input path to input_file_path */
+    sprintf(input_file_path, "%s.am", filename);
+    /* following errors belong to input_file_path, if failed, throw error and cleanup */
+    if (!diagnostics_set_file(diagnostics, input_file_path)) {
+        ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        goto cleanup;
+    }
+
+    /* open input_file as read-only */
+    input_file = fopen(input_file_path, "r");
+    /* if failed, throw error and cleanup */
+    if (!input_file) {
+        ERROR_FILE(diagnostics, ERR_CANNOT_OPEN_FILE, input_file_path);
+        goto cleanup;
+    }
+
+    /* read whole input file and split it to lines (both kept in state for the next file), if failed, throw error and
+     * cleanup */
+    if (!read_file_to_buffer(input_file, &state->text) || !split_lines(state, &line_count)) {
+        ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        goto cleanup;
+    }
+    STATS_ADD(stats, lines_read, line_count);
+    STATS_ADD(stats, bytes_read, state->text.length);
+    /* parsing changes the lines, so the listing's copy is taken first */
+    if (!keep_listing_text(state, state->text.data, state->text.length)) {
+        ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        goto cleanup;
+    }
+
+    /* big files are parsed in chunks on several threads, if that isn't possible or a chunk found an error, parse the
+     * whole file again on this thread so errors are reported exactly as they always were */
+    if (line_count < 2 * MIN_LINES_PER_THREAD || !parse_parallel(state, state->lines, line_count)) {
+        /* the chunks already changed the lines, so the listing's copy survives the reset (which keeps its data), and
+         * so do the pre-assembler's origins (the lines still point into the text, which only loses its length) */
+        listing_text_length = state->listing_text.length;
+        origin_count = state->origins.count;
+        reset_assembler_state(state);
+        state->listing_text.length = listing_text_length;
+        state->origins.count = origin_count;
+        /* if a fatal error happened, cleanup (error already reported) */
+        if (!parse_lines(state, state->lines, line_count, 1, &has_errors))
+            goto cleanup;
     }
 
     hash_table_foreach(state->symbols, update_symbol_data_address, &state->ic);
+    STATS_ADD(state->stats, symbols, state->symbols->count);
 
-    success = !has_errors;
+    /* fail if there were errors, or if the error limit stopped the pass early */
+    success = !has_errors && !diagnostics_should_stop(diagnostics);
 
 cleanup:
     /* if input_file is open, close it */
     if (input_file)
         fclose(input_file);
 
-    /* if success is false, free assembler state and set state variable to NULL */
-    if (!success)
-        state = free_assembler_state(state);
+    return success;
+}
+
+void first_pass_begin(FirstPassStream *stream, char *filename, AssemblerState *state) {
+    /* input file path */
+    char input_file_path[MAX_LINE];
+
+    stream->state = state;
+    stream->line_num = 0;
+    stream->has_errors = false;
+    stream->memory_overflow_reported = false;
+    stream->failed = false;
+
+    /* write input path to input_file_path */
+    sprintf(input_file_path, "%s.am", filename);
+    /* following errors belong to input_file_path, if failed, throw error and ignore the lines */
+    if (!diagnostics_set_file(state->diagnostics, input_file_path)) {
+        ERROR(state->diagnostics, ERR_MEMORY_ALLOC);
+        stream->failed = true;
+    }
+}
+
+void first_pass_feed(FirstPassStream *stream, char *line) {
+    /* count every line so errors point at the right one */
+    stream->line_num++;
+    STATS_ADD(stream->state->stats, phases[PHASE_FIRST_PASS].bytes_read, strlen(line));
+
+    /* after a fatal error or once the error limit was reached, ignore the line */
+    if (stream->failed || diagnostics_should_stop(stream->state->diagnostics))
+        return;
+
+    /* the listing needs where the line's words start, and its text before parsing changes it */
+    if (KEEP_LISTING(stream->state) &&
+        (!add_listing_line(stream->state, stream->state->code.count, stream->state->data.count) ||
+         !buffer_append(&stream->state->listing_text, line, strlen(line) + 1))) {
+        ERROR(stream->state->diagnostics, ERR_MEMORY_ALLOC);
+        stream->failed = true;
+        return;
+    }
+
+    /* if a fatal error happened, ignore the following lines (error already reported) */
+    if (!parse_line(stream->state, line, stream->line_num, &stream->has_errors, &stream->memory_overflow_reported))
+        stream->failed = true;
+}
+
+Bool first_pass_end(FirstPassStream *stream) {
+    STATS_ADD(stream->state->stats, phases[PHASE_FIRST_PASS].lines_read, stream->line_num);
+    /* if a fatal error happened, fail (error already reported) */
+    if (stream->failed)
+        return false;
+
+    hash_table_foreach(stream->state->symbols, update_symbol_data_address, &stream->state->ic);
+    STATS_ADD(stream->state->stats, symbols, stream->state->symbols->count);
 
-    return state;
+    /* fail if there were errors, or if the error limit stopped the pass early */
+    return !stream->has_errors && !diagnostics_should_stop(stream->state->diagnostics);
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 
+#include "alloc.h"
 #include "bool.h"
 #include "hash_table.h"
 #include "string.h"
@@ -79,6 +80,8 @@ HashTable *hash_table_create(void) {
     table->size = INITIAL_TABLE_SIZE;
     /* set the count of key/value elements stored to 0 */
     table->count = 0;
+    /* no recycled nodes yet */
+    table->free_nodes = NULL;
     /* return table */
     return table;
 }
@@ -86,6 +89,10 @@ HashTable *hash_table_create(void) {
 Bool hash_table_insert(HashTable *table, char *key, void *data) {
     /* would be used as the new head if key doesn't exist in table */
     Node *node;
+    /* key size including NULL terminator */
+    int key_size;
+    /* grown key buffer of a recycled node */
+    char *new_key;
     /* get the index of key */
     int index = hash(key) % table->size;
     /* points to the head of the first node under buckets[index] */
@@ -102,18 +109,40 @@ Bool hash_table_insert(HashTable *table, char *key, void *data) {
         /* current now points to next node (if any) */
         current = current->next;
     }
-    /* allocate new node */
-    node = malloc(sizeof(Node));
-    /* if allocation failed, return false */
-    if (!node)
-        return false;
-    /* allocate memory to clone our *char key to + 1 for NULL terminator */
-    node->key = malloc(strlen(key) + 1);
-    /* if allocation failed, free node and return false */
-    if (!node->key) {
-        /* free node */
-        free(node);
-        return false;
+    /* key size including NULL terminator */
+    key_size = strlen(key) + 1;
+    /* if there is a recycled node, reuse it */
+    if (table->free_nodes) {
+        /* pop node from free list */
+        node = table->free_nodes;
+        table->free_nodes = node->next;
+        /* if its key buffer is too small, grow it */
+        if (node->key_size < key_size) {
+            new_key = realloc(node->key, key_size);
+            /* if allocation failed, push node back and return false */
+            if (!new_key) {
+                node->next = table->free_nodes;
+                table->free_nodes = node;
+                return false;
+            }
+            node->key = new_key;
+            node->key_size = key_size;
+        }
+    } else {
+        /* allocate new node */
+        node = malloc(sizeof(Node));
+        /* if allocation failed, return false */
+        if (!node)
+            return false;
+        /* allocate memory to clone our *char key to + 1 for NULL terminator */
+        node->key = malloc(key_size);
+        /* if allocation failed, free node and return false */
+        if (!node->key) {
+            /* free node */
+            free(node);
+            return false;
+        }
+        node->key_size = key_size;
     }
     /* copy key to node->key */
     strcpy(node->key, key);
@@ -180,6 +209,33 @@ void hash_table_foreach(HashTable *table, void (*callback)(char *key, void *data
     }
 }
 
+void hash_table_clear(HashTable *table, void (*free_data)(void *)) {
+    /* would be the head of each bucket in the for loop */
+    Node *current;
+    /* would be current->next */
+    Node *next;
+    /* index tracker */
+    int i;
+    /* a loop that goes through all buckets */
+    for (i = 0; i < table->size; i++) {
+        /* move every node of buckets[i] to the free list, freeing data (if free_data was provided) */
+        for (current = table->buckets[i]; current != NULL; current = next) {
+            /* if free_data provided, call it to free data */
+            if (free_data)
+                free_data(current->data);
+            /* backup current->next before overwrite */
+            next = current->next;
+            /* push current to the free list (key buffer is kept) */
+            current->next = table->free_nodes;
+            table->free_nodes = current;
+        }
+        /* bucket is empty now */
+        table->buckets[i] = NULL;
+    }
+    /* table is empty, but keeps its size */
+    table->count = 0;
+}
+
 void hash_table_free(HashTable *table, void (*free_data)(void *)) {
     /* would be the head of each bucket in the for loop */
     Node *current;
@@ -207,6 +263,14 @@ void hash_table_free(HashTable *table, void (*free_data)(void *)) {
             current = next;
         }
     }
+    /* free recycled nodes, their data was already freed by hash_table_clear */
+    for (current = table->free_nodes; current != NULL; current = next) {
+        /* backup current->next before freeing current */
+        next = current->next;
+        /* free key and node */
+        free(current->key);
+        free(current);
+    }
     /* free the whole buckets array */
     free(table->buckets);
     /* at last, free table */
@@ -1,9 +1,83 @@
 #include <stdio.h>
+#include <stdlib.h>
 
+#include "alloc.h"
+#include "bool.h"
+#include "buffer.h"
 #include "helpers.h"
 
 void discard_rest_of_line(FILE *file) {
     int c;
     /* discard characters until newline or end of file */
     while ((c = fgetc(file)) != '\n' && c != EOF);
+}
+
+Bool read_file(FILE *file, char **buffer, size_t *size) {
+    /* buffer capacity */
+    size_t capacity = READ_CHUNK_SIZE;
+    /* count of bytes read by the last fread */
+    size_t bytes_read;
+    /* temp variable to store buffer before realloc (used for cleanup) */
+    char *prev_buffer;
+
+    *size = 0;
+    /* allocate initial buffer, + 1 for NULL terminator */
+    *buffer = malloc(capacity + 1);
+    if (!*buffer)
+        return false;
+
+    /* read until end of file, doubling the buffer whenever it is full */
+    while ((bytes_read = fread(*buffer + *size, 1, capacity - *size, file)) > 0) {
+        *size += bytes_read;
+        if (*size == capacity) {
+            /* backup buffer before realloc */
+            prev_buffer = *buffer;
+            capacity *= 2;
+            *buffer = realloc(*buffer, capacity + 1);
+            /* if realloc failed, free previous buffer */
+            if (!*buffer) {
+                free(prev_buffer);
+                return false;
+            }
+        }
+    }
+
+    /* add NULL terminator at the end of buffer */
+    (*buffer)[*size] = '\0';
+    return true;
+}
+
+Bool read_file_to_buffer(FILE *file, Buffer *buffer) {
+    /* count of bytes read by the last fread */
+    size_t bytes_read;
+
+    buffer->length = 0;
+    /* read until end of file, making room for another chunk and the NULL terminator before each read */
+    do {
+        if (!buffer_reserve(buffer, READ_CHUNK_SIZE + 1))
+            return false;
+        bytes_read = fread(buffer->data + buffer->length, 1, buffer->capacity - buffer->length - 1, file);
+        buffer->length += bytes_read;
+    } while (bytes_read > 0);
+
+    /* add NULL terminator at the end of buffer */
+    buffer->data[buffer->length] = '\0';
+    return true;
+}
+
+char *put_decimal(char *out, unsigned long value, int width, char pad) {
+    /* digits, least significant first */
+    char digits[24];
+    /* count of digits */
+    int count = 0;
+
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    for (; width > count; width--)
+        *out++ = pad;
+    while (count > 0)
+        *out++ = digits[--count];
+    return out;
 }
\ No newline at end of file
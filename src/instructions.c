@@ -22,4 +22,15 @@ Bool is_valid_src_mode(const InstructionInfo *info, int mode) {
 Bool is_valid_dest_mode(const InstructionInfo *info, int mode) {
     /* check if bit at position "mode" is set in dest_modes */
     return (info->dest_modes & (1 << mode)) != 0;
+}
+
+void build_decode_table(DecodeTable *table) {
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < DECODE_TABLE_SIZE; i++)
+        table->instructions[i] = NULL;
+    /* the first word of each instruction has its opcode and funct where DECODE_INDEX reads them */
+    for (i = 0; INSTRUCTION_TABLE[i].name != NULL; i++)
+        table->instructions[(INSTRUCTION_TABLE[i].opcode << 4) | INSTRUCTION_TABLE[i].funct] = &INSTRUCTION_TABLE[i];
 }
\ No newline at end of file
@@ -0,0 +1,496 @@
+/* mmap's MAP_ANONYMOUS is neither ANSI C nor POSIX */
+#define _DEFAULT_SOURCE
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* translated code is x86-64 and needs memory that is writable and executable */
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+#include "alloc.h"
+#include "assembler.h"
+#include "bool.h"
+#include "disassembler.h"
+#include "instructions.h"
+#include "jit.h"
+#include "simulator.h"
+
+/* room a block can take: prologue, at most 32 bytes per instruction, the exits after the last one and the exit for
+ * running out of instructions */
+#define JIT_MAX_BLOCK_BYTES (JIT_MAX_BLOCK * 32 + 64)
+/* x86-64 registers the code uses (eax and ecx for values, rdi for the machine, rsi for memory, rdx for the count) */
+#define REG_EAX 0
+#define REG_ECX 1
+#define REG_RSI 6
+#define REG_RDI 7
+/* shift that moves the sign bit of a 12-bit value to the sign bit of eax */
+#define WRAP_SHIFT 20
+
+/* instructions that are translated */
+typedef enum {
+    JIT_NONE,
+    JIT_MOV,
+    JIT_CMP,
+    JIT_ADD,
+    JIT_SUB,
+    JIT_LEA,
+    JIT_CLR,
+    JIT_NOT,
+    JIT_INC,
+    JIT_DEC,
+    JIT_JMP,
+    JIT_BNE
+} JitOp;
+
+/* where an operand of a translated instruction is */
+typedef enum { OPERAND_CONSTANT, OPERAND_REGISTER, OPERAND_MEMORY } OperandKind;
+
+/* an operand of a translated instruction */
+typedef struct {
+    OperandKind kind;
+    int value; /* the constant, register number or address */
+} JitOperand;
+
+/* translation of each instruction of INSTRUCTION_TABLE by name, and whether it writes its destination (the ones
+ * missing are run by the interpreter) */
+static const struct {
+    const char *name;
+    JitOp op;
+    Bool writes;
+} JIT_OPS[] = {{"mov", JIT_MOV, true}, {"cmp", JIT_CMP, false}, {"add", JIT_ADD, true}, {"sub", JIT_SUB, true},
+               {"lea", JIT_LEA, true}, {"clr", JIT_CLR, true},  {"not", JIT_NOT, true}, {"inc", JIT_INC, true},
+               {"dec", JIT_DEC, true}, {"jmp", JIT_JMP, false}, {"bne", JIT_BNE, false}, {NULL, JIT_NONE, false}};
+
+static void emit_byte(Jit *jit, int byte) {
+    jit->code[jit->used++] = (unsigned char)byte;
+}
+
+/* writes value as 4 little endian bytes at offset */
+static void put_int(Jit *jit, size_t offset, long value) {
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < 4; i++)
+        jit->code[offset + i] = (unsigned char)((unsigned long)value >> (8 * i));
+}
+
+static void emit_int(Jit *jit, long value) {
+    put_int(jit, jit->used, value);
+    jit->used += 4;
+}
+
+/* emits the modrm byte and displacement of [base + displacement] with reg */
+static void emit_address(Jit *jit, int reg, int base, long displacement) {
+    emit_byte(jit, 0x80 | (reg << 3) | base);
+    emit_int(jit, displacement);
+}
+
+/* emits an operand's address with reg, operand isn't a constant */
+static void emit_operand_address(Jit *jit, int reg, JitOperand *operand) {
+    if (operand->kind == OPERAND_REGISTER)
+        emit_address(jit, reg, REG_RDI, (long)offsetof(Machine, registers) + operand->value * (long)sizeof(int));
+    else
+        emit_address(jit, reg, REG_RSI, operand->value * (long)sizeof(int));
+}
+
+/* mov reg, operand */
+static void emit_load(Jit *jit, int reg, JitOperand *operand) {
+    if (operand->kind == OPERAND_CONSTANT) {
+        emit_byte(jit, 0xB8 + reg);
+        emit_int(jit, operand->value);
+        return;
+    }
+    emit_byte(jit, 0x8B);
+    emit_operand_address(jit, reg, operand);
+}
+
+/* mov operand, eax */
+static void emit_store(Jit *jit, JitOperand *operand) {
+    emit_byte(jit, 0x89);
+    emit_operand_address(jit, REG_EAX, operand);
+}
+
+/* wraps eax to a signed 12-bit value like SIGNED_VALUE (shl eax, sar eax) */
+static void emit_wrap(Jit *jit) {
+    emit_byte(jit, 0xC1);
+    emit_byte(jit, 0xE0);
+    emit_byte(jit, WRAP_SHIFT);
+    emit_byte(jit, 0xC1);
+    emit_byte(jit, 0xF8);
+    emit_byte(jit, WRAP_SHIFT);
+}
+
+/* writes a jump from the exit at offset to the block at entry */
+static void chain_exit(Jit *jit, size_t offset, JitBlock entry) {
+    /* the block's address, as bytes */
+    unsigned char *target;
+
+    memcpy(&target, &entry, sizeof(target));
+    /* jmp rel32 over the mov of the exit (its ret is then never reached) */
+    jit->code[offset] = 0xE9;
+    put_int(jit, offset + 1, (long)(target - (jit->code + offset + 5)));
+    jit->stats.chained++;
+}
+
+/* emits an exit to address: a jump to its block if it was translated, otherwise a return of address (mov eax,
+ * address, ret) that is chained once it is */
+static void emit_exit(Jit *jit, int address) {
+    /* the machine of jit */
+    Machine *machine = jit->machine;
+    /* where the exit starts */
+    size_t offset = jit->used;
+    /* a larger list of exits */
+    JitExit *exits;
+
+    /* every address outside of memory is the op that faults after it */
+    if (address < 0 || address > machine->memory_size)
+        address = machine->memory_size;
+    emit_byte(jit, 0xB8);
+    emit_int(jit, address);
+    emit_byte(jit, 0xC3);
+
+    if (jit->blocks[address]) {
+        chain_exit(jit, offset, jit->blocks[address]);
+        return;
+    }
+    /* an exit that can't be remembered just stays a return */
+    if (jit->exit_count == jit->exit_capacity) {
+        exits = realloc(jit->exits, (jit->exit_capacity * 2 + 16) * sizeof(JitExit));
+        if (!exits)
+            return;
+        jit->exits = exits;
+        jit->exit_capacity = jit->exit_capacity * 2 + 16;
+    }
+    jit->exits[jit->exit_count].target = address;
+    jit->exits[jit->exit_count].offset = offset;
+    jit->exit_count++;
+}
+
+/* drops every translated block */
+static void flush(Jit *jit) {
+    /* the machine of jit */
+    Machine *machine = jit->machine;
+
+    jit->used = 0;
+    jit->exit_count = 0;
+    memset(jit->blocks, 0, (machine->memory_size + 1) * sizeof(JitBlock));
+    memset(jit->interpreted, 0, (machine->memory_size + 1) * sizeof(Bool));
+    jit->stats.flushes++;
+}
+
+/* decodes the instruction at address into its operands, returns how it is translated, JIT_NONE if it can't be */
+static JitOp decode(Jit *jit, int address, DecodedInstruction *instruction, JitOperand operands[2]) {
+    /* the machine of jit */
+    Machine *machine = jit->machine;
+    /* translation of the instruction */
+    JitOp op = JIT_NONE;
+    /* whether it writes its destination */
+    Bool writes = false;
+    /* index tracker */
+    int i;
+
+    if (address >= machine->code_end || !machine->starts[address] ||
+        !machine_decode(machine, address, NULL, NULL, instruction))
+        return JIT_NONE;
+    for (i = 0; JIT_OPS[i].name != NULL; i++) {
+        if (strcmp(JIT_OPS[i].name, instruction->info->name) == 0) {
+            op = JIT_OPS[i].op;
+            writes = JIT_OPS[i].writes;
+        }
+    }
+
+    for (i = 0; op != JIT_NONE && i < instruction->info->num_operands; i++) {
+        operands[i].value = instruction->values[i];
+        if (instruction->modes[i] == ADDR_IMMEDIATE) {
+            /* the immediate's word can only change by a write into the code, which drops the translation */
+            operands[i].kind = OPERAND_CONSTANT;
+        } else if (instruction->modes[i] == ADDR_REGISTER) {
+            operands[i].kind = OPERAND_REGISTER;
+        } else if (instruction->modes[i] == ADDR_DIRECT) {
+            operands[i].kind = OPERAND_MEMORY;
+            /* externals and addresses outside the image fault in the interpreter */
+            if (MACHINE_ARE(machine, address + 1 + i) == ARE_E || instruction->values[i] >= machine->memory_size)
+                op = JIT_NONE;
+        } else {
+            operands[i].kind = OPERAND_CONSTANT;
+        }
+    }
+    /* the interpreter decodes again what a write into the code changed */
+    i = instruction->info->num_operands - 1;
+    if (writes && operands[i].kind == OPERAND_MEMORY && operands[i].value >= machine->code_start &&
+        operands[i].value < machine->code_end)
+        op = JIT_NONE;
+    return op;
+}
+
+/* emits instruction, translated by op, for operands (the last of which is the destination) */
+static void emit_instruction(Jit *jit, JitOp op, int address, DecodedInstruction *instruction,
+                             JitOperand operands[2]) {
+    /* destination operand */
+    JitOperand *dest = &operands[instruction->info->num_operands - 1];
+    /* lea's value */
+    JitOperand value;
+    /* offset of the rel32 of a conditional jump */
+    size_t jump;
+
+    switch (op) {
+    case JIT_MOV:
+        emit_load(jit, REG_EAX, &operands[0]);
+        emit_store(jit, dest);
+        break;
+    case JIT_CMP:
+        /* zero = src == dest (cmp eax, ecx, sete al, movzx eax, al) */
+        emit_load(jit, REG_EAX, &operands[0]);
+        emit_load(jit, REG_ECX, dest);
+        emit_byte(jit, 0x39);
+        emit_byte(jit, 0xC8);
+        emit_byte(jit, 0x0F);
+        emit_byte(jit, 0x94);
+        emit_byte(jit, 0xC0);
+        emit_byte(jit, 0x0F);
+        emit_byte(jit, 0xB6);
+        emit_byte(jit, 0xC0);
+        emit_byte(jit, 0x89);
+        emit_address(jit, REG_EAX, REG_RDI, (long)offsetof(Machine, zero));
+        break;
+    case JIT_ADD:
+    case JIT_SUB:
+        /* add or sub eax, ecx */
+        emit_load(jit, REG_EAX, dest);
+        emit_load(jit, REG_ECX, &operands[0]);
+        emit_byte(jit, op == JIT_ADD ? 0x01 : 0x29);
+        emit_byte(jit, 0xC8);
+        emit_wrap(jit);
+        emit_store(jit, dest);
+        break;
+    case JIT_LEA:
+        value.kind = OPERAND_CONSTANT;
+        value.value = SIGNED_VALUE(instruction->values[0]);
+        emit_load(jit, REG_EAX, &value);
+        emit_store(jit, dest);
+        break;
+    case JIT_CLR:
+        value.kind = OPERAND_CONSTANT;
+        value.value = 0;
+        emit_load(jit, REG_EAX, &value);
+        emit_store(jit, dest);
+        break;
+    case JIT_NOT:
+    case JIT_INC:
+    case JIT_DEC:
+        /* not eax, add eax, 1 or sub eax, 1 */
+        emit_load(jit, REG_EAX, dest);
+        emit_byte(jit, op == JIT_NOT ? 0xF7 : 0x83);
+        emit_byte(jit, op == JIT_NOT ? 0xD0 : op == JIT_INC ? 0xC0 : 0xE8);
+        if (op != JIT_NOT)
+            emit_byte(jit, 1);
+        emit_wrap(jit);
+        emit_store(jit, dest);
+        break;
+    case JIT_JMP:
+        emit_exit(jit, dest->value);
+        break;
+    case JIT_BNE:
+        /* cmp dword [zero], 0, jne to the exit to the next instruction */
+        emit_byte(jit, 0x83);
+        emit_address(jit, 7, REG_RDI, (long)offsetof(Machine, zero));
+        emit_byte(jit, 0);
+        emit_byte(jit, 0x0F);
+        emit_byte(jit, 0x85);
+        jump = jit->used;
+        emit_int(jit, 0);
+        emit_exit(jit, dest->value);
+        put_int(jit, jump, (long)(jit->used - (jump + 4)));
+        emit_exit(jit, address + instruction->length);
+        break;
+    case JIT_NONE:
+        break;
+    }
+}
+
+/* translates the block starting at start, returns it, NULL if its first instruction can't be translated */
+static JitBlock translate(Jit *jit, int start) {
+    /* where the block starts */
+    size_t begin;
+    /* offsets of the instruction count and of the jump to the exit for running out of them */
+    size_t count_offset, jump;
+    /* the block, and its code */
+    JitBlock block;
+    unsigned char *entry;
+    /* address of the current instruction */
+    int address = start;
+    /* count of instructions translated */
+    int count = 0;
+    /* the current instruction and its operands */
+    DecodedInstruction instruction;
+    JitOperand operands[2];
+    /* its translation */
+    JitOp op;
+    /* index tracker */
+    int i;
+
+    if (decode(jit, start, &instruction, operands) == JIT_NONE) {
+        jit->interpreted[start] = true;
+        return NULL;
+    }
+    if (jit->used + JIT_MAX_BLOCK_BYTES > JIT_BUFFER_SIZE)
+        flush(jit);
+    begin = jit->used;
+    /* converting a data pointer to a function pointer isn't ANSI C, copying its bytes is as close as it gets */
+    entry = jit->code + begin;
+    memcpy(&block, &entry, sizeof(block));
+    /* set first, so a loop back to the start jumps straight to it */
+    jit->blocks[start] = block;
+
+    /* take the block's instructions off the count left, and leave if there aren't as many (sub qword [rdx], count,
+     * jb rel32) */
+    emit_byte(jit, 0x48);
+    emit_byte(jit, 0x81);
+    emit_byte(jit, 0x2A);
+    count_offset = jit->used;
+    emit_int(jit, 0);
+    emit_byte(jit, 0x0F);
+    emit_byte(jit, 0x82);
+    jump = jit->used;
+    emit_int(jit, 0);
+
+    /* straight line code until a jump, an instruction that isn't translated, or the block's limit */
+    for (;;) {
+        op = count < JIT_MAX_BLOCK ? decode(jit, address, &instruction, operands) : JIT_NONE;
+        if (op == JIT_NONE) {
+            emit_exit(jit, address);
+            break;
+        }
+        emit_instruction(jit, op, address, &instruction, operands);
+        count++;
+        if (op == JIT_JMP || op == JIT_BNE)
+            break;
+        address += instruction.length;
+    }
+
+    /* leaving for lack of instructions gives the count back and returns the start (add qword [rdx], count, mov eax,
+     * start, ret) */
+    put_int(jit, count_offset, count);
+    put_int(jit, jump, (long)(jit->used - (jump + 4)));
+    emit_byte(jit, 0x48);
+    emit_byte(jit, 0x81);
+    emit_byte(jit, 0x02);
+    emit_int(jit, count);
+    emit_byte(jit, 0xB8);
+    emit_int(jit, start);
+    emit_byte(jit, 0xC3);
+
+    jit->lengths[start] = count;
+    jit->stats.blocks++;
+    jit->stats.translated += count;
+
+    /* exits waiting for this block jump to it from now on */
+    for (i = 0; i < jit->exit_count;) {
+        if (jit->exits[i].target == start) {
+            chain_exit(jit, jit->exits[i].offset, block);
+            jit->exits[i] = jit->exits[--jit->exit_count];
+        } else {
+            i++;
+        }
+    }
+    return block;
+}
+
+Jit *jit_create(Machine *machine) {
+#ifdef JIT_SUPPORTED
+    /* the translator to return */
+    Jit *jit = calloc(1, sizeof(Jit));
+    /* the executable buffer */
+    void *code;
+
+    if (!jit)
+        return NULL;
+    jit->machine = machine;
+    jit->blocks = calloc(machine->memory_size + 1, sizeof(JitBlock));
+    jit->lengths = calloc(machine->memory_size + 1, sizeof(int));
+    jit->interpreted = calloc(machine->memory_size + 1, sizeof(Bool));
+    code = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    jit->code = code == MAP_FAILED ? NULL : code;
+    if (!jit->blocks || !jit->lengths || !jit->interpreted || !jit->code)
+        return jit_free(jit);
+    return jit;
+#else
+    (void)machine;
+    return NULL;
+#endif
+}
+
+MachineStatus jit_run(Jit *jit, unsigned long max_steps) {
+    /* the machine of jit */
+    Machine *machine = jit->machine;
+    /* instructions this call may run, and how many of them are left */
+    unsigned long limit = max_steps ? max_steps : ULONG_MAX, remaining = limit;
+    /* the block at address */
+    JitBlock block;
+    /* an instruction run by the interpreter, and the one after it */
+    const MachineOp *op, *next;
+    /* address to continue at */
+    int address;
+
+    if (machine->status != MACHINE_RUNNING)
+        return machine->status;
+
+    address = machine->pc->address;
+    while (remaining > 0) {
+        block = jit->blocks[address];
+        if (!block && !jit->interpreted[address])
+            block = translate(jit, address);
+        /* a block runs until an exit that isn't chained, or until fewer instructions are left than it has */
+        if (block && remaining >= (unsigned long)jit->lengths[address]) {
+            address = block(machine, machine->memory, &remaining);
+            continue;
+        }
+
+        op = &machine->ops[address];
+        next = op->run(machine, op);
+        remaining--;
+        jit->stats.interpreted++;
+        if (!next)
+            break;
+        /* the only check wrapped around an instruction that goes on is the one of a write into the code, which may
+         * have changed translated instructions */
+        if (op->run != op->execute)
+            flush(jit);
+        address = next->address;
+    }
+
+    machine->steps += limit - remaining;
+    /* a stopped machine set its own pc */
+    if (machine->status == MACHINE_RUNNING)
+        machine->pc = &machine->ops[address];
+    return machine->status;
+}
+
+void jit_print_stats(FILE *out, Jit *jit) {
+    fprintf(out, "jit: %ld blocks (%ld instructions, %.1f per block), %ld chained exits, %ld flushes, %lu "
+                 "instructions interpreted\n",
+            jit->stats.blocks, jit->stats.translated,
+            jit->stats.blocks > 0 ? (double)jit->stats.translated / jit->stats.blocks : 0.0, jit->stats.chained,
+            jit->stats.flushes, jit->stats.interpreted);
+}
+
+Jit *jit_free(Jit *jit) {
+    if (jit) {
+#ifdef JIT_SUPPORTED
+        if (jit->code)
+            munmap(jit->code, JIT_BUFFER_SIZE);
+#endif
+        free(jit->blocks);
+        free(jit->lengths);
+        free(jit->interpreted);
+        free(jit->exits);
+        free(jit);
+    }
+    return NULL;
+}
\ No newline at end of file
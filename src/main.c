@@ -0,0 +1,293 @@
+/* assembler driver - assembles every file named on the command line (given without the .as extension)
+ *
+ * build: gcc -O2 -ansi -pedantic -Iinclude src/[a-z]*.c -pthread -o assembler
+ * usage: assembler [--stats] [--perf] [--trace FILE] [--pipeline] [--json] [--max-errors N] [--memory-size N]
+ *                  [--code-start N] [--symbols] [--listing] [--disassemble] [--source-map] [--deps] [--run]
+ *                  [--profile] [--jit] [--batch FILE] [--max-steps N] file...
+ *   --stats       print per-phase timers and counters of each file, then of all files, then the allocations of
+ *                 each phase (if built with -DTRACK_ALLOCATIONS) and the peak resident set size, and the speed of
+ *                 each run
+ *   --perf        print cycles, instructions, IPC and branch, L1d and LLC misses per line of each phase of each file,
+ *                 then of all files (only timers if the hardware counters can't be opened, ignored with --pipeline)
+ *   --trace       write a span of every phase of every file (and of every thread's share of a phase), plus the
+ *                 depth of the pipeline queues, as Chrome trace events to FILE (open it in Perfetto)
+ *   --pipeline    overlap expansion, parsing and writing of consecutive files on separate threads
+ *   --json        write errors and warnings as json instead of text
+ *   --max-errors  stop reporting a file's errors after N of them (0 for no limit)
+ *   --memory-size assemble for a target memory of N words (4096 by default), operand words still hold 12 bits
+ *                 (so relative operands are limited to targets within -2048..2047 words of their operand word)
+ *   --code-start  place the first code word at address N (100 by default), below the memory size
+ *   --symbols     also write each file's code and data symbols, sorted by address, to a .sym file
+ *   --listing     also write each file's lines with the address and value of every word they encode to a .lst file
+ *   --disassemble also write each file's disassembled code and data to a .dis file, and fail the file if any line
+ *                 doesn't disassemble back to its own text
+ *   --source-map  also write the .as line (and macro call) each file's words come from to a .map file, and show it
+ *                 next to every address of a --profile
+ *   --deps        also write a make rule saying each file's object depends on its .as file and included files to a
+ *                 .d file
+ *   --run         run each file that assembled without errors (reading stdin, writing stdout), and fail it if it
+ *                 doesn't reach stop (ignored with --pipeline)
+ *   --profile     run, then write how many times each address executed to a .prof file and print the instructions
+ *                 per second and the most executed addresses
+ *   --jit         run, translating the program's basic blocks into x86-64 code as they are first reached (interpreted
+ *                 where that isn't supported, or with --profile)
+ *   --batch       run each file once per line of FILE, all runs in lockstep, each reading its line as input, and
+ *                 write each run's status, instruction count and printed values to a .batch file
+ *   --max-steps   stop a run after N instructions (0 for no limit, per line with --batch) */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "assembler.h"
+#include "bool.h"
+#include "diagnostics.h"
+#include "errors.h"
+#include "perf.h"
+#include "pipeline.h"
+#include "pre_assembler.h"
+#include "simulator.h"
+#include "stats.h"
+#include "trace.h"
+
+/* errors reported per file unless --max-errors says otherwise */
+#define DEFAULT_MAX_ERRORS 100
+/* instructions a run may execute unless --max-steps says otherwise, so a program that loops forever fails */
+#define DEFAULT_MAX_STEPS 1000000000UL
+
+/* options given on the command line */
+typedef struct {
+    Bool stats;
+    Bool perf;
+    char *trace; /* trace file path, NULL if none */
+    Bool pipeline;
+    DiagnosticsFormat format;
+    int max_errors;
+    TargetOptions target;
+    OutputOptions outputs;
+    Bool run;
+    RunOptions run_options;
+    char **files;
+    int file_count;
+} Options;
+
+/* prints usage to stderr */
+static void print_usage(char *program) {
+    fprintf(stderr,
+            "usage: %s [--stats] [--perf] [--trace FILE] [--pipeline] [--json] [--max-errors N] [--memory-size N] "
+            "[--code-start N] [--symbols] [--listing] [--disassemble] [--source-map] [--deps] [--run] [--profile] "
+            "[--jit] [--batch FILE] [--max-steps N] file...\n",
+            program);
+}
+
+/* parses text as a whole decimal number into value, returns false if it isn't one or is outside min..max */
+static Bool parse_number(char *text, long min, long max, int *value) {
+    /* end of the number */
+    char *end;
+    /* the number */
+    long number = strtol(text, &end, 10);
+
+    if (end == text || *end != '\0' || number < min || number > max)
+        return false;
+    *value = (int)number;
+    return true;
+}
+
+/* parses argv into options, returns false if they are invalid */
+static Bool parse_options(int argc, char *argv[], Options *options) {
+    /* index tracker */
+    int i;
+
+    options->stats = false;
+    options->perf = false;
+    options->trace = NULL;
+    options->pipeline = false;
+    options->format = DIAGNOSTICS_TEXT;
+    options->max_errors = DEFAULT_MAX_ERRORS;
+    options->target.memory_size = MAX_MEMORY;
+    options->target.ic_start = IC_START;
+    options->outputs.symbols = false;
+    options->outputs.listing = false;
+    options->outputs.disassembly = false;
+    options->outputs.source_map = false;
+    options->outputs.dependencies = false;
+    options->run = false;
+    options->run_options.profile = false;
+    options->run_options.jit = false;
+    options->run_options.stats = false;
+    options->run_options.batch = NULL;
+    options->run_options.max_steps = DEFAULT_MAX_STEPS;
+
+    /* options come first, everything after them is a file */
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--stats") == 0)
+            options->stats = options->run_options.stats = true;
+        else if (strcmp(argv[i], "--perf") == 0)
+            options->perf = true;
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            options->trace = argv[++i];
+        else if (strcmp(argv[i], "--pipeline") == 0)
+            options->pipeline = true;
+        else if (strcmp(argv[i], "--json") == 0)
+            options->format = DIAGNOSTICS_JSON;
+        else if (strcmp(argv[i], "--max-errors") == 0 && i + 1 < argc)
+            options->max_errors = atoi(argv[++i]);
+        /* one more word than memory is allocated for jumps outside of it */
+        else if (strcmp(argv[i], "--memory-size") == 0 && i + 1 < argc) {
+            if (!parse_number(argv[++i], 1, INT_MAX - 1, &options->target.memory_size))
+                return false;
+        }
+        else if (strcmp(argv[i], "--code-start") == 0 && i + 1 < argc) {
+            if (!parse_number(argv[++i], 0, INT_MAX - 1, &options->target.ic_start))
+                return false;
+        }
+        else if (strcmp(argv[i], "--symbols") == 0)
+            options->outputs.symbols = true;
+        else if (strcmp(argv[i], "--listing") == 0)
+            options->outputs.listing = true;
+        else if (strcmp(argv[i], "--disassemble") == 0)
+            options->outputs.disassembly = true;
+        else if (strcmp(argv[i], "--source-map") == 0)
+            options->outputs.source_map = true;
+        else if (strcmp(argv[i], "--deps") == 0)
+            options->outputs.dependencies = true;
+        else if (strcmp(argv[i], "--run") == 0)
+            options->run = true;
+        else if (strcmp(argv[i], "--profile") == 0)
+            options->run = options->run_options.profile = true;
+        else if (strcmp(argv[i], "--jit") == 0)
+            options->run = options->run_options.jit = true;
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            options->run = true;
+            options->run_options.batch = argv[++i];
+        }
+        else if (strcmp(argv[i], "--max-steps") == 0 && i + 1 < argc)
+            options->run_options.max_steps = strtoul(argv[++i], NULL, 10);
+        else
+            return false;
+    }
+
+    options->files = argv + i;
+    options->file_count = argc - i;
+    /* the code starts inside memory */
+    return options->file_count > 0 && options->target.ic_start < options->target.memory_size;
+}
+
+/* assembles files one after another on this thread, returns the count of files that failed */
+static int assemble_files(Options *options) {
+    /* count of failed files */
+    int failed = 0;
+    /* idle states, reused from file to file */
+    StatePool pool;
+    /* state of the current file */
+    AssemblerState *state;
+    /* collector shared by all files, flushed after each one */
+    Diagnostics *diagnostics;
+    /* counters of the current file and of all files */
+    AssemblerStats file_stats, total_stats;
+    /* index tracker */
+    int i;
+
+    state_pool_init(&pool);
+    stats_reset(&total_stats);
+    diagnostics = diagnostics_create(options->max_errors);
+    if (!diagnostics) {
+        ERROR(NULL, ERR_MEMORY_ALLOC);
+        return options->file_count;
+    }
+
+    for (i = 0; i < options->file_count; i++) {
+        /* get an empty state, if failed, count the file as failed */
+        state = state_pool_acquire(&pool);
+        if (!state) {
+            ERROR(NULL, ERR_MEMORY_ALLOC);
+            failed++;
+            continue;
+        }
+        state->diagnostics = diagnostics;
+        state->outputs = options->outputs;
+        set_assembler_target(state, &options->target);
+        /* counters are only collected when asked for (a trace tags its spans with their line counts) */
+        stats_reset(&file_stats);
+        state->stats = options->stats || options->perf || options->trace ? &file_stats : NULL;
+
+        /* the program is run while its state still holds it */
+        if (!assemble_file(options->files[i], state) ||
+            (options->run && !run_program(options->files[i], state, &options->run_options)))
+            failed++;
+        diagnostics_flush(diagnostics, stderr, options->format);
+
+        /* print this file's counters and add them to the total */
+        if (options->stats)
+            stats_print(stderr, options->files[i], &file_stats);
+        if (options->perf)
+            perf_print(stderr, options->files[i], &file_stats);
+        stats_add(&total_stats, &file_stats);
+        state->stats = NULL;
+        state_pool_release(&pool, state);
+    }
+
+    if (options->stats)
+        stats_print(stderr, "all files", &total_stats);
+    if (options->perf)
+        perf_print(stderr, "all files", &total_stats);
+
+    state_pool_free(&pool);
+    diagnostics_free(diagnostics);
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    /* parsed command line */
+    Options options;
+    /* stall counters of the pipelined mode */
+    PipelineStats pipeline_stats;
+    /* allocation counters of the whole run */
+    AllocStats alloc_stats;
+    /* count of failed files */
+    int failed;
+
+    if (!parse_options(argc, argv, &options)) {
+        print_usage(argv[0]);
+        return 2;
+    }
+    /* counters are opened before any thread starts, so every thread is counted (if they can't be opened, only timers
+     * are reported) */
+    if (options.perf && !options.pipeline)
+        perf_open();
+    if (options.trace && !trace_open(options.trace)) {
+        ERROR_FILE(NULL, ERR_CANNOT_CREATE_FILE, options.trace);
+        return 2;
+    }
+
+    /* the pipelined mode has its own counters, which only say which stage waited for which */
+    if (options.pipeline) {
+        failed = assemble_files_pipelined(options.files, options.file_count, options.max_errors, options.format,
+                                          &options.target, &options.outputs, &pipeline_stats);
+        if (options.stats)
+            print_pipeline_stats(stderr, &pipeline_stats);
+    } else {
+        failed = assemble_files(&options);
+    }
+
+    /* allocations are counted by phase, so the pipelined mode (where phases overlap) counts them all as other */
+    if (options.stats && ALLOC_TRACKING) {
+        alloc_get_stats(&alloc_stats);
+        alloc_print_stats(stderr, &alloc_stats);
+    }
+    if (options.stats)
+        fprintf(stderr, "peak resident set: %ld kB\n", peak_rss_kb());
+
+    /* included files are shared by every file, so they are freed once all are done */
+    free_included_files();
+    perf_close();
+    /* every thread was joined, so the trace is complete */
+    if (!trace_close()) {
+        ERROR_FILE(NULL, ERR_CANNOT_WRITE_FILE, options.trace);
+        failed++;
+    }
+
+    return failed > 0 ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "address_sort.h"
+#include "assembler.h"
+#include "bool.h"
+#include "diagnostics.h"
+#include "disassembler.h"
+#include "errors.h"
+#include "hash_table.h"
+#include "helpers.h"
+#include "output.h"
+#include "source_map.h"
+#include "stats.h"
+#include "symbol_table.h"
+
+/* stdio buffer of the listing file */
+#define LISTING_BUFFER_SIZE (1 << 16)
+/* columns of a listing line number */
+#define LINE_NUMBER_WIDTH 6
+/* columns of a listing word (4 digit address, value and ARE letter) */
+#define WORD_ROW_WIDTH 10
+
+/* ARE marking letters, indexed by ARE */
+static const char ARE_LETTERS[] = {'A', 'R', 'E'};
+
+/* fills state->sorted with the records collect gives and sorts them by address, so the output doesn't depend on the
+ * hash table's bucket order (labels and uses all have distinct addresses). Returns false if allocation failed */
+static Bool collect_sorted(AssemblerState *state, void (*collect)(char *, void *, void *)) {
+    /* where the records go */
+    AddressList *list = &state->sorted;
+
+    address_list_clear(list);
+    /* hash_table_foreach can't be stopped, so a failed push marks the list with a negative count */
+    hash_table_foreach(state->symbols, collect, list);
+    if (list->count < 0 || !address_list_sort(list)) {
+        address_list_clear(list);
+        ERROR(state->diagnostics, ERR_MEMORY_ALLOC);
+        return false;
+    }
+    return true;
+}
+
+/* writes name and address of each record in list */
+static void write_records(FILE *file, AddressList *list) {
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < list->count; i++)
+        fprintf(file, "%s %04d\n", list->records[i].name, list->records[i].address);
+}
+
+/* writes address, name and type of each code and data symbol, in address order (so it can be binary searched) */
+static void write_symbol_dump(FILE *file, AssemblerState *state) {
+    /* current record */
+    AddressRecord *record;
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < state->sorted.count; i++) {
+        record = &state->sorted.records[i];
+        /* data is placed right after the code, so the address tells the type */
+        fprintf(file, "%04d %s %s\n", record->address, record->name, record->address >= state->ic ? "data" : "code");
+    }
+}
+
+/* writes the code and data segments in object format */
+static void write_object(FILE *file, AssemblerState *state) {
+    /* index tracker */
+    int i;
+
+    /* header - code and data lengths */
+    fprintf(file, "%d %d\n", state->code.count, state->data.count);
+    /* code words start at ic_start */
+    for (i = 0; i < state->code.count; i++)
+        fprintf(file, "%04d %03X %c\n", state->ic_start + i, WORD_VALUE(state->code.words[i]),
+                ARE_LETTERS[WORD_ARE(state->code.words[i])]);
+    /* data words follow right after code */
+    for (i = 0; i < state->data.count; i++)
+        fprintf(file, "%04d %03X %c\n", state->ic + i, WORD_VALUE(state->data.words[i]),
+                ARE_LETTERS[WORD_ARE(state->data.words[i])]);
+}
+
+/* writes count spaces at out, returns the end */
+static char *put_blank(char *out, int count) {
+    memset(out, ' ', count);
+    return out + count;
+}
+
+/* writes the row of a word: its address, value in hex and ARE letter, returns the end */
+static char *put_word(char *out, int address, Word word) {
+    /* hex digits, indexed by value */
+    static const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+    out = put_decimal(out, address, 4, '0');
+    *out++ = ' ';
+    *out++ = HEX_DIGITS[(WORD_VALUE(word) >> 8) & 0xF];
+    *out++ = HEX_DIGITS[(WORD_VALUE(word) >> 4) & 0xF];
+    *out++ = HEX_DIGITS[WORD_VALUE(word) & 0xF];
+    *out++ = ' ';
+    *out++ = ARE_LETTERS[WORD_ARE(word)];
+    return out;
+}
+
+/* writes each line of the .am file with the address and value of every word it was encoded to (a row per word, the
+ * text on the first), from what the passes kept, so the .am file isn't read again. Rows are formatted by hand since
+ * a listing is several times the size of its source */
+static void write_listing(FILE *file, AssemblerState *state) {
+    /* line number, address, word and ARE of a row */
+    char row[64];
+    /* end of the row so far */
+    char *end;
+    /* text of the current line */
+    char *text = state->listing_text.data;
+    /* words of the current line */
+    int first_word, word_count;
+    /* whether the line's words are data */
+    Bool is_data;
+    /* index trackers */
+    int i, j;
+
+    fprintf(file, "  line addr val A  source\n");
+    for (i = 0; i < state->listing_count; i++) {
+        /* a line's words run up to where the next line's start */
+        is_data = false;
+        first_word = state->listing[i].code_index;
+        word_count = (i + 1 < state->listing_count ? state->listing[i + 1].code_index : state->code.count) - first_word;
+        if (word_count == 0) {
+            is_data = true;
+            first_word = state->listing[i].data_index;
+            word_count =
+                (i + 1 < state->listing_count ? state->listing[i + 1].data_index : state->data.count) - first_word;
+        }
+
+        end = put_decimal(row, i + 1, LINE_NUMBER_WIDTH, ' ');
+        *end++ = ' ';
+        /* data words come right after the code */
+        if (word_count > 0)
+            end = is_data ? put_word(end, state->ic + first_word, state->data.words[first_word])
+                          : put_word(end, state->ic_start + first_word, state->code.words[first_word]);
+        else
+            end = put_blank(end, WORD_ROW_WIDTH);
+        *end++ = ' ';
+        *end++ = ' ';
+        fwrite(row, 1, end - row, file);
+        fputs(text, file);
+        fputc('\n', file);
+
+        /* further words get rows of their own */
+        for (j = 1; j < word_count; j++) {
+            end = put_blank(row, LINE_NUMBER_WIDTH + 1);
+            end = is_data ? put_word(end, state->ic + first_word + j, state->data.words[first_word + j])
+                          : put_word(end, state->ic_start + first_word + j, state->code.words[first_word + j]);
+            *end++ = '\n';
+            fwrite(row, 1, end - row, file);
+        }
+        text += strlen(text) + 1;
+    }
+}
+
+/* writes a Make rule saying the object and expanded files of filename depend on its .as file and every file it
+ * included, plus an empty rule per included file so a deleted one doesn't stop make (like gcc -MP) */
+static void write_dependencies(FILE *file, char *filename, AssemblerState *state) {
+    /* current included path */
+    char *path;
+    /* end of the included paths */
+    char *end = state->includes.data + state->includes.length;
+
+    fprintf(file, "%s.ob %s.am: %s.as", filename, filename, filename);
+    for (path = state->includes.data; path < end; path += strlen(path) + 1)
+        fprintf(file, " \\\n  %s", path);
+    putc('\n', file);
+    for (path = state->includes.data; path < end; path += strlen(path) + 1)
+        fprintf(file, "\n%s:\n", path);
+}
+
+/* opens path for writing, reports error and returns NULL if failed */
+static FILE *open_output(Diagnostics *diagnostics, char *path) {
+    /* output file */
+    FILE *file = fopen(path, "w");
+    /* if failed, throw error */
+    if (!file)
+        ERROR_FILE(diagnostics, ERR_CANNOT_CREATE_FILE, path);
+    return file;
+}
+
+/* closes file, reports error and returns false if anything failed to be written */
+static Bool close_output(Diagnostics *diagnostics, FILE *file, char *path) {
+    /* whether a write failed or not */
+    Bool failed = ferror(file) != 0;
+    /* closing flushes the buffer, which can fail too */
+    if (fclose(file) != 0)
+        failed = true;
+    /* if failed, throw error */
+    if (failed)
+        ERROR_FILE(diagnostics, ERR_CANNOT_WRITE_FILE, path);
+    return !failed;
+}
+
+Bool write_output_files(char *filename, AssemblerState *state) {
+    /* where to report errors */
+    Diagnostics *diagnostics = state->diagnostics;
+    /* output file path */
+    char path[MAX_LINE];
+    /* current output file */
+    FILE *file;
+    /* lines whose disassembly doesn't match them, -1 if the check failed */
+    int mismatches;
+    /* origin of every address, and the .as file it names */
+    SourceMap map;
+    char source_path[MAX_LINE];
+
+    /* write object file */
+    sprintf(path, "%s.ob", filename);
+    if (!(file = open_output(diagnostics, path)))
+        return false;
+    write_object(file, state);
+    STATS_ADD(state->stats, phases[PHASE_OUTPUT].bytes_written, ftell(file));
+    if (!close_output(diagnostics, file, path))
+        return false;
+
+    /* write entries file in address order, remove a stale one if there are no entries */
+    sprintf(path, "%s.ent", filename);
+    if (!collect_sorted(state, collect_entry))
+        return false;
+    if (state->sorted.count == 0) {
+        remove(path);
+    } else {
+        if (!(file = open_output(diagnostics, path)))
+            return false;
+        write_records(file, &state->sorted);
+        STATS_ADD(state->stats, phases[PHASE_OUTPUT].bytes_written, ftell(file));
+        if (!close_output(diagnostics, file, path))
+            return false;
+    }
+
+    /* write externals file in address order, remove a stale one if there are no external uses */
+    sprintf(path, "%s.ext", filename);
+    if (state->ec == 0) {
+        remove(path);
+    } else {
+        if (!collect_sorted(state, collect_external_uses))
+            return false;
+        if (!(file = open_output(diagnostics, path)))
+            return false;
+        write_records(file, &state->sorted);
+        STATS_ADD(state->stats, phases[PHASE_OUTPUT].bytes_written, ftell(file));
+        if (!close_output(diagnostics, file, path))
+            return false;
+    }
+
+    /* write listing file only if asked for, through a bigger buffer since it's the largest output */
+    if (state->outputs.listing) {
+        sprintf(path, "%s.lst", filename);
+        if (!(file = open_output(diagnostics, path)))
+            return false;
+        setvbuf(file, NULL, _IOFBF, LISTING_BUFFER_SIZE);
+        write_listing(file, state);
+        STATS_ADD(state->stats, phases[PHASE_OUTPUT].bytes_written, ftell(file));
+        if (!close_output(diagnostics, file, path))
+            return false;
+    }
+
+    /* write disassembly only if asked for, then make sure every line decodes back to its own text */
+    if (state->outputs.disassembly) {
+        sprintf(path, "%s.dis", filename);
+        if (!(file = open_output(diagnostics, path)))
+            return false;
+        if (!write_disassembly(file, state)) {
+            ERROR(diagnostics, ERR_MEMORY_ALLOC);
+            fclose(file);
+            return false;
+        }
+        STATS_ADD(state->stats, phases[PHASE_OUTPUT].bytes_written, ftell(file));
+        if (!close_output(diagnostics, file, path))
+            return false;
+        /* mismatches are reported inside */
+        mismatches = check_disassembly(state);
+        if (mismatches < 0)
+            ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        if (mismatches != 0)
+            return false;
+    }
+
+    /* write source map only if asked for */
+    if (state->outputs.source_map) {
+        source_map_init(&map);
+        if (!source_map_build(&map, state)) {
+            ERROR(diagnostics, ERR_MEMORY_ALLOC);
+            source_map_free(&map);
+            return false;
+        }
+        sprintf(path, "%s.map", filename);
+        if (!(file = open_output(diagnostics, path))) {
+            source_map_free(&map);
+            return false;
+        }
+        sprintf(source_path, "%s.as", filename);
+        source_map_write(file, source_path, &state->includes, &map);
+        source_map_free(&map);
+        STATS_ADD(state->stats, phases[PHASE_OUTPUT].bytes_written, ftell(file));
+        if (!close_output(diagnostics, file, path))
+            return false;
+    }
+
+    /* write dependencies only if asked for */
+    if (state->outputs.dependencies) {
+        sprintf(path, "%s.d", filename);
+        if (!(file = open_output(diagnostics, path)))
+            return false;
+        write_dependencies(file, filename, state);
+        STATS_ADD(state->stats, phases[PHASE_OUTPUT].bytes_written, ftell(file));
+        if (!close_output(diagnostics, file, path))
+            return false;
+    }
+
+    /* write symbols file only if asked for */
+    if (state->outputs.symbols) {
+        sprintf(path, "%s.sym", filename);
+        if (!collect_sorted(state, collect_label))
+            return false;
+        if (!(file = open_output(diagnostics, path)))
+            return false;
+        write_symbol_dump(file, state);
+        STATS_ADD(state->stats, phases[PHASE_OUTPUT].bytes_written, ftell(file));
+        if (!close_output(diagnostics, file, path))
+            return false;
+    }
+
+    return true;
+}
\ No newline at end of file
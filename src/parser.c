@@ -23,8 +23,8 @@ char *skip_whitespace(char *str) {
 
 char *get_token(char *str, char *dest) {
     str = skip_whitespace(str); /* skip leading whitespaces */
-    /* loops while *str is not a whitespace or a NULL terminator  */
-    while (*str != ' ' && *str != '\t' && *str != '\0') {
+    /* loops while *str is not a whitespace, a newline or a NULL terminator  */
+    while (*str != ' ' && *str != '\t' && *str != '\n' && *str != '\0') {
         *dest = *str; /* assign *str char to *dest char */
         dest++;       /* move dest to next char */
         str++;        /* move str to next char */
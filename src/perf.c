@@ -0,0 +1,172 @@
+/* syscall is neither ANSI C nor POSIX */
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "bool.h"
+#include "perf.h"
+#include "stats.h"
+
+/* counter of each event, -1 if it isn't open */
+static int event_fds[EVENT_COUNT] = {-1, -1, -1, -1, -1};
+/* why the first counter failed to open */
+static const char *open_error = "not opened";
+
+#ifdef __linux__
+/* type and config of each event for perf_event_open, indexed by HardwareEvent */
+static const unsigned long EVENT_TYPES[] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+                                            PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE};
+static const unsigned long EVENT_CONFIGS[] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES,
+    PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+    PERF_COUNT_HW_CACHE_MISSES};
+
+/* opens a counter of event, returns its file descriptor, -1 if failed */
+static int open_event(HardwareEvent event) {
+    /* what to count */
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = EVENT_TYPES[event];
+    attr.config = EVENT_CONFIGS[event];
+    /* count threads started later too, user space only (allowed without privileges on most systems) */
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    /* when there are more events than hardware counters they take turns, these times scale the counts back */
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    /* this thread, any cpu, no group */
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+Bool perf_open(void) {
+    /* whether any counter was opened */
+    Bool opened = false;
+    /* index tracker */
+    int i;
+
+#ifdef __linux__
+    for (i = 0; i < EVENT_COUNT; i++) {
+        event_fds[i] = open_event(i);
+        if (event_fds[i] >= 0)
+            opened = true;
+        else if (!opened)
+            open_error = strerror(errno);
+    }
+#else
+    for (i = 0; i < EVENT_COUNT; i++)
+        event_fds[i] = -1;
+    open_error = "only supported on Linux";
+#endif
+    return opened;
+}
+
+void perf_close(void) {
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < EVENT_COUNT; i++) {
+#ifdef __linux__
+        if (event_fds[i] >= 0)
+            close(event_fds[i]);
+#endif
+        event_fds[i] = -1;
+    }
+}
+
+Bool perf_enabled(void) {
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < EVENT_COUNT; i++) {
+        if (event_fds[i] >= 0)
+            return true;
+    }
+    return false;
+}
+
+Bool perf_available(HardwareEvent event) {
+    return event_fds[event] >= 0;
+}
+
+const char *perf_error(void) {
+    return open_error;
+}
+
+void perf_read(double values[EVENT_COUNT]) {
+#ifdef __linux__
+    /* value, time enabled and time running */
+    __u64 counts[3];
+#endif
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < EVENT_COUNT; i++) {
+        values[i] = 0;
+#ifdef __linux__
+        if (event_fds[i] < 0 || read(event_fds[i], counts, sizeof(counts)) != sizeof(counts))
+            continue;
+        /* scale a multiplexed count to the whole time it was enabled */
+        values[i] = (double)counts[0];
+        if (counts[2] > 0 && counts[2] < counts[1])
+            values[i] *= (double)counts[1] / counts[2];
+#endif
+    }
+}
+
+/* prints count per line of the phase, or n/a if the event isn't available */
+static void print_per_line(FILE *out, HardwareEvent event, PhaseStats *phase, long lines) {
+    if (!perf_available(event))
+        fprintf(out, " %14s", "n/a");
+    else
+        fprintf(out, " %14.3f", lines > 0 ? phase->events[event] / lines : 0.0);
+}
+
+void perf_print(FILE *out, const char *label, AssemblerStats *stats) {
+    /* current phase */
+    PhaseStats *phase;
+    /* lines the current phase worked on */
+    long lines;
+    /* index trackers */
+    int i, j;
+
+    fprintf(out, "perf: %s (%d file%s)\n", label, stats->files, stats->files == 1 ? "" : "s");
+    /* without counters, the timers are all there is */
+    if (!perf_enabled()) {
+        fprintf(out, "  hardware counters unavailable (%s), timers only\n", perf_error());
+        fprintf(out, "  %-13s %10s %10s %12s\n", "phase", "ms", "lines", "ns/line");
+        for (i = 0; i < PHASE_COUNT; i++) {
+            lines = stats_phase_lines(stats, i);
+            fprintf(out, "  %-13s %10.3f %10ld %12.1f\n", PHASE_NAMES[i], stats->phases[i].seconds * 1e3, lines,
+                    lines > 0 ? stats->phases[i].seconds * 1e9 / lines : 0.0);
+        }
+        return;
+    }
+
+    fprintf(out, "  %-13s %10s %10s %14s %14s %6s %14s %14s %14s\n", "phase", "ms", "lines", "cycles", "instructions",
+            "IPC", "br-miss/line", "L1d-miss/line", "LLC-miss/line");
+    for (i = 0; i < PHASE_COUNT; i++) {
+        phase = &stats->phases[i];
+        lines = stats_phase_lines(stats, i);
+        fprintf(out, "  %-13s %10.3f %10ld %14.0f %14.0f", PHASE_NAMES[i], phase->seconds * 1e3, lines,
+                phase->events[EVENT_CYCLES], phase->events[EVENT_INSTRUCTIONS]);
+        /* instructions per cycle needs both counters */
+        if (perf_available(EVENT_CYCLES) && perf_available(EVENT_INSTRUCTIONS) && phase->events[EVENT_CYCLES] > 0)
+            fprintf(out, " %6.2f", phase->events[EVENT_INSTRUCTIONS] / phase->events[EVENT_CYCLES]);
+        else
+            fprintf(out, " %6s", "n/a");
+        for (j = EVENT_BRANCH_MISSES; j < EVENT_COUNT; j++)
+            print_per_line(out, j, phase, lines);
+        fprintf(out, "\n");
+    }
+}
\ No newline at end of file
@@ -0,0 +1,372 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "assembler.h"
+#include "bool.h"
+#include "diagnostics.h"
+#include "errors.h"
+#include "first_pass.h"
+#include "output.h"
+#include "pipeline.h"
+#include "pre_assembler.h"
+#include "ring.h"
+#include "second_pass.h"
+#include "stats.h"
+#include "trace.h"
+
+/* a file travelling through the stages, each stage hands it to the next one through a ring */
+typedef struct {
+    char *filename;
+    Diagnostics *pre_diagnostics; /* pre-assembler errors, they come before the passes' errors */
+    Bool pre_success;             /* set by the pre-assembler stage before the last block of the file */
+    int line_count;               /* expanded lines sent by the pre-assembler stage */
+    LineOrigins origins;          /* set by the pre-assembler stage with pre_success, if the outputs need them */
+    Buffer includes;              /* set by the pre-assembler stage with pre_success */
+    AssemblerState *state;        /* set by the passes stage, state->diagnostics holds the passes' errors */
+    Bool success;
+} PipelineJob;
+
+/* expanded lines of a file (newlines removed) */
+typedef struct {
+    PipelineJob *job;
+    char lines[PIPELINE_BLOCK_LINES][MAX_LINE];
+    int line_count;
+    Bool end_of_file; /* last block of job, pre_success is valid */
+} LineBlock;
+
+/* everything the stages share */
+typedef struct {
+    PipelineJob *jobs;
+    int job_count;
+    int max_errors;
+    TargetOptions target;  /* given to every state */
+    OutputOptions outputs; /* given to every state */
+    LineBlock *blocks; /* all blocks, they only circulate between lines and free_blocks */
+    Ring lines;        /* full blocks, pre-assembler -> passes */
+    Ring free_blocks;  /* used blocks, passes -> pre-assembler (waiting here means lines is full) */
+    Ring files;        /* finished jobs, passes -> writer */
+    Ring free_states;  /* written jobs' states, writer -> passes */
+    LineBlock *block;  /* block the pre-assembler stage is filling */
+    StatePool pool;    /* owned by the passes stage until it is joined */
+} Pipeline;
+
+/* returns an empty block for job, waiting for the passes stage to give one back if needed */
+static LineBlock *take_block(Pipeline *pipeline, PipelineJob *job) {
+    /* the block to return */
+    LineBlock *block = ring_pop(&pipeline->free_blocks);
+
+    block->job = job;
+    block->line_count = 0;
+    block->end_of_file = false;
+    return block;
+}
+
+/* LineSink of the pre-assembler stage, copies line to the current block and sends the block when it's full */
+static Bool send_line(const char *text, int length, void *context) {
+    /* cast context to Pipeline pointer */
+    Pipeline *pipeline = (Pipeline *)context;
+    /* current block */
+    LineBlock *block = pipeline->block;
+
+    /* drop the newline, the first pass doesn't need it */
+    if (length > 0 && text[length - 1] == '\n')
+        length--;
+    /* expanded lines always fit, this only guards the copy */
+    if (length > MAX_LINE - 1)
+        length = MAX_LINE - 1;
+
+    memcpy(block->lines[block->line_count], text, length);
+    block->lines[block->line_count][length] = '\0';
+    block->line_count++;
+    block->job->line_count++;
+
+    /* if block is full, send it and start a new one */
+    if (block->line_count == PIPELINE_BLOCK_LINES) {
+        ring_push(&pipeline->lines, block);
+        if (trace_enabled())
+            trace_counter("lines queue", ring_count(&pipeline->lines));
+        pipeline->block = take_block(pipeline, block->job);
+    }
+    return true;
+}
+
+/* pre-assembler stage - expands each file and streams its lines to the passes stage */
+static void *pre_assembler_stage(void *arg) {
+    /* cast arg to Pipeline pointer */
+    Pipeline *pipeline = (Pipeline *)arg;
+    /* current job */
+    PipelineJob *job;
+    /* reused from file to file (if they can't be created, each file gets its own) */
+    PreAssemblerBuffers *buffers = create_pre_assembler_buffers();
+    /* when the current file started, for the trace */
+    double start;
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < pipeline->job_count; i++) {
+        job = &pipeline->jobs[i];
+        start = trace_now();
+        pipeline->block = take_block(pipeline, job);
+
+        /* expand file (errors reported to the job's own collector) */
+        job->pre_success = pre_assemble_streaming(job->filename, job->pre_diagnostics, send_line, pipeline,
+                                                  pipeline->outputs.source_map ? &job->origins : NULL,
+                                                  &job->includes, NULL, buffers);
+
+        /* send the rest of the file, pre_success is visible to the passes stage once it gets this block */
+        pipeline->block->end_of_file = true;
+        ring_push(&pipeline->lines, pipeline->block);
+        trace_span(PHASE_NAMES[PHASE_PRE_ASSEMBLE], start, job->filename, job->line_count);
+    }
+    free_pre_assembler_buffers(buffers);
+    return NULL;
+}
+
+/* returns an empty state for the next file, reusing the written files' states */
+static AssemblerState *take_state(Pipeline *pipeline) {
+    /* a state the writer is done with */
+    AssemblerState *state;
+    /* the state to return */
+    AssemblerState *result;
+
+    /* move states the writer gave back to the pool */
+    while ((state = ring_try_pop(&pipeline->free_states)))
+        state_pool_release(&pipeline->pool, state);
+
+    result = state_pool_acquire(&pipeline->pool);
+    /* a new state gets its own collector, a reused one keeps its (flushed) collector */
+    if (result && !result->diagnostics) {
+        result->diagnostics = diagnostics_create(pipeline->max_errors);
+        if (!result->diagnostics)
+            result = free_assembler_state(result);
+    }
+    if (result) {
+        result->outputs = pipeline->outputs;
+        set_assembler_target(result, &pipeline->target);
+    }
+    return result;
+}
+
+/* passes stage - parses each file's lines as they arrive, then resolves symbols and sends it to the writer */
+static void *passes_stage(void *arg) {
+    /* cast arg to Pipeline pointer */
+    Pipeline *pipeline = (Pipeline *)arg;
+    /* current job */
+    PipelineJob *job;
+    /* first pass of current job */
+    FirstPassStream stream;
+    /* current block of lines */
+    LineBlock *block;
+    /* origins and includes swapped between job and state */
+    LineOrigins origins;
+    Buffer includes;
+    /* whether the last block of current job arrived */
+    Bool end_of_file;
+    /* when the current pass started, for the trace (the first pass includes waiting for lines) */
+    double start;
+    /* index trackers */
+    int i, j;
+
+    for (i = 0; i < pipeline->job_count; i++) {
+        job = &pipeline->jobs[i];
+        start = trace_now();
+        job->state = take_state(pipeline);
+        if (job->state)
+            first_pass_begin(&stream, job->filename, job->state);
+
+        /* parse lines until the last block of job */
+        do {
+            block = ring_pop(&pipeline->lines);
+            if (trace_enabled())
+                trace_counter("lines queue", ring_count(&pipeline->lines));
+            if (job->state) {
+                for (j = 0; j < block->line_count; j++)
+                    first_pass_feed(&stream, block->lines[j]);
+            }
+            end_of_file = block->end_of_file;
+            ring_push(&pipeline->free_blocks, block);
+        } while (!end_of_file);
+
+        /* the origins and includes are complete with the last block, the state's previous arrays go to the job to be
+         * freed */
+        if (job->state) {
+            origins = job->state->origins;
+            job->state->origins = job->origins;
+            job->origins = origins;
+            includes = job->state->includes;
+            job->state->includes = job->includes;
+            job->includes = includes;
+        }
+
+        /* like assemble_file, the passes only count if the pre-assembler succeeded */
+        if (job->state && job->pre_success) {
+            job->success = first_pass_end(&stream);
+            trace_span(PHASE_NAMES[PHASE_FIRST_PASS], start, job->filename, stream.line_num);
+            if (job->success) {
+                start = trace_now();
+                job->success = second_pass(job->filename, job->state);
+                trace_span(PHASE_NAMES[PHASE_SECOND_PASS], start, job->filename, stream.line_num);
+            }
+            /* otherwise drop the first pass errors of a file that didn't expand (the pre-assembler ones explain it) */
+        } else if (job->state) {
+            diagnostics_clear(job->state->diagnostics);
+        }
+        ring_push(&pipeline->files, job);
+        if (trace_enabled())
+            trace_counter("files queue", ring_count(&pipeline->files));
+    }
+    return NULL;
+}
+
+/* writer stage - writes each finished file and its errors, in file order, returns count of failed files */
+static int writer_stage(Pipeline *pipeline, DiagnosticsFormat format) {
+    /* current job */
+    PipelineJob *job;
+    /* count of failed files */
+    int failed = 0;
+    /* when writing the current file started, for the trace */
+    double start;
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < pipeline->job_count; i++) {
+        job = ring_pop(&pipeline->files);
+        if (trace_enabled())
+            trace_counter("files queue", ring_count(&pipeline->files));
+
+        /* if there was no state for the file, report it through the pre-assembler's collector */
+        if (!job->state)
+            ERROR(job->pre_diagnostics, ERR_MEMORY_ALLOC);
+        else if (job->success) {
+            start = trace_now();
+            job->success = write_output_files(job->filename, job->state);
+            trace_span(PHASE_NAMES[PHASE_OUTPUT], start, job->filename, job->line_count);
+        }
+        if (!job->success)
+            failed++;
+
+        /* pre-assembler errors first, like a serial run (a file that expanded has none, so usually only one of the
+         * collectors is written) */
+        if (job->pre_diagnostics->count > 0 || !job->state || !job->pre_success)
+            diagnostics_flush(job->pre_diagnostics, stderr, format);
+        if (job->state && job->pre_success)
+            diagnostics_flush(job->state->diagnostics, stderr, format);
+        /* give state back to the passes stage (there is room for every file) */
+        if (job->state)
+            ring_push(&pipeline->free_states, job->state);
+    }
+    return failed;
+}
+
+int assemble_files_pipelined(char **filenames, int file_count, int max_errors, DiagnosticsFormat format,
+                             TargetOptions *target, OutputOptions *outputs, PipelineStats *stats) {
+    /* everything the stages share */
+    Pipeline pipeline;
+    /* stage threads */
+    pthread_t pre_thread, passes_thread;
+    /* whether pre_thread was started */
+    Bool pre_started = false;
+    /* count of failed files */
+    int failed = 0;
+    /* a state given back by the writer */
+    AssemblerState *state;
+    /* index tracker */
+    int i;
+
+    memset(&pipeline, 0, sizeof(Pipeline));
+    state_pool_init(&pipeline.pool);
+    pipeline.job_count = file_count;
+    pipeline.max_errors = max_errors;
+    pipeline.target = *target;
+    pipeline.outputs = *outputs;
+    if (stats)
+        memset(stats, 0, sizeof(PipelineStats));
+    if (file_count == 0)
+        return 0;
+
+    /* allocate jobs, blocks and rings (files and free_states have room for every file, so the writer stage can
+     * also run after the others), if failed, throw error and cleanup */
+    pipeline.jobs = calloc(file_count, sizeof(PipelineJob));
+    pipeline.blocks = malloc(PIPELINE_RING_SIZE * sizeof(LineBlock));
+    if (!pipeline.jobs || !pipeline.blocks || !ring_init(&pipeline.lines, PIPELINE_RING_SIZE) ||
+        !ring_init(&pipeline.free_blocks, PIPELINE_RING_SIZE) || !ring_init(&pipeline.files, file_count) ||
+        !ring_init(&pipeline.free_states, file_count)) {
+        ERROR(NULL, ERR_MEMORY_ALLOC);
+        failed = file_count;
+        goto cleanup;
+    }
+    for (i = 0; i < PIPELINE_RING_SIZE; i++)
+        ring_push(&pipeline.free_blocks, &pipeline.blocks[i]);
+    for (i = 0; i < file_count; i++) {
+        pipeline.jobs[i].filename = filenames[i];
+        pipeline.jobs[i].pre_diagnostics = diagnostics_create(max_errors);
+        if (!pipeline.jobs[i].pre_diagnostics) {
+            ERROR(NULL, ERR_MEMORY_ALLOC);
+            failed = file_count;
+            goto cleanup;
+        }
+    }
+
+    /* start the passes stage first, it is the only consumer of lines, if failed, throw error and cleanup */
+    if (pthread_create(&passes_thread, NULL, passes_stage, &pipeline) != 0) {
+        ERROR(NULL, ERR_MEMORY_ALLOC);
+        failed = file_count;
+        goto cleanup;
+    }
+    /* start the pre-assembler stage, if failed, run it on this thread (the writer stage runs after it) */
+    pre_started = pthread_create(&pre_thread, NULL, pre_assembler_stage, &pipeline) == 0;
+    if (!pre_started)
+        pre_assembler_stage(&pipeline);
+
+    /* write files on this thread as they are finished */
+    failed = writer_stage(&pipeline, format);
+
+    /* wait for stages */
+    if (pre_started)
+        pthread_join(pre_thread, NULL);
+    pthread_join(passes_thread, NULL);
+
+    /* stall counters (a full lines queue shows up as the pre-assembler waiting for a free block) */
+    if (stats) {
+        stats->lines.full_stalls = pipeline.free_blocks.empty_stalls;
+        stats->lines.empty_stalls = pipeline.lines.empty_stalls;
+        stats->files.full_stalls = pipeline.files.full_stalls;
+        stats->files.empty_stalls = pipeline.files.empty_stalls;
+    }
+
+cleanup:
+    /* free states with their collectors */
+    if (pipeline.free_states.slots) {
+        while ((state = ring_try_pop(&pipeline.free_states)))
+            state_pool_release(&pipeline.pool, state);
+    }
+    for (i = 0; i < pipeline.pool.count; i++)
+        diagnostics_free(pipeline.pool.states[i]->diagnostics);
+    state_pool_free(&pipeline.pool);
+    /* free jobs' collectors */
+    if (pipeline.jobs) {
+        for (i = 0; i < file_count; i++) {
+            diagnostics_free(pipeline.jobs[i].pre_diagnostics);
+            line_origins_free(&pipeline.jobs[i].origins);
+            buffer_free(&pipeline.jobs[i].includes);
+        }
+    }
+    free(pipeline.jobs);
+    free(pipeline.blocks);
+    ring_free(&pipeline.lines);
+    ring_free(&pipeline.free_blocks);
+    ring_free(&pipeline.files);
+    ring_free(&pipeline.free_states);
+
+    return failed;
+}
+
+void print_pipeline_stats(FILE *out, PipelineStats *stats) {
+    fprintf(out, "queue lines (pre-assembler -> passes): %lu full stalls, %lu empty stalls\n",
+            stats->lines.full_stalls, stats->lines.empty_stalls);
+    fprintf(out, "queue files (passes -> writer): %lu full stalls, %lu empty stalls\n", stats->files.full_stalls,
+            stats->files.empty_stalls);
+}
\ No newline at end of file
@@ -1,208 +1,812 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "alloc.h"
 #include "assembler.h"
 #include "bool.h"
+#include "diagnostics.h"
+#include "buffer.h"
 #include "errors.h"
 #include "hash_table.h"
 #include "helpers.h"
 #include "parser.h"
 #include "pre_assembler.h"
+#include "stats.h"
+#include "trace.h"
 
-/* frees macro lines array */
-static void free_macro_lines(Macro *m) {
+/* a line of a scanned file, written to the expanded file as is, or in place of a call of the macro it belongs to */
+typedef struct {
+    char *text;   /* points into the file buffer, not NULL terminated */
+    int length;   /* text length including the newline (if any) */
+    int line_num; /* line number in the scanned file */
+    int file;      /* file with text: 0 the input file, n its nth included file (see LineOrigin) */
+    int file_line; /* line of text in file */
+} SourceLine;
+
+/* struct for macros */
+typedef struct {
+    SourceLine **lines; /* macro lines array of the file defining the macro (it moves as the file's scan grows it) */
+    int first_line;     /* index of the first line inside macro in *lines, the others follow it */
+    int line_count;     /* count of lines inside macro */
+    int line_num; /* line of the mcro definition, the macro can only be expanded after it */
+    int file;     /* file defining the macro: 0 the input file, n its nth included file (see LineOrigin) */
+} Macro;
+
+/* what scan_macros collects from a file, kept by an included file, and reused from file to file for the input file */
+typedef struct {
+    HashTable *macros;       /* macros table */
+    HashTable *labels;       /* labels defined so far, only used while scanning */
+    SourceLine *lines;       /* lines outside macro definitions, in order */
+    int line_count;
+    int line_capacity;
+    SourceLine *macro_lines; /* lines inside macro definitions, in order */
+    int macro_line_count;
+    int macro_line_capacity;
+    Macro **spare_macros;    /* macros of previous files, reused before allocating new ones */
+    int spare_count;
+    int spare_capacity;
+} ScannedFile;
+
+struct PreAssemblerBuffers {
+    Buffer text;      /* the input file, NULL terminated */
+    ScannedFile scan; /* its macros and lines */
+    Buffer outputs[PRE_ASSEMBLER_THREADS];      /* expanded lines of each chunk */
+    LineOrigins origins[PRE_ASSEMBLER_THREADS]; /* origin of each line of outputs */
+    Buffer includes;  /* included paths if the caller doesn't want them */
+};
+
+/* a range of source lines expanded by one thread */
+typedef struct {
+    SourceLine *lines; /* first line of the chunk */
+    int line_count;    /* count of lines in the chunk */
+    HashTable *macros; /* macros table, read-only while expanding */
+    Buffer *output;    /* the chunk's own (empty) buffer */
+    LineSink sink;     /* also gets each expanded line, NULL if none */
+    void *context;     /* passed to sink */
+    Bool keep_origins; /* whether to fill origins */
+    LineOrigins *origins; /* origin of each line of output */
+    long expanded_lines; /* lines written in place of macro calls */
+    Bool success;
+} ExpansionChunk;
+
+/* a file read by .include, parsed once per run and shared by every file that includes the same contents */
+typedef struct IncludedFile {
+    char *text;                /* whole file, NULL terminated, its lines point into it */
+    size_t size;
+    ScannedFile scan;          /* macros it defines, and its .extern lines as scan.lines */
+    struct IncludedFile *next; /* next file whose contents have the same hash */
+} IncludedFile;
+
+/* what the .include lines of a file need */
+typedef struct {
+    char *path;              /* the .as file, included names are relative to its directory */
+    Buffer *paths;           /* NULL terminated path of every file included so far, including one again does nothing */
+    AssemblerStats *stats;
+} IncludeContext;
+
+/* context for adding the macros of an included file to the macros table of the file including it */
+typedef struct {
+    Diagnostics *diagnostics;
+    ScannedFile *scan; /* of the file including it, with the labels defined before the .include line */
+    int line_num;   /* of the .include line */
+    int file;       /* index of the included file (see LineOrigin) */
+    Bool failed;
+} IncludeMerge;
+
+/* included files parsed so far, keyed by the hash of their contents, shared by all threads under the lock */
+static HashTable *included_files = NULL;
+static pthread_mutex_t included_files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* initializes an empty scan and creates its tables, returns false if allocation failed (scan can still be freed) */
+static Bool init_scanned_file(ScannedFile *scan) {
+    scan->lines = NULL;
+    scan->line_count = 0;
+    scan->line_capacity = 0;
+    scan->macro_lines = NULL;
+    scan->macro_line_count = 0;
+    scan->macro_line_capacity = 0;
+    scan->spare_macros = NULL;
+    scan->spare_count = 0;
+    scan->spare_capacity = 0;
+    scan->macros = hash_table_create();
+    scan->labels = hash_table_create();
+    return scan->macros && scan->labels;
+}
+
+/* returns a macro, reusing a spare one of scan if possible, NULL if allocation failed */
+static Macro *acquire_macro(ScannedFile *scan) {
+    if (scan->spare_count > 0)
+        return scan->spare_macros[--scan->spare_count];
+    return malloc(sizeof(Macro));
+}
+
+static void recycle_macro(char *key, void *data, void *context) {
+    /* cast context to ScannedFile pointer */
+    ScannedFile *scan = (ScannedFile *)context;
+    /* silence unused parameter warning */
+    (void)key;
+    /* store macro as spare (room was reserved by reset_scanned_file) */
+    scan->spare_macros[scan->spare_count++] = (Macro *)data;
+}
+
+/* empties scan for the next file, keeping its tables, arrays and macros */
+static void reset_scanned_file(ScannedFile *scan) {
+    /* needed spare capacity */
+    int needed = scan->spare_count + scan->macros->count;
+    /* grown spare macros array */
+    Macro **new_spare_macros;
+
+    /* make room for all current macros in the spare array */
+    if (needed > scan->spare_capacity) {
+        new_spare_macros = realloc(scan->spare_macros, needed * sizeof(Macro *));
+        if (new_spare_macros) {
+            scan->spare_macros = new_spare_macros;
+            scan->spare_capacity = needed;
+        }
+    }
+
+    /* keep macros as spares if there is room, otherwise just free them */
+    if (needed <= scan->spare_capacity) {
+        hash_table_foreach(scan->macros, recycle_macro, scan);
+        hash_table_clear(scan->macros, NULL);
+    } else {
+        hash_table_clear(scan->macros, free);
+    }
+    hash_table_clear(scan->labels, NULL);
+    scan->line_count = 0;
+    scan->macro_line_count = 0;
+}
+
+/* frees everything scan holds */
+static void free_scanned_file(ScannedFile *scan) {
     /* index tracker */
     int i;
-    /* for each macro line */
-    for (i = 0; i < m->line_count; i++)
-        /* free line */
-        free(m->lines[i]);
-    /* at last free lines array itself */
-    free(m->lines);
+
+    if (scan->macros)
+        hash_table_free(scan->macros, free);
+    if (scan->labels)
+        hash_table_free(scan->labels, NULL);
+    free(scan->lines);
+    free(scan->macro_lines);
+    for (i = 0; i < scan->spare_count; i++)
+        free(scan->spare_macros[i]);
+    free(scan->spare_macros);
 }
 
-static void free_macro(void *data) {
-    /* cast data to Macro pointer */
-    Macro *m = (Macro *)data;
-    /* free macro lines array */
-    free_macro_lines(m);
-    /* free macro itself */
-    free(m);
+PreAssemblerBuffers *create_pre_assembler_buffers(void) {
+    /* the buffers to return */
+    PreAssemblerBuffers *buffers = malloc(sizeof(PreAssemblerBuffers));
+    /* index tracker */
+    int i;
+
+    if (!buffers)
+        return NULL;
+    buffer_init(&buffers->text);
+    for (i = 0; i < PRE_ASSEMBLER_THREADS; i++) {
+        buffer_init(&buffers->outputs[i]);
+        line_origins_init(&buffers->origins[i]);
+    }
+    buffer_init(&buffers->includes);
+    /* if the tables couldn't be created, free buffers and return NULL */
+    if (!init_scanned_file(&buffers->scan))
+        return free_pre_assembler_buffers(buffers);
+    return buffers;
 }
 
-Bool pre_assemble(char *filename) {
-    /* used to tell cleanup whether to remove expanded_file or not */
-    Bool success = false;
-    /* current line from fgets */
+void reset_pre_assembler_buffers(PreAssemblerBuffers *buffers) {
+    /* index tracker */
+    int i;
+
+    buffers->text.length = 0;
+    reset_scanned_file(&buffers->scan);
+    for (i = 0; i < PRE_ASSEMBLER_THREADS; i++) {
+        buffers->outputs[i].length = 0;
+        buffers->origins[i].count = 0;
+    }
+    buffers->includes.length = 0;
+}
+
+PreAssemblerBuffers *free_pre_assembler_buffers(PreAssemblerBuffers *buffers) {
+    /* index tracker */
+    int i;
+
+    if (buffers) {
+        buffer_free(&buffers->text);
+        free_scanned_file(&buffers->scan);
+        for (i = 0; i < PRE_ASSEMBLER_THREADS; i++) {
+            buffer_free(&buffers->outputs[i]);
+            line_origins_free(&buffers->origins[i]);
+        }
+        buffer_free(&buffers->includes);
+        free(buffers);
+    }
+    return NULL;
+}
+
+void line_origins_init(LineOrigins *origins) {
+    origins->lines = NULL;
+    origins->count = 0;
+    origins->capacity = 0;
+}
+
+Bool line_origins_push(LineOrigins *origins, int file, int line, int call) {
+    /* grown array */
+    LineOrigin *lines;
+
+    /* grow geometrically */
+    if (origins->count == origins->capacity) {
+        lines = realloc(origins->lines, (origins->capacity ? origins->capacity * 2 : INITIAL_TABLE_SIZE) *
+                                            sizeof(LineOrigin));
+        if (!lines)
+            return false;
+        origins->lines = lines;
+        origins->capacity = origins->capacity ? origins->capacity * 2 : INITIAL_TABLE_SIZE;
+    }
+    origins->lines[origins->count].file = file;
+    origins->lines[origins->count].line = line;
+    origins->lines[origins->count].call = call;
+    origins->count++;
+    return true;
+}
+
+void line_origins_free(LineOrigins *origins) {
+    free(origins->lines);
+    line_origins_init(origins);
+}
+
+/* writes an expanded line from line line of file (called from line call, 0 if none) to chunk output (and sink, if
+ * any), returns false if allocation failed or sink stopped */
+static Bool emit_line(ExpansionChunk *chunk, const char *text, int length, int file, int line, int call) {
+    if (!buffer_append(chunk->output, text, length))
+        return false;
+    if (chunk->keep_origins && !line_origins_push(chunk->origins, file, line, call))
+        return false;
+    return !chunk->sink || chunk->sink(text, length, chunk->context);
+}
+
+/* phase two - writes every line of the chunk to its output, expanding macro calls */
+static void *expand_chunk(void *arg) {
+    /* the chunk to expand */
+    ExpansionChunk *chunk = (ExpansionChunk *)arg;
+    /* NULL terminated copy of current line */
     char line[MAX_LINE];
     /* a word from line */
     char token[MAX_LINE];
     /* pointer to text after token */
     char *token_ptr;
     /* expanded macro from macros table */
-    Macro *macro_to_expand = NULL;
+    Macro *macro_to_expand;
+    /* current source line */
+    SourceLine *source_line;
+    /* lines of the expanded macro */
+    SourceLine *macro_lines;
+    /* when the chunk started, for the trace */
+    double start = trace_now();
+    /* index trackers */
+    int i, j;
+
+    chunk->success = false;
+    chunk->expanded_lines = 0;
+    for (i = 0; i < chunk->line_count; i++) {
+        source_line = &chunk->lines[i];
+        /* copy line so it can be tokenized (too long lines were already dropped) */
+        memcpy(line, source_line->text, source_line->length);
+        line[source_line->length] = '\0';
+
+        /* gets first word from line */
+        token_ptr = get_token(line, token);
+        /* if token is a label, the word after it is the possible macro call */
+        if (token[0] != '\0' && token[strlen(token) - 1] == ':')
+            get_token(token_ptr, token);
+
+        /* check if token is a macro name defined before this line */
+        macro_to_expand = hash_table_lookup(chunk->macros, token);
+        if (macro_to_expand && macro_to_expand->line_num > source_line->line_num)
+            macro_to_expand = NULL;
+
+        /* if macro not found, write line as is */
+        if (!macro_to_expand) {
+            if (!emit_line(chunk, source_line->text, source_line->length, source_line->file, source_line->file_line, 0))
+                return NULL;
+            /* if macro found, write each macro line */
+        } else {
+            macro_lines = *macro_to_expand->lines + macro_to_expand->first_line;
+            for (j = 0; j < macro_to_expand->line_count; j++) {
+                if (!emit_line(chunk, macro_lines[j].text, macro_lines[j].length, macro_to_expand->file,
+                               macro_lines[j].line_num, source_line->line_num))
+                    return NULL;
+            }
+            chunk->expanded_lines += macro_to_expand->line_count;
+        }
+    }
+
+    chunk->success = true;
+    trace_span("expand_chunk", start, NULL, chunk->line_count);
+    return NULL;
+}
+
+/* appends a line to the source lines, growing them geometrically, returns false if allocation failed */
+static Bool add_source_line(SourceLine **source_lines, int *source_count, int *source_capacity, char *text, int length,
+                            int line_num, int file, int file_line) {
+    /* grown source lines array */
+    SourceLine *new_source_lines;
+
+    if (*source_count == *source_capacity) {
+        new_source_lines =
+            realloc(*source_lines, (*source_capacity ? *source_capacity * 2 : INITIAL_TABLE_SIZE) * sizeof(SourceLine));
+        if (!new_source_lines)
+            return false;
+        *source_lines = new_source_lines;
+        *source_capacity = *source_capacity ? *source_capacity * 2 : INITIAL_TABLE_SIZE;
+    }
+    (*source_lines)[*source_count].text = text;
+    (*source_lines)[*source_count].length = length;
+    (*source_lines)[*source_count].line_num = line_num;
+    (*source_lines)[*source_count].file = file;
+    (*source_lines)[*source_count].file_line = file_line;
+    (*source_count)++;
+    return true;
+}
+
+static Bool scan_macros(Diagnostics *diagnostics, char *buffer, ScannedFile *scan, IncludeContext *include,
+                        PhaseStats *stats);
+
+/* hashes size bytes of text */
+static unsigned long hash_contents(const char *text, size_t size) {
+    unsigned long h = 5381;
+    size_t i;
+    for (i = 0; i < size; i++)
+        h = ((h << 5) + h) + (unsigned char)text[i];
+    return h;
+}
+
+static void free_included_file(void *data) {
+    /* cast data to IncludedFile pointer */
+    IncludedFile *file = (IncludedFile *)data;
+    /* next file with the same hash */
+    IncludedFile *next;
+
+    while (file) {
+        next = file->next;
+        free_scanned_file(&file->scan);
+        free(file->text);
+        free(file);
+        file = next;
+    }
+}
+
+/* parses text (the contents of the file at path, taken over) into a new included file, keeping only its macros and
+ * .extern lines, then reports errors to including_path again, returns NULL on error */
+static IncludedFile *parse_included_file(Diagnostics *diagnostics, char *path, char *including_path, char *text,
+                                         size_t size, PhaseStats *stats) {
+    /* the parsed file */
+    IncludedFile *file = malloc(sizeof(IncludedFile));
+    /* NULL terminated copy of current line */
+    char line[MAX_LINE];
+    /* first word of current line */
+    char token[MAX_LINE];
+    /* used to tell the caller whether the file parsed or not */
+    Bool success = false;
+    /* index trackers */
+    int i, kept;
+
+    if (!file) {
+        ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        free(text);
+        return NULL;
+    }
+    file->text = text;
+    file->size = size;
+    file->next = NULL;
+    if (!init_scanned_file(&file->scan)) {
+        ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        free_included_file(file);
+        return NULL;
+    }
+
+    /* errors inside belong to the included file */
+    if (!diagnostics_set_file(diagnostics, path)) {
+        ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        free_included_file(file);
+        return NULL;
+    }
+    /* an included file can't include, so it scans without an include context */
+    if (scan_macros(diagnostics, text, &file->scan, NULL, stats)) {
+        success = true;
+        /* keep the .extern lines, drop empty lines and comments, anything else is an error */
+        for (i = 0, kept = 0; i < file->scan.line_count; i++) {
+            memcpy(line, file->scan.lines[i].text, file->scan.lines[i].length);
+            line[file->scan.lines[i].length] = '\0';
+            get_token(line, token);
+            if (token[0] == '\0' || token[0] == COMMENT_CHAR)
+                continue;
+            if (strcmp(token, ".extern") == 0) {
+                file->scan.lines[kept++] = file->scan.lines[i];
+            } else {
+                ERROR_LINE(diagnostics, file->scan.lines[i].line_num, ERR_INCLUDE_INVALID_LINE);
+                success = false;
+            }
+        }
+        file->scan.line_count = kept;
+    }
+    /* following errors belong to the including file again */
+    if (!diagnostics_set_file(diagnostics, including_path)) {
+        ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        success = false;
+    }
+
+    if (!success) {
+        free_included_file(file);
+        return NULL;
+    }
+    return file;
+}
+
+/* returns the parsed file with contents text (hashed to key), NULL if none, setting *first to the first parsed file
+ * with that hash, the caller holds included_files_lock */
+static IncludedFile *find_included_file(char *key, char *text, size_t size, IncludedFile **first, PhaseStats *stats) {
+    /* file tracker */
+    IncludedFile *file;
+
+    *first = NULL;
+    if (!included_files)
+        return NULL;
+    STATS_ADD(stats, hash_lookups, 1);
+    *first = hash_table_lookup(included_files, key);
+    for (file = *first; file; file = file->next) {
+        if (file->size == size && memcmp(file->text, text, size) == 0)
+            return file;
+    }
+    return NULL;
+}
+
+/* returns the parsed file at path (included on line line_num of include's file), parsing it only if no file with the
+ * same contents was parsed before, NULL on error */
+static IncludedFile *load_included_file(IncludeContext *include, Diagnostics *diagnostics, char *path, int line_num) {
+    /* counters of this phase, NULL if disabled */
+    PhaseStats *stats = STATS_PHASE(include->stats, PHASE_PRE_ASSEMBLE);
+    /* the included file */
+    FILE *input_file;
+    /* its contents */
+    char *text;
+    size_t size;
+    /* hash of text as a table key */
+    char key[2 * sizeof(unsigned long) + 1];
+    /* first parsed file with that hash, the one with the same contents, and this one parsed */
+    IncludedFile *first, *file, *parsed;
+
+    input_file = fopen(path, "r");
+    if (!input_file) {
+        ERROR_LINE_ARG(diagnostics, line_num, ERR_INCLUDE_CANNOT_OPEN, path);
+        return NULL;
+    }
+    if (!read_file(input_file, &text, &size)) {
+        ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        fclose(input_file);
+        return NULL;
+    }
+    fclose(input_file);
+    STATS_ADD(stats, bytes_read, size);
+    STATS_ADD(include->stats, includes, 1);
+    sprintf(key, "%lx", hash_contents(text, size));
+
+    /* the same contents under another path (or included by another file) are parsed only once */
+    pthread_mutex_lock(&included_files_lock);
+    file = find_included_file(key, text, size, &first, stats);
+    pthread_mutex_unlock(&included_files_lock);
+    if (file) {
+        free(text);
+        return file;
+    }
+
+    /* parsed outside the lock so other files' includes don't wait for it */
+    parsed = parse_included_file(diagnostics, path, include->path, text, size, stats);
+    if (!parsed)
+        return NULL;
+
+    /* published unless another thread published the same contents meanwhile */
+    pthread_mutex_lock(&included_files_lock);
+    if (!included_files && !(included_files = hash_table_create())) {
+        pthread_mutex_unlock(&included_files_lock);
+        ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        free_included_file(parsed);
+        return NULL;
+    }
+    file = find_included_file(key, parsed->text, size, &first, stats);
+    if (!file) {
+        /* the new file goes in front of the others with its hash */
+        parsed->next = first;
+        STATS_ADD(stats, hash_inserts, 1);
+        if (!hash_table_insert(included_files, key, parsed)) {
+            pthread_mutex_unlock(&included_files_lock);
+            ERROR(diagnostics, ERR_MEMORY_ALLOC);
+            parsed->next = NULL;
+            free_included_file(parsed);
+            return NULL;
+        }
+        STATS_ADD(include->stats, includes_parsed, 1);
+        file = parsed;
+        parsed = NULL;
+    }
+    pthread_mutex_unlock(&included_files_lock);
+    if (parsed)
+        free_included_file(parsed);
+    return file;
+}
+
+/* adds a copy of an included macro to the macros table of the file including it */
+static void merge_included_macro(char *key, void *data, void *context) {
+    /* cast context to IncludeMerge pointer */
+    IncludeMerge *merge = (IncludeMerge *)context;
+    /* the copy, with its own definition line */
+    Macro *copy;
+
+    /* stop at the first error */
+    if (merge->failed)
+        return;
+    merge->failed = true;
+    if (hash_table_contains_key(merge->scan->macros, key)) {
+        ERROR_LINE_ARG(merge->diagnostics, merge->line_num, ERR_MACRO_ALREADY_DEFINED, key);
+        return;
+    }
+    if (hash_table_contains_key(merge->scan->labels, key)) {
+        ERROR_LINE_ARG(merge->diagnostics, merge->line_num, ERR_MACRO_NAME_IS_LABEL, key);
+        return;
+    }
+    copy = acquire_macro(merge->scan);
+    if (!copy) {
+        ERROR(merge->diagnostics, ERR_MEMORY_ALLOC);
+        return;
+    }
+    /* the copy shares the lines, and is defined at the .include line so only later lines expand it */
+    *copy = *(Macro *)data;
+    copy->line_num = merge->line_num;
+    copy->file = merge->file;
+    if (!hash_table_insert(merge->scan->macros, key, copy)) {
+        ERROR(merge->diagnostics, ERR_MEMORY_ALLOC);
+        free(copy);
+        return;
+    }
+    merge->failed = false;
+}
+
+/* includes the file named by text (the rest of the .include line line_num): adds its macros and its .extern lines to
+ * scan, returns false on error */
+static Bool include_file(IncludeContext *include, Diagnostics *diagnostics, char *text, int line_num,
+                         ScannedFile *scan) {
+    /* end of the quoted name */
+    char *name_end;
+    /* a word after the name */
+    char token[MAX_LINE];
+    /* path of the included file */
+    char path[MAX_LINE];
+    /* length of the directory of the including file, including its last slash */
+    int directory_length = 0;
+    /* the parsed included file */
+    IncludedFile *file;
+    /* an already included path */
+    char *included;
+    /* index of the included file */
+    int file_index = 1;
+    /* context for adding its macros */
+    IncludeMerge merge;
+    /* index tracker */
+    int i;
+
+    /* the name is quoted and nothing follows it */
+    while (*text == ' ' || *text == '\t')
+        text++;
+    if (*text != '"' || !(name_end = strchr(text + 1, '"')) || name_end == text + 1) {
+        ERROR_LINE(diagnostics, line_num, ERR_INCLUDE_NO_NAME);
+        return false;
+    }
+    get_token(name_end + 1, token);
+    if (token[0] != '\0' && token[0] != COMMENT_CHAR) {
+        ERROR_LINE(diagnostics, line_num, ERR_EXTRA_TEXT);
+        return false;
+    }
+
+    /* a relative name is relative to the directory of the including file */
+    *name_end = '\0';
+    text++;
+    if (text[0] != '/' && strrchr(include->path, '/'))
+        directory_length = strrchr(include->path, '/') - include->path + 1;
+    if (directory_length + strlen(text) >= MAX_LINE) {
+        ERROR_LINE_ARG(diagnostics, line_num, ERR_INCLUDE_CANNOT_OPEN, text);
+        return false;
+    }
+    memcpy(path, include->path, directory_length);
+    strcpy(path + directory_length, text);
+
+    /* a path included again adds nothing (another path with the same contents is another file) */
+    for (included = include->paths->data; included < include->paths->data + include->paths->length;
+         included += strlen(included) + 1, file_index++) {
+        if (strcmp(included, path) == 0)
+            return true;
+    }
+    file = load_included_file(include, diagnostics, path, line_num);
+    if (!file)
+        return false;
+    /* remember the path, for the check above and the dependencies */
+    if (!buffer_append(include->paths, path, strlen(path) + 1)) {
+        ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        return false;
+    }
+
+    /* add its macros (errors reported inside) */
+    merge.diagnostics = diagnostics;
+    merge.scan = scan;
+    merge.line_num = line_num;
+    merge.file = file_index;
+    merge.failed = false;
+    hash_table_foreach(file->scan.macros, merge_included_macro, &merge);
+    if (merge.failed)
+        return false;
+
+    /* its .extern lines take the place of the .include line */
+    for (i = 0; i < file->scan.line_count; i++) {
+        if (!add_source_line(&scan->lines, &scan->line_count, &scan->line_capacity, file->scan.lines[i].text,
+                             file->scan.lines[i].length, line_num, file_index, file->scan.lines[i].line_num)) {
+            ERROR(diagnostics, ERR_MEMORY_ALLOC);
+            return false;
+        }
+    }
+    return true;
+}
+
+void free_included_files(void) {
+    pthread_mutex_lock(&included_files_lock);
+    if (included_files)
+        hash_table_free(included_files, free_included_file);
+    included_files = NULL;
+    pthread_mutex_unlock(&included_files_lock);
+}
+
+/* phase one - fills the macros table of scan (which must be empty) and collects the lines of buffer, outside macro
+ * definitions and inside them, handles .include lines if include is not NULL, returns false on error */
+static Bool scan_macros(Diagnostics *diagnostics, char *buffer, ScannedFile *scan, IncludeContext *include,
+                        PhaseStats *stats) {
+    /* used to tell cleanup whether the scan succeeded or not */
+    Bool success = false;
+    /* current line start in buffer */
+    char *line_start = buffer;
+    /* current line end in buffer (newline or NULL terminator) */
+    char *line_end;
+    /* current line length including newline */
+    int line_length;
+    /* NULL terminated copy of current line */
+    char line[MAX_LINE];
+    /* a word from line */
+    char token[MAX_LINE];
+    /* pointer to text after token */
+    char *token_ptr;
     /* a flag to determine if in macro or outside */
     Bool in_macro = false;
     /* would be initialized for every macro and inserted to macros table */
     Macro *macro = NULL;
-    /* temp variable to store macro lines before realloc (used for cleanup) */
-    char **prev_macro_lines;
-    /* macros table */
-    HashTable *macros = NULL;
-    /* labels array */
-    char **labels = NULL;
-    /* labels array count */
-    int label_count = 0;
-    /* temp variable to store labels array before realloc (used for cleanup) */
-    char **prev_labels = NULL;
+    /* whether current line starts with a label */
+    Bool has_label;
     /* parsed macro name */
     char macro_name[MAX_LINE];
-    /* input file path */
-    char input_file_path[MAX_LINE];
-    /* file after macro expansion path */
-    char expanded_file_path[MAX_LINE];
-    /* index tracker */
-    int i;
     /* used to track current line num */
     int line_num = 0;
     /* used to track macro line num */
     int macro_line_num = 0;
-    /* original file */
-    FILE *input_file = NULL;
-    /* expanded file */
-    FILE *expanded_file = NULL;
-    /* write input path to input_file_path */
-    sprintf(input_file_path, "%s.as", filename);
-    /* write output path to expanded_file_path */
-    sprintf(expanded_file_path, "%s.am", filename);
-    /* open input_file as read-only */
-    input_file = fopen(input_file_path, "r");
-    /* if failed, throw error and cleanup */
-    if (!input_file) {
-        ERROR_FILE(ERR_CANNOT_OPEN_FILE, input_file_path);
-        goto cleanup;
-    }
-    /* open input_file as write-only */
-    expanded_file = fopen(expanded_file_path, "w");
-    /* if failed, throw error and cleanup */
-    if (!expanded_file) {
-        ERROR_FILE(ERR_CANNOT_CREATE_FILE, expanded_file_path);
-        goto cleanup;
-    }
-    /* create macros table */
-    macros = hash_table_create();
-    /* if failed, throw error and cleanup */
-    if (!macros) {
-        ERROR(ERR_MEMORY_ALLOC);
-        goto cleanup;
-    }
-    /* while there are lines to read */
-    while (fgets(line, MAX_LINE, input_file)) {
+
+    /* while there are lines in buffer */
+    while (*line_start != '\0') {
+        /* find line end and its length including the newline */
+        line_end = strchr(line_start, '\n');
+        if (!line_end)
+            line_end = line_start + strlen(line_start);
+        line_length = line_end - line_start + (*line_end == '\n' ? 1 : 0);
         /* increase line counter */
         line_num++;
 
-        /* if line is longer than MAX_LINE, discard rest and skip (first pass will catch the error) */
-        if (strchr(line, '\n') == NULL && !feof(input_file)) {
-            discard_rest_of_line(input_file);
+        /* if line is longer than MAX_LINE, skip it (first pass will catch the error) */
+        if (line_end - line_start > MAX_LINE - 2) {
+            line_start += line_length;
             continue;
         }
+        /* copy line so it can be tokenized */
+        memcpy(line, line_start, line_length);
+        line[line_length] = '\0';
+
         /* gets first word from line */
         token_ptr = get_token(line, token);
 
         /* if token is a label */
+        has_label = false;
         if (token[0] != '\0' && token[strlen(token) - 1] == ':') {
+            has_label = true;
             /* truncate ':' */
             token[strlen(token) - 1] = '\0';
             /* if a macro with name of label was already parsed, throw error and cleanup */
-            if (hash_table_lookup(macros, token)) {
-                ERROR_LINE(line_num, ERR_LABEL_IS_MACRO_NAME);
-                goto cleanup;
-            }
-            /* backup labels array before realloc */
-            prev_labels = labels;
-            /* realloc labels array by +1 and assign it to labels */
-            labels = realloc(labels, (label_count + 1) * sizeof(char *));
-            /* if realloc failed, throw error, assign prev_labels to labels and cleanup */
-            if (!labels) {
-                ERROR(ERR_MEMORY_ALLOC);
-                labels = prev_labels;
+            STATS_ADD(stats, hash_lookups, 1);
+            if (hash_table_lookup(scan->macros, token)) {
+                ERROR_LINE(diagnostics, line_num, ERR_LABEL_IS_MACRO_NAME);
                 goto cleanup;
             }
-            /* allocate slot for label */
-            labels[label_count] = malloc(strlen(token) + 1);
-            /* if allocation failed, throw error and cleanup */
-            if (!labels[label_count]) {
-                ERROR(ERR_MEMORY_ALLOC);
+            /* remember label (the table copies it), if failed, throw error and cleanup */
+            if (!hash_table_insert(scan->labels, token, NULL)) {
+                ERROR(diagnostics, ERR_MEMORY_ALLOC);
                 goto cleanup;
             }
-            /* copy label to labels[label_count] */
-            strcpy(labels[label_count], token);
-            /* increase label count by +1 */
-            label_count++;
             /* restore ':' */
             token[strlen(token)] = ':';
             /* get next word after label */
             token_ptr = get_token(token_ptr, token);
             /* if next word is either mcro or mcroend, throw error and cleanup */
             if (strcmp(token, "mcro") == 0 || strcmp(token, "mcroend") == 0) {
-                ERROR_LINE(line_num, ERR_LABEL_BEFORE_MACRO);
+                ERROR_LINE(diagnostics, line_num, ERR_LABEL_BEFORE_MACRO);
                 goto cleanup;
             }
         }
 
-        /* if line is a macro */
-        if (strcmp(token, "mcro") == 0) {
+        /* if line includes a file (inside a macro it is just a macro line) */
+        if (include && !in_macro && strcmp(token, ".include") == 0) {
+            /* if there is a label before .include, throw error and cleanup */
+            if (has_label) {
+                ERROR_LINE(diagnostics, line_num, ERR_LABEL_BEFORE_INCLUDE);
+                goto cleanup;
+            }
+            /* if including failed, cleanup (error already reported) */
+            if (!include_file(include, diagnostics, token_ptr, line_num, scan))
+                goto cleanup;
+            /* if line is a macro */
+        } else if (strcmp(token, "mcro") == 0) {
             /* gets macro name */
             token_ptr = get_token(token_ptr, macro_name);
             /* if macro name is empty, throw error and cleanup */
             if (macro_name[0] == '\0') {
-                ERROR_LINE(line_num, ERR_MACRO_NO_NAME);
+                ERROR_LINE(diagnostics, line_num, ERR_MACRO_NO_NAME);
                 goto cleanup;
             }
             /* if macro name is a reserved word, throw error and cleanup */
             if (is_reserved_word(macro_name)) {
-                ERROR_LINE(line_num, ERR_MACRO_RESERVED);
+                ERROR_LINE(diagnostics, line_num, ERR_MACRO_RESERVED);
                 goto cleanup;
             }
             /* make sure macro name doesn't have any word after it */
             token_ptr = get_token(token_ptr, token);
             /* if macro name has at least one word after it, throw error and cleanup */
             if (token[0] != '\0') {
-                ERROR_LINE(line_num, ERR_MACRO_EXTRA_TEXT);
+                ERROR_LINE(diagnostics, line_num, ERR_MACRO_EXTRA_TEXT);
                 goto cleanup;
             }
             /* if macro already exists in macros table (duplicate), throw error and cleanup */
-            if (hash_table_contains_key(macros, macro_name)) {
-                ERROR_LINE(line_num, ERR_MACRO_ALREADY_DEFINED);
+            STATS_ADD(stats, hash_lookups, 1);
+            if (hash_table_contains_key(scan->macros, macro_name)) {
+                ERROR_LINE(diagnostics, line_num, ERR_MACRO_ALREADY_DEFINED);
                 goto cleanup;
             }
-            /* if there is at least one label, check if a label with macro_name was already defined */
-            if (labels) {
-                /* loop all labels */
-                for (i = 0; i < label_count; i++) {
-                    /* if macro_name found in labels array, throw error and cleanup */
-                    if (strcmp(labels[i], macro_name) == 0) {
-                        ERROR_LINE(line_num, ERR_MACRO_NAME_IS_LABEL);
-                        goto cleanup;
-                    }
-                }
+            /* if macro_name is a label, throw error and cleanup */
+            if (hash_table_contains_key(scan->labels, macro_name)) {
+                ERROR_LINE(diagnostics, line_num, ERR_MACRO_NAME_IS_LABEL);
+                goto cleanup;
             }
-            /* allocate new Macro */
-            macro = malloc(sizeof(Macro));
+            /* get a Macro (a spare one if possible) */
+            macro = acquire_macro(scan);
             /* if allocation failed, throw error and cleanup */
             if (!macro) {
-                ERROR(ERR_MEMORY_ALLOC);
+                ERROR(diagnostics, ERR_MEMORY_ALLOC);
                 goto cleanup;
             }
-            /* set macro lines to NULL */
-            macro->lines = NULL;
-            /* set macro line count to 0 */
+            /* its lines will be the next macro lines of the file */
+            macro->lines = &scan->macro_lines;
+            macro->first_line = scan->macro_line_count;
             macro->line_count = 0;
+            /* the macro is this file's own */
+            macro->file = 0;
+            /* remember where the macro was defined so earlier lines don't expand it */
+            macro->line_num = line_num;
             /* if insert macro to macros table failed, throw error and cleanup */
-            if (!hash_table_insert(macros, macro_name, macro)) {
-                ERROR(ERR_MEMORY_ALLOC);
-                free_macro(macro);
+            STATS_ADD(stats, hash_inserts, 1);
+            if (!hash_table_insert(scan->macros, macro_name, macro)) {
+                ERROR(diagnostics, ERR_MEMORY_ALLOC);
+                free(macro);
                 goto cleanup;
             }
             /* enable in_macro flag */
@@ -213,70 +817,209 @@ Bool pre_assemble(char *filename) {
         } else if (strcmp(token, "mcroend") == 0) {
             /* if reached here with in_macro set to false, no mcro, thus throw error and cleanup */
             if (!in_macro) {
-                ERROR_LINE(line_num, ERR_MACRO_END_WITHOUT_START);
+                ERROR_LINE(diagnostics, line_num, ERR_MACRO_END_WITHOUT_START);
                 goto cleanup;
             }
             /* make sure macro end doesn't have any word after it */
             token_ptr = get_token(token_ptr, token);
             /* if macro end has at least one word after it, throw error and cleanup */
             if (token[0] != '\0') {
-                ERROR_LINE(line_num, ERR_MACRO_EXTRA_TEXT);
+                ERROR_LINE(diagnostics, line_num, ERR_MACRO_EXTRA_TEXT);
                 goto cleanup;
             }
             /* disable in_macro flag */
             in_macro = false;
             /* if in_macro flag enabled */
         } else if (in_macro) {
-            /* backup macro lines before realloc */
-            prev_macro_lines = macro->lines;
-            /* realloc macro lines array by +1 and assign it to macro->lines */
-            macro->lines = realloc(macro->lines, (macro->line_count + 1) * sizeof(char *));
-            /* if realloc failed, throw error, assign prev_macro_lines to macro->lines and cleanup */
-            if (!macro->lines) {
-                ERROR(ERR_MEMORY_ALLOC);
-                macro->lines = prev_macro_lines;
+            /* remember the line (in place, with where it is in the file), if failed, throw error and cleanup */
+            if (!add_source_line(&scan->macro_lines, &scan->macro_line_count, &scan->macro_line_capacity, line_start,
+                                 line_length, line_num, 0, line_num)) {
+                ERROR(diagnostics, ERR_MEMORY_ALLOC);
                 goto cleanup;
             }
-            /* allocate slot for macro line */
-            macro->lines[macro->line_count] = malloc(strlen(line) + 1);
-            /* if allocation failed, throw error and cleanup */
-            if (!macro->lines[macro->line_count]) {
-                ERROR(ERR_MEMORY_ALLOC);
-                goto cleanup;
-            }
-            /* copy line to macro->lines[macro->line_count] */
-            strcpy(macro->lines[macro->line_count], line);
             /* increase macro line count by +1 */
             macro->line_count++;
-            /* if in_macro flag disabled */
+            /* if in_macro flag disabled, the line is expanded in phase two */
         } else {
-            /* check if token is a macro name */
-            macro_to_expand = hash_table_lookup(macros, token);
-            /* if macro not found */
-            if (!macro_to_expand) {
-                /* write line to expanded_file as is, if failed, throw error and cleanup */
-                if (fputs(line, expanded_file) == EOF) {
-                    ERROR(ERR_CANNOT_WRITE_FILE);
-                    goto cleanup;
-                }
-                /* if macro found */
-            } else {
-                /* go over each macro line */
-                for (i = 0; i < macro_to_expand->line_count; i++) {
-                    /* write macro line to expanded_file, if failed, throw error and cleanup */
-                    if (fputs(macro_to_expand->lines[i], expanded_file) == EOF) {
-                        ERROR(ERR_CANNOT_WRITE_FILE);
-                        goto cleanup;
-                    }
-                }
+            /* remember line for phase two, if failed, throw error and cleanup */
+            if (!add_source_line(&scan->lines, &scan->line_count, &scan->line_capacity, line_start, line_length,
+                                 line_num, 0, line_num)) {
+                ERROR(diagnostics, ERR_MEMORY_ALLOC);
+                goto cleanup;
             }
         }
+
+        /* advance to next line */
+        line_start += line_length;
     }
 
     /* if still in macro, no mcroend, thus throw error and cleanup */
     if (in_macro) {
-        ERROR_LINE(macro_line_num, ERR_MACRO_START_WITHOUT_END);
+        ERROR_LINE(diagnostics, macro_line_num, ERR_MACRO_START_WITHOUT_END);
+        goto cleanup;
+    }
+
+    /* mark scan as success */
+    success = true;
+
+cleanup:
+    /* count the lines read so far, including the skipped ones */
+    STATS_ADD(stats, lines_read, line_num);
+
+    /* return whether the scan succeeded or failed */
+    return success;
+}
+
+/* expands filename.as to filename.am, passing lines to sink if not NULL (then on this thread only), replacing origins
+ * and includes if not NULL, counting into stats if not NULL, working in buffers if not NULL */
+static Bool expand_file(char *filename, Diagnostics *diagnostics, LineSink sink, void *context, LineOrigins *origins,
+                        Buffer *includes, AssemblerStats *stats, PreAssemblerBuffers *buffers) {
+    /* used to tell cleanup whether to remove expanded_file or not */
+    Bool success = false;
+    /* buffers of this file only, if the caller has none */
+    PreAssemblerBuffers *own_buffers = NULL;
+    /* the input file's macros and lines, in buffers */
+    ScannedFile *scan;
+    /* what the .include lines need */
+    IncludeContext include;
+    /* expansion chunks, one per thread */
+    ExpansionChunk chunks[PRE_ASSEMBLER_THREADS];
+    /* expansion threads */
+    pthread_t threads[PRE_ASSEMBLER_THREADS];
+    /* whether threads[i] was started */
+    Bool thread_started[PRE_ASSEMBLER_THREADS];
+    /* count of chunks */
+    int chunk_count;
+    /* lines per chunk */
+    int lines_per_chunk;
+    /* input file path */
+    char input_file_path[MAX_LINE];
+    /* file after macro expansion path */
+    char expanded_file_path[MAX_LINE];
+    /* index trackers */
+    int i, j;
+    /* original file */
+    FILE *input_file = NULL;
+    /* expanded file */
+    FILE *expanded_file = NULL;
+    /* counters of this phase, NULL if disabled */
+    PhaseStats *phase_stats = STATS_PHASE(stats, PHASE_PRE_ASSEMBLE);
+
+    /* no chunk was expanded yet */
+    for (i = 0; i < PRE_ASSEMBLER_THREADS; i++)
+        thread_started[i] = false;
+    chunk_count = 0;
+    if (origins)
+        origins->count = 0;
+    if (includes)
+        includes->length = 0;
+    /* write input path to input_file_path */
+    sprintf(input_file_path, "%s.as", filename);
+    /* write output path to expanded_file_path */
+    sprintf(expanded_file_path, "%s.am", filename);
+    /* following errors belong to input_file_path, if failed, throw error and cleanup */
+    if (!diagnostics_set_file(diagnostics, input_file_path)) {
+        ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        goto cleanup;
+    }
+    /* empty the caller's buffers (keeping their memory), or create buffers for this file, if failed, throw error and
+     * cleanup */
+    if (buffers) {
+        reset_pre_assembler_buffers(buffers);
+    } else if (!(buffers = own_buffers = create_pre_assembler_buffers())) {
+        ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        goto cleanup;
+    }
+    scan = &buffers->scan;
+    include.path = input_file_path;
+    include.paths = includes ? includes : &buffers->includes;
+    include.stats = stats;
+    /* open input_file as read-only */
+    input_file = fopen(input_file_path, "r");
+    /* if failed, throw error and cleanup */
+    if (!input_file) {
+        ERROR_FILE(diagnostics, ERR_CANNOT_OPEN_FILE, input_file_path);
+        goto cleanup;
+    }
+    /* open input_file as write-only */
+    expanded_file = fopen(expanded_file_path, "w");
+    /* if failed, throw error and cleanup */
+    if (!expanded_file) {
+        ERROR_FILE(diagnostics, ERR_CANNOT_CREATE_FILE, expanded_file_path);
+        goto cleanup;
+    }
+    /* read whole input file, if failed, throw error and cleanup */
+    if (!read_file_to_buffer(input_file, &buffers->text)) {
+        ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        goto cleanup;
+    }
+    STATS_ADD(phase_stats, bytes_read, buffers->text.length);
+
+    /* phase one - find macro definitions (errors reported inside) */
+    if (!scan_macros(diagnostics, buffers->text.data, scan, &include, phase_stats))
         goto cleanup;
+    STATS_ADD(stats, macros_defined, scan->macros->count);
+    /* every line outside macro definitions looks up its possible macro call */
+    STATS_ADD(phase_stats, hash_lookups, scan->line_count);
+
+    /* phase two - split source lines to chunks, small files are expanded on this thread only */
+    chunk_count = scan->line_count / MIN_LINES_PER_THREAD;
+    if (chunk_count > PRE_ASSEMBLER_THREADS)
+        chunk_count = PRE_ASSEMBLER_THREADS;
+    /* a sink needs the lines in order, so it gets a single chunk */
+    if (chunk_count < 1 || sink)
+        chunk_count = 1;
+    lines_per_chunk = (scan->line_count + chunk_count - 1) / chunk_count;
+    for (i = 0; i < chunk_count; i++) {
+        chunks[i].lines = scan->lines + i * lines_per_chunk;
+        chunks[i].line_count = scan->line_count - i * lines_per_chunk;
+        if (chunks[i].line_count > lines_per_chunk)
+            chunks[i].line_count = lines_per_chunk;
+        chunks[i].macros = scan->macros;
+        chunks[i].output = &buffers->outputs[i];
+        chunks[i].sink = sink;
+        chunks[i].context = context;
+        chunks[i].keep_origins = origins != NULL;
+        chunks[i].origins = &buffers->origins[i];
+    }
+
+    /* expand all chunks but the first on their own threads */
+    for (i = 1; i < chunk_count; i++)
+        thread_started[i] = pthread_create(&threads[i], NULL, expand_chunk, &chunks[i]) == 0;
+    /* expand the first chunk, and any chunk whose thread failed to start, on this thread */
+    for (i = 0; i < chunk_count; i++) {
+        if (!thread_started[i])
+            expand_chunk(&chunks[i]);
+    }
+    /* wait for all threads */
+    for (i = 1; i < chunk_count; i++) {
+        if (thread_started[i])
+            pthread_join(threads[i], NULL);
+    }
+
+    /* stitch chunks back together in order */
+    for (i = 0; i < chunk_count; i++) {
+        /* if expansion ran out of memory, throw error and cleanup */
+        if (!chunks[i].success) {
+            ERROR(diagnostics, ERR_MEMORY_ALLOC);
+            goto cleanup;
+        }
+        /* write chunk to expanded_file, if failed, throw error and cleanup */
+        if (chunks[i].output->length > 0 &&
+            fwrite(chunks[i].output->data, 1, chunks[i].output->length, expanded_file) != chunks[i].output->length) {
+            ERROR(diagnostics, ERR_CANNOT_WRITE_FILE);
+            goto cleanup;
+        }
+        /* origins follow the lines, if failed, throw error and cleanup */
+        for (j = 0; origins && j < chunks[i].origins->count; j++) {
+            if (!line_origins_push(origins, chunks[i].origins->lines[j].file, chunks[i].origins->lines[j].line,
+                                   chunks[i].origins->lines[j].call)) {
+                ERROR(diagnostics, ERR_MEMORY_ALLOC);
+                goto cleanup;
+            }
+        }
+        STATS_ADD(phase_stats, bytes_written, chunks[i].output->length);
+        STATS_ADD(stats, expanded_lines, chunks[i].expanded_lines);
     }
 
     /* mark operation as success so cleanup wouldn't remove expanded_file */
@@ -293,20 +1036,20 @@ cleanup:
         if (!success)
             remove(expanded_file_path);
     }
-    /* if macros table created, free it */
-    if (macros)
-        hash_table_free(macros, free_macro);
-
-    /* if labels array exists, free it and its members */
-    if (labels) {
-        /* loop all labels */
-        for (i = 0; i < label_count; i++)
-            /* free label */
-            free(labels[i]);
-        /* free labels array */
-        free(labels);
-    }
+    /* free buffers of this file only, the caller's stay filled until they are reset */
+    free_pre_assembler_buffers(own_buffers);
 
     /* return whether the operation succeeded or failed */
     return success;
+}
+
+Bool pre_assemble(char *filename, Diagnostics *diagnostics, LineOrigins *origins, Buffer *includes,
+                  AssemblerStats *stats, PreAssemblerBuffers *buffers) {
+    return expand_file(filename, diagnostics, NULL, NULL, origins, includes, stats, buffers);
+}
+
+Bool pre_assemble_streaming(char *filename, Diagnostics *diagnostics, LineSink sink, void *context,
+                            LineOrigins *origins, Buffer *includes, AssemblerStats *stats,
+                            PreAssemblerBuffers *buffers) {
+    return expand_file(filename, diagnostics, sink, context, origins, includes, stats, buffers);
 }
\ No newline at end of file
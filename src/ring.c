@@ -0,0 +1,89 @@
+#include <sched.h>
+#include <stdlib.h>
+
+#include "alloc.h"
+#include "bool.h"
+#include "ring.h"
+
+Bool ring_init(Ring *ring, int capacity) {
+    /* capacity rounded up to a power of two so indexes wrap with a mask */
+    unsigned long size = 1;
+
+    while (size < (unsigned long)capacity)
+        size *= 2;
+
+    ring->slots = malloc(size * sizeof(void *));
+    if (!ring->slots)
+        return false;
+    ring->mask = size - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->empty_stalls = 0;
+    ring->full_stalls = 0;
+    return true;
+}
+
+Bool ring_try_push(Ring *ring, void *item) {
+    /* only this thread writes tail */
+    unsigned long tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+    /* if every slot holds an unread item, ring is full (acquire: the consumer is done reading freed slots) */
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) > ring->mask)
+        return false;
+
+    ring->slots[tail & ring->mask] = item;
+    /* release: item is visible to the consumer before the new tail is */
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void *ring_try_pop(Ring *ring) {
+    /* only this thread writes head */
+    unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    /* the popped item */
+    void *item;
+
+    /* if consumer caught up with producer, ring is empty (acquire: pairs with the producer's release of tail) */
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    item = ring->slots[head & ring->mask];
+    /* release: slot is read before the producer may reuse it */
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+void ring_push(Ring *ring, void *item) {
+    if (ring_try_push(ring, item))
+        return;
+
+    /* count the wait once, then give the consumer the core until there is room */
+    ring->full_stalls++;
+    while (!ring_try_push(ring, item))
+        sched_yield();
+}
+
+void *ring_pop(Ring *ring) {
+    /* the popped item */
+    void *item = ring_try_pop(ring);
+
+    if (item)
+        return item;
+
+    /* count the wait once, then give the producer the core until there is an item */
+    ring->empty_stalls++;
+    while (!(item = ring_try_pop(ring)))
+        sched_yield();
+    return item;
+}
+
+unsigned long ring_count(Ring *ring) {
+    /* read head first, so the count can't come out negative while both sides run */
+    unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - head;
+}
+
+void ring_free(Ring *ring) {
+    free(ring->slots);
+    ring->slots = NULL;
+}
\ No newline at end of file
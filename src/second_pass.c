@@ -1,302 +1,343 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
 
+#include "alloc.h"
 #include "assembler.h"
 #include "bool.h"
+#include "diagnostics.h"
 #include "errors.h"
 #include "hash_table.h"
-#include "instructions.h"
-#include "parser.h"
 #include "second_pass.h"
+#include "stats.h"
 #include "symbol_table.h"
+#include "trace.h"
+
+/* capacity the pending errors and uses arrays start with on their first use */
+#define INITIAL_PENDING_SIZE 16
+
+/* records an error to report once all chunks are done (code is the name of msg, like ERROR_LINE) */
+#define PENDING_ERROR(list, line, msg) add_pending_error(list, line, #msg, msg)
+
+/* a range of references resolved by one thread (the symbols table is only read) */
+typedef struct {
+    AssemblerState *state;
+    SymbolReference *references;
+    int reference_count;
+    PendingErrors *errors; /* the chunk's own array in state */
+    PendingUses *uses;     /* the chunk's own array in state */
+    int lookups;           /* references looked up (the skipped ones aren't) */
+} ResolveChunk;
+
+static void add_pending_error(PendingErrors *list, int line_num, const char *code, const char *message) {
+    /* new capacity if errors array needs to grow */
+    int new_capacity;
+    /* grown errors array */
+    PendingError *new_errors;
+
+    /* if errors array is full, grow it geometrically */
+    if (list->count == list->capacity) {
+        new_capacity = list->capacity ? list->capacity * 2 : INITIAL_PENDING_SIZE;
+        new_errors = realloc(list->errors, new_capacity * sizeof(PendingError));
+        if (!new_errors) {
+            list->out_of_memory = true;
+            return;
+        }
+        list->errors = new_errors;
+        list->capacity = new_capacity;
+    }
 
-Bool second_pass(char *filename, AssemblerState *state) {
-    /* used to tell cleanup whether to free state variable or not */
-    Bool success = false;
-    /* a flag to tell whether the file has any errors or not */
-    Bool has_errors = false;
-    /* current line from fgets */
-    char line[MAX_LINE];
-    /* used to track current line num */
-    int line_num = 0;
-    /* a word from line */
-    char token[MAX_LINE];
-    /* pointer to text after token */
-    char *token_ptr;
-    /* stores a pointer to comment start (if any) */
-    char *comment_start = NULL;
-    /* symbol from assembler state */
-    Symbol *symbol = NULL;
-    /* read-only instruction info */
-    const InstructionInfo *instruction_info = NULL;
-    /* operands for instruction */
-    char operand1[MAX_LINE], operand2[MAX_LINE];
-    /* operand1 length to trim trailing whitepsaces of first operand for 2 operations instruction */
-    int operand1_length;
-    /* operands addressing modes */
-    int operand1_addressing_mode, operand2_addressing_mode;
-    /* operand comma pointer */
-    char *comma_ptr = NULL;
-    /* would store state->ic - IC_START */
-    int code_index = 0;
-    /* operand symbol name */
-    char *symbol_name = NULL;
-    /* input file path */
-    char input_file_path[MAX_LINE];
-    /* original file */
-    FILE *input_file = NULL;
-
-    /* write input path to input_file_path */
-    sprintf(input_file_path, "%s.am", filename);
-
-    /* open input_file as read-only */
-    input_file = fopen(input_file_path, "r");
-    /* if failed, throw error and cleanup */
-    if (!input_file) {
-        ERROR_FILE(ERR_CANNOT_OPEN_FILE, input_file_path);
-        goto cleanup;
+    list->errors[list->count].line_num = line_num;
+    list->errors[list->count].code = code;
+    list->errors[list->count].message = message;
+    list->count++;
+}
+
+static void add_pending_use(PendingUses *list, Symbol *symbol, int address) {
+    /* new capacity if uses array needs to grow */
+    int new_capacity;
+    /* grown uses array */
+    PendingUse *new_uses;
+
+    /* if uses array is full, grow it geometrically */
+    if (list->count == list->capacity) {
+        new_capacity = list->capacity ? list->capacity * 2 : INITIAL_PENDING_SIZE;
+        new_uses = realloc(list->uses, new_capacity * sizeof(PendingUse));
+        if (!new_uses) {
+            list->out_of_memory = true;
+            return;
+        }
+        list->uses = new_uses;
+        list->capacity = new_capacity;
     }
 
-    /* allocate externals array */
-    state->externals = malloc(MAX_MEMORY * sizeof(External));
-    /* if failed, throw error and cleanup */
-    if (!state->externals) {
-        ERROR(ERR_MEMORY_ALLOC);
-        goto cleanup;
+    list->uses[list->count].symbol = symbol;
+    list->uses[list->count].address = address;
+    list->count++;
+}
+
+/* resolves a single reference into its code word, returns false if it has an error (recorded to chunk) */
+static Bool resolve_reference(ResolveChunk *chunk, SymbolReference *reference) {
+    /* state of the file */
+    AssemblerState *state = chunk->state;
+    /* address of the operand word */
+    int address = state->ic_start + reference->code_index;
+    /* the referenced symbol */
+    Symbol *symbol = hash_table_lookup(state->symbols, state->names.data + reference->name);
+
+    /* if symbol not found, record error */
+    if (!symbol) {
+        PENDING_ERROR(chunk->errors, reference->line_num, ERR_SYMBOL_NOT_FOUND);
+        return false;
     }
 
-    /* set initial ec to 0 */
-    state->ec = 0;
+    /* if addressing mode is relative and symbol is external, record error */
+    if (reference->is_relative && symbol->type == SYMBOL_EXTERNAL) {
+        PENDING_ERROR(chunk->errors, reference->line_num, ERR_RELATIVE_EXTERNAL);
+        return false;
+    }
 
-    /* while there are lines to read */
-    while (fgets(line, MAX_LINE, input_file)) {
-        /* increase line counter */
-        line_num++;
+    /* if a local symbol's address doesn't fit in a word (large memory), record error */
+    if (!reference->is_relative && symbol->type != SYMBOL_EXTERNAL && symbol->address > WORD_VALUE_MASK) {
+        PENDING_ERROR(chunk->errors, reference->line_num, ERR_ADDRESS_OUT_OF_RANGE);
+        return false;
+    }
 
-        /* finds first comment char in line */
-        comment_start = strchr(line, COMMENT_CHAR);
-        /* if found, strips it and what's after */
-        if (comment_start)
-            *comment_start = '\0';
+    /* if a relative distance doesn't fit in a word, record error */
+    if (reference->is_relative &&
+        (symbol->address - address < MIN_NUMBER || symbol->address - address > MAX_NUMBER)) {
+        PENDING_ERROR(chunk->errors, reference->line_num, ERR_DISTANCE_OUT_OF_RANGE);
+        return false;
+    }
 
-        /* if line is empty or comment, skip to next line */
-        if (is_empty(line))
+    /* relative operand holds the distance from the operand word */
+    if (reference->is_relative) {
+        state->code.words[reference->code_index] = MAKE_WORD(symbol->address - address, ARE_A);
+        /* external operand is filled by the linker, record where it is used */
+    } else if (symbol->type == SYMBOL_EXTERNAL) {
+        state->code.words[reference->code_index] = MAKE_WORD(0, ARE_E);
+        add_pending_use(chunk->uses, symbol, address);
+        /* in any other case */
+    } else {
+        state->code.words[reference->code_index] = MAKE_WORD(symbol->address, ARE_R);
+    }
+    return true;
+}
+
+/* resolves a range of references, each chunk writes only its own code words */
+static void *resolve_chunk(void *arg) {
+    /* the chunk to resolve */
+    ResolveChunk *chunk = (ResolveChunk *)arg;
+    /* whether the previous reference had an error */
+    Bool previous_failed = false;
+    /* when the chunk started, for the trace */
+    double start = trace_now();
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < chunk->reference_count; i++) {
+        /* the second operand of an instruction whose first operand failed is skipped, like the rest of its line */
+        if (previous_failed && chunk->references[i].line_num == chunk->references[i - 1].line_num) {
+            previous_failed = false;
             continue;
+        }
+        chunk->lookups++;
+        previous_failed = !resolve_reference(chunk, &chunk->references[i]);
+    }
+    /* references aren't lines, so the span only shows how long the chunk took */
+    trace_span("resolve_chunk", start, NULL, -1);
+    return NULL;
+}
+
+/* marks entry symbols, errors are recorded to list */
+static void process_entries(AssemblerState *state, PendingErrors *list) {
+    /* current entry */
+    EntryRequest *entry;
+    /* symbol from assembler state */
+    Symbol *symbol;
+    /* index tracker */
+    int i;
 
-        /* gets first word from line */
-        token_ptr = get_token(line, token);
-
-        /* if token is a label, skip it (labels were already processed in first pass) */
-        if (token[0] != '\0' && token[strlen(token) - 1] == ':')
-            token_ptr = get_token(token_ptr, token);
-
-        /* if token is .entry directive */
-        if (strcmp(token, ".entry") == 0) {
-            /* store symbol name in token */
-            token_ptr = get_token(token_ptr, token);
-            /* if no symbol provided, report error and skip to next line */
-            if (is_empty(token)) {
-                ERROR_LINE(line_num, ERR_ENTRY_INVALID_SYMBOL);
-                has_errors = true;
-                continue;
-            }
-
-            /* get symbol from symbols table */
-            symbol = hash_table_lookup(state->symbols, token);
-            /* if symbol not found, report error and skip to next line */
-            if (!symbol) {
-                ERROR_LINE(line_num, ERR_ENTRY_NOT_FOUND);
-                has_errors = true;
-                continue;
-            }
-
-            /* if symbol is external, report error and skip to next line */
-            if (symbol->type == SYMBOL_EXTERNAL) {
-                ERROR_LINE(line_num, ERR_ENTRY_IS_EXTERN);
-                has_errors = true;
-                continue;
-            }
-
-            /* mark symbol as entry */
-            symbol->is_entry = true;
-            /* if token is not a directive (not .data, .string, and .extern) */
-        } else if (!is_directive(token)) {
-            /* skip instruction word */
-            code_index++;
-
-            /* get instruction info */
-            instruction_info = get_instruction_info(token);
+    for (i = 0; i < state->entry_count; i++) {
+        entry = &state->entries[i];
 
-            /* handle 1-operand instruction */
-            if (instruction_info->num_operands == 1) {
-                /* get first operand */
-                token_ptr = get_token(token_ptr, operand1);
+        /* if no symbol provided, record error and skip to next entry */
+        if (state->names.data[entry->name] == '\0') {
+            PENDING_ERROR(list, entry->line_num, ERR_ENTRY_INVALID_SYMBOL);
+            continue;
+        }
 
-                /* set operand1_length to operand1 length */
-                operand1_length = strlen(operand1);
-                /* skip leading whitespace */
-                token_ptr = skip_whitespace(token_ptr);
+        /* get symbol from symbols table */
+        symbol = hash_table_lookup(state->symbols, state->names.data + entry->name);
+        STATS_ADD(state->stats, phases[PHASE_SECOND_PASS].hash_lookups, 1);
+        /* if symbol not found, record error and skip to next entry */
+        if (!symbol) {
+            PENDING_ERROR(list, entry->line_num, ERR_ENTRY_NOT_FOUND);
+            continue;
+        }
 
-                /* get addressing mode for operand1 */
-                operand1_addressing_mode = get_addressing_mode(operand1);
-            }
+        /* if symbol is external, record error and skip to next entry */
+        if (symbol->type == SYMBOL_EXTERNAL) {
+            PENDING_ERROR(list, entry->line_num, ERR_ENTRY_IS_EXTERN);
+            continue;
+        }
 
-            /* handle 2-operand instruction */
-            if (instruction_info->num_operands == 2) {
-                /* skip leading whitespace */
-                token_ptr = skip_whitespace(token_ptr);
+        /* mark symbol as entry */
+        symbol->is_entry = true;
+        STATS_ADD(state->stats, entries, 1);
+    }
+}
+
+/* reports entry errors and chunks' errors merged by line (as a single pass over the file would), returns false if
+ * there were any */
+static Bool report_errors(Diagnostics *diagnostics, PendingErrors *entry_errors, ResolveChunk *chunks,
+                          int chunk_count) {
+    /* next entry error to report */
+    int entry_index = 0;
+    /* current pending error */
+    PendingError *error;
+    /* whether anything was reported */
+    Bool has_errors = false;
+    /* index trackers */
+    int i, j;
+
+    for (i = 0; i < chunk_count; i++) {
+        for (j = 0; j < chunks[i].errors->count; j++) {
+            error = &chunks[i].errors->errors[j];
+            /* report entry errors of earlier lines first */
+            for (; entry_index < entry_errors->count && entry_errors->errors[entry_index].line_num < error->line_num;
+                 entry_index++)
+                diagnostics_report(diagnostics, DIAGNOSTIC_ERROR, entry_errors->errors[entry_index].line_num,
+                                   entry_errors->errors[entry_index].code, entry_errors->errors[entry_index].message,
+                                   NULL);
+            diagnostics_report(diagnostics, DIAGNOSTIC_ERROR, error->line_num, error->code, error->message, NULL);
+            has_errors = true;
+        }
+    }
+    /* report remaining entry errors */
+    for (; entry_index < entry_errors->count; entry_index++) {
+        diagnostics_report(diagnostics, DIAGNOSTIC_ERROR, entry_errors->errors[entry_index].line_num,
+                           entry_errors->errors[entry_index].code, entry_errors->errors[entry_index].message, NULL);
+        has_errors = true;
+    }
 
-                /* get pointer to first comma */
-                comma_ptr = strchr(token_ptr, ',');
+    return !has_errors;
+}
 
-                /* copy all characters before comma to operand1 */
-                strncpy(operand1, token_ptr, comma_ptr - token_ptr);
-                /* add NULL terminator at the end of operand1 */
-                operand1[comma_ptr - token_ptr] = '\0';
+Bool second_pass(char *filename, AssemblerState *state) {
+    /* where to report errors */
+    Diagnostics *diagnostics = state->diagnostics;
+    /* used to tell the caller whether the pass succeeded or not */
+    Bool success = false;
+    /* errors of .entry requests */
+    PendingErrors *entry_errors = &state->entry_errors;
+    /* chunks, one per thread */
+    ResolveChunk chunks[SECOND_PASS_THREADS];
+    /* resolving threads */
+    pthread_t threads[SECOND_PASS_THREADS];
+    /* whether threads[i] was started */
+    Bool thread_started[SECOND_PASS_THREADS];
+    /* count of chunks */
+    int chunk_count;
+    /* first reference of the next chunk */
+    int start = 0;
+    /* input file path */
+    char input_file_path[MAX_LINE];
+    /* index trackers */
+    int i, j;
+
+    /* split references to chunks, small files are resolved on this thread only */
+    chunk_count = state->reference_count / MIN_REFERENCES_PER_THREAD;
+    if (chunk_count > SECOND_PASS_THREADS)
+        chunk_count = SECOND_PASS_THREADS;
+    if (chunk_count < 1)
+        chunk_count = 1;
+    for (i = 0; i < chunk_count; i++) {
+        chunks[i].state = state;
+        chunks[i].references = state->references + start;
+        /* move chunk end forward so both operands of an instruction land in the same chunk */
+        j = i == chunk_count - 1 ? state->reference_count : state->reference_count * (i + 1) / chunk_count;
+        while (j > start && j < state->reference_count &&
+               state->references[j].line_num == state->references[j - 1].line_num)
+            j++;
+        chunks[i].reference_count = j - start;
+        start = j;
+        /* the chunk's arrays are kept in state from file to file, only emptied here */
+        chunks[i].errors = &state->pending_errors[i];
+        chunks[i].errors->count = 0;
+        chunks[i].errors->out_of_memory = false;
+        chunks[i].uses = &state->pending_uses[i];
+        chunks[i].uses->count = 0;
+        chunks[i].uses->out_of_memory = false;
+        chunks[i].lookups = 0;
+        thread_started[i] = false;
+    }
 
-                /* skip trailing whitespace from operand1 */
-                operand1_length = strlen(operand1);
-                while (operand1_length > 0 &&
-                       (operand1[operand1_length - 1] == ' ' || operand1[operand1_length - 1] == '\t')) {
-                    operand1[operand1_length - 1] = '\0';
-                    operand1_length--;
-                }
+    entry_errors->count = 0;
+    entry_errors->out_of_memory = false;
 
-                /* skip comma */
-                token_ptr = comma_ptr + 1;
+    /* errors belong to the .am file the references were read from, if failed, throw error and cleanup */
+    sprintf(input_file_path, "%s.am", filename);
+    if (!diagnostics_set_file(diagnostics, input_file_path)) {
+        ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        goto cleanup;
+    }
 
-                /* skip leading whitespace */
-                token_ptr = skip_whitespace(token_ptr);
+    /* set initial ec to 0 */
+    state->ec = 0;
 
-                /* extract operand2 from token_ptr */
-                token_ptr = get_token(token_ptr, operand2);
+    /* resolve all chunks but the first on their own threads */
+    for (i = 1; i < chunk_count; i++)
+        thread_started[i] = pthread_create(&threads[i], NULL, resolve_chunk, &chunks[i]) == 0;
+    /* resolve the first chunk, and any chunk whose thread failed to start, on this thread */
+    for (i = 0; i < chunk_count; i++) {
+        if (!thread_started[i])
+            resolve_chunk(&chunks[i]);
+    }
+    /* entries only mark symbols, which resolving doesn't read */
+    process_entries(state, entry_errors);
+    /* wait for all threads */
+    for (i = 1; i < chunk_count; i++) {
+        if (thread_started[i])
+            pthread_join(threads[i], NULL);
+    }
 
-                /* skip leading whitespace */
-                token_ptr = skip_whitespace(token_ptr);
+    /* count the chunks' lookups */
+    for (i = 0; i < chunk_count; i++)
+        STATS_ADD(state->stats, phases[PHASE_SECOND_PASS].hash_lookups, chunks[i].lookups);
 
-                /* get addressing mode for operand1 */
-                operand1_addressing_mode = get_addressing_mode(operand1);
-                /* get addressing mode for operand2 */
-                operand2_addressing_mode = get_addressing_mode(operand2);
-            }
+    /* if any error or use couldn't be recorded, throw error and cleanup */
+    for (i = 0; i < chunk_count; i++) {
+        if (chunks[i].errors->out_of_memory || chunks[i].uses->out_of_memory) {
+            ERROR(diagnostics, ERR_MEMORY_ALLOC);
+            goto cleanup;
+        }
+    }
+    if (entry_errors->out_of_memory) {
+        ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        goto cleanup;
+    }
 
-            /* update operand1 code word */
-            if (instruction_info->num_operands >= 1) {
-                if (operand1_addressing_mode == ADDR_DIRECT || operand1_addressing_mode == ADDR_RELATIVE) {
-                    /* store operand1 symbol name */
-                    symbol_name = operand1 + (operand1_addressing_mode == ADDR_RELATIVE ? 1 : 0);
-                    /* get symbol from symbols table */
-                    symbol = hash_table_lookup(state->symbols, symbol_name);
-                    /* if symbol not found, report error, advance code_index and skip to next line */
-                    if (!symbol) {
-                        ERROR_LINE(line_num, ERR_SYMBOL_NOT_FOUND);
-                        has_errors = true;
-                        code_index += instruction_info->num_operands;
-                        continue;
-                    }
-                }
-
-                /* if operand1 addressing mode is relative and symbol is external, report error, advance code_index and skip to next line */
-                if (operand1_addressing_mode == ADDR_RELATIVE && symbol->type == SYMBOL_EXTERNAL) {
-                    ERROR_LINE(line_num, ERR_RELATIVE_EXTERNAL);
-                    has_errors = true;
-                    code_index += instruction_info->num_operands;
-                    continue;
-                }
-
-                /* if operand1 addressing mode is direct */
-                if (operand1_addressing_mode == ADDR_DIRECT) {
-                    /* if symbol is external */
-                    if (symbol->type == SYMBOL_EXTERNAL) {
-                        /* update code word data */
-                        state->code[code_index].value = 0;
-                        state->code[code_index].are = ARE_E;
-
-                        /* add external to externals array */
-                        strcpy(state->externals[state->ec].name, symbol_name);
-                        state->externals[state->ec].address = IC_START + code_index;
-                        state->ec++;
-
-                        /* in any other case */
-                    } else {
-                        state->code[code_index].value = symbol->address;
-                        state->code[code_index].are = ARE_R;
-                    }
-                    /* if operand1 addressing mode is relative */
-                } else if (operand1_addressing_mode == ADDR_RELATIVE) {
-                    state->code[code_index].value = symbol->address - (IC_START + code_index);
-                    state->code[code_index].are = ARE_A;
-                }
-
-                /* advance code_index to next word */
-                code_index++;
-            }
+    /* report errors in line order, if there were any, cleanup */
+    if (!report_errors(diagnostics, entry_errors, chunks, chunk_count))
+        goto cleanup;
 
-            /* update operand2 code word */
-            if (instruction_info->num_operands == 2) {
-                if (operand2_addressing_mode == ADDR_DIRECT || operand2_addressing_mode == ADDR_RELATIVE) {
-                    /* store operand2 symbol name */
-                    symbol_name = operand2 + (operand2_addressing_mode == ADDR_RELATIVE ? 1 : 0);
-                    /* get symbol from symbols table */
-                    symbol = hash_table_lookup(state->symbols, symbol_name);
-                    /* if symbol not found, report error, advance code_index and skip to next line */
-                    if (!symbol) {
-                        ERROR_LINE(line_num, ERR_SYMBOL_NOT_FOUND);
-                        has_errors = true;
-                        code_index++;
-                        continue;
-                    }
-                }
-
-                /* if operand2 addressing mode is relative and symbol is external, report error, advance code_index and skip to next line */
-                if (operand2_addressing_mode == ADDR_RELATIVE && symbol->type == SYMBOL_EXTERNAL) {
-                    ERROR_LINE(line_num, ERR_RELATIVE_EXTERNAL);
-                    has_errors = true;
-                    code_index++;
-                    continue;
-                }
-
-                /* if operand2 addressing mode is direct */
-                if (operand2_addressing_mode == ADDR_DIRECT) {
-                    /* if symbol is external */
-                    if (symbol->type == SYMBOL_EXTERNAL) {
-                        /* update code word data */
-                        state->code[code_index].value = 0;
-                        state->code[code_index].are = ARE_E;
-
-                        /* add external to externals array */
-                        strcpy(state->externals[state->ec].name, symbol_name);
-                        state->externals[state->ec].address = IC_START + code_index;
-                        state->ec++;
-
-                        /* in any other case */
-                    } else {
-                        state->code[code_index].value = symbol->address;
-                        state->code[code_index].are = ARE_R;
-                    }
-                    /* if operand2 addressing mode is relative */
-                } else if (operand2_addressing_mode == ADDR_RELATIVE) {
-                    state->code[code_index].value = symbol->address - (IC_START + code_index);
-                    state->code[code_index].are = ARE_A;
-                }
-
-                /* advance code_index to next word */
-                code_index++;
+    /* record external uses on their symbols, chunks are in code order so each symbol's uses stay in address order */
+    for (i = 0; i < chunk_count; i++) {
+        for (j = 0; j < chunks[i].uses->count; j++) {
+            /* if failed, throw error and cleanup */
+            if (!add_external_use(chunks[i].uses->uses[j].symbol, chunks[i].uses->uses[j].address)) {
+                ERROR(diagnostics, ERR_MEMORY_ALLOC);
+                goto cleanup;
             }
+            state->ec++;
         }
     }
+    STATS_ADD(state->stats, external_uses, state->ec);
 
-    success = !has_errors;
+    success = true;
 
 cleanup:
-    /* if input_file is open, close it */
-    if (input_file)
-        fclose(input_file);
-
-    /* if success is false, free assembler state */
-    if (!success)
-        free_assembler_state(state);
-
+    /* the chunks' errors and uses stay in state (with their capacity) for the next file */
     return success;
 }
\ No newline at end of file
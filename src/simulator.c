@@ -0,0 +1,544 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "address_sort.h"
+#include "assembler.h"
+#include "batch.h"
+#include "bool.h"
+#include "diagnostics.h"
+#include "disassembler.h"
+#include "errors.h"
+#include "hash_table.h"
+#include "instructions.h"
+#include "jit.h"
+#include "simulator.h"
+#include "source_map.h"
+#include "stats.h"
+#include "symbol_table.h"
+#include "trace.h"
+
+/* handler of an instruction, and whether it writes its destination */
+typedef struct {
+    const char *name;
+    OpHandler handler;
+    Bool writes;
+} OpInfo;
+
+/* stops machine at op because of status, returns NULL so the handler can return it */
+static const MachineOp *fault(Machine *machine, const MachineOp *op, MachineStatus status) {
+    machine->status = status;
+    machine->fault_address = op->address;
+    machine->pc = op;
+    return NULL;
+}
+
+static const MachineOp *op_mov(Machine *machine, const MachineOp *op) {
+    (void)machine;
+    *op->dest = *op->src;
+    return op->next;
+}
+
+static const MachineOp *op_cmp(Machine *machine, const MachineOp *op) {
+    /* values are kept as signed 12-bit numbers, so equal values are equal words */
+    machine->zero = *op->src == *op->dest;
+    return op->next;
+}
+
+static const MachineOp *op_add(Machine *machine, const MachineOp *op) {
+    (void)machine;
+    *op->dest = SIGNED_VALUE(*op->dest + *op->src);
+    return op->next;
+}
+
+static const MachineOp *op_sub(Machine *machine, const MachineOp *op) {
+    (void)machine;
+    *op->dest = SIGNED_VALUE(*op->dest - *op->src);
+    return op->next;
+}
+
+static const MachineOp *op_lea(Machine *machine, const MachineOp *op) {
+    (void)machine;
+    *op->dest = SIGNED_VALUE(op->value);
+    return op->next;
+}
+
+static const MachineOp *op_clr(Machine *machine, const MachineOp *op) {
+    (void)machine;
+    *op->dest = 0;
+    return op->next;
+}
+
+static const MachineOp *op_not(Machine *machine, const MachineOp *op) {
+    (void)machine;
+    *op->dest = SIGNED_VALUE(~*op->dest);
+    return op->next;
+}
+
+static const MachineOp *op_inc(Machine *machine, const MachineOp *op) {
+    (void)machine;
+    *op->dest = SIGNED_VALUE(*op->dest + 1);
+    return op->next;
+}
+
+static const MachineOp *op_dec(Machine *machine, const MachineOp *op) {
+    (void)machine;
+    *op->dest = SIGNED_VALUE(*op->dest - 1);
+    return op->next;
+}
+
+static const MachineOp *op_jmp(Machine *machine, const MachineOp *op) {
+    (void)machine;
+    return op->target;
+}
+
+static const MachineOp *op_bne(Machine *machine, const MachineOp *op) {
+    return machine->zero ? op->next : op->target;
+}
+
+static const MachineOp *op_jsr(Machine *machine, const MachineOp *op) {
+    if (machine->stack_depth == MACHINE_STACK_SIZE)
+        return fault(machine, op, MACHINE_STACK_OVERFLOW);
+    machine->stack[machine->stack_depth++] = op->next;
+    return op->target;
+}
+
+static const MachineOp *op_red(Machine *machine, const MachineOp *op) {
+    /* a character, -1 at end of input */
+    int c = getc(machine->input);
+    *op->dest = c == EOF ? -1 : SIGNED_VALUE(c);
+    return op->next;
+}
+
+static const MachineOp *op_prn(Machine *machine, const MachineOp *op) {
+    fprintf(machine->output, "%d\n", *op->dest);
+    return op->next;
+}
+
+static const MachineOp *op_rts(Machine *machine, const MachineOp *op) {
+    if (machine->stack_depth == 0)
+        return fault(machine, op, MACHINE_STACK_UNDERFLOW);
+    return machine->stack[--machine->stack_depth];
+}
+
+static const MachineOp *op_stop(Machine *machine, const MachineOp *op) {
+    machine->status = MACHINE_STOPPED;
+    machine->pc = op;
+    return NULL;
+}
+
+static const MachineOp *op_bad(Machine *machine, const MachineOp *op) {
+    return fault(machine, op, MACHINE_BAD_INSTRUCTION);
+}
+
+static const MachineOp *op_unresolved(Machine *machine, const MachineOp *op) {
+    return fault(machine, op, MACHINE_UNRESOLVED_EXTERNAL);
+}
+
+/* handler of every instruction of INSTRUCTION_TABLE, by name */
+static const OpInfo OP_INFOS[] = {{"mov", op_mov, true},  {"cmp", op_cmp, false}, {"add", op_add, true},
+                                  {"sub", op_sub, true},  {"lea", op_lea, true},  {"clr", op_clr, true},
+                                  {"not", op_not, true},  {"inc", op_inc, true},  {"dec", op_dec, true},
+                                  {"jmp", op_jmp, false}, {"bne", op_bne, false}, {"jsr", op_jsr, false},
+                                  {"red", op_red, true},  {"prn", op_prn, false}, {"rts", op_rts, false},
+                                  {"stop", op_stop, false}, {NULL, NULL, false}};
+
+/* returns the handler info of instruction, NULL if there is none */
+static const OpInfo *get_op_info(const InstructionInfo *instruction) {
+    /* index tracker */
+    int i;
+
+    for (i = 0; OP_INFOS[i].name != NULL; i++) {
+        if (strcmp(OP_INFOS[i].name, instruction->name) == 0)
+            return &OP_INFOS[i];
+    }
+    return NULL;
+}
+
+static void decode_op(Machine *machine, int address);
+
+/* runs an instruction that may write into the code, then decodes the instructions the write may have changed */
+static const MachineOp *op_checked_write(Machine *machine, const MachineOp *op) {
+    /* the op to run next (decoding doesn't move ops) */
+    const MachineOp *next = op->execute(machine, op);
+    /* address written to */
+    int address = (int)(op->dest - machine->memory);
+    /* index tracker */
+    int i;
+
+    /* an instruction is at most 3 words long, so only the last 3 starts can cover address */
+    if (address >= machine->code_start && address < machine->code_end) {
+        for (i = address; i >= address - 2 && i >= machine->code_start; i--) {
+            if (machine->starts[i])
+                decode_op(machine, i);
+        }
+    }
+    return next;
+}
+
+/* returns the op at address, the op after memory if it's outside of it */
+static MachineOp *op_at(Machine *machine, int address) {
+    return &machine->ops[address >= 0 && address < machine->memory_size ? address : machine->memory_size];
+}
+
+/* decodes the instruction at address (from the words currently in memory) into its op */
+static void decode_op(Machine *machine, int address) {
+    /* the op to fill */
+    MachineOp *op = &machine->ops[address];
+    /* the decoded instruction */
+    DecodedInstruction instruction;
+    /* handler of the instruction */
+    const OpInfo *info;
+    /* storage of each operand */
+    int *operands[2];
+    /* count of operands */
+    int operand_count;
+    /* whether an operand is external */
+    Bool unresolved = false;
+    /* index tracker */
+    int i;
+
+    op->address = address;
+    op->run = op->execute = op_bad;
+    op->next = op + 1;
+    if (!machine->starts[address])
+        return;
+
+    if (!machine_decode(machine, address, NULL, NULL, &instruction) || !(info = get_op_info(instruction.info)))
+        return;
+
+    operand_count = instruction.info->num_operands;
+    for (i = 0; i < operand_count; i++) {
+        operands[i] = NULL;
+        if (instruction.modes[i] == ADDR_IMMEDIATE)
+            /* immediates are read from their own word */
+            operands[i] = &machine->memory[address + 1 + i];
+        else if (instruction.modes[i] == ADDR_REGISTER)
+            operands[i] = &machine->registers[instruction.values[i]];
+        else if (instruction.modes[i] == ADDR_DIRECT && MACHINE_ARE(machine, address + 1 + i) == ARE_E)
+            unresolved = true;
+        else if (instruction.modes[i] == ADDR_DIRECT && instruction.values[i] < machine->memory_size)
+            operands[i] = &machine->memory[instruction.values[i]];
+    }
+
+    op->next = op + instruction.length;
+    op->src = operand_count == 2 ? operands[0] : NULL;
+    op->dest = operand_count > 0 ? operands[operand_count - 1] : NULL;
+    /* jumps go to the address of their operand, lea loads its source's address */
+    op->target = operand_count > 0 ? op_at(machine, instruction.values[operand_count - 1]) : NULL;
+    op->value = instruction.values[0];
+    op->execute = info->handler;
+    op->run = info->handler;
+    /* an external operand has no value until linked */
+    if (unresolved) {
+        op->run = op_unresolved;
+        return;
+    }
+    /* a direct operand beyond the image can't be run either (only a linker could place it) */
+    for (i = 0; i < operand_count; i++) {
+        if (instruction.modes[i] == ADDR_DIRECT && !operands[i] &&
+            (info->handler != op_jmp && info->handler != op_bne && info->handler != op_jsr)) {
+            op->run = op_bad;
+            return;
+        }
+    }
+    /* a write into the code has to decode what it changed, writes elsewhere don't pay for the check */
+    if (info->writes && op->dest >= machine->memory + machine->code_start &&
+        op->dest < machine->memory + machine->code_end)
+        op->run = op_checked_write;
+}
+
+Machine *machine_create(AssemblerState *state, Bool profile) {
+    /* the machine to return */
+    Machine *machine = calloc(1, sizeof(Machine));
+    /* current address */
+    int address;
+    /* words of the current instruction */
+    DecodedInstruction instruction;
+    /* index tracker */
+    int i;
+
+    if (!machine)
+        return NULL;
+    machine->code_start = state->ic_start;
+    machine->code_end = state->ic_start + state->code.count;
+    machine->memory_size = state->ic + state->data.count;
+    machine->memory = calloc(machine->memory_size, sizeof(int));
+    machine->image = malloc((state->code.count + 1) * sizeof(Word));
+    machine->ops = malloc((machine->memory_size + 1) * sizeof(MachineOp));
+    machine->starts = calloc(machine->memory_size + 1, sizeof(Bool));
+    if (profile)
+        machine->counts = calloc(machine->memory_size + 1, sizeof(unsigned long));
+    if (!machine->memory || !machine->image || !machine->ops || !machine->starts || (profile && !machine->counts))
+        return machine_free(machine);
+
+    /* load code and data */
+    for (i = 0; i < state->code.count; i++) {
+        machine->image[i] = state->code.words[i];
+        machine->memory[machine->code_start + i] = SIGNED_VALUE(WORD_VALUE(state->code.words[i]));
+    }
+    for (i = 0; i < state->data.count; i++)
+        machine->memory[state->ic + i] = SIGNED_VALUE(WORD_VALUE(state->data.words[i]));
+
+    /* the code is instructions back to back, mark where each starts (a word that isn't one counts as one word) */
+    build_decode_table(&machine->table);
+    for (address = machine->code_start; address < machine->code_end;) {
+        machine->starts[address] = true;
+        i = decode_instruction(&machine->table, state->code.words + address - machine->code_start,
+                               machine->code_end - address, address, machine->memory_size, NULL, NULL, &instruction);
+        address += i > 0 ? i : 1;
+    }
+    /* decode every address, the ones where no instruction starts fault if they are run */
+    for (address = 0; address <= machine->memory_size; address++)
+        decode_op(machine, address);
+
+    machine->input = stdin;
+    machine->output = stdout;
+    machine->status = MACHINE_RUNNING;
+    machine->pc = &machine->ops[machine->code_start];
+    return machine;
+}
+
+int machine_decode(Machine *machine, int address, AddressList *labels, AddressList *externals,
+                   DecodedInstruction *instruction) {
+    /* words of the instruction */
+    Word words[3];
+    /* count of words the instruction can have */
+    int count = machine->code_end - address < 3 ? machine->code_end - address : 3;
+    /* index tracker */
+    int i;
+
+    if (address < machine->code_start || address >= machine->code_end)
+        return 0;
+    /* the value is in memory (the program may have changed it), the marking is the image's */
+    for (i = 0; i < count; i++)
+        words[i] = MAKE_WORD(machine->memory[address + i], MACHINE_ARE(machine, address + i));
+    return decode_instruction(&machine->table, words, count, address, machine->memory_size, labels, externals,
+                              instruction);
+}
+
+MachineStatus machine_run(Machine *machine, unsigned long max_steps) {
+    /* the op to run next */
+    const MachineOp *op = machine->pc;
+    /* instructions run by this call, and most it may run */
+    unsigned long steps = 0, limit = max_steps ? max_steps : ULONG_MAX;
+
+    if (machine->status != MACHINE_RUNNING)
+        return machine->status;
+
+    /* each handler returns the next op, so the loop is only a call (and a count when profiling) */
+    if (machine->counts) {
+        while (op && steps != limit) {
+            machine->counts[op->address]++;
+            op = op->run(machine, op);
+            steps++;
+        }
+    } else {
+        while (op && steps != limit) {
+            op = op->run(machine, op);
+            steps++;
+        }
+    }
+
+    machine->steps += steps;
+    /* a stopped machine set its own pc */
+    if (op)
+        machine->pc = op;
+    return machine->status;
+}
+
+Machine *machine_free(Machine *machine) {
+    if (machine) {
+        free(machine->memory);
+        free(machine->image);
+        free(machine->ops);
+        free(machine->starts);
+        free(machine->counts);
+        free(machine);
+    }
+    return NULL;
+}
+
+/* writes the text of the instruction at address as it is now, named by labels and externals */
+static void format_address(Machine *machine, int address, AddressList *labels, AddressList *externals, char *text) {
+    /* the decoded instruction */
+    DecodedInstruction instruction;
+
+    strcpy(text, "?");
+    if (machine_decode(machine, address, labels, externals, &instruction))
+        format_instruction(&instruction, text);
+}
+
+/* writes where address comes from (if map has entries, see outputs.source_map) after an instruction's text, naming the
+ * file only if it isn't the .as file but one of includes */
+static void append_origin(SourceMap *map, const Buffer *includes, int address, char *text) {
+    /* the entry of address */
+    const SourceMapEntry *entry = source_map_find(map, address);
+    /* name of the included file with the line */
+    const char *name;
+
+    if (!entry)
+        return;
+    strcat(text, "  ; ");
+    if (entry->file && (name = source_map_file_name(NULL, includes, entry->file)))
+        sprintf(text + strlen(text), "%s ", name);
+    if (entry->call)
+        sprintf(text + strlen(text), "line %d (mcro called at line %d)", entry->line, entry->call);
+    else
+        sprintf(text + strlen(text), "line %d", entry->line);
+}
+
+/* writes the execution count of every address that ran to filename.prof and prints the most executed ones to
+ * stderr, returns false if the file couldn't be written */
+static Bool write_profile(char *filename, AssemblerState *state, Machine *machine) {
+    /* where to report errors */
+    Diagnostics *diagnostics = state->diagnostics;
+    /* profile path */
+    char path[MAX_LINE];
+    /* profile file */
+    FILE *file;
+    /* names of labels and of external operands */
+    AddressList labels, externals;
+    /* text of the current instruction, with its source line */
+    char text[MAX_DISASSEMBLY + 2 * MAX_LINE];
+    /* source line of every address, empty unless kept for the source map */
+    SourceMap map;
+    /* most executed addresses, most first */
+    int top[PROFILE_TOP];
+    int top_count = 0;
+    /* whether a write failed or not */
+    Bool failed;
+    /* index trackers */
+    int address, i;
+
+    /* names are a nicety, without memory for them addresses are printed */
+    address_list_init(&labels);
+    address_list_init(&externals);
+    hash_table_foreach(state->symbols, collect_label, &labels);
+    hash_table_foreach(state->symbols, collect_external_uses, &externals);
+    if (labels.count < 0 || externals.count < 0 || !address_list_sort(&labels) || !address_list_sort(&externals)) {
+        address_list_clear(&labels);
+        address_list_clear(&externals);
+    }
+    /* so are source lines */
+    source_map_init(&map);
+    if (state->outputs.source_map && !source_map_build(&map, state))
+        map.count = 0;
+
+    sprintf(path, "%s.prof", filename);
+    file = fopen(path, "w");
+    if (!file) {
+        ERROR_FILE(diagnostics, ERR_CANNOT_CREATE_FILE, path);
+        address_list_free(&labels);
+        address_list_free(&externals);
+        source_map_free(&map);
+        return false;
+    }
+    fprintf(file, "%-6s %14s %8s  %s\n", "addr", "count", "percent", "instruction");
+    for (address = 0; address <= machine->memory_size; address++) {
+        if (machine->counts[address] == 0)
+            continue;
+        format_address(machine, address, &labels, &externals, text);
+        append_origin(&map, &state->includes, address, text);
+        fprintf(file, "%04d   %14lu %7.2f%%  %s\n", address, machine->counts[address],
+                100.0 * machine->counts[address] / machine->steps, text);
+
+        /* insert into the most executed (replacing the least of them when full), keeping them sorted */
+        if (top_count < PROFILE_TOP)
+            top_count++;
+        else if (machine->counts[top[PROFILE_TOP - 1]] >= machine->counts[address])
+            continue;
+        for (i = top_count - 1; i > 0 && machine->counts[top[i - 1]] < machine->counts[address]; i--)
+            top[i] = top[i - 1];
+        top[i] = address;
+    }
+    failed = ferror(file) != 0;
+    /* closing flushes the buffer, which can fail too */
+    if (fclose(file) != 0)
+        failed = true;
+    if (failed)
+        ERROR_FILE(diagnostics, ERR_CANNOT_WRITE_FILE, path);
+
+    for (i = 0; i < top_count; i++) {
+        format_address(machine, top[i], &labels, &externals, text);
+        append_origin(&map, &state->includes, top[i], text);
+        fprintf(stderr, "  %04d %14lu %7.2f%%  %s\n", top[i], machine->counts[top[i]],
+                100.0 * machine->counts[top[i]] / machine->steps, text);
+    }
+
+    address_list_free(&labels);
+    address_list_free(&externals);
+    source_map_free(&map);
+    return !failed;
+}
+
+Bool run_program(char *filename, AssemblerState *state, RunOptions *options) {
+    /* where to report errors */
+    Diagnostics *diagnostics = state->diagnostics;
+    /* the machine running the program */
+    Machine *machine;
+    /* its translator, NULL if running it by the interpreter */
+    Jit *jit = NULL;
+    /* why it stopped */
+    MachineStatus status;
+    /* when it started, and how long it ran */
+    double start, seconds;
+    /* address it stopped at, as text */
+    char address[32];
+    /* used to tell the caller whether the program ran to stop or not */
+    Bool success;
+
+    /* a batch loads its own copies of the program */
+    if (options->batch)
+        return run_batch(filename, state, options);
+    machine = machine_create(state, options->profile);
+    if (!machine) {
+        ERROR(diagnostics, ERR_MEMORY_ALLOC);
+        return false;
+    }
+    /* translated code doesn't count executions, a profile is always interpreted */
+    if (options->jit && !options->profile)
+        jit = jit_create(machine);
+    start = stats_now();
+    status = jit ? jit_run(jit, options->max_steps) : machine_run(machine, options->max_steps);
+    seconds = stats_now() - start;
+    trace_span("run", start, filename, -1);
+    /* the program's output goes before any report */
+    fflush(machine->output);
+
+    sprintf(address, "%04d", machine->fault_address);
+    switch (status) {
+    case MACHINE_STOPPED:
+        break;
+    case MACHINE_RUNNING:
+        sprintf(address, "%lu", machine->steps);
+        ERROR_FILE(diagnostics, ERR_RUN_STEP_LIMIT, address);
+        break;
+    case MACHINE_BAD_INSTRUCTION:
+        ERROR_FILE(diagnostics, ERR_RUN_BAD_INSTRUCTION, address);
+        break;
+    case MACHINE_UNRESOLVED_EXTERNAL:
+        ERROR_FILE(diagnostics, ERR_RUN_UNRESOLVED_EXTERNAL, address);
+        break;
+    case MACHINE_STACK_OVERFLOW:
+        ERROR_FILE(diagnostics, ERR_RUN_STACK_OVERFLOW, address);
+        break;
+    case MACHINE_STACK_UNDERFLOW:
+        ERROR_FILE(diagnostics, ERR_RUN_STACK_UNDERFLOW, address);
+        break;
+    }
+    success = status == MACHINE_STOPPED;
+    if (options->profile || options->stats)
+        fprintf(stderr, "run: %s (%lu instructions in %.3f s, %.1f MIPS%s)\n", filename, machine->steps, seconds,
+                seconds > 0 ? machine->steps / seconds / 1e6 : 0.0, jit ? ", translated" : "");
+    if (jit && options->stats)
+        jit_print_stats(stderr, jit);
+    if (options->profile && !write_profile(filename, state, machine))
+        success = false;
+
+    jit_free(jit);
+    machine_free(machine);
+    return success;
+}
\ No newline at end of file
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "assembler.h"
+#include "bool.h"
+#include "buffer.h"
+#include "hash_table.h"
+#include "pre_assembler.h"
+#include "source_map.h"
+
+/* digits of a base64 VLQ */
+static const char BASE64_DIGITS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+/* value bits of a VLQ digit, and the bit that says another digit follows */
+#define VLQ_BITS 5
+#define VLQ_CONTINUE 32
+
+void source_map_init(SourceMap *map) {
+    map->entries = NULL;
+    map->count = 0;
+    map->capacity = 0;
+}
+
+/* adds an entry unless it continues the last one, returns false if allocation failed */
+static Bool push_entry(SourceMap *map, int address, LineOrigin *origin) {
+    /* grown entries array */
+    SourceMapEntry *entries;
+
+    if (map->count > 0 && map->entries[map->count - 1].file == origin->file &&
+        map->entries[map->count - 1].line == origin->line && map->entries[map->count - 1].call == origin->call)
+        return true;
+    /* grow geometrically */
+    if (map->count == map->capacity) {
+        entries =
+            realloc(map->entries, (map->capacity ? map->capacity * 2 : INITIAL_TABLE_SIZE) * sizeof(SourceMapEntry));
+        if (!entries)
+            return false;
+        map->entries = entries;
+        map->capacity = map->capacity ? map->capacity * 2 : INITIAL_TABLE_SIZE;
+    }
+    map->entries[map->count].address = address;
+    map->entries[map->count].file = origin->file;
+    map->entries[map->count].line = origin->line;
+    map->entries[map->count].call = origin->call;
+    map->count++;
+    return true;
+}
+
+/* adds the entries of the code words (or the data words) of every line, returns false if allocation failed */
+static Bool map_segment(SourceMap *map, AssemblerState *state, Bool code) {
+    /* origin of the current line */
+    LineOrigin origin;
+    /* first word of the current line and of the next one */
+    int first_word, end_word;
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < state->listing_count; i++) {
+        first_word = code ? state->listing[i].code_index : state->listing[i].data_index;
+        if (i + 1 < state->listing_count)
+            end_word = code ? state->listing[i + 1].code_index : state->listing[i + 1].data_index;
+        else
+            end_word = code ? state->code.count : state->data.count;
+        if (end_word == first_word)
+            continue;
+        /* without origins, a line is its own origin */
+        if (i < state->origins.count) {
+            origin = state->origins.lines[i];
+        } else {
+            origin.file = 0;
+            origin.line = i + 1;
+            origin.call = 0;
+        }
+        if (!push_entry(map, (code ? state->ic_start : state->ic) + first_word, &origin))
+            return false;
+    }
+    return true;
+}
+
+Bool source_map_build(SourceMap *map, AssemblerState *state) {
+    map->count = 0;
+    /* the data follows the code, so mapping the code first keeps the entries in address order */
+    return map_segment(map, state, true) && map_segment(map, state, false);
+}
+
+const SourceMapEntry *source_map_find(SourceMap *map, int address) {
+    /* bounds of the search, the answer is below high */
+    int low = 0, high = map->count, middle;
+
+    /* find the first entry after address, the one before it is the answer */
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (map->entries[middle].address <= address)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low > 0 ? &map->entries[low - 1] : NULL;
+}
+
+/* writes value as a base64 VLQ */
+static void put_vlq(FILE *file, long value) {
+    /* the value with its sign in the lowest bit */
+    unsigned long bits = value < 0 ? ((unsigned long)-value << 1) | 1 : (unsigned long)value << 1;
+    /* current digit */
+    int digit;
+
+    do {
+        digit = bits & (VLQ_CONTINUE - 1);
+        bits >>= VLQ_BITS;
+        if (bits)
+            digit |= VLQ_CONTINUE;
+        putc(BASE64_DIGITS[digit], file);
+    } while (bits);
+}
+
+const char *source_map_file_name(const char *source, const Buffer *includes, int file) {
+    /* current included path */
+    const char *path;
+
+    if (file == 0)
+        return source;
+    for (path = includes->data; path < includes->data + includes->length; path += strlen(path) + 1) {
+        if (--file == 0)
+            return path;
+    }
+    return NULL;
+}
+
+void source_map_write(FILE *file, const char *source, const Buffer *includes, SourceMap *map) {
+    /* the previous entry, the first is written against zeros */
+    SourceMapEntry previous = {0, 0, 0, 0};
+    /* current included path */
+    const char *path;
+    /* index tracker */
+    int i;
+
+    fprintf(file, "%s\n", source);
+    for (path = includes->data; path < includes->data + includes->length; path += strlen(path) + 1)
+        fprintf(file, "%s\n", path);
+    putc('\n', file);
+    for (i = 0; i < map->count; i++) {
+        put_vlq(file, map->entries[i].address - previous.address);
+        put_vlq(file, map->entries[i].file - previous.file);
+        put_vlq(file, map->entries[i].line - previous.line);
+        put_vlq(file, map->entries[i].call - previous.call);
+        previous = map->entries[i];
+    }
+    putc('\n', file);
+}
+
+void source_map_free(SourceMap *map) {
+    free(map->entries);
+    source_map_init(map);
+}
\ No newline at end of file
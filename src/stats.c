@@ -0,0 +1,82 @@
+/* clock_gettime is POSIX, not ANSI C */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+const char *PHASE_NAMES[] = {"pre_assemble", "first_pass", "second_pass", "output"};
+
+double stats_now(void) {
+    /* current time */
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void stats_reset(AssemblerStats *stats) {
+    memset(stats, 0, sizeof(AssemblerStats));
+}
+
+void stats_add(AssemblerStats *total, AssemblerStats *source) {
+    /* index trackers */
+    int i, j;
+
+    for (i = 0; i < PHASE_COUNT; i++) {
+        total->phases[i].seconds += source->phases[i].seconds;
+        total->phases[i].lines_read += source->phases[i].lines_read;
+        total->phases[i].bytes_read += source->phases[i].bytes_read;
+        total->phases[i].bytes_written += source->phases[i].bytes_written;
+        total->phases[i].hash_lookups += source->phases[i].hash_lookups;
+        total->phases[i].hash_inserts += source->phases[i].hash_inserts;
+        for (j = 0; j < EVENT_COUNT; j++)
+            total->phases[i].events[j] += source->phases[i].events[j];
+    }
+    total->macros_defined += source->macros_defined;
+    total->expanded_lines += source->expanded_lines;
+    total->includes += source->includes;
+    total->includes_parsed += source->includes_parsed;
+    total->symbols += source->symbols;
+    total->external_uses += source->external_uses;
+    total->entries += source->entries;
+    total->files += source->files;
+}
+
+long stats_phase_lines(AssemblerStats *stats, Phase phase) {
+    return stats->phases[phase == PHASE_PRE_ASSEMBLE ? phase : PHASE_FIRST_PASS].lines_read;
+}
+
+/* prints a row of the stats table */
+static void print_phase(FILE *out, const char *name, PhaseStats *phase) {
+    fprintf(out, "  %-13s %10.3f %10ld %12ld %12ld %10ld %10ld\n", name, phase->seconds * 1e3, phase->lines_read,
+            phase->bytes_read, phase->bytes_written, phase->hash_lookups, phase->hash_inserts);
+}
+
+void stats_print(FILE *out, const char *label, AssemblerStats *stats) {
+    /* sum of all phases */
+    PhaseStats sum;
+    /* index tracker */
+    int i;
+
+    memset(&sum, 0, sizeof(PhaseStats));
+    fprintf(out, "stats: %s (%d file%s)\n", label, stats->files, stats->files == 1 ? "" : "s");
+    fprintf(out, "  %-13s %10s %10s %12s %12s %10s %10s\n", "phase", "ms", "lines", "bytes in", "bytes out",
+            "lookups", "inserts");
+    /* a row per phase, then their sum */
+    for (i = 0; i < PHASE_COUNT; i++) {
+        print_phase(out, PHASE_NAMES[i], &stats->phases[i]);
+        sum.seconds += stats->phases[i].seconds;
+        sum.lines_read += stats->phases[i].lines_read;
+        sum.bytes_read += stats->phases[i].bytes_read;
+        sum.bytes_written += stats->phases[i].bytes_written;
+        sum.hash_lookups += stats->phases[i].hash_lookups;
+        sum.hash_inserts += stats->phases[i].hash_inserts;
+    }
+    print_phase(out, "total", &sum);
+    fprintf(out, "  macros defined %ld, expanded lines %ld, symbols %ld, external uses %ld, entries %ld\n",
+            stats->macros_defined, stats->expanded_lines, stats->symbols, stats->external_uses, stats->entries);
+    if (stats->includes > 0)
+        fprintf(out, "  includes %ld, parsed %ld\n", stats->includes, stats->includes_parsed);
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include <stdlib.h>
+
+#include "alloc.h"
+#include "address_sort.h"
+#include "bool.h"
+#include "symbol_table.h"
+
+Bool add_external_use(Symbol *symbol, int address) {
+    /* new capacity if uses array needs to grow */
+    int new_capacity;
+    /* grown addresses array */
+    int *new_addresses;
+
+    /* if uses array is full, grow it geometrically */
+    if (symbol->uses.count == symbol->uses.capacity) {
+        new_capacity = symbol->uses.capacity ? symbol->uses.capacity * 2 : INITIAL_USES_SIZE;
+        /* realloc addresses array, if failed, keep the old one and return false */
+        new_addresses = realloc(symbol->uses.addresses, new_capacity * sizeof(int));
+        if (!new_addresses)
+            return false;
+        symbol->uses.addresses = new_addresses;
+        symbol->uses.capacity = new_capacity;
+    }
+
+    /* store address and advance count */
+    symbol->uses.addresses[symbol->uses.count++] = address;
+    return true;
+}
+
+void free_symbol(void *data) {
+    /* cast data to Symbol pointer */
+    Symbol *symbol = (Symbol *)data;
+    /* free external uses array (NULL if never used) */
+    free(symbol->uses.addresses);
+    /* free symbol itself */
+    free(symbol);
+}
+
+void collect_entry(char *key, void *data, void *context) {
+    /* cast data to Symbol pointer */
+    Symbol *symbol = (Symbol *)data;
+    /* cast context to AddressList pointer */
+    AddressList *list = (AddressList *)context;
+
+    if (list->count >= 0 && symbol->is_entry && !address_list_push(list, key, symbol->address))
+        list->count = -1;
+}
+
+void collect_external_uses(char *key, void *data, void *context) {
+    /* cast data to Symbol pointer */
+    Symbol *symbol = (Symbol *)data;
+    /* cast context to AddressList pointer */
+    AddressList *list = (AddressList *)context;
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < symbol->uses.count && list->count >= 0; i++) {
+        if (!address_list_push(list, key, symbol->uses.addresses[i]))
+            list->count = -1;
+    }
+}
+
+void collect_label(char *key, void *data, void *context) {
+    /* cast data to Symbol pointer */
+    Symbol *symbol = (Symbol *)data;
+    /* cast context to AddressList pointer */
+    AddressList *list = (AddressList *)context;
+
+    /* externals have no address */
+    if (list->count >= 0 && symbol->type != SYMBOL_EXTERNAL && !address_list_push(list, key, symbol->address))
+        list->count = -1;
+}
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include <pthread.h>
+#include <stdio.h>
+
+#include "bool.h"
+#include "stats.h"
+#include "trace.h"
+
+/* the trace file, NULL if no trace is being written (only changed while no other thread traces) */
+static FILE *trace_file = NULL;
+/* when the trace started, event times are relative to it */
+static double trace_start;
+/* serializes writing events and assigning thread ids */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+/* threads seen so far, a thread's id is its index + 1 */
+static pthread_t trace_threads[MAX_TRACE_THREADS];
+static int trace_thread_count;
+/* whether an event was written (every later one is preceded by a comma) */
+static Bool has_events;
+
+/* writes text as a json string */
+static void write_json_string(const char *text) {
+    fputc('"', trace_file);
+    for (; *text != '\0'; text++) {
+        if (*text == '"' || *text == '\\')
+            fprintf(trace_file, "\\%c", *text);
+        else if ((unsigned char)*text < 0x20)
+            fprintf(trace_file, "\\u%04x", (unsigned char)*text);
+        else
+            fputc(*text, trace_file);
+    }
+    fputc('"', trace_file);
+}
+
+/* starts an event, writing the separator from the previous one (trace_lock must be held) */
+static void begin_event(void) {
+    if (has_events)
+        fputs(",\n", trace_file);
+    has_events = true;
+}
+
+/* returns the id of the calling thread, naming it in the trace when it's seen first (trace_lock must be held) */
+static int current_thread_id(void) {
+    /* the calling thread */
+    pthread_t self = pthread_self();
+    /* index tracker */
+    int i;
+
+    for (i = 0; i < trace_thread_count; i++) {
+        if (pthread_equal(trace_threads[i], self))
+            return i + 1;
+    }
+    /* out of ids, the rest share the last one */
+    if (trace_thread_count == MAX_TRACE_THREADS)
+        return MAX_TRACE_THREADS;
+
+    trace_threads[trace_thread_count++] = self;
+    begin_event();
+    fprintf(trace_file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,", trace_thread_count);
+    fprintf(trace_file, "\"args\":{\"name\":\"thread %d\"}}", trace_thread_count);
+    return trace_thread_count;
+}
+
+Bool trace_open(const char *path) {
+    trace_file = fopen(path, "w");
+    if (!trace_file)
+        return false;
+
+    trace_start = stats_now();
+    trace_thread_count = 0;
+    has_events = false;
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", trace_file);
+    return true;
+}
+
+Bool trace_close(void) {
+    /* whether a write failed or not */
+    Bool failed;
+
+    if (!trace_file)
+        return true;
+
+    fputs("\n]}\n", trace_file);
+    failed = ferror(trace_file) != 0;
+    /* closing flushes the buffer, which can fail too */
+    if (fclose(trace_file) != 0)
+        failed = true;
+    trace_file = NULL;
+    return !failed;
+}
+
+Bool trace_enabled(void) {
+    return trace_file != NULL;
+}
+
+double trace_now(void) {
+    return trace_file ? stats_now() : 0;
+}
+
+void trace_span(const char *name, double start, const char *file, long lines) {
+    /* when the span ended */
+    double end;
+    /* id of the calling thread */
+    int thread_id;
+
+    if (!trace_file)
+        return;
+    end = stats_now();
+
+    pthread_mutex_lock(&trace_lock);
+    /* naming a new thread is an event of its own, so it comes first */
+    thread_id = current_thread_id();
+    /* a complete event, times in microseconds */
+    begin_event();
+    fprintf(trace_file, "{\"name\":");
+    write_json_string(name);
+    fprintf(trace_file, ",\"cat\":\"assembler\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{",
+            (start - trace_start) * 1e6, (end - start) * 1e6, thread_id);
+    if (file) {
+        fprintf(trace_file, "\"file\":");
+        write_json_string(file);
+    }
+    if (lines >= 0)
+        fprintf(trace_file, "%s\"lines\":%ld", file ? "," : "", lines);
+    fprintf(trace_file, "}}");
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_counter(const char *name, long value) {
+    /* when the value was seen */
+    double now;
+    /* id of the calling thread */
+    int thread_id;
+
+    if (!trace_file)
+        return;
+    now = stats_now();
+
+    pthread_mutex_lock(&trace_lock);
+    thread_id = current_thread_id();
+    begin_event();
+    fprintf(trace_file, "{\"name\":");
+    write_json_string(name);
+    fprintf(trace_file, ",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"value\":%ld}}",
+            (now - trace_start) * 1e6, thread_id, value);
+    pthread_mutex_unlock(&trace_lock);
+}
\ No newline at end of file